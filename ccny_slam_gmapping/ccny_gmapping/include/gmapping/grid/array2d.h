@@ -6,9 +6,17 @@
 #include "accessstate.h"
 
 #include <iostream>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
 
 namespace GMapping {
 
+/**The cells are kept in a single block, row after row, so that a cell is
+found with one lookup and an array is copied in bulk. m_cells points to
+the rows, for the code indexing it directly. If ARRAY2D_ALIGNMENT is
+defined (the same for the whole build), the block is aligned to that many
+bytes, e.g. for SIMD loads.*/
 template<class Cell, const bool debug=false> class Array2D{
 	public:
 		Array2D(int xsize=0, int ysize=0);
@@ -36,6 +44,9 @@ template<class Cell, const bool debug=false> class Array2D{
 		inline Cell** cells() {return m_cells;}
 		Cell ** m_cells;
 	protected:
+		inline void allocate(int xsize, int ysize);
+		inline void release();
+		Cell * m_data;
 		int m_xsize, m_ysize;
 };
 
@@ -44,17 +55,7 @@ template <class Cell, const bool debug>
 Array2D<Cell,debug>::Array2D(int xsize, int ysize){
 //	assert(xsize>0);
 //	assert(ysize>0);
-	m_xsize=xsize;
-	m_ysize=ysize;
-	if (m_xsize>0 && m_ysize>0){
-		m_cells=new Cell*[m_xsize];
-		for (int i=0; i<m_xsize; i++)
-			m_cells[i]=new Cell[m_ysize];
-	}
-	else{
-		m_xsize=m_ysize=0;
-		m_cells=0;
-	}
+	allocate(xsize, ysize);
 	if (debug){
 		std::cerr << __PRETTY_FUNCTION__ << std::endl;
 		std::cerr << "m_xsize= " << m_xsize<< std::endl;
@@ -64,19 +65,13 @@ Array2D<Cell,debug>::Array2D(int xsize, int ysize){
 
 template <class Cell, const bool debug>
 Array2D<Cell,debug> & Array2D<Cell,debug>::operator=(const Array2D<Cell,debug> & g){
+	if (this==&g)
+		return *this;
 	if (debug || m_xsize!=g.m_xsize || m_ysize!=g.m_ysize){
-		for (int i=0; i<m_xsize; i++)
-			delete [] m_cells[i];
-		delete [] m_cells;
-		m_xsize=g.m_xsize;
-		m_ysize=g.m_ysize;
-		m_cells=new Cell*[m_xsize];
-		for (int i=0; i<m_xsize; i++)
-			m_cells[i]=new Cell[m_ysize];
+		release();
+		allocate(g.m_xsize, g.m_ysize);
 	}
-	for (int x=0; x<m_xsize; x++)
-		for (int y=0; y<m_ysize; y++)
-			m_cells[x][y]=g.m_cells[x][y];
+	std::copy(g.m_data, g.m_data+m_xsize*m_ysize, m_data);
 	
 	if (debug){
 		std::cerr << __PRETTY_FUNCTION__ << std::endl;
@@ -88,14 +83,8 @@ Array2D<Cell,debug> & Array2D<Cell,debug>::operator=(const Array2D<Cell,debug> &
 
 template <class Cell, const bool debug>
 Array2D<Cell,debug>::Array2D(const Array2D<Cell,debug> & g){
-	m_xsize=g.m_xsize;
-	m_ysize=g.m_ysize;
-	m_cells=new Cell*[m_xsize];
-	for (int x=0; x<m_xsize; x++){
-		m_cells[x]=new Cell[m_ysize];
-		for (int y=0; y<m_ysize; y++)
-			m_cells[x][y]=g.m_cells[x][y];
-	}
+	allocate(g.m_xsize, g.m_ysize);
+	std::copy(g.m_data, g.m_data+m_xsize*m_ysize, m_data);
 	if (debug){
 		std::cerr << __PRETTY_FUNCTION__ << std::endl;
 		std::cerr << "m_xsize= " << m_xsize<< std::endl;
@@ -110,12 +99,7 @@ Array2D<Cell,debug>::~Array2D(){
 	std::cerr << "m_xsize= " << m_xsize<< std::endl;
 	std::cerr << "m_ysize= " << m_ysize<< std::endl;
   }
-  for (int i=0; i<m_xsize; i++){
-    delete [] m_cells[i];
-    m_cells[i]=0;
-  }
-  delete [] m_cells;
-  m_cells=0;
+  release();
 }
 
 template <class Cell, const bool debug>
@@ -125,39 +109,70 @@ void Array2D<Cell,debug>::clear(){
 	std::cerr << "m_xsize= " << m_xsize<< std::endl;
 	std::cerr << "m_ysize= " << m_ysize<< std::endl;
   }
-  for (int i=0; i<m_xsize; i++){
-    delete [] m_cells[i];
-    m_cells[i]=0;
-  }
-  delete [] m_cells;
-  m_cells=0;
-  m_xsize=0;
-  m_ysize=0;
+  release();
 }
 
 
 template <class Cell, const bool debug>
 void Array2D<Cell,debug>::resize(int xmin, int ymin, int xmax, int ymax){
-	int xsize=xmax-xmin;
-	int ysize=ymax-ymin;
-	Cell ** newcells=new Cell *[xsize];
-	for (int x=0; x<xsize; x++){
-		newcells[x]=new Cell[ysize];
-	}
+	Array2D<Cell,debug> old;
+	std::swap(old.m_cells, this->m_cells);
+	std::swap(old.m_data, this->m_data);
+	std::swap(old.m_xsize, this->m_xsize);
+	std::swap(old.m_ysize, this->m_ysize);
+	allocate(xmax-xmin, ymax-ymin);
 	int dx= xmin < 0 ? 0 : xmin;
 	int dy= ymin < 0 ? 0 : ymin;
-	int Dx=xmax<this->m_xsize?xmax:this->m_xsize;
-	int Dy=ymax<this->m_ysize?ymax:this->m_ysize;
+	int Dx=xmax<old.m_xsize?xmax:old.m_xsize;
+	int Dy=ymax<old.m_ysize?ymax:old.m_ysize;
 	for (int x=dx; x<Dx; x++){
-		for (int y=dy; y<Dy; y++){
-			newcells[x-xmin][y-ymin]=this->m_cells[x][y];
-		}
-		delete [] this->m_cells[x];
+		if (dy<Dy)
+			std::copy(old.m_cells[x]+dy, old.m_cells[x]+Dy, this->m_cells[x-xmin]+dy-ymin);
+	}
+}
+
+/**Allocates the cells and the row pointers, the cells are default constructed.*/
+template <class Cell, const bool debug>
+void Array2D<Cell,debug>::allocate(int xsize, int ysize){
+	if (xsize<=0 || ysize<=0){
+		m_xsize=m_ysize=0;
+		m_data=0;
+		m_cells=0;
+		return;
+	}
+	m_xsize=xsize;
+	m_ysize=ysize;
+#ifdef ARRAY2D_ALIGNMENT
+	void* block=0;
+	if (posix_memalign(&block, ARRAY2D_ALIGNMENT, sizeof(Cell)*m_xsize*m_ysize))
+		throw std::bad_alloc();
+	m_data=static_cast<Cell*>(block);
+	for (int i=0; i<m_xsize*m_ysize; i++)
+		new (m_data+i) Cell;
+#else
+	m_data=new Cell[m_xsize*m_ysize];
+#endif
+	m_cells=new Cell*[m_xsize];
+	for (int x=0; x<m_xsize; x++)
+		m_cells[x]=m_data+x*m_ysize;
+}
+
+template <class Cell, const bool debug>
+void Array2D<Cell,debug>::release(){
+	if (m_data){
+#ifdef ARRAY2D_ALIGNMENT
+		for (int i=0; i<m_xsize*m_ysize; i++)
+			m_data[i].~Cell();
+		free(m_data);
+#else
+		delete [] m_data;
+#endif
 	}
-	delete [] this->m_cells;
-	this->m_cells=newcells;
-	this->m_xsize=xsize;
-	this->m_ysize=ysize; 
+	delete [] m_cells;
+	m_data=0;
+	m_cells=0;
+	m_xsize=0;
+	m_ysize=0;
 }
 
 template <class Cell, const bool debug>
@@ -168,14 +183,14 @@ inline bool Array2D<Cell,debug>::isInside(int x, int y) const{
 template <class Cell, const bool debug>
 inline const Cell& Array2D<Cell,debug>::cell(int x, int y) const{
 	assert(isInside(x,y));
-	return m_cells[x][y];
+	return m_data[x*m_ysize+y];
 }
 
 
 template <class Cell, const bool debug>
 inline Cell& Array2D<Cell,debug>::cell(int x, int y){
 	assert(isInside(x,y));
-	return m_cells[x][y];
+	return m_data[x*m_ysize+y];
 }
 
 };
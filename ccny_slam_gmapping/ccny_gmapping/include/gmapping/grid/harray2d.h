@@ -15,7 +15,6 @@ class HierarchicalArray2D: public Array2D<autoptr< Array2D<Cell> > >{
 		HierarchicalArray2D(const HierarchicalArray2D& hg);
 		HierarchicalArray2D& operator=(const HierarchicalArray2D& hg);
 		virtual ~HierarchicalArray2D(){}
-		void resize(int ixmin, int iymin, int ixmax, int iymax);
 		inline int getPatchSize() const {return m_patchMagnitude;}
 		inline int getPatchMagnitude() const {return m_patchMagnitude;}
 		
@@ -50,64 +49,15 @@ HierarchicalArray2D<Cell>::HierarchicalArray2D(int xsize, int ysize, int patchMa
 
 template <class Cell>
 HierarchicalArray2D<Cell>::HierarchicalArray2D(const HierarchicalArray2D& hg)
-  :Array2D<autoptr< Array2D<Cell> > >::Array2D((hg.m_xsize>>hg.m_patchMagnitude), (hg.m_ysize>>hg.m_patchMagnitude))  // added by cyrill: if you have a resize error, check this again
+  :Array2D<autoptr< Array2D<Cell> > >::Array2D(hg)
 {
-	this->m_xsize=hg.m_xsize;
-	this->m_ysize=hg.m_ysize;
-	this->m_cells=new autoptr< Array2D<Cell> >*[this->m_xsize];
-	for (int x=0; x<this->m_xsize; x++){
-		this->m_cells[x]=new autoptr< Array2D<Cell> >[this->m_ysize];
-		for (int y=0; y<this->m_ysize; y++)
-			this->m_cells[x][y]=hg.m_cells[x][y];
-	}
 	this->m_patchMagnitude=hg.m_patchMagnitude;
 	this->m_patchSize=hg.m_patchSize;
 }
 
-template <class Cell>
-void HierarchicalArray2D<Cell>::resize(int xmin, int ymin, int xmax, int ymax){
-	int xsize=xmax-xmin;
-	int ysize=ymax-ymin;
-	autoptr< Array2D<Cell> > ** newcells=new autoptr< Array2D<Cell> > *[xsize];
-	for (int x=0; x<xsize; x++){
-		newcells[x]=new autoptr< Array2D<Cell> >[ysize];
-		for (int y=0; y<ysize; y++){
-			newcells[x][y]=autoptr< Array2D<Cell> >(0);
-		}
-	}
-	int dx= xmin < 0 ? 0 : xmin;
-	int dy= ymin < 0 ? 0 : ymin;
-	int Dx=xmax<this->m_xsize?xmax:this->m_xsize;
-	int Dy=ymax<this->m_ysize?ymax:this->m_ysize;
-	for (int x=dx; x<Dx; x++){
-		for (int y=dy; y<Dy; y++){
-			newcells[x-xmin][y-ymin]=this->m_cells[x][y];
-		}
-		delete [] this->m_cells[x];
-	}
-	delete [] this->m_cells;
-	this->m_cells=newcells;
-	this->m_xsize=xsize;
-	this->m_ysize=ysize; 
-}
-
 template <class Cell>
 HierarchicalArray2D<Cell>& HierarchicalArray2D<Cell>::operator=(const HierarchicalArray2D& hg){
-//	Array2D<autoptr< Array2D<Cell> > >::operator=(hg);
-	if (this->m_xsize!=hg.m_xsize || this->m_ysize!=hg.m_ysize){
-		for (int i=0; i<this->m_xsize; i++)
-			delete [] this->m_cells[i];
-		delete [] this->m_cells;
-		this->m_xsize=hg.m_xsize;
-		this->m_ysize=hg.m_ysize;
-		this->m_cells=new autoptr< Array2D<Cell> >*[this->m_xsize];
-		for (int i=0; i<this->m_xsize; i++)
-			this->m_cells[i]=new autoptr< Array2D<Cell> > [this->m_ysize];
-	}
-	for (int x=0; x<this->m_xsize; x++)
-		for (int y=0; y<this->m_ysize; y++)
-			this->m_cells[x][y]=hg.m_cells[x][y];
-	
+	Array2D<autoptr< Array2D<Cell> > >::operator=(hg);
 	m_activeArea.clear();
 	m_patchMagnitude=hg.m_patchMagnitude;
 	m_patchSize=hg.m_patchSize;
@@ -153,6 +103,9 @@ void HierarchicalArray2D<Cell>::allocActiveArea(){
 		Array2D<Cell>* patch=0;
 		if (!ptr){
 			patch=createPatch(*it);
+		} else if (ptr.unique()){
+			//nobody else sees the patch, it is updated in place
+			continue;
 		} else{	
 			patch=new Array2D<Cell>(*ptr);
 		}
@@ -6,6 +6,7 @@
 #include <fstream>
 #include <vector>
 #include <deque>
+#include <pthread.h>
 #include <particlefilter/particlefilter.h>
 #include <utils/point.h>
 #include <utils/macro_params.h>
@@ -102,6 +103,8 @@ namespace GMapping {
       inline void setWeight(double w) {weight=w;}
       /** The map */
       ScanMatcherMap map;
+      /** The likelihood field of the map, filled while scan matching */
+      LikelihoodField likelihoodField;
       /** The pose of the robot */
       OrientedPoint pose;
 
@@ -244,6 +247,12 @@ namespace GMapping {
     /**minimum score for considering the outcome of the scanmatching good*/
     PARAM_SET_GET(double, minimumScore, protected, public, public);
 
+    /**the number of threads scanmatching the particles (1 scanmatches them in turn)*/
+    STRUCT_PARAM_SET_GET(m_matchingSetup, unsigned int, matchingThreads, protected, public, public);
+
+    /**scanmatch against the likelihood field of each particle map, instead of searching the kernel*/
+    STRUCT_PARAM_SET_GET(m_matchingSetup, bool, useLikelihoodField, protected, public, public);
+
   protected:
     /**Copy constructor*/
     GridSlamProcessor(const GridSlamProcessor& gsp);
@@ -267,6 +276,14 @@ namespace GMapping {
     /**the motion model*/
     MotionModel m_motionModel;
 
+    /**the scanmatching threads and method*/
+    struct MatchingSetup{
+      MatchingSetup(): matchingThreads(1), useLikelihoodField(false) {}
+      unsigned int matchingThreads;
+      bool useLikelihoodField;
+    };
+    MatchingSetup m_matchingSetup;
+
     /**this sets the neff based resampling threshold*/
     PARAM_SET_GET(double, resampleThreshold, protected, public, public);
       
@@ -315,6 +332,44 @@ namespace GMapping {
     
     /**scanmatches all the particles*/
     inline void scanMatch(const double *plainReading);
+    /**the particles left to a scanmatching thread, and their results*/
+    struct MatchingJob;
+    /**scanmatches the particles of a job not yet taken by another thread*/
+    static void scanMatchParticles(MatchingJob& job, ScanMatcher& matcher);
+    
+    /**the threads scanmatching along with the caller, each keeping a matcher of its own.
+       They are started by the first scan matched on several threads, restarted when the
+       number of threads changes, and joined with the processor. A copy of the processor
+       starts without them.*/
+    class MatchingPool{
+      public:
+        MatchingPool();
+        MatchingPool(const MatchingPool&);
+        ~MatchingPool();
+        /**scanmatches the particles of the job on this many threads, the caller's included*/
+        inline void run(MatchingJob& job, unsigned int threads);
+      private:
+        struct Worker{
+          MatchingPool* pool;
+          pthread_t thread;
+          unsigned int round;   // the last job seen
+          ScanMatcher matcher;
+        };
+        std::vector<Worker*> m_workers;   // the first one is the caller's, without a thread
+        unsigned int m_threads;           // as asked for: some may have failed to start
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_wake, m_done;
+        MatchingJob* m_job;
+        unsigned int m_round;             // jobs handed out
+        unsigned int m_running;           // threads still on the current job
+        bool m_stop;
+        inline void init();
+        inline void start(unsigned int threads);
+        inline void stop();
+        static void* work(void* worker);
+        MatchingPool& operator=(const MatchingPool&);
+    };
+    MatchingPool m_matchingPool;
     /**normalizes the particle weights*/
     inline void normalize();
     
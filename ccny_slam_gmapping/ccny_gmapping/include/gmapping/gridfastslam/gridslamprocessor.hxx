@@ -4,36 +4,193 @@
 #define isnan(x) (x==FP_NAN)
 #endif
 
+struct GridSlamProcessor::MatchingJob{
+  GridSlamProcessor* gsp;
+  const double* plainReading;
+  volatile unsigned int next;
+  std::vector<double> scores;
+  std::vector<double> likelihoods;
+};
+
+/**Scan matches the particles not yet taken by another thread.
+Each thread has its own matcher, the particles only share the map patches they read.*/
+inline void GridSlamProcessor::scanMatchParticles(MatchingJob& job, ScanMatcher& matcher){
+  ParticleVector& particles=job.gsp->m_particles;
+  
+  for (unsigned int i=__sync_fetch_and_add(&job.next, 1); i<particles.size(); i=__sync_fetch_and_add(&job.next, 1)){
+    Particle& particle=particles[i];
+    if (job.gsp->m_matchingSetup.useLikelihoodField){
+      particle.likelihoodField.update(particle.map);
+      matcher.setLikelihoodField(&particle.likelihoodField);
+    }
+    OrientedPoint corrected;
+    double score, l, s;
+    score=matcher.optimize(corrected, particle.map, particle.pose, job.plainReading);
+    //    particle.pose=corrected;
+    if (score>job.gsp->m_minimumScore){
+      particle.pose=corrected;
+    }
+    
+    matcher.likelihoodAndScore(s, l, particle.map, particle.pose, job.plainReading);
+    particle.weight+=l;
+    particle.weightSum+=l;
+    
+    job.scores[i]=score;
+    job.likelihoods[i]=l;
+  }
+}
+
+inline GridSlamProcessor::MatchingPool::MatchingPool(){
+  init();
+}
+
+inline GridSlamProcessor::MatchingPool::MatchingPool(const MatchingPool&){
+  init();
+}
+
+inline GridSlamProcessor::MatchingPool::~MatchingPool(){
+  stop();
+  pthread_cond_destroy(&m_done);
+  pthread_cond_destroy(&m_wake);
+  pthread_mutex_destroy(&m_mutex);
+}
+
+inline void GridSlamProcessor::MatchingPool::init(){
+  m_threads=0;
+  m_job=0;
+  m_round=0;
+  m_running=0;
+  m_stop=false;
+  pthread_mutex_init(&m_mutex, 0);
+  pthread_cond_init(&m_wake, 0);
+  pthread_cond_init(&m_done, 0);
+}
+
+inline void GridSlamProcessor::MatchingPool::start(unsigned int threads){
+  m_threads=threads;
+  m_stop=false;
+  Worker* caller=new Worker;
+  caller->pool=this;
+  m_workers.push_back(caller);
+  for (unsigned int t=1; t<threads; t++){
+    Worker* worker=new Worker;
+    worker->pool=this;
+    worker->round=m_round;
+    if (pthread_create(&worker->thread, 0, work, worker)){
+      delete worker;
+      break;
+    }
+    m_workers.push_back(worker);
+  }
+}
+
+inline void GridSlamProcessor::MatchingPool::stop(){
+  if (m_workers.empty())
+    return;
+  pthread_mutex_lock(&m_mutex);
+  m_stop=true;
+  pthread_cond_broadcast(&m_wake);
+  pthread_mutex_unlock(&m_mutex);
+  for (unsigned int t=1; t<m_workers.size(); t++)
+    pthread_join(m_workers[t]->thread, 0);
+  for (unsigned int t=0; t<m_workers.size(); t++)
+    delete m_workers[t];
+  m_workers.clear();
+  m_threads=0;
+}
+
+/**Waits for each job, refreshes the matcher of the thread from the processor's, which is
+not changed while the job runs, and takes particles until there are none left.*/
+inline void* GridSlamProcessor::MatchingPool::work(void* data){
+  Worker* worker=static_cast<Worker*>(data);
+  MatchingPool* pool=worker->pool;
+  pthread_mutex_lock(&pool->m_mutex);
+  for (;;){
+    while (worker->round==pool->m_round && !pool->m_stop)
+      pthread_cond_wait(&pool->m_wake, &pool->m_mutex);
+    if (pool->m_stop)
+      break;
+    worker->round=pool->m_round;
+    MatchingJob* job=pool->m_job;
+    pthread_mutex_unlock(&pool->m_mutex);
+    
+    worker->matcher=job->gsp->m_matcher;
+    scanMatchParticles(*job, worker->matcher);
+    
+    pthread_mutex_lock(&pool->m_mutex);
+    if (--pool->m_running==0)
+      pthread_cond_signal(&pool->m_done);
+  }
+  pthread_mutex_unlock(&pool->m_mutex);
+  return 0;
+}
+
+inline void GridSlamProcessor::MatchingPool::run(MatchingJob& job, unsigned int threads){
+  if (threads<1)
+    threads=1;
+  if (threads!=m_threads){
+    stop();
+    start(threads);
+  }
+  
+  pthread_mutex_lock(&m_mutex);
+  m_job=&job;
+  m_running=m_workers.size()-1;
+  m_round++;
+  pthread_cond_broadcast(&m_wake);
+  pthread_mutex_unlock(&m_mutex);
+  
+  Worker* caller=m_workers[0];
+  caller->matcher=job.gsp->m_matcher;
+  scanMatchParticles(job, caller->matcher);
+  
+  pthread_mutex_lock(&m_mutex);
+  while (m_running)
+    pthread_cond_wait(&m_done, &m_mutex);
+  pthread_mutex_unlock(&m_mutex);
+}
+
 /**Just scan match every single particle.
-If the scan matching fails, the particle gets a default likelihood.*/
+If the scan matching fails, the particle gets a default likelihood.
+The particles are shared among the matching threads, the results are
+gathered in the order of the particles, as if they were matched in turn.*/
 inline void GridSlamProcessor::scanMatch(const double* plainReading){
   // sample a new pose from each scan in the reference
   
+  m_matcher.updateBeamTable();
+  
+  MatchingJob job;
+  job.gsp=this;
+  job.plainReading=plainReading;
+  job.next=0;
+  job.scores.resize(m_particles.size());
+  job.likelihoods.resize(m_particles.size());
+  
+  unsigned int threads=m_matchingSetup.matchingThreads;
+  if (threads>m_particles.size())
+    threads=m_particles.size();
+  
+  m_matchingPool.run(job, threads);
+  
   double sumScore=0;
-  for (ParticleVector::iterator it=m_particles.begin(); it!=m_particles.end(); it++){
-    OrientedPoint corrected;
-    double score, l, s;
-    score=m_matcher.optimize(corrected, it->map, it->pose, plainReading);
-    //    it->pose=corrected;
-    if (score>m_minimumScore){
-      it->pose=corrected;
-    } else {
+  for (unsigned int i=0; i<m_particles.size(); i++){
+    Particle& particle=m_particles[i];
+    double score=job.scores[i], l=job.likelihoods[i];
+    if (score<=m_minimumScore){
 	if (m_infoStream){
 	  m_infoStream << "Scan Matching Failed, using odometry. Likelihood=" << l <<std::endl;
 	  m_infoStream << "lp:" << m_lastPartPose.x << " "  << m_lastPartPose.y << " "<< m_lastPartPose.theta <<std::endl;
 	  m_infoStream << "op:" << m_odoPose.x << " " << m_odoPose.y << " "<< m_odoPose.theta <<std::endl;
 	}
     }
-
-    m_matcher.likelihoodAndScore(s, l, it->map, it->pose, plainReading);
     sumScore+=score;
-    it->weight+=l;
-    it->weightSum+=l;
 
     //set up the selective copy of the active area
-    //by detaching the areas that will be updated
+    //by detaching the areas that will be updated.
+    //It resizes the map, whose patches are reference counted
+    //across the particles, hence it is not shared among the threads
     m_matcher.invalidateActiveArea();
-    m_matcher.computeActiveArea(it->map, it->pose, plainReading);
+    m_matcher.computeActiveArea(particle.map, particle.pose, plainReading);
   }
   if (m_infoStream)
     m_infoStream << "Average Scan Matching Score=" << sumScore/m_particles.size() << std::endl;	
@@ -141,6 +298,7 @@ inline bool GridSlamProcessor::resample(const double* plainReading, int adaptSiz
       it->setWeight(0);
       m_matcher.invalidateActiveArea();
       m_matcher.registerScan(it->map, it->pose, plainReading);
+      it->likelihoodField.clear();
       m_particles.push_back(*it);
     }
     std::cerr  << " Done" <<std::endl;
@@ -162,6 +320,7 @@ inline bool GridSlamProcessor::resample(const double* plainReading, int adaptSiz
       //END: BUILDING TREE
       m_matcher.invalidateActiveArea();
       m_matcher.registerScan(it->map, it->pose, plainReading);
+      it->likelihoodField.clear();
       it->previousIndex=index;
       index++;
       node_it++;
@@ -0,0 +1,93 @@
+#ifndef LIKELIHOODFIELD_H
+#define LIKELIHOODFIELD_H
+
+#include <map>
+#include <vector>
+#include "smmap.h"
+
+namespace GMapping {
+
+/**The mean of the occupied cell nearest to each cell of a map, among the
+cells within the kernel of the scan matcher. It replaces the kernel search
+of score and likelihoodAndScore by one lookup per beam.
+A cell is searched the first time a beam ends in it, and kept until the
+field is cleared, when a scan is registered in the map. Unlike the kernel
+search, the field does not check the cell before the hit to be free.
+Copies of a field are empty, since it is only a cache of its map.*/
+class LikelihoodField{
+	public:
+		inline LikelihoodField(): m_lastPatch(0) {}
+		inline LikelihoodField(const LikelihoodField&): m_lastPatch(0) {}
+		inline LikelihoodField& operator=(const LikelihoodField&) { clear(); return *this; }
+
+		inline void clear();
+		inline void update(const ScanMatcherMap& map);
+		inline const Point* nearest(const ScanMatcherMap& map, const IntPoint& p, int kernelSize, double fullnessThreshold);
+
+	protected:
+		enum State{Unknown, Empty, Found};
+		struct Entry{
+			Entry(): state(Unknown) {}
+			Point mean;
+			char state;
+		};
+		typedef std::vector<Entry> Patch;
+		typedef std::map<IntPoint, Patch, pointcomparator<int> > PatchMap;
+
+		PatchMap m_patches;
+		IntPoint m_lastIndex;
+		Patch* m_lastPatch;
+		//the origin of the map when the field was filled
+		Point m_origin;
+};
+
+void LikelihoodField::clear(){
+	m_patches.clear();
+	m_lastPatch=0;
+}
+
+/**Clears the field if the map was resized since it was filled, which moves
+the cells.*/
+void LikelihoodField::update(const ScanMatcherMap& map){
+	Point origin=map.map2world(0,0);
+	if (origin.x!=m_origin.x || origin.y!=m_origin.y){
+		clear();
+		m_origin=origin;
+	}
+}
+
+const Point* LikelihoodField::nearest(const ScanMatcherMap& map, const IntPoint& p, int kernelSize, double fullnessThreshold){
+	int magnitude=map.storage().getPatchMagnitude();
+	IntPoint index(p.x>>magnitude, p.y>>magnitude);
+	if (!m_lastPatch || index.x!=m_lastIndex.x || index.y!=m_lastIndex.y){
+		Patch& patch=m_patches[index];
+		if (patch.empty())
+			patch.resize(1<<(2*magnitude));
+		m_lastIndex=index;
+		m_lastPatch=&patch;
+	}
+	Entry& entry=(*m_lastPatch)[((p.x-(index.x<<magnitude))<<magnitude)+p.y-(index.y<<magnitude)];
+	if (entry.state==Unknown){
+		Point center=map.map2world(p);
+		double bestDistance=0;
+		entry.state=Empty;
+		for (int xx=-kernelSize; xx<=kernelSize; xx++)
+		for (int yy=-kernelSize; yy<=kernelSize; yy++){
+			const PointAccumulator& cell=map.cell(p+IntPoint(xx,yy));
+			if (((double)cell )>fullnessThreshold){
+				Point mean=cell.mean();
+				Point mu=center-mean;
+				if (entry.state==Empty || mu*mu<bestDistance){
+					entry.mean=mean;
+					entry.state=Found;
+					bestDistance=mu*mu;
+				}
+			}
+		}
+	}
+	return entry.state==Found?&entry.mean:0;
+}
+
+};
+
+#endif
@@ -3,10 +3,16 @@
 
 #include "icp.h"
 #include "smmap.h"
+#include "likelihoodfield.h"
 #include <utils/macro_params.h>
 #include <utils/stat.h>
 #include <iostream>
 #include <utils/gvalues.h>
+#include <cstring>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #define LASER_MAXBEAMS 2048
 
 namespace GMapping {
@@ -28,6 +34,7 @@ class ScanMatcher{
 		void invalidateActiveArea();
 		void computeActiveArea(ScanMatcherMap& map, const OrientedPoint& p, const double* readings);
 
+		inline void updateBeamTable();
 		inline double icpStep(OrientedPoint & pret, const ScanMatcherMap& map, const OrientedPoint& p, const double* readings) const;
 		inline double score(const ScanMatcherMap& map, const OrientedPoint& p, const double* readings) const;
 		inline unsigned int likelihoodAndScore(double& s, double& l, const ScanMatcherMap& map, const OrientedPoint& p, const double* readings) const;
@@ -35,11 +42,47 @@ class ScanMatcher{
 		double likelihood(double& _lmax, OrientedPoint& _mean, CovarianceMatrix& _cov, const ScanMatcherMap& map, const OrientedPoint& p, Gaussian3& odometry, const double* readings, double gain=180.);
 		inline const double* laserAngles() const { return m_laserAngles; }
 		inline unsigned int laserBeams() const { return m_laserBeams; }
+		/**scores against the likelihood field of the map, instead of searching the kernel (0 searches the kernel)*/
+		inline void setLikelihoodField(LikelihoodField* field) { m_likelihoodField.field=field; }
 		
 		static const double nullLikelihood;
 	protected:
 		//state of the matcher
 		bool m_activeAreaComputed;
+		struct LikelihoodFieldBinding{
+			LikelihoodFieldBinding(): field(0) {}
+			LikelihoodField* field;
+		};
+		LikelihoodFieldBinding m_likelihoodField;
+		
+		/**the unit vectors of the laser angles, rotated by the pose instead
+		   of computing the sine and cosine of each beam. It holds beams==m_laserBeams
+		   only while built for the current angles: updateBeamTable() compares them once
+		   per scan, so that projectBeams() only compares the counts*/
+		struct BeamTable{
+			BeamTable(): beams(0) {}
+			unsigned int beams;
+			double angles[LASER_MAXBEAMS];
+			double cos[LASER_MAXBEAMS];
+			double sin[LASER_MAXBEAMS];
+		};
+		BeamTable m_beamTable;
+		
+		/**the directions dx,dy and the endpoints hx,hy of the beams, projected by projectBeams()
+		   for the pose being scored. They are kept with the matcher instead of on the stack of
+		   each call, sized for m_laserBeams: a matcher scores on one thread at a time, and each
+		   matching thread has its own copy*/
+		struct BeamProjection{
+			std::vector<double> dx, dy, hx, hy;
+			inline void resize(unsigned int beams){
+				if (dx.size()>=beams)
+					return;
+				dx.resize(beams); dy.resize(beams);
+				hx.resize(beams); hy.resize(beams);
+			}
+		};
+		mutable BeamProjection m_projection;
+		inline void projectBeams(const OrientedPoint& lp, const double* readings) const;
 		
 		/**laser parameters*/
 		unsigned int m_laserBeams;
@@ -69,28 +112,83 @@ class ScanMatcher{
 		PARAM_SET_GET(unsigned int, initialBeamsSkip, protected, public, public)
 };
 
+/**Builds the beam table for the current laser angles, if they have changed, and sizes the
+beam projection for them. Call it after setLaserParameters() and before matching.*/
+inline void ScanMatcher::updateBeamTable(){
+	m_projection.resize(m_laserBeams);
+	if (m_beamTable.beams==m_laserBeams && !memcmp(m_beamTable.angles, m_laserAngles, sizeof(double)*m_laserBeams))
+		return;
+	for (unsigned int b=0; b<m_laserBeams; b++){
+		m_beamTable.angles[b]=m_laserAngles[b];
+		m_beamTable.cos[b]=cos(m_laserAngles[b]);
+		m_beamTable.sin[b]=sin(m_laserAngles[b]);
+	}
+	m_beamTable.beams=m_laserBeams;
+}
+
+/**Computes the directions dx,dy and the endpoints hx,hy of the beams from the laser pose lp,
+into m_projection. The directions are rotated from the beam table, if it was built by
+updateBeamTable(), or else computed from the angles.*/
+inline void ScanMatcher::projectBeams(const OrientedPoint& lp, const double* readings) const{
+	unsigned int b=m_initialBeamsSkip;
+	m_projection.resize(m_laserBeams);
+	if (b>=m_laserBeams)
+		return;
+	double *dx=&m_projection.dx[0], *dy=&m_projection.dy[0], *hx=&m_projection.hx[0], *hy=&m_projection.hy[0];
+	if (m_beamTable.beams!=m_laserBeams){
+		for (; b<m_laserBeams; b++){
+			dx[b]=cos(lp.theta+m_laserAngles[b]);
+			dy[b]=sin(lp.theta+m_laserAngles[b]);
+			hx[b]=lp.x+readings[b]*dx[b];
+			hy[b]=lp.y+readings[b]*dy[b];
+		}
+		return;
+	}
+	double c=cos(lp.theta), s=sin(lp.theta);
+#ifdef __SSE2__
+	__m128d vc=_mm_set1_pd(c), vs=_mm_set1_pd(s);
+	__m128d vx=_mm_set1_pd(lp.x), vy=_mm_set1_pd(lp.y);
+	for (; b+1<m_laserBeams; b+=2){
+		__m128d bc=_mm_loadu_pd(m_beamTable.cos+b), bs=_mm_loadu_pd(m_beamTable.sin+b);
+		__m128d r=_mm_loadu_pd(readings+b);
+		__m128d vdx=_mm_sub_pd(_mm_mul_pd(vc, bc), _mm_mul_pd(vs, bs));
+		__m128d vdy=_mm_add_pd(_mm_mul_pd(vs, bc), _mm_mul_pd(vc, bs));
+		_mm_storeu_pd(dx+b, vdx);
+		_mm_storeu_pd(dy+b, vdy);
+		_mm_storeu_pd(hx+b, _mm_add_pd(vx, _mm_mul_pd(r, vdx)));
+		_mm_storeu_pd(hy+b, _mm_add_pd(vy, _mm_mul_pd(r, vdy)));
+	}
+#endif
+	for (; b<m_laserBeams; b++){
+		dx[b]=c*m_beamTable.cos[b]-s*m_beamTable.sin[b];
+		dy[b]=s*m_beamTable.cos[b]+c*m_beamTable.sin[b];
+		hx[b]=lp.x+readings[b]*dx[b];
+		hy[b]=lp.y+readings[b]*dy[b];
+	}
+}
+
 inline double ScanMatcher::icpStep(OrientedPoint & pret, const ScanMatcherMap& map, const OrientedPoint& p, const double* readings) const{
-	const double * angle=m_laserAngles+m_initialBeamsSkip;
 	OrientedPoint lp=p;
 	lp.x+=cos(p.theta)*m_laserPose.x-sin(p.theta)*m_laserPose.y;
 	lp.y+=sin(p.theta)*m_laserPose.x+cos(p.theta)*m_laserPose.y;
 	lp.theta+=m_laserPose.theta;
+	projectBeams(lp, readings);
+	const std::vector<double> &dx=m_projection.dx, &dy=m_projection.dy, &hx=m_projection.hx, &hy=m_projection.hy;
 	unsigned int skip=0;
 	double freeDelta=map.getDelta()*m_freeCellRatio;
 	std::list<PointPair> pairs;
 	
-	for (const double* r=readings+m_initialBeamsSkip; r<readings+m_laserBeams; r++, angle++){
+	for (unsigned int b=m_initialBeamsSkip; b<m_laserBeams; b++){
+		const double* r=readings+b;
 		skip++;
 		skip=skip>m_likelihoodSkip?0:skip;
 		if (*r>m_usableRange) continue;
 		if (skip) continue;
-		Point phit=lp;
-		phit.x+=*r*cos(lp.theta+*angle);
-		phit.y+=*r*sin(lp.theta+*angle);
+		Point phit(hx[b], hy[b]);
 		IntPoint iphit=map.world2map(phit);
 		Point pfree=lp;
-		pfree.x+=(*r-map.getDelta()*freeDelta)*cos(lp.theta+*angle);
-		pfree.y+=(*r-map.getDelta()*freeDelta)*sin(lp.theta+*angle);
+		pfree.x+=(*r-map.getDelta()*freeDelta)*dx[b];
+		pfree.y+=(*r-map.getDelta()*freeDelta)*dy[b];
  		pfree=pfree-phit;
 		IntPoint ipfree=map.world2map(pfree);
 		bool found=false;
@@ -138,25 +236,34 @@ inline double ScanMatcher::icpStep(OrientedPoint & pret, const ScanMatcherMap& m
 
 inline double ScanMatcher::score(const ScanMatcherMap& map, const OrientedPoint& p, const double* readings) const{
 	double s=0;
-	const double * angle=m_laserAngles+m_initialBeamsSkip;
 	OrientedPoint lp=p;
 	lp.x+=cos(p.theta)*m_laserPose.x-sin(p.theta)*m_laserPose.y;
 	lp.y+=sin(p.theta)*m_laserPose.x+cos(p.theta)*m_laserPose.y;
 	lp.theta+=m_laserPose.theta;
+	projectBeams(lp, readings);
+	const std::vector<double> &dx=m_projection.dx, &dy=m_projection.dy, &hx=m_projection.hx, &hy=m_projection.hy;
 	unsigned int skip=0;
 	double freeDelta=map.getDelta()*m_freeCellRatio;
-	for (const double* r=readings+m_initialBeamsSkip; r<readings+m_laserBeams; r++, angle++){
+	LikelihoodField* field=m_likelihoodField.field;
+	for (unsigned int b=m_initialBeamsSkip; b<m_laserBeams; b++){
+		const double* r=readings+b;
 		skip++;
 		skip=skip>m_likelihoodSkip?0:skip;
 		if (*r>m_usableRange) continue;
 		if (skip) continue;
-		Point phit=lp;
-		phit.x+=*r*cos(lp.theta+*angle);
-		phit.y+=*r*sin(lp.theta+*angle);
+		Point phit(hx[b], hy[b]);
 		IntPoint iphit=map.world2map(phit);
+		if (field){
+			const Point* mean=field->nearest(map, iphit, m_kernelSize, m_fullnessThreshold);
+			if (mean){
+				Point mu=phit-*mean;
+				s+=exp(-1./m_gaussianSigma*mu*mu);
+			}
+			continue;
+		}
 		Point pfree=lp;
-		pfree.x+=(*r-map.getDelta()*freeDelta)*cos(lp.theta+*angle);
-		pfree.y+=(*r-map.getDelta()*freeDelta)*sin(lp.theta+*angle);
+		pfree.x+=(*r-map.getDelta()*freeDelta)*dx[b];
+		pfree.y+=(*r-map.getDelta()*freeDelta)*dy[b];
  		pfree=pfree-phit;
 		IntPoint ipfree=map.world2map(pfree);
 		bool found=false;
@@ -189,48 +296,57 @@ inline unsigned int ScanMatcher::likelihoodAndScore(double& s, double& l, const
 	using namespace std;
 	l=0;
 	s=0;
-	const double * angle=m_laserAngles+m_initialBeamsSkip;
 	OrientedPoint lp=p;
 	lp.x+=cos(p.theta)*m_laserPose.x-sin(p.theta)*m_laserPose.y;
 	lp.y+=sin(p.theta)*m_laserPose.x+cos(p.theta)*m_laserPose.y;
 	lp.theta+=m_laserPose.theta;
+	projectBeams(lp, readings);
+	const std::vector<double> &dx=m_projection.dx, &dy=m_projection.dy, &hx=m_projection.hx, &hy=m_projection.hy;
 	double noHit=nullLikelihood/(m_likelihoodSigma);
 	unsigned int skip=0;
 	unsigned int c=0;
 	double freeDelta=map.getDelta()*m_freeCellRatio;
-	for (const double* r=readings+m_initialBeamsSkip; r<readings+m_laserBeams; r++, angle++){
+	LikelihoodField* field=m_likelihoodField.field;
+	for (unsigned int b=m_initialBeamsSkip; b<m_laserBeams; b++){
+		const double* r=readings+b;
 		skip++;
 		skip=skip>m_likelihoodSkip?0:skip;
 		if (*r>m_usableRange) continue;
 		if (skip) continue;
-		Point phit=lp;
-		phit.x+=*r*cos(lp.theta+*angle);
-		phit.y+=*r*sin(lp.theta+*angle);
+		Point phit(hx[b], hy[b]);
 		IntPoint iphit=map.world2map(phit);
-		Point pfree=lp;
-		pfree.x+=(*r-freeDelta)*cos(lp.theta+*angle);
-		pfree.y+=(*r-freeDelta)*sin(lp.theta+*angle);
-		pfree=pfree-phit;
-		IntPoint ipfree=map.world2map(pfree);
 		bool found=false;
 		Point bestMu(0.,0.);
-		for (int xx=-m_kernelSize; xx<=m_kernelSize; xx++)
-		for (int yy=-m_kernelSize; yy<=m_kernelSize; yy++){
-			IntPoint pr=iphit+IntPoint(xx,yy);
-			IntPoint pf=pr+ipfree;
-			//AccessibilityState s=map.storage().cellState(pr);
-			//if (s&Inside && s&Allocated){
-				const PointAccumulator& cell=map.cell(pr);
-				const PointAccumulator& fcell=map.cell(pf);
-				if (((double)cell )>m_fullnessThreshold && ((double)fcell )<m_fullnessThreshold){
-					Point mu=phit-cell.mean();
-					if (!found){
-						bestMu=mu;
-						found=true;
-					}else
-						bestMu=(mu*mu)<(bestMu*bestMu)?mu:bestMu;
-				}
-			//}	
+		if (field){
+			const Point* mean=field->nearest(map, iphit, m_kernelSize, m_fullnessThreshold);
+			if (mean){
+				bestMu=phit-*mean;
+				found=true;
+			}
+		} else {
+			Point pfree=lp;
+			pfree.x+=(*r-freeDelta)*dx[b];
+			pfree.y+=(*r-freeDelta)*dy[b];
+			pfree=pfree-phit;
+			IntPoint ipfree=map.world2map(pfree);
+			for (int xx=-m_kernelSize; xx<=m_kernelSize; xx++)
+			for (int yy=-m_kernelSize; yy<=m_kernelSize; yy++){
+				IntPoint pr=iphit+IntPoint(xx,yy);
+				IntPoint pf=pr+ipfree;
+				//AccessibilityState s=map.storage().cellState(pr);
+				//if (s&Inside && s&Allocated){
+					const PointAccumulator& cell=map.cell(pr);
+					const PointAccumulator& fcell=map.cell(pf);
+					if (((double)cell )>m_fullnessThreshold && ((double)fcell )<m_fullnessThreshold){
+						Point mu=phit-cell.mean();
+						if (!found){
+							bestMu=mu;
+							found=true;
+						}else
+							bestMu=(mu*mu)<(bestMu*bestMu)?mu:bestMu;
+					}
+				//}	
+			}
 		}
 		if (found){
 			s+=exp(-1./m_gaussianSigma*bestMu*bestMu);
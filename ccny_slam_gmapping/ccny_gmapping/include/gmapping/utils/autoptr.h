@@ -9,15 +9,19 @@ class autoptr{
 	protected:
 	
 	public:
+	/**the shared object, its shares are counted atomically, so that
+	   autoptrs to the same object may be copied and released from
+	   different threads*/
 	struct reference{
 		X* data;
-		unsigned int shares;
+		volatile unsigned int shares;
 	};
 		inline autoptr(X* p=(X*)(0));
 		inline autoptr(const autoptr<X>& ap);
 		inline autoptr& operator=(const autoptr<X>& ap);
 		inline ~autoptr();
 		inline operator int() const;
+		inline bool unique() const;
 		inline X& operator*();
 		inline const X& operator*() const;
 		//p	
@@ -41,7 +45,7 @@ autoptr<X>::autoptr(const autoptr<X>& ap){
 	reference* ref=ap.m_reference;
 	if (ap.m_reference){
 		m_reference=ref;
-		m_reference->shares++;
+		__sync_fetch_and_add(&m_reference->shares, 1);
 	}
 }
 
@@ -51,14 +55,15 @@ autoptr<X>& autoptr<X>::operator=(const autoptr<X>& ap){
 	if (m_reference==ref){
 		return *this;
 	}
-	if (m_reference && !(--m_reference->shares)){
+	if (ref)
+		__sync_fetch_and_add(&ref->shares, 1);
+	if (m_reference && !__sync_sub_and_fetch(&m_reference->shares, 1)){
 		delete m_reference->data;
 		delete m_reference;
 		m_reference=0;
 	}	
 	if (ref){
 		m_reference=ref;
-		m_reference->shares++;
 	} 
 //20050802 nasty changes begin
 	else
@@ -69,7 +74,7 @@ autoptr<X>& autoptr<X>::operator=(const autoptr<X>& ap){
 
 template <class X>
 autoptr<X>::~autoptr(){
-	if (m_reference && !(--m_reference->shares)){
+	if (m_reference && !__sync_sub_and_fetch(&m_reference->shares, 1)){
 		delete m_reference->data;
 		delete m_reference;
 		m_reference=0;
@@ -78,18 +83,28 @@ autoptr<X>::~autoptr(){
 
 template <class X>
 autoptr<X>::operator int() const{
-	return m_reference && m_reference->shares && m_reference->data;
+	//a reference holds a share, the count is not read here, since
+	//another thread may be changing it
+	return m_reference && m_reference->data;
+}
+
+/**@returns true if no other autoptr shares the object. Only the owner of
+   the last share can make a new one, so the object can then be written
+   in place.*/
+template <class X>
+bool autoptr<X>::unique() const{
+	return m_reference && __sync_fetch_and_add(&m_reference->shares, 0)==1;
 }
 
 template <class X>
 X& autoptr<X>::operator*(){
-	assert(m_reference && m_reference->shares && m_reference->data);
+	assert(m_reference && m_reference->data);
 	return *(m_reference->data);
 }
 
 template <class X>
 const X& autoptr<X>::operator*() const{
-	assert(m_reference && m_reference->shares && m_reference->data);
+	assert(m_reference && m_reference->data);
 	return *(m_reference->data);
 }
 
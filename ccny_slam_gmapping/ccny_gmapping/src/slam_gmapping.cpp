@@ -96,6 +96,10 @@ SlamGMapping::SlamGMapping():
     resampleThreshold_ = 0.5;
   if(!private_nh_.getParam("particles", particles_))
     particles_ = 30;
+  if(!private_nh_.getParam("matchingThreads", matchingThreads_))
+    matchingThreads_ = 1;
+  if(!private_nh_.getParam("likelihoodField", likelihoodField_))
+    likelihoodField_ = false;
   if(!private_nh_.getParam("xmin", xmin_))
     xmin_ = -100.0;
   if(!private_nh_.getParam("ymin", ymin_))
@@ -266,6 +270,8 @@ bool SlamGMapping::initMapper(const laser_ortho_projector::LaserScanWithAngles&
   gsp_->setUpdateDistances(linearUpdate_, angularUpdate_, resampleThreshold_);
   gsp_->setUpdatePeriod(temporalUpdate_);
   gsp_->setgenerateMap(true);
+  gsp_->setmatchingThreads(matchingThreads_);
+  gsp_->setuseLikelihoodField(likelihoodField_);
   gsp_->GridSlamProcessor::init(particles_, xmin_, ymin_, xmax_, ymax_,
                                 delta_, initialPose);
   gsp_->setllsamplerange(llsamplerange_);
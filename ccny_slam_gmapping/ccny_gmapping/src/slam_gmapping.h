@@ -129,6 +129,8 @@ class SlamGMapping
     double temporalUpdate_;
     double resampleThreshold_;
     int particles_;
+    int matchingThreads_;
+    bool likelihoodField_;
     double xmin_;
     double ymin_;
     double xmax_;
@@ -0,0 +1,165 @@
+/* Scan matching the particles on several threads: the filter must end with
+ * the same particles, bit for bit, as when they are matched in turn, and
+ * the time of both is printed. */
+
+#include <gtest/gtest.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <gridfastslam/gridslamprocessor.h>
+#include <sensor/sensor_range/rangesensor.h>
+#include <sensor/sensor_range/rangereading.h>
+#include <utils/stat.h>
+
+using namespace GMapping;
+
+static const int    BEAMS     = 1081;
+static const double FOV       = 270.0 * M_PI / 180.0;
+static const int    PARTICLES = 30;
+static const int    SCANS     = 20;
+static const int    THREADS   = 4;
+
+static double now()
+{
+  timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+// a 10 x 8 m room with a pillar
+static double castBeam(double x, double y, double a)
+{
+  static const double walls[8][4] =
+  {
+    {-5, -4,  5, -4}, { 5, -4,  5,  4}, { 5,  4, -5,  4}, {-5,  4, -5, -4},
+    { 1, -.5, 1.5, -.5}, {1.5, -.5, 1.5, .5}, {1.5, .5, 1, .5}, {1, .5, 1, -.5}
+  };
+
+  double dx = cos(a), dy = sin(a), range = 30.0;
+  for (int w = 0; w < 8; w++)
+  {
+    double ex = walls[w][2] - walls[w][0], ey = walls[w][3] - walls[w][1];
+    double den = dx * ey - dy * ex;
+    if (fabs(den) < 1e-12) continue;
+    double t = ((walls[w][0] - x) * ey - (walls[w][1] - y) * ex) / den;
+    double u = ((walls[w][0] - x) * dy - (walls[w][1] - y) * dx) / den;
+    if (t > 0 && u >= 0 && u <= 1 && t < range) range = t;
+  }
+  return range;
+}
+
+struct Result
+{
+  std::vector<OrientedPoint> poses;
+  std::vector<double> weights;
+  std::vector<double> weightSums;
+  double seconds;
+};
+
+// the same scans, odometry and random seed for each run: only the number
+// of matching threads differs
+static void run(unsigned int threads, bool useLikelihoodField, Result& result)
+{
+  std::vector<double> angles(BEAMS);
+  for (int i = 0; i < BEAMS; i++)
+    angles[i] = -0.5 * FOV + FOV * i / (BEAMS - 1);
+
+  RangeSensor laser("FLASER", BEAMS, &angles[0], OrientedPoint(0, 0, 0), 0.0, 29.9);
+  SensorMap sensors;
+  sensors.insert(std::make_pair(laser.getName(), &laser));
+
+  GridSlamProcessor gsp;
+  gsp.setSensorMap(sensors);
+  gsp.setMatchingParameters(8.0, 29.9, 0.05, 1, 0.05, 0.05, 5, 0.075, 3.0, 0);
+  gsp.setMotionModelParameters(0.1, 0.2, 0.1, 0.2);
+  gsp.setUpdateDistances(0.1, 0.1, 0.5);
+  gsp.setUpdatePeriod(-1.0);
+  gsp.setgenerateMap(false);
+  gsp.setmatchingThreads(threads);
+  gsp.setuseLikelihoodField(useLikelihoodField);
+
+  OrientedPoint start(-3.0, -1.0, 0.0);
+  gsp.init(PARTICLES, -6, -6, 6, 6, 0.05, start);
+
+  sampleGaussian(1, 7);
+
+  std::vector<double> ranges(BEAMS);
+  double t0 = now();
+
+  for (int s = 0; s < SCANS; s++)
+  {
+    OrientedPoint truth(start.x + 0.15 * s, start.y + 0.05 * s, start.theta + 0.02 * s);
+    for (int i = 0; i < BEAMS; i++)
+      ranges[i] = castBeam(truth.x, truth.y, truth.theta + angles[i]);
+
+    // odometry which drifts from the true pose
+    OrientedPoint odometry(truth.x * 1.02, truth.y, truth.theta * 0.98);
+
+    RangeReading reading(BEAMS, &ranges[0], &laser, s);
+    reading.setPose(odometry);
+    gsp.processScan(reading, odometry);
+  }
+
+  result.seconds = now() - t0;
+
+  const GridSlamProcessor::ParticleVector& particles = gsp.getParticles();
+  for (unsigned int i = 0; i < particles.size(); i++)
+  {
+    result.poses.push_back(particles[i].pose);
+    result.weights.push_back(particles[i].weight);
+    result.weightSums.push_back(particles[i].weightSum);
+  }
+}
+
+static bool same(double a, double b)
+{
+  return !memcmp(&a, &b, sizeof(double));
+}
+
+static void expectSameParticles(const Result& serial, const Result& threaded)
+{
+  ASSERT_EQ(serial.poses.size(), threaded.poses.size());
+
+  for (unsigned int i = 0; i < serial.poses.size(); i++)
+  {
+    EXPECT_TRUE(same(serial.poses[i].x,     threaded.poses[i].x))     << "particle " << i;
+    EXPECT_TRUE(same(serial.poses[i].y,     threaded.poses[i].y))     << "particle " << i;
+    EXPECT_TRUE(same(serial.poses[i].theta, threaded.poses[i].theta)) << "particle " << i;
+    EXPECT_TRUE(same(serial.weights[i],     threaded.weights[i]))     << "particle " << i;
+    EXPECT_TRUE(same(serial.weightSums[i],  threaded.weightSums[i]))  << "particle " << i;
+  }
+}
+
+TEST(GridSlamProcessorTest, matchingThreadsKernel)
+{
+  Result serial, threaded;
+  run(1, false, serial);
+  run(THREADS, false, threaded);
+
+  printf("kernel: 1 thread %.1f ms/scan, %d threads %.1f ms/scan, %.2fx\n",
+         1000 * serial.seconds / SCANS, THREADS, 1000 * threaded.seconds / SCANS,
+         serial.seconds / threaded.seconds);
+
+  expectSameParticles(serial, threaded);
+}
+
+TEST(GridSlamProcessorTest, matchingThreadsLikelihoodField)
+{
+  Result serial, threaded;
+  run(1, true, serial);
+  run(THREADS, true, threaded);
+
+  printf("likelihood field: 1 thread %.1f ms/scan, %d threads %.1f ms/scan, %.2fx\n",
+         1000 * serial.seconds / SCANS, THREADS, 1000 * threaded.seconds / SCANS,
+         serial.seconds / threaded.seconds);
+
+  expectSameParticles(serial, threaded);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,221 @@
+/* Stress test and benchmark of the map patches shared between particles:
+ * maps are copied, resampled and updated from several threads at once,
+ * as when the particles are scan matched and registered in parallel. */
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <vector>
+
+#include <grid/harray2d.h>
+#include <scanmatcher/smmap.h>
+
+using namespace GMapping;
+
+// a cell which counts its instances, to find leaked or twice freed patches
+struct CountedCell
+{
+  CountedCell(): value(0) { __sync_fetch_and_add(&instances, 1); }
+  CountedCell(const CountedCell& c): value(c.value) { __sync_fetch_and_add(&instances, 1); }
+  ~CountedCell() { __sync_fetch_and_sub(&instances, 1); }
+
+  int value;
+  static volatile int instances;
+};
+
+volatile int CountedCell::instances = 0;
+
+typedef HierarchicalArray2D<CountedCell> PatchMap;
+
+static const int MAP_SIZE  = 256;
+static const int PATCH_MAG = 4;
+static const int PARTICLES = 16;
+static const int STEPS     = 100;
+
+static double now()
+{
+  timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+static int checksum(const PatchMap& map, int x0 = 0, int y0 = 0, int size = MAP_SIZE)
+{
+  int sum = 0;
+  for (int x = x0; x < x0 + size; x++)
+    for (int y = y0; y < y0 + size; y++)
+      if (map.isAllocated(x, y))
+        sum += map.cell(x, y).value;
+  return sum;
+}
+
+struct StressJob
+{
+  const PatchMap* root;
+  int             rootSum;
+  unsigned int    seed;
+  bool            ok;
+};
+
+// each thread keeps particles copied from the shared root, resamples them
+// and writes an area of each, as registerScan does
+static void* stress(void* data)
+{
+  StressJob* job = static_cast<StressJob*>(data);
+  std::vector<PatchMap> particles(PARTICLES, *job->root);
+
+  for (int s = 0; s < STEPS; s++)
+  {
+    for (int p = 0; p < PARTICLES; p++)
+    {
+      int x0 = rand_r(&job->seed) % (MAP_SIZE - 48);
+      int y0 = rand_r(&job->seed) % (MAP_SIZE - 48);
+
+      PatchMap::PointSet area;
+      for (int x = x0; x < x0 + 48; x += 16)
+        for (int y = y0; y < y0 + 48; y += 16)
+          area.insert(IntPoint(x >> PATCH_MAG, y >> PATCH_MAG));
+
+      PatchMap& map = particles[p];
+      int before = checksum(map, x0, y0, 48);
+
+      map.setActiveArea(area, true);
+      map.allocActiveArea();
+      map.cell(x0, y0).value++;
+
+      if (checksum(map, x0, y0, 48) != before + 1) job->ok = false;
+    }
+
+    // resample: the particles share their patches with each other and with
+    // the particles of the other threads
+    for (int p = 0; p < PARTICLES; p++)
+    {
+      int q = rand_r(&job->seed) % PARTICLES;
+      if (rand_r(&job->seed) % 8)
+        particles[p] = particles[q];
+      else
+        particles[p] = *job->root;
+    }
+  }
+
+  if (checksum(*job->root) != job->rootSum) job->ok = false;
+  return 0;
+}
+
+TEST(HierarchicalArray2D, concurrentResampleAndRegister)
+{
+  int instances = CountedCell::instances;
+  {
+    PatchMap root(MAP_SIZE, MAP_SIZE, PATCH_MAG);
+    for (int x = 0; x < MAP_SIZE; x += 3)
+      for (int y = 0; y < MAP_SIZE; y += 5)
+        root.cell(x, y).value = x + y;
+
+    int threads = 8;
+    std::vector<StressJob> jobs(threads);
+    std::vector<pthread_t> workers(threads);
+
+    for (int t = 0; t < threads; t++)
+    {
+      jobs[t].root    = &root;
+      jobs[t].rootSum = checksum(root);
+      jobs[t].seed    = t + 1;
+      jobs[t].ok      = true;
+      ASSERT_EQ(0, pthread_create(&workers[t], 0, stress, &jobs[t]));
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+      pthread_join(workers[t], 0);
+      EXPECT_TRUE(jobs[t].ok) << "thread " << t;
+    }
+  }
+  EXPECT_EQ(instances, CountedCell::instances);
+}
+
+TEST(HierarchicalArray2D, singleThreadOverhead)
+{
+  PatchMap root(MAP_SIZE, MAP_SIZE, PATCH_MAG);
+  for (int x = 0; x < MAP_SIZE; x++)
+    for (int y = 0; y < MAP_SIZE; y++)
+      root.cell(x, y).value = 1;
+
+  // copying and releasing a map only counts the shares of its patches
+  std::vector<PatchMap> particles(PARTICLES, root);
+
+  int copies = 2000;
+  double t0 = now();
+  for (int i = 0; i < copies; i++)
+    particles[i % PARTICLES] = (i & 1) ? root : PatchMap(root);
+  double t = now() - t0;
+
+  int patches = (MAP_SIZE >> PATCH_MAG) * (MAP_SIZE >> PATCH_MAG);
+  printf("map copy: %.1f us, %.1f ns per patch\n",
+         1e6 * t / copies, 1e9 * t / (copies * patches));
+
+  EXPECT_EQ(MAP_SIZE * MAP_SIZE, checksum(particles[0]));
+}
+
+TEST(Array2D, resizeAndCopy)
+{
+  Array2D<int> a(8, 6);
+  for (int x = 0; x < 8; x++)
+    for (int y = 0; y < 6; y++)
+      a.cell(x, y) = 10 * x + y;
+
+  // the cells are kept row after row, and reached through the row pointers
+  EXPECT_EQ(&a.cell(1, 0), &a.cell(0, 0) + 6);
+  EXPECT_EQ(&a.cell(3, 4), &a.cells()[3][4]);
+#ifdef ARRAY2D_ALIGNMENT
+  EXPECT_EQ(0u, reinterpret_cast<size_t>(&a.cell(0, 0)) % ARRAY2D_ALIGNMENT);
+#endif
+
+  Array2D<int> b(a);
+  a.resize(-2, 1, 10, 9);
+  ASSERT_EQ(12, a.getXSize());
+  ASSERT_EQ(8, a.getYSize());
+  for (int x = 0; x < 8; x++)
+    for (int y = 1; y < 6; y++)
+      EXPECT_EQ(10 * x + y, a.cell(x + 2, y - 1));
+
+  a = b;
+  ASSERT_EQ(8, a.getXSize());
+  for (int x = 0; x < 8; x++)
+    for (int y = 0; y < 6; y++)
+      EXPECT_EQ(10 * x + y, a.cell(x, y));
+
+  a.clear();
+  EXPECT_EQ(0, a.getXSize());
+  EXPECT_TRUE(a.cells() == 0);
+}
+
+TEST(Array2D, patchCopy)
+{
+  // a patch of the scan matcher map, copied when a particle first writes it
+  Array2D<PointAccumulator> patch(1 << 5, 1 << 5);
+  for (int x = 0; x < patch.getXSize(); x++)
+    for (int y = 0; y < patch.getYSize(); y++)
+      patch.cell(x, y).update(true, Point(x, y));
+
+  int copies = 20000;
+  double sum = 0;
+  double t0 = now();
+  for (int i = 0; i < copies; i++)
+  {
+    Array2D<PointAccumulator> copy(patch);
+    copy.cell(i & 31, 0).update(false, Point(0, 0));
+    sum += copy.cell(i & 31, 0).n;
+  }
+  double t = now() - t0;
+
+  printf("patch copy: %.2f us\n", 1e6 * t / copies);
+
+  EXPECT_EQ(copies, sum);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
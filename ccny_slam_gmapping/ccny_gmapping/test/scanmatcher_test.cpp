@@ -0,0 +1,238 @@
+/* Accuracy and throughput of the scan matcher shortcuts: the likelihood field
+ * of a map against the kernel search around each beam endpoint, and the beam
+ * table against the sine and cosine of each beam. */
+
+#include <gtest/gtest.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+
+#include <scanmatcher/scanmatcher.h>
+
+using namespace GMapping;
+
+static const int    BEAMS = 1081;
+static const double FOV   = 270.0 * M_PI / 180.0;
+static const int    POSES = 200;
+
+static double now()
+{
+  timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+// a 10 x 8 m room with a pillar
+static double castBeam(double x, double y, double a)
+{
+  static const double walls[8][4] =
+  {
+    {-5, -4,  5, -4}, { 5, -4,  5,  4}, { 5,  4, -5,  4}, {-5,  4, -5, -4},
+    { 1, -.5, 1.5, -.5}, {1.5, -.5, 1.5, .5}, {1.5, .5, 1, .5}, {1, .5, 1, -.5}
+  };
+
+  double dx = cos(a), dy = sin(a), range = 30.0;
+  for (int w = 0; w < 8; w++)
+  {
+    double ex = walls[w][2] - walls[w][0], ey = walls[w][3] - walls[w][1];
+    double den = dx * ey - dy * ex;
+    if (fabs(den) < 1e-12) continue;
+    double t = ((walls[w][0] - x) * ey - (walls[w][1] - y) * ex) / den;
+    double u = ((walls[w][0] - x) * dy - (walls[w][1] - y) * dx) / den;
+    if (t > 0 && u >= 0 && u <= 1 && t < range) range = t;
+  }
+  return range;
+}
+
+class ScanMatcherTest: public testing::Test
+{
+  protected:
+
+    ScanMatcherTest(): map(Point(0, 0), -6, -6, 6, 6, 0.05) {}
+
+    virtual void SetUp()
+    {
+      std::vector<double> angles(BEAMS);
+      for (int i = 0; i < BEAMS; i++)
+        angles[i] = -0.5 * FOV + FOV * i / (BEAMS - 1);
+
+      matcher.setLaserParameters(BEAMS, &angles[0], OrientedPoint(0, 0, 0));
+      matcher.setMatchingParameters(8.0, 30.0, 0.05, 1, 0.05, 0.05, 5, 0.075, 0);
+      matcher.setgenerateMap(true);
+
+      // the map of a few scans along a path
+      for (int s = 0; s < 10; s++)
+      {
+        OrientedPoint pose(-3.0 + 0.5 * s, -1.0 + 0.2 * s, 0.1 * s);
+        scan(pose, readings);
+        matcher.invalidateActiveArea();
+        matcher.registerScan(map, pose, &readings[0]);
+      }
+
+      truth = OrientedPoint(0.2, 0.4, 0.5);
+      scan(truth, readings);
+
+      srand(1);
+      for (int p = 0; p < POSES; p++)
+      {
+        OrientedPoint pose = truth;
+        pose.x     += 0.2  * (rand() / (double)RAND_MAX - 0.5);
+        pose.y     += 0.2  * (rand() / (double)RAND_MAX - 0.5);
+        pose.theta += 0.05 * (rand() / (double)RAND_MAX - 0.5);
+        poses.push_back(pose);
+      }
+    }
+
+    void scan(const OrientedPoint& pose, std::vector<double>& ranges)
+    {
+      ranges.resize(BEAMS);
+      for (int i = 0; i < BEAMS; i++)
+        ranges[i] = castBeam(pose.x, pose.y, pose.theta + matcher.laserAngles()[i]);
+    }
+
+    ScanMatcher         matcher;
+    ScanMatcherMap      map;
+    LikelihoodField     field;
+    std::vector<double> readings;
+    OrientedPoint       truth;
+    std::vector<OrientedPoint> poses;
+};
+
+TEST_F(ScanMatcherTest, likelihoodFieldAccuracy)
+{
+  double scoreError = 0, likelihoodError = 0, poseError = 0;
+
+  for (int p = 0; p < POSES; p++)
+  {
+    double s, l, fs, fl;
+    OrientedPoint corrected, fieldCorrected;
+
+    matcher.setLikelihoodField(0);
+    matcher.likelihoodAndScore(s, l, map, poses[p], &readings[0]);
+    matcher.optimize(corrected, map, poses[p], &readings[0]);
+
+    matcher.setLikelihoodField(&field);
+    matcher.likelihoodAndScore(fs, fl, map, poses[p], &readings[0]);
+    matcher.optimize(fieldCorrected, map, poses[p], &readings[0]);
+
+    scoreError      += fabs(fs - s) / s;
+    likelihoodError += fabs(fl - l) / fabs(l);
+    poseError       += hypot(fieldCorrected.x - corrected.x, fieldCorrected.y - corrected.y);
+  }
+  matcher.setLikelihoodField(0);
+
+  printf("field vs kernel: score %.2f%%, likelihood %.2f%%, optimized pose %.1f mm apart\n",
+         100 * scoreError / POSES, 100 * likelihoodError / POSES, 1000 * poseError / POSES);
+
+  EXPECT_LT(scoreError / POSES, 0.05);
+  EXPECT_LT(likelihoodError / POSES, 0.05);
+  EXPECT_LT(poseError / POSES, map.getDelta());
+}
+
+TEST_F(ScanMatcherTest, likelihoodFieldThroughput)
+{
+  OrientedPoint corrected;
+
+  double t0 = now();
+  for (int p = 0; p < POSES; p++)
+    matcher.optimize(corrected, map, poses[p], &readings[0]);
+  double kernel = now() - t0;
+
+  // the field is filled by the first optimize, as for a particle per scan
+  matcher.setLikelihoodField(&field);
+  t0 = now();
+  for (int p = 0; p < POSES; p++)
+    matcher.optimize(corrected, map, poses[p], &readings[0]);
+  double lookup = now() - t0;
+  matcher.setLikelihoodField(0);
+
+  printf("optimize: kernel %.2f ms, field %.2f ms, %.1fx\n",
+         1000 * kernel / POSES, 1000 * lookup / POSES, kernel / lookup);
+
+  EXPECT_LT(lookup, kernel);
+}
+
+TEST_F(ScanMatcherTest, beamTableAccuracy)
+{
+  ScanMatcher tableMatcher(matcher);
+  tableMatcher.updateBeamTable();
+
+  double scoreError = 0, likelihoodError = 0, poseError = 0;
+  int identical = 0;
+
+  for (int p = 0; p < POSES; p++)
+  {
+    double s, l, ts, tl;
+    OrientedPoint corrected, tableCorrected;
+
+    matcher.likelihoodAndScore(s, l, map, poses[p], &readings[0]);
+    matcher.optimize(corrected, map, poses[p], &readings[0]);
+
+    tableMatcher.likelihoodAndScore(ts, tl, map, poses[p], &readings[0]);
+    tableMatcher.optimize(tableCorrected, map, poses[p], &readings[0]);
+
+    scoreError      = std::max(scoreError, fabs(ts - s) / s);
+    likelihoodError = std::max(likelihoodError, fabs(tl - l) / fabs(l));
+    poseError       = std::max(poseError, hypot(tableCorrected.x - corrected.x, tableCorrected.y - corrected.y));
+
+    if (tableCorrected.x == corrected.x && tableCorrected.y == corrected.y &&
+        tableCorrected.theta == corrected.theta) identical++;
+  }
+
+  printf("table vs angles: score %.1e, likelihood %.1e, optimized pose %.1e m apart at most, %d of %d identical\n",
+         scoreError, likelihoodError, poseError, identical, POSES);
+
+  EXPECT_LT(scoreError, 1e-3);
+  EXPECT_LT(likelihoodError, 1e-3);
+  EXPECT_LT(poseError, 1e-9);
+}
+
+TEST_F(ScanMatcherTest, beamTableThroughput)
+{
+  ScanMatcher tableMatcher(matcher);
+  tableMatcher.updateBeamTable();
+  OrientedPoint corrected;
+
+  double t0 = now();
+  for (int p = 0; p < POSES; p++)
+    matcher.optimize(corrected, map, poses[p], &readings[0]);
+  double angles = now() - t0;
+
+  t0 = now();
+  for (int p = 0; p < POSES; p++)
+    tableMatcher.optimize(corrected, map, poses[p], &readings[0]);
+  double table = now() - t0;
+
+  // with the likelihood field, the projection is most of what is left
+  ScanMatcher fieldMatcher(matcher);
+  fieldMatcher.setLikelihoodField(&field);
+  for (int p = 0; p < POSES; p++)
+    fieldMatcher.optimize(corrected, map, poses[p], &readings[0]);
+
+  t0 = now();
+  for (int p = 0; p < POSES; p++)
+    fieldMatcher.optimize(corrected, map, poses[p], &readings[0]);
+  double fieldAngles = now() - t0;
+
+  fieldMatcher.updateBeamTable();
+  t0 = now();
+  for (int p = 0; p < POSES; p++)
+    fieldMatcher.optimize(corrected, map, poses[p], &readings[0]);
+  double fieldTable = now() - t0;
+
+  printf("optimize: angles %.2f ms, table %.2f ms, %.1fx\n",
+         1000 * angles / POSES, 1000 * table / POSES, angles / table);
+  printf("optimize with field: angles %.2f ms, table %.2f ms, %.1fx\n",
+         1000 * fieldAngles / POSES, 1000 * fieldTable / POSES, fieldAngles / fieldTable);
+
+  EXPECT_LT(table, angles);
+  EXPECT_LT(fieldTable, fieldAngles);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
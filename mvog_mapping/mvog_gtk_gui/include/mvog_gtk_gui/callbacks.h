@@ -59,6 +59,37 @@ extern "C" G_MODULE_EXPORT
 void on_btnColorByHeight_toggled (GtkToggleButton * togglebutton,
                                   GTKGui          * gui);
 
+extern "C" G_MODULE_EXPORT 
+gboolean on_txtVisCenterX_focus_out_event(GtkEntry      * entry,
+                                          GdkEventFocus * event,
+                                          GTKGui        * gui);
+
+extern "C" G_MODULE_EXPORT 
+gboolean on_txtVisCenterY_focus_out_event(GtkEntry      * entry,
+                                          GdkEventFocus * event,
+                                          GTKGui        * gui);
+
+extern "C" G_MODULE_EXPORT 
+gboolean on_txtVisSize_focus_out_event(GtkEntry      * entry,
+                                       GdkEventFocus * event,
+                                       GTKGui        * gui);
+
+extern "C" G_MODULE_EXPORT 
+void on_btnColor2DByHeight_toggled (GtkToggleButton * togglebutton,
+                                    GTKGui          * gui);
+
+extern "C" G_MODULE_EXPORT 
+void on_btnColor2DOccupancy_toggled (GtkToggleButton * togglebutton,
+                                     GTKGui          * gui);
+
+extern "C" G_MODULE_EXPORT 
+void on_txtZPlane_value_changed (GtkSpinButton * spinbutton,
+                                 GTKGui        * gui);
+
+extern "C" G_MODULE_EXPORT 
+void on_btnHighlightUnknown_toggled (GtkToggleButton * togglebutton,
+                                     GTKGui          * gui);
+
 /*
 extern "C" G_MODULE_EXPORT 
 void on_btn3DZoomOut_pressed (GtkButton *button, 
@@ -116,41 +147,6 @@ extern "C" G_MODULE_EXPORT
 void on_btnCutOffZPlane_toggled (GtkToggleButton* togglebutton,
                               	 AppData*         data);
 
-extern "C" G_MODULE_EXPORT 
-gboolean on_txtVisCenterX_focus_out_event(GtkEntry    *entry,
-                                          GdkEventFocus *event,
-                                          AppData*  data);
-
-extern "C" G_MODULE_EXPORT 
-gboolean on_txtVisCenterY_focus_out_event(GtkEntry    *entry,
-                                          GdkEventFocus *event,
-                                          AppData*  data);
-
-extern "C" G_MODULE_EXPORT 
-gboolean on_txtVisSize_focus_out_event(GtkEntry    *entry,
-                                       GdkEventFocus *event,
-                                       AppData*  data);
-
-extern "C" G_MODULE_EXPORT 
-void on_btnHighlightUnknown_toggled (GtkToggleButton* togglebutton,
-                                     AppData*         data);
-
-extern "C" G_MODULE_EXPORT 
-void on_btnDrawProbability_toggled (GtkToggleButton* togglebutton,
-                                 AppData*         data);
-
-extern "C" G_MODULE_EXPORT 
-void on_btnDrawPDensity_toggled (GtkToggleButton* togglebutton,
-                                 AppData*         data);
-
-extern "C" G_MODULE_EXPORT 
-void on_btnDrawNDensity_toggled (GtkToggleButton* togglebutton,
-                                 AppData*         data);
-
-extern "C" G_MODULE_EXPORT 
-void on_txtZPlane_value_changed (GtkSpinButton* spinbutton,
-                                 AppData*       data);
-
 extern "C" G_MODULE_EXPORT 
 void on_txtVerticalScale_value_changed (GtkSpinButton* spinbutton,
                                         AppData*       data);
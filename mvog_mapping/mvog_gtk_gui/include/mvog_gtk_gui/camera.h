@@ -38,6 +38,11 @@ class Camera
 		double getLookY() const { return look_.getY(); }
 		double getLookZ() const { return look_.getZ(); }
 
+		// the planes of the view frustum for a perspective of fovY degrees,
+		// as (a, b, c, d): a*x + b*y + c*z + d >= 0 inside each of them
+		void getFrustum(double fovY, double aspect, double zNear, double zFar,
+		                double planes[6][4]) const;
+
 		void pan(double a);
 		void tilt(double a);
 		void zoom (double r);
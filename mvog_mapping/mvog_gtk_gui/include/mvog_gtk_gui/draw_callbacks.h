@@ -21,7 +21,7 @@ namespace MVOG
 class GTKGui;
 
 extern "C" G_MODULE_EXPORT 
-gboolean on_drawArea_idle(void * data);
+gboolean on_drawArea_timeout(void * data);
 
 
 extern "C" G_MODULE_EXPORT 
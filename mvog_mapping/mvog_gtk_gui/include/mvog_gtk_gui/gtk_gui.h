@@ -20,6 +20,7 @@
 namespace MVOG 
 {
 
+class MapDrawer2D;
 class MapDrawer3D;
 
 const double PAN_SPEED  = 0.01;
@@ -27,6 +28,8 @@ const double TILT_SPEED = 0.01;
 const double ZOOM_SPEED = 0.01;
 const double MOVE_SPEED = 0.825;
 
+const double MAX_FPS = 30.0;
+
 class GTKGui
 {
   private:
@@ -79,6 +82,9 @@ class GTKGui
 	    GtkToggleButton * btnCutOffZPlane;
 
 	    GtkToggleButton * btnHighlightUnknown;
+
+      GtkToggleButton * btnColor2DByHeight;
+      GtkToggleButton * btnColor2DOccupancy;
     };
 
     struct Options
@@ -90,6 +96,10 @@ class GTKGui
       bool drawNVolumes;    
 
       bool colorByHeight;
+
+      bool color2DByHeight;   // or by occupancy at zPlane
+      double zPlane;          // m
+      bool highlightUnknown;
     };
 
     Controls controls_;
@@ -110,23 +120,36 @@ class GTKGui
 
     // **** OpenGL drawers
 
-    MapDrawer2D drawer2D_;
+    MapDrawer2D * drawer2D_;
     MapDrawer3D * drawer3D_;
 
+    // **** redraws: at most maxFps a second, and only when the map, the
+    //      camera or the options changed
+
+    double maxFps_;
+    bool optionsChanged_;
+
     void setUpGTK();
 
   public:
 
-    GTKGui();
+    GTKGui(double maxFps = MAX_FPS);
     virtual ~GTKGui();
 
     Controls * getControls() { return &controls_; }
 
     void setMap(MVOG::Map * map);
 
+    // sets up gtk and the window, and runs the gtk main loop until the
+    // window is closed or stop() is called. The gui may run on a thread
+    // of its own, as long as start() is called there: it reads the map
+    // only with the map's mutex held. Set the map before calling start().
     void start();
 
-    void setView3D(bool view3D) { options_.view3D = view3D; }
+    // ends start(); can be called from any thread
+    void stop();
+
+    void setView3D(bool view3D) { options_.view3D = view3D; optionsChanged_ = true; }
 
     void setDrawPVolumes(bool drawPVolumes);
     void setDrawNVolumes(bool drawNVolumes);
@@ -138,6 +161,18 @@ class GTKGui
     bool getDrawRawData() const;
     bool getColorByHeight() const;
 
+    void setColor2DByHeight(bool color2DByHeight);
+    void setZPlane(double zPlane);
+    void setHighlightUnknown(bool highlightUnknown);
+
+    bool getColor2DByHeight() const { return options_.color2DByHeight; }
+    double getZPlane() const { return options_.zPlane; }
+    bool getHighlightUnknown() const { return options_.highlightUnknown; }
+
+    void setVisCenterX(double x);
+    void setVisCenterY(double y);
+    void setVisSize(double size);
+
     void setCanvasWidth (double canvasWidth ) { canvasWidth_  = canvasWidth;  }
     void setCanvasHeight(double canvasHeight) { canvasHeight_ = canvasHeight; }
 
@@ -147,13 +182,14 @@ class GTKGui
     void setView();
     void updateControls();
 
+    void setFontListBase(GLuint fontListBase);
+
     void mouseDown(double x, double y, int button);
     void mouseUp  (double x, double y, int button);
     void mouseMove(double x, double y);
 
+    bool needsRedraw() const;
     void draw();
-
-    void spinOnce() {  gtk_main_iteration(); }
 };
 
 void* startGTK(void *);
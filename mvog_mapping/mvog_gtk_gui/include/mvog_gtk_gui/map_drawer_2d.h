@@ -1,18 +1,124 @@
 #ifndef MVOG_GTK_GUI_MAP_DRAWER_2D_H
 #define MVOG_GTK_GUI_MAP_DRAWER_2D_H
 
+#include <map>
+#include <vector>
+
+#include <GL/glut.h>
+
+#include <mvog_model/map.h>
+
+#include <mvog_gtk_gui/gtk_gui.h>
+
 namespace MVOG
 {
 
+class GTKGui;
+
+// **** occupancy at the z plane
+
+const unsigned char COLOR_2D_OCCUPIED[4] = {  0,   0,   0, 255};
+const unsigned char COLOR_2D_FREE[4]     = {255, 255, 255, 255};
+const unsigned char COLOR_2D_UNKNOWN[4]  = {255, 200,   0, 255};  // when highlighted
+
+// **** colored by the maximum height: blue at HEIGHT_2D_MIN, through
+//      green, to red at HEIGHT_2D_MAX
+
+const double HEIGHT_2D_MIN = 0.0;   // m
+const double HEIGHT_2D_MAX = 3.0;   // m
+
+const double VIS_SIZE = 20.0;       // m, across the shorter side of the canvas
+
 class MapDrawer2D
 {
 	private:
 
+    // **** a TILE_SIZE x TILE_SIZE RGBA texture per tile, texel (i, j)
+    //      for cell (i, j). Only the cells of a tile which changed since
+    //      the last draw, as flagged on its CHANGES_DRAW_2D channel, are
+    //      colored and uploaded again, so the cost of a frame does not
+    //      depend on the size of the map. Unknown cells are transparent
+    //      unless they are highlighted. Other options color the textures
+    //      again, but they are kept until then; a tile evicted to the
+    //      spill file is not reloaded to be drawn and keeps its texture.
+
+    struct TileTexture
+    {
+      GLuint texture;
+      bool valid;           // colored for the current options
+      bool used;            // the tile is still in the map
+    };
+
+    // keyed by the tile's position, as the tile buffers of MapDrawer3D
+    typedef std::map<std::pair<int, int>, TileTexture> TileTextureMap;
+
+    Map    * map_;
+    GTKGui * gui_;
+
+    TileTextureMap tileTextures_;
+    Map * textureMap_;          // the map and the options the textures were built for
+    bool textureByHeight_;
+    double textureZPlane_;
+    bool textureHighlight_;
+
+    std::vector<unsigned char> texels_;
+
+    // **** the view: panning and zooming only change the projection
+
+    double centerX_;            // m
+    double centerY_;
+    double visSize_;            // m, across the shorter side of the canvas
+    double viewMin_[2];         // m, the corners of the canvas
+    double viewMax_[2];
+
+    // **** the textures to draw, chosen with the map locked: drawing them
+    //      does not touch the map
+
+    std::vector<std::pair<GLuint, std::pair<int, int> > > visibleTextures_;
+    double visibleResolution_;
+
+    unsigned long drawnVersion_;  // the map's version when last drawn
+    bool viewChanged_;            // the view moved since then
+
+    void updateTileTextures();
+    void buildTexture(Tile * tile, const std::bitset<TILE_CELLS>& changed, TileTexture& tileTexture);
+    void clearTileTextures();
+
+    void selectTileTextures();
+    void drawTileTextures();
+    void drawAxes();
+
+    void getCellColor(Tile * tile, int i, int j, unsigned char color[4]);
+    void getHeightColor(double height, unsigned char color[4]);
+
 	public:
 
-		MapDrawer2D();
+		MapDrawer2D(GTKGui * gui);
 		~MapDrawer2D();
 
+    // brings the textures up to date, with the map locked only while
+    // doing so, and draws them
+    void draw();
+
+    // true if the map changed or the view moved since the last draw()
+    bool needsRedraw() const { return viewChanged_ || (map_ && map_->getVersion() != drawnVersion_); }
+
+    double getVisCenterX() const { return centerX_; }
+    double getVisCenterY() const { return centerY_; }
+    double getVisSize()    const { return visSize_; }
+
+    void setVisCenterX(double x) { centerX_ = x; viewChanged_ = true; }
+    void setVisCenterY(double y) { centerY_ = y; viewChanged_ = true; }
+    void setVisSize(double size);
+
+    // by x, y pixels of the canvas, the way the map is dragged
+    void move(double x, double y);
+    void zoom(double r);
+
+    void setView();
+    void setMap(MVOG::Map * map) { map_ = map; viewChanged_ = true; }
+
+    Map * getMap() {return map_;}
 };
 
 } // namespace MVOG
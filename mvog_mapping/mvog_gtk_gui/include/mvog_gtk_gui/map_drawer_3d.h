@@ -1,7 +1,13 @@
 #ifndef MVOG_GTK_GUI_MAP_DRAWER_3D_H
 #define MVOG_GTK_GUI_MAP_DRAWER_3D_H
 
+#define GL_GLEXT_PROTOTYPES
+
+#include <map>
+#include <vector>
+
 #include <GL/glut.h>
+#include <GL/glext.h>
 
 #include <mvog_model/map.h>
 
@@ -18,23 +24,133 @@ const double COLOR_N_VOLUMES[3]  = {0.00, 0.00, 0.75};
 const double COLOR_ML_VOLUMES[3] = {0.00, 0.75, 0.00};
 const double GRID_COLOR[3]      = {0.70, 0.70, 0.70};
 
+// **** perspective of the view, also used for culling
+
+const double CAMERA_FOV  = 45.0;  // deg, vertical
+const double CAMERA_NEAR = 0.1;   // m
+const double CAMERA_FAR  = 100.0;
+
+// **** tiles further than the LOD distance are drawn as columns of
+//      LOD_BLOCK x LOD_BLOCK cells, from the lowest to the highest volume
+
+const int    LOD_BLOCK    = 4;
+const double LOD_DISTANCE = 20.0; // m
+
+// **** what the tile buffers hold
+
+enum DrawMode
+{
+  DRAW_ML_VOLUMES = 1,
+  DRAW_P_VOLUMES  = 2,
+  DRAW_N_VOLUMES  = 4
+};
+
 class MapDrawer3D
 {
 	private:
 
+    // **** a vertex of the tile buffers, laid out for GL_C4UB_V3F
+
+    struct Vertex
+    {
+      unsigned char color[4];
+      float x, y, z;
+    };
+
+    // **** a vertex buffer: faces as GL_QUADS, followed by their edges
+    //      as GL_LINES
+
+    struct Batch
+    {
+      GLuint buffer;
+      int faceVertices;
+      int edgeVertices;
+    };
+
+    // **** the batches of a tile: every volume, and the columns drawn
+    //      from afar. The volumes are rebuilt only when the tile changed
+    //      since they were built, as flagged on the tile's CHANGES_DRAW
+    //      channel, or for another draw mode; the columns once they are
+    //      needed again. A tile evicted to the spill file is not reloaded
+    //      to be drawn: it keeps the batches it has until it is used.
+
+    struct TileBuffer
+    {
+      Tile * tile;          // the tile at this position
+      Batch volumes;
+      Batch columns;
+      bool volumesValid;
+      bool columnsValid;
+      float zMin, zMax;     // m, bounds of the volumes
+      bool used;            // the tile is still in the map
+    };
+
+    // keyed by the tile's position, (cx, cy) of its cell (0, 0) divided
+    // by TILE_SIZE, which does not change when the map's directory grows
+    typedef std::map<std::pair<int, int>, TileBuffer> TileBufferMap;
+
     Map    * map_;
     GTKGui * gui_;
 
     Camera camera_;
-    
-    void drawMLolumes();
-		void drawPVolumes();
-		void drawNVolumes();
+
+    TileBufferMap tileBuffers_;
+    Map * bufferMap_;       // the map and the mode the buffers were built for
+    int bufferMode_;
+
+    std::vector<Vertex> faces_;
+    std::vector<Vertex> edges_;
+
+    double lodDistance_;
+
+    // **** the batches to draw, chosen with the map locked: drawing them
+    //      does not touch the map
+
+    std::vector<const Batch*> visibleBatches_;
+
+    unsigned long drawnVersion_;  // the map's version when last drawn
+    bool viewChanged_;            // the camera moved since then
+
+    // **** the grid, as one batch of lines, for the map size it was
+    //      built for
+
+    GLuint gridBuffer_;
+    int gridVertices_;
+    int gridSize_[4];       // sizeX, sizeY, offsetX, offsetY
+    double gridResolution_;
+
+    // **** overlay
+
+    GLuint fontListBase_;   // 0 without a font
+
+    double lastFrameTime_;  // s
+    double frameInterval_;  // s, smoothed
+    double drawTime_;       // s, smoothed
+
+    int tilesDrawn_;
+    int tilesColumns_;
+    int tilesCulled_;
+
+    int getDrawMode() const;
+
+    void updateTileBuffers();
+    void buildVolumes(Tile * tile, int cx, int cy, TileBuffer& tileBuffer);
+    void buildColumns(Tile * tile, int cx, int cy, TileBuffer& tileBuffer);
+    void uploadBatch(Batch& batch);
+    void clearTileBuffers();
+
+    void selectTileBuffers();
+    void drawTileBuffers();
+    void drawBatch(const Batch& batch);
 
     void drawAxes();
+    void updateGrid();
     void drawGrid();
+    void drawOverlay();
 
-    void drawSolidColorVolume(double bottom, double top, const double color[3]);
+    // adds the 6 faces and 12 edges of the box over size x size cells
+    // from (cx, cy), with bottom and top in grid units
+    void addBox(int cx, int cy, int size, float bottom, float top, const double color[3]);
     void drawHeightColorVolume(double bottom, double top);
 
 	public:
@@ -42,7 +158,12 @@ class MapDrawer3D
 		MapDrawer3D(GTKGui * gui);
 		~MapDrawer3D();
 
+    // brings the vertex buffers up to date, with the map locked only
+    // while doing so, and draws them
     void draw();
+
+    // true if the map changed or the camera moved since the last draw()
+    bool needsRedraw() const { return viewChanged_ || (map_ && map_->getVersion() != drawnVersion_); }
     
     double getCameraPosX() const { return camera_.getPosX(); }
     double getCameraPosY() const { return camera_.getPosY(); }    
@@ -58,7 +179,14 @@ class MapDrawer3D
     void move(double x, double y);
 
     void setView();
-    void setMap(MVOG::Map * map) { map_ = map; }
+    void setMap(MVOG::Map * map) { map_ = map; viewChanged_ = true; }
+
+    // 0 to draw every tile at full detail
+    void setLodDistance(double lodDistance) { lodDistance_ = lodDistance; viewChanged_ = true; }
+
+    // display lists of the overlay font, for the characters 0 ... 127
+    void setFontListBase(GLuint fontListBase) { fontListBase_ = fontListBase; }
+
     Map * getMap() {return map_;}
 };
 
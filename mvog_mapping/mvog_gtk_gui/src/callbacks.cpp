@@ -17,6 +17,9 @@ extern "C" G_MODULE_EXPORT
 void on_winMain_destroy (GtkObject *object, GTKGui   * gui)
 {
   printf("Closing GTK Gui.\n");
+
+  // **** mapping goes on without the gui
+  gtk_main_quit();
 }
 
 extern "C" G_MODULE_EXPORT 
@@ -96,6 +99,75 @@ void on_btnColorByHeight_toggled (GtkToggleButton * togglebutton,
 	gui->updateControls();
 }
 
+// **** 2D *************************************************
+
+extern "C" G_MODULE_EXPORT 
+gboolean on_txtVisCenterX_focus_out_event(GtkEntry      * entry,
+                                          GdkEventFocus * event,
+                                          GTKGui        * gui)
+{
+	double val = atof(gtk_entry_get_text(entry));
+  gui->setVisCenterX(val);
+	gui->updateControls();
+	return FALSE;
+}
+
+extern "C" G_MODULE_EXPORT 
+gboolean on_txtVisCenterY_focus_out_event(GtkEntry      * entry,
+                                          GdkEventFocus * event,
+                                          GTKGui        * gui)
+{
+	double val = atof(gtk_entry_get_text(entry));
+  gui->setVisCenterY(val);
+	gui->updateControls();
+	return FALSE;
+}
+
+extern "C" G_MODULE_EXPORT 
+gboolean on_txtVisSize_focus_out_event(GtkEntry      * entry,
+                                       GdkEventFocus * event,
+                                       GTKGui        * gui)
+{
+	double val = atof(gtk_entry_get_text(entry));
+  gui->setVisSize(val);
+	gui->updateControls();
+	return FALSE;
+}
+
+extern "C" G_MODULE_EXPORT 
+void on_btnColor2DByHeight_toggled (GtkToggleButton * togglebutton,
+                                    GTKGui          * gui)
+{
+	bool val = gtk_toggle_button_get_active(togglebutton);
+  gui->setColor2DByHeight(val);
+	gui->updateControls();
+}
+
+extern "C" G_MODULE_EXPORT 
+void on_btnColor2DOccupancy_toggled (GtkToggleButton * togglebutton,
+                                     GTKGui          * gui)
+{
+	bool val = gtk_toggle_button_get_active(togglebutton);
+  gui->setColor2DByHeight(!val);
+	gui->updateControls();
+}
+
+extern "C" G_MODULE_EXPORT 
+void on_txtZPlane_value_changed (GtkSpinButton * spinbutton,
+                                 GTKGui        * gui)
+{
+	double val = gtk_spin_button_get_value(spinbutton);
+  gui->setZPlane(val);
+}
+
+extern "C" G_MODULE_EXPORT 
+void on_btnHighlightUnknown_toggled (GtkToggleButton * togglebutton,
+                                     GTKGui          * gui)
+{
+	bool val = gtk_toggle_button_get_active(togglebutton);
+  gui->setHighlightUnknown(val);
+}
+
 /*
 extern "C" G_MODULE_EXPORT 
 void on_btn3DZoomOut_pressed (GtkButton *button, 
@@ -251,110 +323,6 @@ void on_btnCutOffZPlane_toggled (GtkToggleButton* togglebutton,
 	gtk_widget_draw(data->drawArea, NULL);
 }
 
-// **** 2D *************************************************
-
-extern "C" G_MODULE_EXPORT 
-gboolean on_txtVisCenterX_focus_out_event(GtkEntry    *entry,
-                                          GdkEventFocus *event,
-                                          AppData*  data)  
-{
-	double val = atof(gtk_entry_get_text(entry));
-  
-	data->map->setVisCenterX(val);
-  
-	updateUIFromCamera(data);
-	gtk_widget_draw(data->drawArea, NULL);
-
-	return FALSE;
-}
-
-extern "C" G_MODULE_EXPORT 
-gboolean on_txtVisCenterY_focus_out_event(GtkEntry    *entry,
-                                          GdkEventFocus *event,
-                                          AppData*  data)  
-{
-	double val = atof(gtk_entry_get_text(entry));
- 
-	data->map->setVisCenterY(val);
-
-	updateUIFromCamera(data);
-	gtk_widget_draw(data->drawArea, NULL);
-
-	return FALSE;
-}
-
-extern "C" G_MODULE_EXPORT 
-gboolean on_txtVisSize_focus_out_event(GtkEntry    *entry,
-                                       GdkEventFocus *event,
-                                       AppData*  data)  
-{
-	double val = atof(gtk_entry_get_text(entry));
-
-	data->map->setVisSize(val); 
-
-	updateUIFromCamera(data);
-	gtk_widget_draw(data->drawArea, NULL);
-
-	return FALSE;
-}
-
-extern "C" G_MODULE_EXPORT 
-void on_btnHighlightUnknown_toggled (GtkToggleButton* togglebutton,
-                                     AppData*         data) 
-{
-	bool val = gtk_toggle_button_get_active(togglebutton);
-
-	data->map->setHighlightUnknown(val);
- 
-	gtk_widget_draw(data->drawArea, NULL);
-}
-
-extern "C" G_MODULE_EXPORT 
-void on_btnDrawProbability_toggled (GtkToggleButton* togglebutton,
-                                 AppData*         data)
-{
-	bool val = gtk_toggle_button_get_active(togglebutton);
-
-	data->map->setDrawProbability(val);
-
-	gtk_widget_draw(data->drawArea, NULL);
-}
-
-extern "C" G_MODULE_EXPORT 
-void on_btnDrawPDensity_toggled (GtkToggleButton* togglebutton,
-                                 AppData*         data)
-{
-	bool val = gtk_toggle_button_get_active(togglebutton);
-
-	data->map->setDrawPDensity(val);
- 
-	gtk_widget_draw(data->drawArea, NULL);
-}
-
-extern "C" G_MODULE_EXPORT 
-void on_btnDrawNDensity_toggled (GtkToggleButton* togglebutton,
-                                 AppData*         data)
-{
-	bool val = gtk_toggle_button_get_active(togglebutton);
-  
-	data->map->setDrawNDensity(val);
- 
-	gtk_widget_draw(data->drawArea, NULL);
-}
-
-
-extern "C" G_MODULE_EXPORT 
-void on_txtZPlane_value_changed (GtkSpinButton* spinbutton,
-                                 AppData*       data)
-{
-	double val = gtk_spin_button_get_value(spinbutton);
-  
-	data->map->setZPlane(val);
-  
-	updateUIFromMap(data);
-	gtk_widget_draw(data->drawArea, NULL);
-}
-
 extern "C" G_MODULE_EXPORT 
 void on_txtVerticalScale_value_changed (GtkSpinButton* spinbutton,
                                         AppData*       data)
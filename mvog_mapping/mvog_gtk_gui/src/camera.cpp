@@ -37,6 +37,45 @@ void Camera::updateLook()
 	look_.setZ(lookR_ * sin(lookTheta_)               + pos_.getZ());
 }
 
+void Camera::getFrustum(double fovY, double aspect, double zNear, double zFar,
+                        double planes[6][4]) const
+{
+  // **** camera axes, with z up as in gluLookAt
+
+  btVector3 f = look_ - pos_;
+  f.normalize();
+
+  btVector3 r = f.cross(btVector3(0.0, 0.0, 1.0));
+  r.normalize();
+
+  btVector3 u = r.cross(f);
+
+  // **** a direction f + a*r + b*u is inside if |a| <= tanX and |b| <= tanY
+
+  double tanY = tan(fovY * 0.5 * DEG_TO_RAD);
+  double tanX = tanY * aspect;
+
+  btVector3 normals[6] = 
+  {
+    f, -f,                          // near, far
+    r + f * tanX, -r + f * tanX,    // left, right
+    u + f * tanY, -u + f * tanY     // bottom, top
+  };
+
+  btVector3 points[6] = 
+  {
+    pos_ + f * zNear, pos_ + f * zFar, pos_, pos_, pos_, pos_
+  };
+
+  for (int p = 0; p < 6; p++)
+  {
+    planes[p][0] = normals[p].getX();
+    planes[p][1] = normals[p].getY();
+    planes[p][2] = normals[p].getZ();
+    planes[p][3] = -normals[p].dot(points[p]);
+  }
+}
+
 void Camera::pan(double a)
 {
 	lookPhi_ += a;
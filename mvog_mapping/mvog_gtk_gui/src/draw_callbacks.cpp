@@ -11,12 +11,15 @@ namespace MVOG
 {
 
 extern "C" G_MODULE_EXPORT 
-gboolean on_drawArea_idle(void * data)
+gboolean on_drawArea_timeout(void * data)
 {
 	GTKGui * gui = static_cast<GTKGui*>(data);
 
   if (!GTK_IS_WIDGET(gui->getControls()->drawArea)) return TRUE;
 
+  // **** nothing new to show
+  if (!gui->needsRedraw()) return TRUE;
+
   gtk_widget_draw(gui->getControls()->drawArea, NULL);
 
   return TRUE;
@@ -41,6 +44,17 @@ void on_drawArea_realize (GtkWidget *widget,
 	// hidden surface
 	glEnable(GL_DEPTH_TEST);
 
+  // font of the frame time overlay
+  GLuint fontListBase = glGenLists(128);
+  PangoFontDescription * fontDesc = pango_font_description_from_string("Monospace 9");
+
+  if (gdk_gl_font_use_pango_font(fontDesc, 0, 128, fontListBase))
+    gui->setFontListBase(fontListBase);
+  else
+    printf("cannot load the overlay font\n");
+
+  pango_font_description_free(fontDesc);
+
 	gdk_gl_drawable_gl_end (gldrawable);
 }
 
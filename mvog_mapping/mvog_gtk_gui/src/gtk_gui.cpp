@@ -3,7 +3,7 @@
 namespace MVOG
 {
 
-GTKGui::GTKGui()
+GTKGui::GTKGui(double maxFps)
 {
   options_.view3D = true;
   options_.drawPVolumes = false;
@@ -11,13 +11,24 @@ GTKGui::GTKGui()
   options_.drawRawData = false;
   options_.colorByHeight = true;
 
+  options_.color2DByHeight  = true;
+  options_.zPlane           = 1.0;
+  options_.highlightUnknown = false;
+
   mouseLeftIsDown_  = false;
   mouseMidIsDown_   = false;
   mouseRightIsDown_ = false;
 
+  maxFps_         = maxFps;
+  optionsChanged_ = true;
+
+  drawer2D_ = new MapDrawer2D(this);
   drawer3D_ = new MapDrawer3D(this);
 
-  setUpGTK();
+  // **** stop() may be called from another thread; gtk itself is set up
+  //      by start(), on the thread which runs the main loop
+
+  if (!g_thread_supported()) g_thread_init(NULL);
 }
 
 GTKGui::~GTKGui()
@@ -68,6 +79,22 @@ void GTKGui::updateControls()
     gtk_widget_hide(controls_.frame3DOtherOptions);
   }
 
+  // **** 2D view options
+
+  gtk_toggle_button_set_active(controls_.btnColor2DByHeight,   options_.color2DByHeight);
+  gtk_toggle_button_set_active(controls_.btnColor2DOccupancy, !options_.color2DByHeight);
+  gtk_toggle_button_set_active(controls_.btnHighlightUnknown,  options_.highlightUnknown);
+  gtk_spin_button_set_value(controls_.txtZPlane, options_.zPlane);
+
+  sprintf(s, "%3.1f", drawer2D_->getVisCenterX());
+  gtk_entry_set_text(controls_.txtVisCenterX, s);
+
+  sprintf(s, "%3.1f", drawer2D_->getVisCenterY());
+  gtk_entry_set_text(controls_.txtVisCenterY, s);
+
+  sprintf(s, "%3.1f", drawer2D_->getVisSize());
+  gtk_entry_set_text(controls_.txtVisSize, s);
+
 	// update camera Position text fields
 	sprintf(s, "%3.2f", drawer3D_->getCameraPosX());
 	gtk_entry_set_text(controls_.txtCamPosX, s);
@@ -95,22 +122,61 @@ void GTKGui::updateControls()
 void GTKGui::setDrawPVolumes(bool drawPVolumes) 
 {
   options_.drawPVolumes = drawPVolumes; 
+  optionsChanged_ = true;
 }
 
 void GTKGui::setDrawNVolumes(bool drawNVolumes) 
 {
   options_.drawNVolumes = drawNVolumes; 
+  optionsChanged_ = true;
 }
 
 void GTKGui::setDrawRawData(bool drawRawData) 
 {
   options_.drawRawData = drawRawData; 
+  optionsChanged_ = true;
+
+  boost::mutex::scoped_lock lock(drawer3D_->getMap()->mutex_);
   drawer3D_->getMap()->validate();
 }
 
 void GTKGui::setColorByHeight(bool colorByHeight) 
 {
   options_.colorByHeight = colorByHeight; 
+  optionsChanged_ = true;
+}
+
+void GTKGui::setColor2DByHeight(bool color2DByHeight)
+{
+  options_.color2DByHeight = color2DByHeight;
+  optionsChanged_ = true;
+}
+
+void GTKGui::setZPlane(double zPlane)
+{
+  options_.zPlane = zPlane;
+  optionsChanged_ = true;
+}
+
+void GTKGui::setHighlightUnknown(bool highlightUnknown)
+{
+  options_.highlightUnknown = highlightUnknown;
+  optionsChanged_ = true;
+}
+
+void GTKGui::setVisCenterX(double x)
+{
+  drawer2D_->setVisCenterX(x);
+}
+
+void GTKGui::setVisCenterY(double y)
+{
+  drawer2D_->setVisCenterY(y);
+}
+
+void GTKGui::setVisSize(double size)
+{
+  drawer2D_->setVisSize(size);
 }
 
 bool GTKGui::getDrawPVolumes() const 
@@ -171,7 +237,16 @@ void GTKGui::mouseMove(double x, double y)
   }
   else
   {
-
+    if (mouseLeftIsDown_)
+    {
+      drawer2D_->move(mouseX_ - x, y - mouseY_);
+      updateControls();
+    }
+    else if (mouseRightIsDown_)
+    {
+      drawer2D_->zoom(1.0 - (mouseY_ - y) * ZOOM_SPEED);
+      updateControls();
+    }
   }
 
   mouseX_ = x;
@@ -180,21 +255,36 @@ void GTKGui::mouseMove(double x, double y)
 
 void GTKGui::setMap(MVOG::Map * map)
 {
-  //drawer2D_.setMap(map);
+  drawer2D_->setMap(map);
   drawer3D_->setMap(map);
 }
 
 
+void GTKGui::setFontListBase(GLuint fontListBase)
+{
+  drawer3D_->setFontListBase(fontListBase);
+}
+
 void GTKGui::setView()
 {
   if (options_.view3D) drawer3D_->setView();
- // else                 drawer2D_.setView();
+  else                 drawer2D_->setView();
+}
+
+bool GTKGui::needsRedraw() const
+{
+  if (optionsChanged_) return true;
+
+  if (options_.view3D) return drawer3D_->needsRedraw();
+  else                 return drawer2D_->needsRedraw();
 }
 
 void GTKGui::draw()
 {
+  optionsChanged_ = false;
+
   if (options_.view3D) drawer3D_->draw();
- // else                 drawer2D_.draw();
+  else                 drawer2D_->draw();
 }
 
 void GTKGui::setUpGTK()
@@ -283,6 +373,9 @@ void GTKGui::setUpGTK()
   controls_.txtVisCenterY = GTK_ENTRY(gtk_builder_get_object(builder, "txtVisCenterY"));
   controls_.txtVisSize    = GTK_ENTRY(gtk_builder_get_object(builder, "txtVisSize"));
 
+  controls_.btnColor2DByHeight  = GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "btnColor2DByHeight"));
+  controls_.btnColor2DOccupancy = GTK_TOGGLE_BUTTON(gtk_builder_get_object(builder, "btnColor2DOccupancy"));
+
   // Connect signals
   gtk_builder_connect_signals(builder, this);
 
@@ -292,8 +385,8 @@ void GTKGui::setUpGTK()
   // Add OpenGL-capability to drawArea.
   gtk_widget_set_gl_capability (controls_.drawArea, glconfig, NULL, TRUE, GDK_GL_RGBA_TYPE);
 
-	// Register idle function
-	g_idle_add (on_drawArea_idle, this);
+  // Redraw when needed, at most maxFps_ times a second
+  g_timeout_add ((guint)(1000.0 / maxFps_), on_drawArea_timeout, this);
 
   // Destroy builder, since we don't need it anymore
   g_object_unref( G_OBJECT( builder ) );
@@ -304,8 +397,21 @@ void GTKGui::setUpGTK()
 
 void GTKGui::start()
 {
+  setUpGTK();
   gtk_main();
 }
 
+static gboolean quitMainLoop(void * data)
+{
+  gtk_main_quit();
+  return FALSE;
+}
+
+void GTKGui::stop()
+{
+  // **** gtk must only be used from the thread running the main loop
+  g_idle_add(quitMainLoop, NULL);
+}
+
 } // namespace MVOG
 
@@ -1,16 +1,378 @@
 #include <mvog_gtk_gui/map_drawer_2d.h>
 
+#include <cstring>
+
 namespace MVOG
 {
 
-MapDrawer2D::MapDrawer2D()
+MapDrawer2D::MapDrawer2D(GTKGui * gui)
 {
+  gui_ = gui;
+  map_ = NULL;
+
+  textureMap_       = NULL;
+  textureByHeight_  = true;
+  textureZPlane_    = 0.0;
+  textureHighlight_ = false;
+
+  centerX_ = 0.0;
+  centerY_ = 0.0;
+  visSize_ = VIS_SIZE;
+  memset(viewMin_, 0, sizeof(viewMin_));
+  memset(viewMax_, 0, sizeof(viewMax_));
+
+  visibleResolution_ = 0.0;
 
+  drawnVersion_ = 0;
+  viewChanged_  = true;
 }
 
 MapDrawer2D::~MapDrawer2D()
 {
-	
+	clearTileTextures();
+}
+
+void MapDrawer2D::draw()
+{
+  setView();
+
+  {
+    // **** the map is changed by the mapper thread: hold it only while
+    //      coloring the changed cells, not while drawing
+
+    boost::mutex::scoped_lock lock(map_->mutex_);
+
+    drawnVersion_ = map_->getVersion();
+    viewChanged_  = false;
+
+    updateTileTextures();
+    selectTileTextures();
+  }
+
+  glDisable(GL_DEPTH_TEST);
+
+  drawTileTextures();
+  drawAxes();
+
+  glEnable(GL_DEPTH_TEST);
+}
+
+void MapDrawer2D::updateTileTextures()
+{
+  bool   byHeight  = gui_->getColor2DByHeight();
+  double zPlane    = gui_->getZPlane();
+  bool   highlight = gui_->getHighlightUnknown();
+
+  if (map_ != textureMap_)
+  {
+    clearTileTextures();
+
+    textureMap_ = map_;
+  }
+
+  // **** other options: the textures are colored again, but kept until then
+
+  if (byHeight != textureByHeight_ || zPlane != textureZPlane_ || highlight != textureHighlight_)
+  {
+    for (TileTextureMap::iterator it = tileTextures_.begin(); it != tileTextures_.end(); ++it)
+      it->second.valid = false;
+
+    textureByHeight_  = byHeight;
+    textureZPlane_    = zPlane;
+    textureHighlight_ = highlight;
+  }
+
+  for (TileTextureMap::iterator it = tileTextures_.begin(); it != tileTextures_.end(); ++it)
+    it->second.used = false;
+
+  std::bitset<TILE_CELLS> changed;
+
+  for (int tx = 0; tx < map_->getTilesX(); ++tx)
+  for (int ty = 0; ty < map_->getTilesY(); ++ty)
+  {
+    Tile * tile = map_->getTile(tx, ty);
+    if (!tile) continue;
+
+    int cx = tx * TILE_SIZE - map_->getOffsetX();
+    int cy = ty * TILE_SIZE - map_->getOffsetY();
+
+    std::pair<int, int> key(cx / TILE_SIZE, cy / TILE_SIZE);
+
+    TileTextureMap::iterator it = tileTextures_.find(key);
+
+    if (it == tileTextures_.end())
+    {
+      TileTexture tileTexture;
+      memset(&tileTexture, 0, sizeof(tileTexture));
+
+      it = tileTextures_.insert(std::make_pair(key, tileTexture)).first;
+    }
+
+    TileTexture& tileTexture = it->second;
+    tileTexture.used = true;
+
+    if (tileTexture.valid && !tile->hasChangedCells(CHANGES_DRAW_2D)) continue;
+    if (isSpilled(tile)) continue;
+
+    tile->takeChangedCells(CHANGES_DRAW_2D, changed);
+
+    // **** a new texture, or one for other options, is colored all over
+
+    if (!tileTexture.valid) changed.set();
+
+    buildTexture(tile, changed, tileTexture);
+  }
+
+  // **** tiles which left the map, e.g. when a snapshot was loaded
+
+  for (TileTextureMap::iterator it = tileTextures_.begin(); it != tileTextures_.end(); )
+  {
+    if (it->second.used)
+    {
+      ++it;
+      continue;
+    }
+
+    glDeleteTextures(1, &it->second.texture);
+    tileTextures_.erase(it++);
+  }
+}
+
+void MapDrawer2D::buildTexture(Tile * tile, const std::bitset<TILE_CELLS>& changed, TileTexture& tileTexture)
+{
+  if (!tileTexture.texture)
+  {
+    glGenTextures(1, &tileTexture.texture);
+    glBindTexture(GL_TEXTURE_2D, tileTexture.texture);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TILE_SIZE, TILE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  }
+
+  tileTexture.valid = true;
+
+  // **** bounding box of the changed cells
+
+  int minI = TILE_SIZE, maxI = -1;
+  int minJ = TILE_SIZE, maxJ = -1;
+
+  for (int c = 0; c < TILE_CELLS; ++c)
+  {
+    if (!changed.test(c)) continue;
+
+    minI = std::min(minI, c / TILE_SIZE);
+    maxI = std::max(maxI, c / TILE_SIZE);
+    minJ = std::min(minJ, c % TILE_SIZE);
+    maxJ = std::max(maxJ, c % TILE_SIZE);
+  }
+
+  if (maxI < 0) return;
+
+  // **** the texels of the box, row by row
+
+  int sizeI = maxI - minI + 1;
+  int sizeJ = maxJ - minJ + 1;
+
+  texels_.resize(sizeI * sizeJ * 4);
+
+  for (int j = minJ; j <= maxJ; ++j)
+  for (int i = minI; i <= maxI; ++i)
+    getCellColor(tile, i, j, &texels_[((j - minJ) * sizeI + (i - minI)) * 4]);
+
+  glBindTexture(GL_TEXTURE_2D, tileTexture.texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, minI, minJ, sizeI, sizeJ, GL_RGBA, GL_UNSIGNED_BYTE, &texels_[0]);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void MapDrawer2D::getCellColor(Tile * tile, int i, int j, unsigned char color[4])
+{
+  const unsigned char * cellColor = COLOR_2D_UNKNOWN;
+
+  int count;
+  const MLVolume * mlVolumes = tile->getMLVolumes(i, j, count);
+
+  if (textureByHeight_)
+  {
+    if (count)
+    {
+      getHeightColor(mlVolumes[count - 1].top * map_->getResolution(), color);
+      return;
+    }
+  }
+  else
+  {
+    // **** as GridExporter, for a band of zero height
+
+    float z = textureZPlane_ / map_->getResolution();
+
+    for (int v = 0; v < count && cellColor == COLOR_2D_UNKNOWN; ++v)
+      if (mlVolumes[v].bot <= z && mlVolumes[v].top >= z) cellColor = COLOR_2D_OCCUPIED;
+
+    if (cellColor == COLOR_2D_UNKNOWN)
+    {
+      int nCount;
+      const Volume * nVolumes = tile->getNVolumes(i, j, nCount);
+
+      for (int v = 0; v < nCount && cellColor == COLOR_2D_UNKNOWN; ++v)
+        if (getBot(nVolumes[v]) <= z && getTop(nVolumes[v]) >= z) cellColor = COLOR_2D_FREE;
+    }
+  }
+
+  memcpy(color, cellColor, 4);
+
+  if (cellColor == COLOR_2D_UNKNOWN && !textureHighlight_) color[3] = 0;
+}
+
+void MapDrawer2D::getHeightColor(double height, unsigned char color[4])
+{
+  // **** blue - cyan - green - yellow - red
+
+  double h = (height - HEIGHT_2D_MIN) / (HEIGHT_2D_MAX - HEIGHT_2D_MIN);
+  h = std::max(0.0, std::min(1.0, h)) * 4.0;
+
+  double r = 0.0, g = 0.0, b = 0.0;
+
+  if      (h < 1.0) { g = h;       b = 1.0;     }
+  else if (h < 2.0) { g = 1.0;     b = 2.0 - h; }
+  else if (h < 3.0) { r = h - 2.0; g = 1.0;     }
+  else              { r = 1.0;     g = 4.0 - h; }
+
+  color[0] = r * 255.0;
+  color[1] = g * 255.0;
+  color[2] = b * 255.0;
+  color[3] = 255;
+}
+
+void MapDrawer2D::clearTileTextures()
+{
+  for (TileTextureMap::iterator it = tileTextures_.begin(); it != tileTextures_.end(); ++it)
+    glDeleteTextures(1, &it->second.texture);
+
+  tileTextures_.clear();
+}
+
+void MapDrawer2D::selectTileTextures()
+{
+  visibleResolution_ = map_->getResolution();
+
+  double tileSize = TILE_SIZE * visibleResolution_;
+
+  visibleTextures_.clear();
+
+  for (TileTextureMap::iterator it = tileTextures_.begin(); it != tileTextures_.end(); ++it)
+  {
+    double minX = it->first.first  * tileSize;
+    double minY = it->first.second * tileSize;
+
+    if (minX > viewMax_[0] || minX + tileSize < viewMin_[0] ||
+        minY > viewMax_[1] || minY + tileSize < viewMin_[1]) continue;
+
+    // an evicted tile which was never drawn
+    if (!it->second.texture) continue;
+
+    visibleTextures_.push_back(std::make_pair(it->second.texture, it->first));
+  }
+}
+
+void MapDrawer2D::drawTileTextures()
+{
+  double tileSize = TILE_SIZE * visibleResolution_;
+
+  glEnable(GL_TEXTURE_2D);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  for (size_t t = 0; t < visibleTextures_.size(); ++t)
+  {
+    double x = visibleTextures_[t].second.first  * tileSize;
+    double y = visibleTextures_[t].second.second * tileSize;
+
+    glBindTexture(GL_TEXTURE_2D, visibleTextures_[t].first);
+
+    glBegin(GL_QUADS);
+      glTexCoord2d(0.0, 0.0); glVertex2d(x,            y);
+      glTexCoord2d(1.0, 0.0); glVertex2d(x + tileSize, y);
+      glTexCoord2d(1.0, 1.0); glVertex2d(x + tileSize, y + tileSize);
+      glTexCoord2d(0.0, 1.0); glVertex2d(x,            y + tileSize);
+    glEnd();
+  }
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glDisable(GL_BLEND);
+  glDisable(GL_TEXTURE_2D);
+}
+
+void MapDrawer2D::drawAxes()
+{
+  glLineWidth(2.0);
+
+  glColor3d(1.0, 0.0, 0.0);
+  glBegin(GL_LINES);
+    glVertex2d(0.0, 0.0);
+    glVertex2d(1.0, 0.0);
+  glEnd();
+
+  glColor3d(0.0, 1.0, 0.0);
+  glBegin(GL_LINES);
+    glVertex2d(0.0, 0.0);
+    glVertex2d(0.0, 1.0);
+  glEnd();
+
+  glLineWidth(1.0);
+}
+
+void MapDrawer2D::setView()
+{
+  double width  = gui_->getCanvasWidth();
+  double height = gui_->getCanvasHeight();
+
+  // **** visSize_ across the shorter side
+
+  double metersPerPixel = visSize_ / std::min(width, height);
+
+  viewMin_[0] = centerX_ - 0.5 * width  * metersPerPixel;
+  viewMax_[0] = centerX_ + 0.5 * width  * metersPerPixel;
+  viewMin_[1] = centerY_ - 0.5 * height * metersPerPixel;
+  viewMax_[1] = centerY_ + 0.5 * height * metersPerPixel;
+
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+
+  glViewport(0, 0, width, height);
+
+  glOrtho(viewMin_[0], viewMax_[0], viewMin_[1], viewMax_[1], -1.0, 1.0);
+
+  glMatrixMode(GL_MODELVIEW);
+  glLoadIdentity();
+}
+
+void MapDrawer2D::setVisSize(double size)
+{
+  visSize_ = std::max(size, 0.1);
+  viewChanged_ = true;
+}
+
+void MapDrawer2D::move(double x, double y)
+{
+  double metersPerPixel = visSize_ / std::min(gui_->getCanvasWidth(), gui_->getCanvasHeight());
+
+  centerX_ += x * metersPerPixel;
+  centerY_ += y * metersPerPixel;
+
+  viewChanged_ = true;
+}
+
+void MapDrawer2D::zoom(double r)
+{
+  setVisSize(visSize_ * r);
 }
 
 } // namespace MVOG
@@ -1,88 +1,499 @@
 #include <mvog_gtk_gui/map_drawer_3d.h>
 
+#include <cstring>
+#include <limits>
+#include <sys/time.h>
+
 namespace MVOG
 {
 
+static double getTime()
+{
+  timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
 MapDrawer3D::MapDrawer3D(GTKGui * gui)
 {
   gui_ = gui;
+  map_ = NULL;
+
+  bufferMap_  = NULL;
+  bufferMode_ = 0;
+
+  lodDistance_ = LOD_DISTANCE;
+
+  gridBuffer_     = 0;
+  gridVertices_   = 0;
+  gridResolution_ = 0.0;
+  memset(gridSize_, 0, sizeof(gridSize_));
+
+  drawnVersion_ = 0;
+  viewChanged_  = true;
+
+  fontListBase_ = 0;
+
+  lastFrameTime_ = 0.0;
+  frameInterval_ = 0.0;
+  drawTime_      = 0.0;
+
+  tilesDrawn_   = 0;
+  tilesColumns_ = 0;
+  tilesCulled_  = 0;
 }
 
 MapDrawer3D::~MapDrawer3D()
 {
-	
+	clearTileBuffers();
+  glDeleteBuffers(1, &gridBuffer_);
 }
 
 void MapDrawer3D::draw()
 {  
+  double start = getTime();
+
   setView();
 
+  {
+    // **** the map is changed by the mapper thread: hold it only while
+    //      copying the changed tiles into buffers, not while drawing
+
+    boost::mutex::scoped_lock lock(map_->mutex_);
+
+    drawnVersion_ = map_->getVersion();
+    viewChanged_  = false;
+
+    updateGrid();
+    updateTileBuffers();
+    selectTileBuffers();
+  }
+
   drawGrid();
   drawAxes();
+  drawTileBuffers();
+  drawOverlay();
+
+  // **** smoothed over the last few frames
+
+  double end = getTime();
+
+  if (lastFrameTime_ > 0.0)
+    frameInterval_ = 0.9 * frameInterval_ + 0.1 * (end - lastFrameTime_);
+
+  drawTime_ = 0.9 * drawTime_ + 0.1 * (end - start);
+  lastFrameTime_ = end;
+}
+
+int MapDrawer3D::getDrawMode() const
+{
+  if (!gui_->getDrawRawData()) return DRAW_ML_VOLUMES;
 
-  if (gui_->getDrawRawData())
+  int mode = 0;
+  if (gui_->getDrawPVolumes()) mode |= DRAW_P_VOLUMES;
+  if (gui_->getDrawNVolumes()) mode |= DRAW_N_VOLUMES;
+  return mode;
+}
+
+void MapDrawer3D::updateTileBuffers()
+{
+  int mode = getDrawMode();
+
+  if (map_ != bufferMap_)
+  {
+    clearTileBuffers();
+
+    bufferMap_  = map_;
+    bufferMode_ = mode;
+  }
+
+  // **** another mode: the buffers are rebuilt, but kept until then
+
+  if (mode != bufferMode_)
   {
-    if (gui_->getDrawPVolumes()) drawPVolumes();
-    if (gui_->getDrawNVolumes()) drawNVolumes();
+    for (TileBufferMap::iterator it = tileBuffers_.begin(); it != tileBuffers_.end(); ++it)
+    {
+      it->second.volumesValid = false;
+      it->second.columnsValid = false;
+    }
+
+    bufferMode_ = mode;
   }
-  else
+
+  for (TileBufferMap::iterator it = tileBuffers_.begin(); it != tileBuffers_.end(); ++it)
+    it->second.used = false;
+
+  std::bitset<TILE_CELLS> changed;
+
+  for (int tx = 0; tx < map_->getTilesX(); ++tx)
+  for (int ty = 0; ty < map_->getTilesY(); ++ty)
   {
-    drawMLolumes();
+    Tile * tile = map_->getTile(tx, ty);
+    if (!tile) continue;
+
+    int cx = tx * TILE_SIZE - map_->getOffsetX();
+    int cy = ty * TILE_SIZE - map_->getOffsetY();
+
+    TileBufferMap::iterator it = tileBuffers_.find(std::make_pair(cx / TILE_SIZE, cy / TILE_SIZE));
+
+    if (it == tileBuffers_.end())
+    {
+      TileBuffer tileBuffer;
+      memset(&tileBuffer, 0, sizeof(tileBuffer));
+
+      it = tileBuffers_.insert(std::make_pair(std::make_pair(cx / TILE_SIZE, cy / TILE_SIZE), tileBuffer)).first;
+    }
+
+    TileBuffer& tileBuffer = it->second;
+    tileBuffer.used = true;
+    tileBuffer.tile = tile;
+
+    if (tileBuffer.volumesValid && !tile->hasChangedCells(CHANGES_DRAW)) continue;
+    if (isSpilled(tile)) continue;
+
+    tile->takeChangedCells(CHANGES_DRAW, changed);
+    buildVolumes(tile, cx, cy, tileBuffer);
+  }
+
+  // **** tiles which left the map, e.g. when a snapshot was loaded
+
+  for (TileBufferMap::iterator it = tileBuffers_.begin(); it != tileBuffers_.end(); )
+  {
+    if (it->second.used)
+    {
+      ++it;
+      continue;
+    }
+
+    glDeleteBuffers(1, &it->second.volumes.buffer);
+    glDeleteBuffers(1, &it->second.columns.buffer);
+    tileBuffers_.erase(it++);
   }
 }
 
-void MapDrawer3D::drawMLolumes()
+void MapDrawer3D::buildVolumes(Tile * tile, int cx, int cy, TileBuffer& tileBuffer)
 {
+  faces_.clear();
+  edges_.clear();
+
+  // **** one kind of volumes after the other, in the order they were
+  //      drawn before: faces shared by neighbouring cells go to the first
+
+  if (bufferMode_ & DRAW_ML_VOLUMES)
+  {
+    for (int i = 0; i < TILE_SIZE; ++i)
+    for (int j = 0; j < TILE_SIZE; ++j)
+    {
+      int count;
+      const MLVolume * mlVolumes = tile->getMLVolumes(i, j, count);
+
+      for (int v = 0; v < count; ++v)
+        addBox(cx + i, cy + j, 1, mlVolumes[v].bot, mlVolumes[v].top, COLOR_ML_VOLUMES);
+    }
+  }
+
+  for (int positive = 1; positive >= 0; --positive)
+  {
+    if (!(bufferMode_ & (positive ? DRAW_P_VOLUMES : DRAW_N_VOLUMES))) continue;
+
+    for (int i = 0; i < TILE_SIZE; ++i)
+    for (int j = 0; j < TILE_SIZE; ++j)
+    {
+      int count;
+      const Volume * volumes = positive ? tile->getPVolumes(i, j, count) : tile->getNVolumes(i, j, count);
 
-  for (int i = 0; i < map_->sizeX_; ++i)
-  for (int j = 0; j < map_->sizeY_; ++j)
+      for (int v = 0; v < count; ++v)
+        addBox(cx + i, cy + j, 1, getBot(volumes[v]), getTop(volumes[v]), 
+               positive ? COLOR_P_VOLUMES : COLOR_N_VOLUMES);
+    }
+  }
+
+  // **** z bounds, for culling
+
+  tileBuffer.zMin =  std::numeric_limits<float>::max();
+  tileBuffer.zMax = -std::numeric_limits<float>::max();
+
+  for (size_t v = 0; v < faces_.size(); ++v)
   {
-    MLVolumeVector vect;
-    map_->grid_[i][j].createMLVolumes(vect);
+    tileBuffer.zMin = std::min(tileBuffer.zMin, faces_[v].z);
+    tileBuffer.zMax = std::max(tileBuffer.zMax, faces_[v].z);
+  }
 
-    double x = i - map_->offsetX_;
-    double y = j - map_->offsetY_;
+  tileBuffer.volumesValid = true;
+  tileBuffer.columnsValid = false;
 
-		glPushMatrix();
+  uploadBatch(tileBuffer.volumes);
+}
+
+void MapDrawer3D::buildColumns(Tile * tile, int cx, int cy, TileBuffer& tileBuffer)
+{
+  faces_.clear();
+  edges_.clear();
 
-    glScalef(map_->resolution_, map_->resolution_, map_->resolution_);
-		glTranslatef(x, y, 0.0);
+  const int kinds[3] = {DRAW_ML_VOLUMES, DRAW_P_VOLUMES, DRAW_N_VOLUMES};
 
-    for (size_t c = 0; c < vect.size(); ++c)
+  for (int k = 0; k < 3; ++k)
+  {
+    if (!(bufferMode_ & kinds[k])) continue;
+
+    for (int bi = 0; bi < TILE_SIZE; bi += LOD_BLOCK)
+    for (int bj = 0; bj < TILE_SIZE; bj += LOD_BLOCK)
     {
-      drawSolidColorVolume(vect[c].top, vect[c].bot, COLOR_ML_VOLUMES);  
+      // **** the lowest bottom and highest top in the block: the lists
+      //      are sorted, so only their ends are needed
+
+      float bottom =  std::numeric_limits<float>::max();
+      float top    = -std::numeric_limits<float>::max();
+
+      for (int i = bi; i < bi + LOD_BLOCK; ++i)
+      for (int j = bj; j < bj + LOD_BLOCK; ++j)
+      {
+        int count;
+
+        if (kinds[k] == DRAW_ML_VOLUMES)
+        {
+          const MLVolume * mlVolumes = tile->getMLVolumes(i, j, count);
+          if (!count) continue;
+
+          bottom = std::min(bottom, mlVolumes[0].bot);
+          top    = std::max(top,    mlVolumes[count - 1].top);
+        }
+        else
+        {
+          const Volume * volumes = kinds[k] == DRAW_P_VOLUMES ? tile->getPVolumes(i, j, count) : 
+                                                                tile->getNVolumes(i, j, count);
+          if (!count) continue;
+
+          bottom = std::min(bottom, getBot(volumes[0]));
+          top    = std::max(top,    getTop(volumes[count - 1]));
+        }
+      }
+
+      if (bottom > top) continue;
+
+      const double * color = kinds[k] == DRAW_ML_VOLUMES ? COLOR_ML_VOLUMES :
+                             kinds[k] == DRAW_P_VOLUMES  ? COLOR_P_VOLUMES : COLOR_N_VOLUMES;
+
+      addBox(cx + bi, cy + bj, LOD_BLOCK, bottom, top, color);
     }
+  }
+
+  tileBuffer.columnsValid = true;
+
+  uploadBatch(tileBuffer.columns);
+}
+
+void MapDrawer3D::uploadBatch(Batch& batch)
+{
+  batch.faceVertices = faces_.size();
+  batch.edgeVertices = edges_.size();
+
+  if (!batch.buffer) glGenBuffers(1, &batch.buffer);
 
-    glPopMatrix();
+  glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+  glBufferData(GL_ARRAY_BUFFER, (faces_.size() + edges_.size()) * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+
+  if (!faces_.empty())
+  {
+    glBufferSubData(GL_ARRAY_BUFFER, 0, faces_.size() * sizeof(Vertex), &faces_[0]);
+    glBufferSubData(GL_ARRAY_BUFFER, faces_.size() * sizeof(Vertex), edges_.size() * sizeof(Vertex), &edges_[0]);
   }
 
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void MapDrawer3D::drawGrid()
+void MapDrawer3D::clearTileBuffers()
 {
-  glColor3dv(GRID_COLOR);
+  for (TileBufferMap::iterator it = tileBuffers_.begin(); it != tileBuffers_.end(); ++it)
+  {
+    glDeleteBuffers(1, &it->second.volumes.buffer);
+    glDeleteBuffers(1, &it->second.columns.buffer);
+  }
 
-  glPushMatrix();
-  glScaled(map_->resolution_, map_->resolution_, 1.0);
-  glTranslated(-map_->offsetX_, -map_->offsetY_, 0.0);
+  tileBuffers_.clear();
+}
+
+void MapDrawer3D::selectTileBuffers()
+{
+  double planes[6][4];
+  camera_.getFrustum(CAMERA_FOV, gui_->getCanvasWidth() / gui_->getCanvasHeight(), 
+                     CAMERA_NEAR, CAMERA_FAR, planes);
+
+  btVector3 eye(camera_.getPosX(), camera_.getPosY(), camera_.getPosZ());
+
+  double tileSize = TILE_SIZE * map_->getResolution();
 
-  for (int i = 0; i <= map_->sizeX_; ++i)
+  tilesDrawn_   = 0;
+  tilesColumns_ = 0;
+  tilesCulled_  = 0;
+
+  visibleBatches_.clear();
+
+  for (TileBufferMap::iterator it = tileBuffers_.begin(); it != tileBuffers_.end(); ++it)
   {
-    glBegin(GL_LINES);
-      glVertex3d(i, 0           , 0.0);
-      glVertex3d(i, map_->sizeY_, 0.0);
-    glEnd();
+    TileBuffer& tileBuffer = it->second;
+    if (!tileBuffer.volumes.faceVertices) continue;
+
+    double min[3] = {it->first.first * tileSize, it->first.second * tileSize, tileBuffer.zMin};
+    double max[3] = {min[0] + tileSize, min[1] + tileSize, tileBuffer.zMax};
+
+    // **** outside if the corner furthest along a plane's normal is 
+    //      behind it
+
+    bool inside = true;
+
+    for (int p = 0; p < 6 && inside; ++p)
+    {
+      double d = planes[p][3];
+      for (int a = 0; a < 3; ++a)
+        d += planes[p][a] * (planes[p][a] > 0.0 ? max[a] : min[a]);
+
+      inside = d >= 0.0;
+    }
+
+    if (!inside)
+    {
+      tilesCulled_++;
+      continue;
+    }
+
+    btVector3 center(0.5 * (min[0] + max[0]), 0.5 * (min[1] + max[1]), 0.5 * (min[2] + max[2]));
+
+    bool far = lodDistance_ > 0.0 && (center - eye).length() > lodDistance_;
+
+    if (far && !tileBuffer.columnsValid && !isSpilled(tileBuffer.tile))
+      buildColumns(tileBuffer.tile, it->first.first * TILE_SIZE, it->first.second * TILE_SIZE, tileBuffer);
+
+    // **** an evicted tile without its columns is drawn in full
+
+    if (far && tileBuffer.columnsValid)
+    {
+      visibleBatches_.push_back(&tileBuffer.columns);
+      tilesColumns_++;
+    }
+    else
+    {
+      visibleBatches_.push_back(&tileBuffer.volumes);
+      tilesDrawn_++;
+    }
   }
+}
+
+void MapDrawer3D::drawTileBuffers()
+{
+	glEnable(GL_POLYGON_OFFSET_FILL); // Avoid Stitching!
+	glPolygonOffset(1.0, 1.0);
+
+  for (size_t b = 0; b < visibleBatches_.size(); ++b)
+    drawBatch(*visibleBatches_[b]);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+	glDisable(GL_POLYGON_OFFSET_FILL);
+}
+
+void MapDrawer3D::drawBatch(const Batch& batch)
+{
+  if (!batch.faceVertices) return;
+
+  glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+  glInterleavedArrays(GL_C4UB_V3F, 0, NULL);
+
+  glDrawArrays(GL_QUADS, 0, batch.faceVertices);
+  glDrawArrays(GL_LINES, batch.faceVertices, batch.edgeVertices);
+}
 
-  for (int j = 0; j <= map_->sizeY_; ++j)
+void MapDrawer3D::updateGrid()
+{
+  int size[4] = {map_->getSizeX(), map_->getSizeY(), map_->getOffsetX(), map_->getOffsetY()};
+
+  if (!gridBuffer_ || memcmp(size, gridSize_, sizeof(size)) || gridResolution_ != map_->getResolution())
   {
-    glBegin(GL_LINES);
-      glVertex3d(0,            j, 0.0);
-      glVertex3d(map_->sizeX_, j, 0.0);
-    glEnd();
+    // **** a line along each cell border, in meters
+
+    double resolution = map_->getResolution();
+
+    float x0 = -size[2] * resolution, x1 = (size[0] - size[2]) * resolution;
+    float y0 = -size[3] * resolution, y1 = (size[1] - size[3]) * resolution;
+
+    std::vector<float> lines;
+    lines.reserve((size[0] + size[1] + 2) * 6);
+
+    for (int i = 0; i <= size[0]; ++i)
+    {
+      float x = (i - size[2]) * resolution;
+      float line[6] = {x, y0, 0.0f, x, y1, 0.0f};
+      lines.insert(lines.end(), line, line + 6);
+    }
+
+    for (int j = 0; j <= size[1]; ++j)
+    {
+      float y = (j - size[3]) * resolution;
+      float line[6] = {x0, y, 0.0f, x1, y, 0.0f};
+      lines.insert(lines.end(), line, line + 6);
+    }
+
+    if (!gridBuffer_) glGenBuffers(1, &gridBuffer_);
+
+    glBindBuffer(GL_ARRAY_BUFFER, gridBuffer_);
+    glBufferData(GL_ARRAY_BUFFER, lines.size() * sizeof(float), &lines[0], GL_STATIC_DRAW);
+
+    gridVertices_   = lines.size() / 3;
+    gridResolution_ = resolution;
+    memcpy(gridSize_, size, sizeof(size));
   }
+}
+
+void MapDrawer3D::drawGrid()
+{
+  glColor3dv(GRID_COLOR);
+
+  glBindBuffer(GL_ARRAY_BUFFER, gridBuffer_);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, NULL);
+
+  glDrawArrays(GL_LINES, 0, gridVertices_);
+
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MapDrawer3D::drawOverlay()
+{
+  if (!fontListBase_) return;
+
+  char text[128];
+  snprintf(text, sizeof(text), "%5.1f fps  draw %5.1f ms  tiles %d + %d far, %d culled",
+    frameInterval_ > 0.0 ? 1.0 / frameInterval_ : 0.0, 1000.0 * drawTime_,
+    tilesDrawn_, tilesColumns_, tilesCulled_);
+
+  // **** in window coordinates, over everything
+
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  gluOrtho2D(0.0, gui_->getCanvasWidth(), 0.0, gui_->getCanvasHeight());
+
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  glDisable(GL_DEPTH_TEST);
+
+  glColor3d(0.0, 0.0, 0.0);
+  glRasterPos2d(8.0, gui_->getCanvasHeight() - 16.0);
 
+  glListBase(fontListBase_);
+  glCallLists(strlen(text), GL_UNSIGNED_BYTE, text);
+
+  glEnable(GL_DEPTH_TEST);
+
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
   glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
 }
 
 void MapDrawer3D::drawAxes()
@@ -111,156 +522,58 @@ void MapDrawer3D::drawAxes()
   glLineWidth(1.0);
 }
 
-void MapDrawer3D::drawPVolumes()
+void MapDrawer3D::addBox(int cx, int cy, int size, float bottom, float top, const double color[3])
 {
-  for (int i = 0; i < map_->sizeX_; ++i)
-  for (int j = 0; j < map_->sizeY_; ++j)
-  {
-    Volume * volumes = map_->grid_[i][j].getPVolumes();
-    int count = map_->grid_[i][j].getPVolumesCount();
-
-    for (int v = 0; v < count; ++v)
-    {
-      double x = i - map_->offsetX_;
-      double y = j - map_->offsetY_;
-
-  		glPushMatrix();
-
-      glScalef(map_->resolution_, map_->resolution_, map_->resolution_);
-			glTranslatef(x, y, 0.0);
-
+  double resolution = map_->getResolution();
 
-      //if (useHeightColor_) 
-      //  drawHeightColorVolume(volume->getBot(), volume->getTop());
-      //else
-        drawSolidColorVolume(getBot(volumes[v]), getTop(volumes[v]), COLOR_P_VOLUMES);
+  float x[2] = {(float)(cx * resolution), (float)((cx + size) * resolution)};
+  float y[2] = {(float)(cy * resolution), (float)((cy + size) * resolution)};
+  float z[2] = {(float)(bottom * resolution), (float)(top * resolution)};
 
-			glPopMatrix();
-    } 
-  }
-}
+  // **** corner c of the box: x[c & 1], y[c >> 1 & 1], z[c >> 2]
 
-void MapDrawer3D::drawNVolumes()
-{
-  for (int i = 0; i < map_->sizeX_; ++i)
-  for (int j = 0; j < map_->sizeY_; ++j)
+  static const int FACES[6][4] = 
   {
-    Volume * volumes = map_->grid_[i][j].getNVolumes();
-    int count = map_->grid_[i][j].getNVolumesCount();
-
-    for (int v = 0; v < count; ++v)
-    {
-      double x = i - map_->offsetX_;
-      double y = j - map_->offsetY_;
-
-  		glPushMatrix();
+    {0, 2, 3, 1}, {4, 6, 7, 5},   // bottom and top
+    {0, 2, 6, 4}, {1, 3, 7, 5},   // left and right
+    {0, 1, 5, 4}, {2, 3, 7, 6}    // front and back
+  };
 
-      glScalef(map_->resolution_, map_->resolution_, map_->resolution_);
-			glTranslatef(x, y, 0.0);
+  static const int EDGES[12][2] =
+  {
+    {0, 1}, {1, 3}, {3, 2}, {2, 0},
+    {4, 5}, {5, 7}, {7, 6}, {6, 4},
+    {0, 4}, {1, 5}, {2, 6}, {3, 7}
+  };
 
+  Vertex vertex;
 
-      //if (useHeightColor_) 
-      //  drawHeightColorVolume(volume->getBot(), volume->getTop());
-      //else
-        drawSolidColorVolume(getBot(volumes[v]), getTop(volumes[v]), COLOR_N_VOLUMES);
+  vertex.color[0] = color[0] * 255.0;
+  vertex.color[1] = color[1] * 255.0;
+  vertex.color[2] = color[2] * 255.0;
+  vertex.color[3] = 255;
 
-			glPopMatrix();
-    } 
+  for (int f = 0; f < 6; ++f)
+  for (int v = 0; v < 4; ++v)
+  {
+    int c = FACES[f][v];
+    vertex.x = x[c & 1];
+    vertex.y = y[c >> 1 & 1];
+    vertex.z = z[c >> 2];
+    faces_.push_back(vertex);
   }
-}
-
-void MapDrawer3D::drawSolidColorVolume(double bottom, double top, const double color[3])
-{
-	glEnable(GL_POLYGON_OFFSET_FILL); // Avoid Stitching!
-	glPolygonOffset(1.0, 1.0);
-
-	double eps  =  0.5;
-	double eps1 =  0.0;
-	double eps2 =  1.0;
-
-	// top and bottom
-
-	glColor3dv(color);
-
-	glBegin(GL_POLYGON);
-		glVertex3f(eps1, eps1, bottom);
-		glVertex3f(eps1, eps2, bottom);
-		glVertex3f(eps2, eps2, bottom);
-		glVertex3f(eps2, eps1, bottom);
-	glEnd();
-
-	glBegin(GL_POLYGON);
-		glVertex3f(eps1, eps1, top);
-		glVertex3f(eps1, eps2, top);
-		glVertex3f(eps2, eps2, top);
-		glVertex3f(eps2, eps1, top);
-	glEnd();
-
-	// left and right
-
-	glColor3dv(color);
-
-	glBegin(GL_POLYGON);
-		glVertex3f(eps1, eps1, bottom);
-		glVertex3f(eps1, eps2, bottom);
-		glVertex3f(eps1, eps2, top);
-		glVertex3f(eps1, eps1, top);
-	glEnd();
-
-	glBegin(GL_POLYGON);
-		glVertex3f(eps2, eps1, bottom);
-		glVertex3f(eps2, eps2, bottom);
-		glVertex3f(eps2, eps2, top);
-		glVertex3f(eps2, eps1, top);
-	glEnd();
-
-	// front and back
-
-	glBegin(GL_POLYGON);
-		glVertex3f(eps1, eps1, bottom);
-		glVertex3f(eps2, eps1, bottom);
-		glVertex3f(eps2, eps1, top);
-		glVertex3f(eps1, eps1, top);
-	glEnd();
-
-	glBegin(GL_POLYGON);
-		glVertex3f(eps1, eps2, bottom);
-		glVertex3f(eps2, eps2, bottom);
-		glVertex3f(eps2, eps2, top);
-		glVertex3f(eps1, eps2, top);
-	glEnd();
-
-	glDisable(GL_POLYGON_OFFSET_FILL);
 
-	// ******* LINES
-
-	glColor3f(0.0, 0.0, 0.0);
-
-	glBegin(GL_LINE_LOOP);
-		glVertex3f(eps1, eps1, bottom);
-		glVertex3f(eps1, eps2, bottom);
-		glVertex3f(eps2, eps2, bottom);
-		glVertex3f(eps2, eps1, bottom);
-	glEnd();
-
-	glBegin(GL_LINE_LOOP);
-		glVertex3f(eps1, eps1, top);
-		glVertex3f(eps1, eps2, top);
-		glVertex3f(eps2, eps2, top);
-		glVertex3f(eps2, eps1, top);
-	glEnd();
-
-	glBegin(GL_LINES);
-		glVertex3f(eps1, eps1, bottom);
-		glVertex3f(eps1, eps1, top);
-		glVertex3f(eps1, eps2, bottom);
-		glVertex3f(eps1, eps2, top);
-		glVertex3f(eps2, eps2, bottom);
-		glVertex3f(eps2, eps2, top);
-		glVertex3f(eps2, eps1, bottom);
-		glVertex3f(eps2, eps1, top);
-	glEnd();
+  vertex.color[0] = vertex.color[1] = vertex.color[2] = 0;
 
+  for (int e = 0; e < 12; ++e)
+  for (int v = 0; v < 2; ++v)
+  {
+    int c = EDGES[e][v];
+    vertex.x = x[c & 1];
+    vertex.y = y[c >> 1 & 1];
+    vertex.z = z[c >> 2];
+    edges_.push_back(vertex);
+  }
 }
 
 void MapDrawer3D::drawHeightColorVolume(double bottom, double top)
@@ -275,7 +588,7 @@ void MapDrawer3D::setView()
 
   glViewport(0,0, gui_->getCanvasWidth(), gui_->getCanvasHeight());
 
-	gluPerspective(45.0, gui_->getCanvasWidth()/gui_->getCanvasHeight(), 0.1, 100.0);
+	gluPerspective(CAMERA_FOV, gui_->getCanvasWidth()/gui_->getCanvasHeight(), CAMERA_NEAR, CAMERA_FAR);
 
 	// display camera view
 	gluLookAt(camera_.getPosX(),  camera_.getPosY(),  camera_.getPosZ(),
@@ -287,24 +600,28 @@ void MapDrawer3D::pan(double angle)
 {
   camera_.pan(angle);
   setView();
+  viewChanged_ = true;
 }
 
 void MapDrawer3D::tilt(double angle)
 {
   camera_.tilt(angle);
   setView();
+  viewChanged_ = true;
 }
 
 void MapDrawer3D::zoom(double r)
 {
   camera_.zoom(r);
   setView();
+  viewChanged_ = true;
 }
 
 void MapDrawer3D::move(double x, double y)
 {
   camera_.move(x, y);
   setView();
+  viewChanged_ = true;
 }
 
 } // namespace MVOG
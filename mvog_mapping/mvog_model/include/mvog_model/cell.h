@@ -8,14 +8,24 @@
 #include <queue>
 
 #include <mvog_model/volume.h>
+#include <mvog_model/volume_allocator.h>
 
 #include <boost/numeric/interval.hpp>
+#include <boost/static_assert.hpp>
 
 namespace MVOG 
 {
 
 typedef Volume*               VolumeArray;
-typedef std::vector<MLVolume> MLVolumeVector;
+
+// **** number of P and N volumes stored inside the cell itself,
+//      before anything is requested from the map's allocator
+
+const int CELL_INLINE_VOLUMES = 2;
+
+// **** batched merges of up to this many volumes need no scratch memory
+
+const int CELL_MERGE_VOLUMES = 16;
 
 class Boundary 
 {
@@ -42,30 +52,59 @@ class Cell
   
   private:
 
-    VolumeArray pVolumes;
-    VolumeArray nVolumes;
+    union VolumeStorage
+    {
+      Volume * heap;
+      Volume   local[CELL_INLINE_VOLUMES];
+    };
+
+    VolumeStorage pStorage;
+    VolumeStorage nStorage;
     
     int pVolumesCount;
     int nVolumesCount;
 
-    void addVolume(float bot, float top, VolumeArray& volumes, int& volumesCount);
+    static int getCapacity(int volumesCount);
+
+    static VolumeArray getArray(VolumeStorage& volumes, int volumesCount);
+    static const Volume * getArray(const VolumeStorage& volumes, int volumesCount);
+
+    static void resize(VolumeStorage& volumes, int& volumesCount, int newCount, 
+                       VolumeAllocator& allocator);
+
+    static void release(VolumeStorage& volumes, int& volumesCount, VolumeAllocator& allocator);
+
+    void addVolume(float bot, float top, VolumeStorage& storage, int& volumesCount,
+                   VolumeAllocator& allocator);
+
+    void addVolumes(const Volume * volumes, int count, VolumeStorage& storage, int& volumesCount,
+                    VolumeAllocator& allocator);
 
-    float getCombinedDensity(int cp, int cn);
    
   public:
 
+    typedef VolumeAllocator Allocator;
+
     Cell();
-    virtual ~Cell();
+    ~Cell();
   
-    void addPVolume(float bot, float top);
-    void addNVolume(float bot, float top);
+    void addPVolume(float bot, float top, VolumeAllocator& allocator);
+    void addNVolume(float bot, float top, VolumeAllocator& allocator);
 
-    VolumeArray getPVolumes() { return pVolumes; }
-    VolumeArray getNVolumes() { return nVolumes; }
+    // merges count volumes, sorted by their bottom, in a single pass. 
+    // The result is the same as adding them one by one.
+    void addPVolumes(const Volume * volumes, int count, VolumeAllocator& allocator);
+    void addNVolumes(const Volume * volumes, int count, VolumeAllocator& allocator);
+
+    VolumeArray getPVolumes() { return getArray(pStorage, pVolumesCount); }
+    VolumeArray getNVolumes() { return getArray(nStorage, nVolumesCount); }
 
     int getPVolumesCount() { return pVolumesCount; }
     int getNVolumesCount() { return nVolumesCount; }
 
+    // volume arrays all come from the allocator
+    size_t getHeapSize() const { return 0; }
+
     bool  getOccDensity(float z, float& density) const;
     float getPDensity(float z) const;
     float getNDensity(float z) const;
@@ -75,11 +114,16 @@ class Cell
 
     bool validate();
 
-    void clear();
+    void clear(VolumeAllocator& allocator);
 
     void createMLVolumes(MLVolumeVector& mlVolumes);
 };
 
+// **** a tile holds TILE_CELLS of them: no vtable, and no padding
+//      between the inline volumes and the counts
+
+BOOST_STATIC_ASSERT(sizeof(Cell) == 2 * CELL_INLINE_VOLUMES * sizeof(Volume) + 2 * sizeof(int));
+
 
 
 }; // namespace MVOG
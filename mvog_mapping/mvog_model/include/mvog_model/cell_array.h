@@ -1,16 +1,18 @@
-#ifndef MVOG_MODEL_CELL_H
-#define MVOG_MODEL_CELL_H
+#ifndef MVOG_MODEL_CELL_ARRAY_H
+#define MVOG_MODEL_CELL_ARRAY_H
 
 #include <cstdio>
 #include <string.h>
 #include <mvog_model/volume.h>
+#include <mvog_model/volume_allocator.h>
 
 namespace MVOG 
 {
 
-const size_t VOLUME_BYTE_SIZE = sizeof(Volume);
+// **** cell storage policy: exactly sized Volume arrays from new[],
+//      reallocated on every change
 
-class Cell
+class ArrayCell
 {
 
   private:
@@ -21,15 +23,25 @@ class Cell
     int pVolumesCount;
     int nVolumesCount;
 
-    void addVolume(double bot, double top, Volume*& volumes, int& volumesCount);
+    void addVolume(float bot, float top, Volume*& volumes, int& volumesCount);
+    void addVolumes(const Volume * batch, int count, Volume*& volumes, int& volumesCount);
+
+    // non-copyable: owns its volume arrays
+    ArrayCell(const ArrayCell&);
+    ArrayCell& operator=(const ArrayCell&);
 
   public:
 
-    Cell();
-    virtual ~Cell();
+    typedef NullVolumeAllocator Allocator;
+
+    ArrayCell();
+    virtual ~ArrayCell();
   
-    void addPVolume(double bot, double top);
-    void addNVolume(double bot, double top);
+    void addPVolume(float bot, float top, Allocator&);
+    void addNVolume(float bot, float top, Allocator&);
+
+    void addPVolumes(const Volume * volumes, int count, Allocator&);
+    void addNVolumes(const Volume * volumes, int count, Allocator&);
 
     Volume * getPVolumes() { return pVolumes; }
     Volume * getNVolumes() { return nVolumes; }
@@ -37,10 +49,16 @@ class Cell
     int getPVolumesCount() { return pVolumesCount; }
     int getNVolumesCount() { return nVolumesCount; }
 
+    size_t getHeapSize() const { return (pVolumesCount + nVolumesCount) * VOLUME_BYTE_SIZE; }
+
+    void clear(Allocator&);
+
+    void createMLVolumes(MLVolumeVector& mlVolumes);
+
     void printPVolumes();
 
 };
 
 }; // namespace MVOG
 
-#endif // MVOG_MODEL_CELL_H
+#endif // MVOG_MODEL_CELL_ARRAY_H
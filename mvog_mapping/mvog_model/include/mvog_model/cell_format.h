@@ -0,0 +1,31 @@
+#ifndef MVOG_MODEL_CELL_FORMAT_H
+#define MVOG_MODEL_CELL_FORMAT_H
+
+#include <mvog_model/tile.h>
+
+namespace MVOG
+{
+
+// **** how the volumes of the cells are stored:
+//      CELL_FORMAT_FLOAT:   Cells, full precision floats (FloatTile)
+//      CELL_FORMAT_COMPACT: CompactCells, quantized 16 bit heights and
+//                           masses, about half the memory (CompactTile)
+//      CELL_FORMAT_ARRAY:   ArrayCells, new[] arrays per cell
+//      CELL_FORMAT_VECTOR:  VectorCells, std::vectors per cell
+
+enum CellFormat
+{
+  CELL_FORMAT_FLOAT,
+  CELL_FORMAT_COMPACT,
+  CELL_FORMAT_ARRAY,
+  CELL_FORMAT_VECTOR
+};
+
+const char * getCellFormatName(CellFormat cellFormat);
+
+// a new, empty tile storing its cells in the given format
+Tile * createTile(CellFormat cellFormat);
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_CELL_FORMAT_H
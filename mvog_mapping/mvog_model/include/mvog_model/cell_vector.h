@@ -1,16 +1,20 @@
-#ifndef MVOG_MODEL_CELL_H
-#define MVOG_MODEL_CELL_H
+#ifndef MVOG_MODEL_CELL_VECTOR_H
+#define MVOG_MODEL_CELL_VECTOR_H
 
 #include <cstdio>
 #include <vector>
 #include <mvog_model/volume.h>
+#include <mvog_model/volume_allocator.h>
 
 namespace MVOG 
 {
 
-typedef std::vector<Volume> VolumeVector;
+// **** 3 floats per volume
+typedef std::vector<float> VolumeVector;
 
-class Cell
+// **** cell storage policy: a std::vector of volumes per list
+
+class VectorCell
 {
 
   private:
@@ -18,18 +22,35 @@ class Cell
     VolumeVector pVolumes;
     VolumeVector nVolumes;
 
-    void addVolume(double bot, double top, VolumeVector& volumes);
+    static Volume * getArray(VolumeVector& volumes);
+
+    void addVolume(float bot, float top, VolumeVector& volumes);
+    void addVolumes(const Volume * batch, int count, VolumeVector& volumes);
 
   public:
 
-    Cell();
-    virtual ~Cell();
+    typedef NullVolumeAllocator Allocator;
+
+    VectorCell();
+    virtual ~VectorCell();
   
-    void addPVolume(double bot, double top);
-    void addNVolume(double bot, double top);
+    void addPVolume(float bot, float top, Allocator&);
+    void addNVolume(float bot, float top, Allocator&);
+
+    void addPVolumes(const Volume * volumes, int count, Allocator&);
+    void addNVolumes(const Volume * volumes, int count, Allocator&);
+
+    Volume * getPVolumes() { return getArray(pVolumes); }
+    Volume * getNVolumes() { return getArray(nVolumes); }
+
+    int getPVolumesCount() { return pVolumes.size() / 3; }
+    int getNVolumesCount() { return nVolumes.size() / 3; }
+
+    size_t getHeapSize() const { return (pVolumes.capacity() + nVolumes.capacity()) * sizeof(float); }
+
+    void clear(Allocator&);
 
-    VolumeVector * getPVolumes() { return &pVolumes; }
-    VolumeVector * getNVolumes() { return &nVolumes; }
+    void createMLVolumes(MLVolumeVector& mlVolumes);
 
     void printPVolumes();
 
@@ -37,4 +58,4 @@ class Cell
 
 }; // namespace MVOG
 
-#endif // MVOG_MODEL_CELL_H
+#endif // MVOG_MODEL_CELL_VECTOR_H
@@ -0,0 +1,96 @@
+#ifndef MVOG_MODEL_COMPACT_TILE_H
+#define MVOG_MODEL_COMPACT_TILE_H
+
+#include <vector>
+
+#include <mvog_model/tile.h>
+
+namespace MVOG
+{
+
+// **** quantization of compact volumes: heights in 1/8 of a cell height
+//      (+/- 4096 cells), masses in 1/16 of a cell height
+
+const float COMPACT_HEIGHT_SCALE = 8.0;
+const float COMPACT_MASS_SCALE   = 16.0;
+
+struct CompactVolume
+{
+  short          bot;
+  short          top;
+  unsigned short mass;
+};
+
+// **** 8 bytes per cell, no virtual table: the P volumes of the cell
+//      followed by its N volumes, at offset in the tile's volume buffer
+
+struct CompactCell
+{
+  unsigned int   offset;
+  unsigned short pVolumesCount;
+  unsigned short nVolumesCount;
+};
+
+// **** tile of CompactCells. Volumes are merged as floats and quantized
+//      when stored. When a mass no longer fits in 16 bits, all masses of
+//      the cell are halved. This keeps the P/N density ratios the ML
+//      volumes depend on, and gives new evidence more weight than old.
+
+class CompactTile: public Tile
+{
+  private:
+
+    CompactCell cells_[TILE_CELLS];
+
+    // **** volume buffer, carved in power-of-two ranges. Free ranges
+    //      are kept per size class and reused.
+
+    std::vector<CompactVolume> volumes_;
+    std::vector<unsigned int>  freeRanges_[VOLUME_ALLOCATOR_CLASSES];
+
+    // **** decoded volumes, 3 floats each
+
+    std::vector<float> pScratch_;
+    std::vector<float> nScratch_;
+    std::vector<float> mergeScratch_;
+
+    static int getCapacity(int volumesCount);
+
+    unsigned int allocate(int capacity);
+    void deallocate(unsigned int offset, int capacity);
+
+    static Volume * getScratch(std::vector<float>& scratch, int count);
+
+    static void quantize(Volume& volume);
+
+    void decode(const CompactCell& cell, Volume * pVolumes, Volume * nVolumes) const;
+    void store(CompactCell& cell, const Volume * pVolumes, int pVolumesCount,
+                                  const Volume * nVolumes, int nVolumesCount);
+
+    void addVolumes(int i, int j, const Volume * volumes, int count, bool positive);
+
+  protected:
+
+    virtual void createMLVolumes(int i, int j, MLVolumeVector& mlVolumes);
+
+  public:
+
+    CompactTile();
+    virtual ~CompactTile();
+
+    virtual void addPVolume(int i, int j, float bot, float top);
+    virtual void addNVolume(int i, int j, float bot, float top);
+    virtual void addPVolumes(int i, int j, const Volume * volumes, int count);
+    virtual void addNVolumes(int i, int j, const Volume * volumes, int count);
+
+    virtual void clearCell(int i, int j);
+
+    virtual const Volume * getPVolumes(int i, int j, int& count);
+    virtual const Volume * getNVolumes(int i, int j, int& count);
+
+    virtual size_t getMemorySize() const;
+};
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_COMPACT_TILE_H
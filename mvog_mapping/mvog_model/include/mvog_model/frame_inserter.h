@@ -0,0 +1,155 @@
+#ifndef MVOG_MODEL_FRAME_INSERTER_H
+#define MVOG_MODEL_FRAME_INSERTER_H
+
+#include <vector>
+
+#include <btBulletDynamicsCommon.h>
+
+#include <mvog_model/map.h>
+
+namespace MVOG
+{
+
+// **** inserts one frame of a dense sensor - a depth image or an organized
+//      point cloud - in grid units:
+//
+//      - endpoints are deduplicated by voxel before anything is traced:
+//        every voxel hit in the frame gets one P volume of height 1
+//      - beams to a run of stacked voxels of one column cross the same
+//        cells, and are traced once, as a bundle
+//      - the free space of the frame is gathered per cell, as the union
+//        of the beams crossing it; each cell receives it in one merge
+
+class FrameInserter
+{
+  private:
+
+    struct Voxel
+    {
+      int cx, cy, cz;
+      size_t slot;    // in the hash table
+
+      // by column, then upwards
+      bool operator<(const Voxel& other) const
+      {
+        if (cx != other.cx) return cx < other.cx;
+        if (cy != other.cy) return cy < other.cy;
+        return cz < other.cz;
+      }
+    };
+
+    // free space of one cell of the frame, in a list per cell
+    struct Interval
+    {
+      float bot, top;
+      int next;       // -1 at the end
+    };
+
+    Map * map_;
+
+    btVector3 origin_;
+
+    std::vector<unsigned long long> table_;   // voxel keys, open addressing
+    std::vector<Voxel> voxels_;
+
+    // **** free space, for the cells of the frame's bounding box
+
+    int gridMinCX_, gridMinCY_;
+    int gridSizeX_, gridSizeY_;
+
+    std::vector<int> cells_;          // first interval of each cell, or -1
+    std::vector<int> touchedCells_;
+    std::vector<Interval> intervals_;
+    std::vector<float> scratch_;      // volumes of one cell, 3 floats each
+
+    size_t pointCount_;
+    size_t bundleCount_;
+
+    // voxels: stacked, without gaps, in one column
+    void traceBundle(const Voxel * voxels, int count, double maxFreeRange);
+
+    void flushFreeSpace();
+
+    inline void addFreeSpace(int cx, int cy, double bot, double top)
+    {
+      // **** N volumes are at least one cell high (see createVolume)
+
+      if (top - bot < 1.0)
+      {
+        double m = (bot + top) / 2.0;
+        bot = m - 0.5;
+        top = m + 0.5;
+      }
+
+      int c = (cx - gridMinCX_) * gridSizeY_ + (cy - gridMinCY_);
+
+      if (cells_[c] == -1) touchedCells_.push_back(c);
+
+      // **** the first interval of the cell which touches the new one
+      //      grows, and absorbs the others it comes to touch
+
+      Interval * target = NULL;
+
+      int * link = &cells_[c];
+      while (*link != -1)
+      {
+        Interval& interval = intervals_[*link];
+
+        if (bot <= interval.top && top >= interval.bot)
+        {
+          bot = std::min(bot, (double)interval.bot);
+          top = std::max(top, (double)interval.top);
+
+          if (!target)
+          {
+            target = &interval;
+            link = &interval.next;
+          }
+          else
+            *link = interval.next;
+        }
+        else
+          link = &interval.next;
+      }
+
+      if (target)
+      {
+        target->bot = bot;
+        target->top = top;
+        return;
+      }
+
+      Interval interval;
+      interval.bot  = bot;
+      interval.top  = top;
+      interval.next = cells_[c];
+
+      cells_[c] = intervals_.size();
+      intervals_.push_back(interval);
+    }
+
+  public:
+
+    FrameInserter(Map * map);
+    virtual ~FrameInserter();
+
+    // starts a frame taken from origin, with about maxPoints points
+    void begin(const btVector3& origin, size_t maxPoints);
+
+    void addPoint(const btVector3& point);
+
+    // inserts the frame. No free space is carved further than
+    // maxFreeRange from the origin; 0 for no limit. The caller must hold
+    // the map's mutex if other threads use the map.
+    void end(bool modelNegativeSpace, double maxFreeRange);
+
+    // **** statistics of the last frame
+
+    size_t getPointCount()  const { return pointCount_;    }
+    size_t getVoxelCount()  const { return voxels_.size(); }
+    size_t getBundleCount() const { return bundleCount_;   }
+};
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_FRAME_INSERTER_H
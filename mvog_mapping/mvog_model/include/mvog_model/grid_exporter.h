@@ -0,0 +1,75 @@
+#ifndef MVOG_MODEL_GRID_EXPORTER_H
+#define MVOG_MODEL_GRID_EXPORTER_H
+
+#include <vector>
+
+#include <mvog_model/map.h>
+
+namespace MVOG
+{
+
+const signed char GRID_UNKNOWN  = -1;
+const signed char GRID_FREE     = 0;
+const signed char GRID_OCCUPIED = 100;
+
+// **** a rectangle of 2D values, for the cells (minCX, minCY) up to
+//      (minCX + sizeX - 1, minCY + sizeY - 1). Values are stored row by
+//      row: cell (minCX + x, minCY + y) at y * sizeX + x.
+
+struct GridPatch
+{
+  int minCX, minCY;
+  int sizeX, sizeY;
+
+  // the height band: GRID_OCCUPIED if a maximum likelihood volume
+  // reaches into it, GRID_FREE if a negative volume does, GRID_UNKNOWN
+  // otherwise
+  std::vector<signed char> occupancy;
+
+  // meters: the top of the highest ML volume, NaN for cells without any
+  std::vector<float> maxHeight;
+
+  // meters: the free height between the lowest ML volume and the one
+  // above it, infinity if there is none above, NaN for cells without any
+  std::vector<float> minClearance;
+};
+
+// **** 2D views of a map - a height band occupancy grid, and a 2.5D
+//      elevation grid - kept in step with the map by patches. Each call
+//      covers only the cells changed since the previous one, read from
+//      the tiles' CHANGES_EXPORT flags: one patch per changed tile, the
+//      bounding box of its changed cells. Tiles evicted to the spill file
+//      are left out until a call finds them resident again.
+
+class GridExporter
+{
+  private:
+
+    Map * map_;
+
+    double bandMin_;  // m
+    double bandMax_;
+    bool   all_;      // the next patches cover every tile
+
+    void exportCell(Tile * tile, int i, int j, GridPatch& patch, int index);
+
+  public:
+
+    GridExporter(Map * map);
+    virtual ~GridExporter();
+
+    // the band of the occupancy grid, in meters. The next patches cover
+    // the whole map.
+    void setBand(double minZ, double maxZ);
+
+    // the next patches cover the whole map, e.g. for a new subscriber
+    void exportAll() { all_ = true; }
+
+    // patches for the cells changed since the last call; on the first
+    // call, the whole map. The caller must hold the map's mutex.
+    void getPatches(std::vector<GridPatch>& patches);
+};
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_GRID_EXPORTER_H
@@ -1,9 +1,15 @@
 #ifndef MVOG_MODEL_MAP_H
 #define MVOG_MODEL_MAP_H
 
+#include <vector>
+#include <bitset>
+
 #include <boost/thread.hpp>
 
 #include <mvog_model/cell.h>
+#include <mvog_model/tile.h>
+#include <mvog_model/cell_format.h>
+#include <mvog_model/tile_spill.h>
 #include <sensor_msgs/LaserScan.h>
 #include <btBulletDynamicsCommon.h>
 
@@ -14,37 +20,288 @@ class Map
 {
   friend class MapDrawer2D;
   friend class MapDrawer3D;
+  friend class MapFile;
 
   private:
 
     // **** map size and resolution variables
 
     double resolution_;
-    int sizeX_;
+    int sizeX_;         // in cells, always a multiple of TILE_SIZE
     int sizeY_;
-    int offsetX_;
+    int offsetX_;       // in cells, always a multiple of TILE_SIZE
     int offsetY_;
 
-    Cell** grid_;
+    CellFormat cellFormat_;
+
+    // **** tile directory: tilesX_ x tilesY_ pointers, NULL until touched
+
+    Tile** tiles_;
+    int tilesX_;
+    int tilesY_;
+
+    // **** memory budget: see enforceMemoryBudget()
+
+    TileSpill * spill_;
+    size_t memoryBudget_;       // bytes, 0 for none
+    size_t residentBytes_;
+    size_t tileBytes_;          // the sum of the tiles' counted bytes
+    bool recountAll_;           // the counted bytes of some tiles are stale
+    unsigned long clock_;       // ticks once per enforceMemoryBudget()
+
+    mutable unsigned long version_;  // see getVersion()
+
+    // counts the bytes of the tiles used or resized since the clock last
+    // ticked again - or of every tile - and ticks the clock. Sets
+    // residentBytes_, the levels' included.
+    void countResidentBytes(bool all);
+
+    void growDirectory(int cx, int cy);
+    void growToInclude(int cx, int cy);
+
+    Tile* getTile(double x, double y, int& i, int& j);
+
+    // **** batched queries
+
+    // a point, keyed by its tile and cell: points of the same cell are
+    // next to each other once the keys are sorted
+    struct PointKey
+    {
+      unsigned long long key;
+      int index;
+
+      bool operator<(const PointKey& other) const { return key < other.key; }
+    };
+
+    // keys of the points inside the map, sorted. Large batches are
+    // radix sorted, in as many passes as the number of cells requires.
+    void sortPoints(const std::vector<btVector3>& points, std::vector<PointKey>& keys) const;
+
+    // ML volumes of cell (cx, cy), NULL outside the map or in empty tiles
+    const MLVolume * getMLVolumesAt(int cx, int cy, int& count);
+
+    // first ML volume reached travelling from z0 to z1 inside one cell
+    static bool findHit(const MLVolume * mlVolumes, int count, double z0, double z1, double& hitZ);
+
+    // **** coarser levels: levels_[l - 1] is level l, with cells 2^l times
+    //      as wide as this map's, and heights in its own grid units. A
+    //      cell of a level holds the union of the P (N) volumes of its
+    //      2 x 2 children one level down, with their masses summed.
 
-    Cell** initializeGrid(int sizeX, int sizeY);
-    void deleteGrid();
+    std::vector<Map*> levels_;
+
+    std::vector<float> levelVolumes_;   // 3 floats per volume
+    std::vector<float> childVolumes_;
+    std::vector<float> mergedVolumes_;
+
+    // an empty level above finer
+    explicit Map(const Map * finer);
+
+    // recomputes the cells of target whose children in source changed
+    // since the last update - or all of them
+    void updateLevel(Map * source, Map * target, bool all);
+
+    void updateLevels();
+
+    // union of the P (N) volumes of the children (i, j) ... (i + 1, j + 1)
+    // of a tile, scaled to the next level, in levelVolumes_
+    int mergeChildren(Tile * tile, int i, int j, bool positive);
+
+    // **** merging another map: its tiles are packed into records first,
+    //      then every tile of this map covered by it is filled by one
+    //      thread, pulling the volumes of each of its cells from the
+    //      source cell under the cell's center
+
+    struct MergeJob
+    {
+      Map * source;
+      std::vector<std::vector<char> > records;  // per source tile, empty if none
+
+      std::vector<int> tiles;   // tiles of this map to fill
+
+      // source grid coordinates of cell (cx, cy) of this map:
+      // origin + ex * cx + ey * cy
+      double originX, originY;
+      double exX, exY;
+      double eyX, eyY;
+
+      float dz;                 // grid units
+      int threads;
+    };
+
+    void packMergeTiles(MergeJob * job, int thread);
+    void fillMergeTiles(MergeJob * job, int thread);
 
   public:
 
-    Map(double resolution, double sizeXmeters, double sizeYmeters);
+    Map(double resolution, double sizeXmeters, double sizeYmeters,
+        CellFormat cellFormat = CELL_FORMAT_FLOAT);
     virtual ~Map();
 
+    // the Cell at (x, y). Only FloatTiles have Cells - for other tiles,
+    // returns NULL; use the tile's volume accessors instead.
     Cell* getCell(double x, double y);
     double getResolution() const { return resolution_; }
+    CellFormat getCellFormat() const { return cellFormat_; }
+
+    void addPVolume(double x, double y, float bot, float top);
+    void addNVolume(double x, double y, float bot, float top);
+
+    void clearCell(double x, double y);
+
+    // **** maximum likelihood volumes of the cell at (x, y), with bot and
+    //      top in grid units. Cached per tile and recomputed only for
+    //      cells changed since the last query. Cells outside the map or
+    //      never touched have none. Valid until the map is changed.
+
+    const MLVolume * getMLVolumes(double x, double y, int& count);
+
+    // **** batched queries. Unlike the rest of the map's interface, points
+    //      are in meters. Volume lists are searched by bisection, and read
+    //      once for a run of consecutive points in one cell; segments are
+    //      grouped by the cell they start in. The caller must hold mutex_
+    //      if the map is changed by other threads.
+
+    // pd / (pd + nd) at each point, -1 where nothing is known
+    void getOccDensities(const std::vector<btVector3>& points, std::vector<float>& densities);
+
+    // 1 for each point inside a maximum likelihood volume, 0 otherwise
+    void getOccupied(const std::vector<btVector3>& points, std::vector<char>& occupied);
+
+    // 1 for each segment from starts[s] to ends[s] which crosses a
+    // maximum likelihood volume, 0 otherwise
+    void getSegmentsOccupied(const std::vector<btVector3>& starts, const std::vector<btVector3>& ends,
+                             std::vector<char>& occupied);
+
+    // first point inside a maximum likelihood volume along the ray from
+    // origin in the given direction, up to maxRange meters. Returns false
+    // if there is none, or if the direction is zero or maxRange is not
+    // positive. A hit through the side of a column lies on the column's
+    // wall.
+    bool castRay(const btVector3& origin, const btVector3& direction, double maxRange, btVector3& hit);
+
+    // **** multi-resolution levels, for coarse planning and rendering.
+    //      Level 0 is this map. The levels are kept up to date lazily:
+    //      getLevel() first recomputes the coarse cells above any cell
+    //      changed since the last call. Guarded by this map's mutex_.
+
+    // keeps levels 1 ... levels; new levels are built from the whole map
+    void setLevels(int levels);
+    int getLevels() const { return levels_.size(); }
+
+    // the map of the given level, with its cells 2^level times as wide
+    // as this map's: all of its queries are available at that resolution.
+    // NULL if there is no such level.
+    Map * getLevel(int level);
+
+    // **** merges other into this map, as seen through transform - from
+    //      other's frame to this map's. The P (N) volume lists of each
+    //      cell are merged, touching volumes joined and their masses
+    //      summed, just as if the volumes had been added to this map.
+    //      Cells are matched by their centers: for transforms by whole
+    //      cells, each cell receives exactly one cell of other. Only
+    //      rotations about z are supported. Both maps must have the same
+    //      resolution; their grid origins and sizes may differ. Returns
+    //      false, leaving this map unchanged, if they cannot be merged.
+    //      The caller must hold both mutexes if the maps are used by
+    //      other threads.
+    //      other is only read: its volumes are unchanged, its tiles are
+    //      not touched and its spilled tiles are read from the spill
+    //      file without being reloaded. It is not const because reading
+    //      the volumes of a tile may fill the tile's scratch buffers
+    //      (CompactTile). A spilled tile which cannot be read is merged
+    //      as empty.
+
+    bool merge(Map& other, const btTransform& transform, int threads = 1);
+
+    // **** bounded memory. Once the map takes more than its budget, the
+    //      tiles used least recently are written to a spill file and
+    //      freed. An evicted tile stays in the directory as a SpilledTile,
+    //      which reloads it on its next use. The coarser levels are never
+    //      evicted, but count towards the budget.
+
+    // 0 bytes for no budget. Returns false if the spill file cannot be
+    // created.
+    bool setMemoryBudget(size_t bytes, const std::string& spillFilename);
+    size_t getMemoryBudget() const { return memoryBudget_; }
+
+    // ticks the map's clock, and if over budget evicts tiles, least
+    // recently used first, until 90% of the budget is left. Tiles within
+    // keepRadius cells of (x, y) are kept. Call with mutex_ held.
+    void enforceMemoryBudget(double x, double y, double keepRadius);
+
+    // bytes in memory, as of the last enforceMemoryBudget() with a budget.
+    // Only the tiles used since the previous call are measured again.
+    size_t getResidentBytes() const { return residentBytes_; }
+
+    void getSpillStats(SpillStats& stats);
+
+    // **** access by integer cell coordinates, cx = floor(x), cy = floor(y)
+
+    // returns the tile holding the cell, and the cell's (i, j) inside it.
+    // Creates the tile if needed, and grows the directory unless the
+    // cell was covered by a previous reserve().
+    Tile* getTileAt(int cx, int cy, int& i, int& j);
+
+    // grows the directory to cover the given cell range, so that
+    // getTileAt() does not move any tile pointers for cells inside it
+    void reserve(int minCX, int minCY, int maxCX, int maxCY);
+
+    // like getTileAt(), without any bounds checks: the cell must be
+    // covered by a previous reserve()
+    inline Tile* getReservedTileAt(int cx, int cy, int& i, int& j)
+    {
+      cx += offsetX_;
+      cy += offsetY_;
+
+      Tile *& tile = tiles_[(cx >> TILE_BITS) * tilesY_ + (cy >> TILE_BITS)];
+      if (!tile) tile = createTile(cellFormat_);
+      tile->touch(clock_);
+
+      i = cx & TILE_MASK;
+      j = cy & TILE_MASK;
+
+      return tile;
+    }
+
+    // **** tile iteration: tx, ty in [0, tilesX) x [0, tilesY)
+    //      cell (i, j) of tile (tx, ty) has grid coordinates
+    //      (tx * TILE_SIZE + i - offsetX, ty * TILE_SIZE + j - offsetY)
+
+    int getTilesX() const { return tilesX_; }
+    int getTilesY() const { return tilesY_; }
+
+    Tile * getTile(int tx, int ty) { return tiles_[tx * tilesY_ + ty]; }
+    const Tile * getTile(int tx, int ty) const { return tiles_[tx * tilesY_ + ty]; }
+
+    int getSizeX() const { return sizeX_; }
+    int getSizeY() const { return sizeY_; }
+    int getOffsetX() const { return offsetX_; }
+    int getOffsetY() const { return offsetY_; }
 
     // test
 
     void test();
 
+    // **** held by the Mapper while it changes the map. Anyone reading
+    //      the map from another thread must hold it as well.
+
     boost::mutex mutex_;
 
-    double getMemorySize(); 
+    // **** version counter, bumped after every change: by the Mapper once
+    //      per insertion, by merge() and by MapFile::load(). Others who
+    //      change the map call markChanged() themselves. Can be read
+    //      without the mutex, e.g. to tell whether a view is out of date.
+
+    void markChanged() { __sync_fetch_and_add(&version_, 1); }
+    unsigned long getVersion() const { return __sync_fetch_and_add(&version_, 0); }
+
+    // bytes in memory, measured over every tile and cell: for
+    // diagnostics, not once per scan
+    size_t getMemoryBytes();
+
+    // the same in KB
+    double getMemorySize() { return getMemoryBytes() / 1024.0; }
 
     void validate();
 
@@ -0,0 +1,157 @@
+#ifndef MVOG_MODEL_MAP_FILE_H
+#define MVOG_MODEL_MAP_FILE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <mvog_model/map.h>
+
+namespace MVOG
+{
+
+// **** map snapshot file, in the byte order of the host which wrote it:
+//
+//      MapFileHeader
+//      uint64_t tileOffsets[tilesX * tilesY]   0 for tiles never touched
+//
+//      one record per tile, at an 8 byte aligned offset:
+//      uint32_t pStart[TILE_CELLS + 1]         the P volumes of cell c are
+//      uint32_t nStart[TILE_CELLS + 1]         pVolumes[pStart[c]] up to
+//      Volume   pVolumes[pStart[TILE_CELLS]]   pVolumes[pStart[c+1] - 1],
+//      Volume   nVolumes[nStart[TILE_CELLS]]   the same for N
+//
+//      Volumes are stored at full precision whatever the cell format.
+
+const uint32_t MAP_FILE_VERSION    = 1;
+const uint32_t MAP_FILE_BYTE_ORDER = 0x01020304;
+
+struct MapFileHeader
+{
+  char     magic[4];    // "MVOG"
+  uint32_t version;
+  uint32_t byteOrder;   // MAP_FILE_BYTE_ORDER, as written by the host
+  uint32_t tileSize;
+
+  double   resolution;
+
+  int32_t  sizeX;
+  int32_t  sizeY;
+  int32_t  offsetX;
+  int32_t  offsetY;
+  int32_t  tilesX;
+  int32_t  tilesY;
+
+  uint32_t cellFormat;  // format of the saved map, for information only
+  uint32_t reserved;
+};
+
+// **** read-only mapping of a whole file, unmapped when destroyed
+
+class MappedFile
+{
+  private:
+
+    const char * data_;
+    size_t size_;
+
+    // non-copyable: owns the mapping
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+  public:
+
+    MappedFile();
+    virtual ~MappedFile();
+
+    bool open(const std::string& filename);
+
+    const char * getData() const { return data_; }
+    size_t getSize() const { return size_; }
+};
+
+// **** tile served from a mapped snapshot: the volumes are read in place,
+//      and pages are only loaded once they are used. The first change
+//      copies the tile into a new tile of the map's cell format, which
+//      handles all calls from then on.
+
+class MappedTile: public Tile
+{
+  private:
+
+    boost::shared_ptr<MappedFile> file_; // keeps the mapping alive
+
+    const uint32_t * pStart_;
+    const uint32_t * nStart_;
+    const Volume   * pVolumes_;
+    const Volume   * nVolumes_;
+
+    CellFormat cellFormat_;
+    Tile * copy_;
+
+    Tile * getCopy();
+
+    const Volume * getVolumes(const uint32_t * start, const Volume * volumes,
+                              int c, int& count) const;
+
+  protected:
+
+    virtual void createMLVolumes(int i, int j, MLVolumeVector& mlVolumes);
+
+  public:
+
+    // the tile record at offset must lie inside the file
+    MappedTile(const boost::shared_ptr<MappedFile>& file, uint64_t offset, CellFormat cellFormat);
+    virtual ~MappedTile();
+
+    // bytes of the tile record at offset, or 0 if it does not fit in size
+    static uint64_t getRecordSize(const char * data, uint64_t offset, uint64_t size);
+
+    bool isCopied() const { return copy_ != NULL; }
+
+    virtual void addPVolume(int i, int j, float bot, float top);
+    virtual void addNVolume(int i, int j, float bot, float top);
+    virtual void addPVolumes(int i, int j, const Volume * volumes, int count);
+    virtual void addNVolumes(int i, int j, const Volume * volumes, int count);
+
+    virtual void clearCell(int i, int j);
+
+    virtual const Volume * getPVolumes(int i, int j, int& count);
+    virtual const Volume * getNVolumes(int i, int j, int& count);
+
+    // the mapped pages are not counted - they belong to the page cache
+    virtual size_t getMemorySize() const;
+};
+
+class MapFile
+{
+  public:
+
+    // **** tile records, as stored in a snapshot
+
+    // the record of a tile, starting at record[0]
+    static void packTile(Tile& tile, std::vector<char>& record);
+
+    // adds the volumes of a record to an empty tile
+    static void unpackTile(const char * record, Tile& tile);
+
+    // the P (N) volumes of cell c = i * TILE_SIZE + j of a record
+    static const Volume * getRecordVolumes(const char * record, int c, bool positive, int& count);
+
+    // writes a snapshot of the map. The file is written under a temporary
+    // name and renamed when complete, so a map mapped from the same file
+    // stays valid.
+    static bool save(Map& map, const std::string& filename);
+
+    // replaces the contents of the map with a snapshot. The map keeps its
+    // cell format. If mapped, tiles are served from the file until they
+    // are changed; otherwise, they are all copied right away. The map's
+    // levels are rebuilt from the snapshot.
+    static bool load(Map& map, const std::string& filename, bool mapped = true);
+};
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_MAP_FILE_H
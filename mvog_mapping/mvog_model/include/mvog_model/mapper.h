@@ -3,37 +3,165 @@
 
 #include <boost/thread.hpp>
 
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/PointCloud2.h>
+
 #include <mvog_model/map.h>
+#include <mvog_model/frame_inserter.h>
+#include <mvog_model/ray_traversal.h>
+#include <mvog_model/volume_buffer.h>
+#include <mvog_model/worker_pool.h>
 
-namespace MVOG 
+namespace MVOG
 {
 
+// **** a volume waiting to be merged into a cell
+
+struct VolumeUpdate
+{
+  int   cx;       // cell coordinates, floor(x) and floor(y)
+  int   cy;
+  float bot;
+  float top;
+  bool  positive;
+};
+
+typedef std::vector<VolumeUpdate> VolumeUpdateVector;
+
 class Mapper
 {
   private:
 
+    // **** output of one insertion thread: its updates, bucketed by the
+    //      thread which merges them, and the range of cells they touch
+
+    struct InsertionWorker
+    {
+      std::vector<VolumeUpdateVector> partitions;
+
+      int minCX, minCY;
+      int maxCX, maxCY;
+
+      void add(int cx, int cy, float bot, float top, bool positive);
+    };
+
     Map map_;
 
     // **** map building options
-    
+
     bool modelNegativeSpace_;
     bool modelOutOfRange_;
 
-    void addPositiveBeamSpace(btVector3 obstacle);
-    void addNegativeBeamSpace(btVector3 origin, btVector3 obstacle);
+    // **** parallel insertion
+
+    WorkerPool * pool_;
+    std::vector<InsertionWorker> workers_;
+    std::vector<VolumeBuffer*>   buffers_;   // one per merging thread
+
+    // **** dense sensors
+
+    FrameInserter frameInserter_;
+    double maxFreeSpaceRange_;
+
+    // camera frame direction of every pixel, with z = 1, for the
+    // intrinsics and image size they were computed for
+    std::vector<btVector3> pixelRays_;
+    double pixelRaysK_[4];
+    int pixelRaysWidth_;
+    int pixelRaysHeight_;
+
+    void updatePixelRays(const sensor_msgs::CameraInfo& info, int width, int height);
+
+    // **** bounded memory
+
+    double memoryKeepRadius_;   // m
+
+    // after an insertion from a sensor at origin, with the map locked:
+    // bumps the map's version and keeps it within its memory budget
+    void endInsertion(const btVector3& origin);
+
+    void addBeams(const sensor_msgs::LaserScanConstPtr& scan, const btTransform& w2l,
+                  size_t begin, size_t end, InsertionWorker * worker);
+
+    void rasterizeBeams(const sensor_msgs::LaserScanConstPtr& scan, const btTransform& w2l, int index);
+    void mergeUpdates(int index);
+
+    void addBeamReading(btVector3 origin, btVector3 obstacle, InsertionWorker * worker);
+
+    void addPositiveBeamSpace(btVector3 obstacle, InsertionWorker * worker);
+    void addNegativeBeamSpace(btVector3 origin, btVector3 obstacle, InsertionWorker * worker);
+
+    // serial insertion (no worker): (cx, cy) must be covered by a
+    // map_.reserve(), and the volume waits in the first buffer
+    inline void addNVolume(int cx, int cy, float bot, float top, InsertionWorker * worker)
+    {
+      if (worker)
+      {
+        worker->add(cx, cy, bot, top, false);
+      }
+      else
+      {
+        int i, j;
+        Tile * tile = map_.getReservedTileAt(cx, cy, i, j);
+        buffers_[0]->addNVolume(tile, i, j, bot, top);
+      }
+    }
 
   public:
 
-    Mapper(double resolution, double sizeXmeters, double sizeYmeters);
+    Mapper(double resolution, double sizeXmeters, double sizeYmeters,
+           CellFormat cellFormat = CELL_FORMAT_FLOAT);
     virtual ~Mapper();
 
     void addLaserData (const sensor_msgs::LaserScanConstPtr& scan, const btTransform& w2l);
 
     void addBeamReading(btVector3 origin, btVector3 obstacle);
 
+    // **** dense sensors: endpoints are deduplicated by voxel, and beams
+    //      traced in bundles - see FrameInserter. The map is only locked
+    //      once the points are gathered. w2c and w2s transform from the
+    //      frame of the message into the world.
+
+    // depth image in the camera's optical frame, 16UC1 (mm) or 32FC1 (m).
+    // Returns false for other encodings, for an image whose data is
+    // shorter than its rows or not in this host's byte order, and for an
+    // uncalibrated camera.
+    bool addDepthImage(const sensor_msgs::ImageConstPtr& image, 
+                       const sensor_msgs::CameraInfoConstPtr& info, const btTransform& w2c);
+
+    // point cloud with float x, y and z fields; NaN points are skipped.
+    // Returns false if the fields are missing or not FLOAT32, or if the
+    // points, rows or data are too short to hold them, or not in this
+    // host's byte order.
+    bool addPointCloud(const sensor_msgs::PointCloud2ConstPtr& cloud, const btTransform& w2s);
+
+    // free space is only carved up to range meters from the sensor, 0 for
+    // no limit. Endpoints are inserted at any range.
+    void   setMaxFreeSpaceRange(double range);
+    double getMaxFreeSpaceRange() const;
+
+    // points and distinct voxels of the last dense frame
+    void getFrameStats(size_t& points, size_t& voxels) const;
+
+    // once the map takes more than bytes, tiles further than keepRadius
+    // meters from the sensor are evicted to the spill file after an
+    // insertion - see Map::setMemoryBudget(). 0 bytes for no budget.
+    bool setMemoryBudget(size_t bytes, const std::string& spillFilename, double keepRadius);
+
     void setModelNegativeSpace(bool modelNegativeSpace);
     bool getModelNegativeSpace() const;
 
+    // 1: insert on the calling thread. More than 1: split the beams of
+    // each scan between that many threads; the resulting map is
+    // identical to the single-threaded one.
+    void setInsertionThreads(int threads);
+    int  getInsertionThreads() const;
+
+    // N volumes rasterized so far, and the number of cell merges they
+    // were coalesced into
+    void getCoalescingStats(size_t& volumes, size_t& merges) const;
+
     Map * getMap();
 
 };
@@ -0,0 +1,115 @@
+#ifndef MVOG_MODEL_RAY_TRAVERSAL_H
+#define MVOG_MODEL_RAY_TRAVERSAL_H
+
+#include <cmath>
+#include <limits>
+
+#include <btBulletDynamicsCommon.h>
+
+namespace MVOG
+{
+
+// **** Amanatides-Woo traversal of the grid columns crossed by a beam.
+//      Coordinates are in grid units. The beam is parametrized by
+//      t in [0, 1] from origin to end point; tMax is the t at which
+//      the next x (y) cell wall is crossed, tDelta the t between walls.
+//
+//      A beam travelling in the negative direction of an axis starts
+//      in the lower cell when its origin lies exactly on a cell wall,
+//      and ties between an x and a y wall are broken towards y.
+
+class RayTraversal
+{
+  private:
+
+    int cellX_;
+    int cellY_;
+    int stepX_;
+    int stepY_;
+
+    double tMaxX_;
+    double tMaxY_;
+    double tDeltaX_;
+    double tDeltaY_;
+
+    double originZ_;
+    double beamZ_;
+    double entryZ_;
+    double entryT_;
+
+    static void initAxis(double origin, double beam, int& cell, int& step, double& tMax, double& tDelta)
+    {
+      if (beam > 0.0)
+      {
+        cell   = (int)floor(origin);
+        step   = 1;
+        tMax   = (cell + 1 - origin) / beam;
+        tDelta = 1.0 / beam;
+      }
+      else if (beam < 0.0)
+      {
+        cell   = (int)ceil(origin) - 1;
+        step   = -1;
+        tMax   = (cell - origin) / beam;
+        tDelta = -1.0 / beam;
+      }
+      else
+      {
+        cell   = (int)floor(origin);
+        step   = 0;
+        tMax   = std::numeric_limits<double>::infinity();
+        tDelta = std::numeric_limits<double>::infinity();
+      }
+    }
+
+  public:
+
+    RayTraversal(const btVector3& origin, const btVector3& end)
+    {
+      btVector3 beam = end - origin;
+
+      initAxis(origin.getX(), beam.getX(), cellX_, stepX_, tMaxX_, tDeltaX_);
+      initAxis(origin.getY(), beam.getY(), cellY_, stepY_, tMaxY_, tDeltaY_);
+
+      originZ_ = origin.getZ();
+      beamZ_   = beam.getZ();
+      entryZ_  = originZ_;
+      entryT_  = 0.0;
+    }
+
+    // the current cell, and the height and t at which the beam entered it
+    int getCellX() const { return cellX_; }
+    int getCellY() const { return cellY_; }
+    double getEntryZ() const { return entryZ_; }
+    double getEntryT() const { return entryT_; }
+
+    // true if the beam leaves the current cell before the end point,
+    // false if the current cell is the one holding the end point
+    bool leavesCell() const { return std::min(tMaxX_, tMaxY_) < 1.0; }
+
+    // height and t at which the beam leaves the current cell
+    double getExitZ() const { return originZ_ + std::min(tMaxX_, tMaxY_) * beamZ_; }
+    double getExitT() const { return std::min(tMaxX_, tMaxY_); }
+
+    // move on to the next cell
+    void step()
+    {
+      entryZ_ = getExitZ();
+      entryT_ = getExitT();
+
+      if (tMaxX_ < tMaxY_)
+      {
+        cellX_ += stepX_;
+        tMaxX_ += tDeltaX_;
+      }
+      else
+      {
+        cellY_ += stepY_;
+        tMaxY_ += tDeltaY_;
+      }
+    }
+};
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_RAY_TRAVERSAL_H
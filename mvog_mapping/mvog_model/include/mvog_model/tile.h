@@ -0,0 +1,274 @@
+#ifndef MVOG_MODEL_TILE_H
+#define MVOG_MODEL_TILE_H
+
+#include <bitset>
+
+#include <mvog_model/cell.h>
+#include <mvog_model/volume_allocator.h>
+
+namespace MVOG
+{
+
+const int TILE_BITS  = 6;
+const int TILE_SIZE  = 1 << TILE_BITS;  // cells per tile side
+const int TILE_MASK  = TILE_SIZE - 1;
+const int TILE_CELLS = TILE_SIZE * TILE_SIZE;
+
+// **** users of the tiles' change flags, each with its own set of flags
+
+enum ChangeChannel
+{
+  CHANGES_LEVELS,   // coarser levels of the map
+  CHANGES_EXPORT,   // GridExporter
+  CHANGES_DRAW,     // vertex buffers of the 3D viewer
+  CHANGES_DRAW_2D,  // textures of the 2D viewer
+  CHANGE_CHANNELS
+};
+
+// **** a fixed block of TILE_SIZE x TILE_SIZE cells, and a cache of the
+//      maximum likelihood volumes of its cells. The way the volumes are
+//      stored is up to the subclass.
+
+class Tile
+{
+  private:
+
+    // **** ML volume cache: the volumes of cell c are
+    //      mlVolumes_[mlStart_[c]] ... mlVolumes_[mlStart_[c+1] - 1].
+    //      mlStart_ is only allocated once the cache is first used.
+
+    MLVolumeVector mlVolumes_;
+    int * mlStart_;
+
+    std::bitset<TILE_CELLS> mlDirtyCells_;
+    bool mlDirty_;
+
+    // **** cells changed since the last takeChangedCells(), per channel
+
+    std::bitset<TILE_CELLS> changedCells_[CHANGE_CHANNELS];
+    bool changed_[CHANGE_CHANNELS];
+
+    unsigned long lastTouch_;
+    size_t countedBytes_;
+
+    void updateMLVolumes();
+
+    // non-copyable: subclasses own raw volume storage
+    Tile(const Tile&);
+    Tile& operator=(const Tile&);
+
+  protected:
+
+    bool resized_;        // grew or shrank without being touched
+
+    inline void setDirty(int i, int j)
+    {
+      mlDirtyCells_.set(i * TILE_SIZE + j);
+      mlDirty_ = true;
+
+      for (int c = 0; c < CHANGE_CHANNELS; c++)
+      {
+        changedCells_[c].set(i * TILE_SIZE + j);
+        changed_[c] = true;
+      }
+    }
+
+    // takes over the change flags of another tile, which it replaces
+    void moveChanges(Tile& tile);
+
+    // appends the ML volumes of cell (i, j)
+    virtual void createMLVolumes(int i, int j, MLVolumeVector& mlVolumes) = 0;
+
+    // called before the ML volumes of changed cells are recomputed.
+    // Returns false if the volumes cannot be read for now: the changed
+    // cells are then left for the next query.
+    virtual bool prepareMLVolumes() { return true; }
+
+    size_t getCacheMemorySize() const;
+
+    // frees the ML volume cache; it is rebuilt by the next query
+    void freeCache();
+
+  public:
+
+    Tile();
+    virtual ~Tile();
+
+    // **** i, j: cell indices inside the tile
+
+    virtual void addPVolume(int i, int j, float bot, float top) = 0;
+    virtual void addNVolume(int i, int j, float bot, float top) = 0;
+
+    // volumes sorted by their bottom, masses are kept
+    virtual void addPVolumes(int i, int j, const Volume * volumes, int count) = 0;
+    virtual void addNVolumes(int i, int j, const Volume * volumes, int count) = 0;
+
+    virtual void clearCell(int i, int j) = 0;
+
+    // volumes of cell (i, j), sorted by their bottom. Valid until the
+    // tile is changed, or the next call for the same kind of volumes.
+    virtual const Volume * getPVolumes(int i, int j, int& count) = 0;
+    virtual const Volume * getNVolumes(int i, int j, int& count) = 0;
+
+    // ML volumes of cell (i, j), recomputed only if the cell changed
+    // since the last call. Valid until the tile is changed.
+    const MLVolume * getMLVolumes(int i, int j, int& count)
+    {
+      if (mlDirty_) updateMLVolumes();
+
+      int c = i * TILE_SIZE + j;
+      count = mlStart_[c + 1] - mlStart_[c];
+      return count ? &mlVolumes_[mlStart_[c]] : NULL;
+    }
+
+    // flags every cell as changed on every channel, for a tile which
+    // replaces another one with other volumes
+    void setAllChanged();
+
+    // flags every cell as changed on the channel, so that its user
+    // reads the whole tile again
+    void setAllChanged(ChangeChannel channel)
+    {
+      changedCells_[channel].set();
+      changed_[channel] = true;
+    }
+
+    // true if any cell changed since the last takeChangedCells() on the
+    // channel
+    bool hasChangedCells(ChangeChannel channel) const { return changed_[channel]; }
+
+    // the cells changed since the last call on the channel, which are
+    // then forgotten there
+    void takeChangedCells(ChangeChannel channel, std::bitset<TILE_CELLS>& cells)
+    {
+      cells = changedCells_[channel];
+      changedCells_[channel].reset();
+      changed_[channel] = false;
+    }
+
+    // **** when the tile was last used by the map, in ticks of the map's
+    //      clock - see Map::enforceMemoryBudget()
+
+    void touch(unsigned long clock) { lastTouch_ = clock; }
+    unsigned long getLastTouch() const { return lastTouch_; }
+
+    // **** the tile's bytes as the map last counted them - see
+    //      Map::countResidentBytes()
+
+    void setCountedBytes(size_t bytes) { countedBytes_ = bytes; }
+    size_t getCountedBytes() const { return countedBytes_; }
+
+    // true once after the tile's size changed by a read, e.g. when its
+    // ML volumes were cached or it was reloaded from the spill file
+    bool takeResized()
+    {
+      bool resized = resized_;
+      resized_ = false;
+      return resized;
+    }
+
+    // true if the volumes of cell (i, j) are sorted and do not overlap
+    bool validate(int i, int j);
+
+    virtual size_t getMemorySize() const = 0;
+};
+
+// **** tile of cells of type CellType, each holding full precision
+//      volumes. The cell type is the storage policy. It provides:
+//
+//        typedef ... Allocator;   shared by the cells of a tile, with
+//                                 size_t getSlabBytes() const
+//        addPVolume(bot, top, allocator), addNVolume(bot, top, allocator)
+//        addPVolumes(volumes, count, allocator), the same for N
+//        clear(allocator)
+//        getPVolumes(), getPVolumesCount(), and the same for N
+//        createMLVolumes(mlVolumes)
+//        size_t getHeapSize() const: bytes owned outside the allocator
+
+template <class CellType>
+class CellTile: public Tile
+{
+  private:
+
+    CellType cells_[TILE_CELLS];
+
+    typename CellType::Allocator volumeAllocator_;
+
+  protected:
+
+    virtual void createMLVolumes(int i, int j, MLVolumeVector& mlVolumes)
+    {
+      getCell(i, j)->createMLVolumes(mlVolumes);
+    }
+
+  public:
+
+    CellTile() { }
+    virtual ~CellTile() { }
+
+    // cells should only be changed through the tile, so that the ML
+    // cache sees the change
+    CellType * getCell(int i, int j) { return &cells_[i * TILE_SIZE + j]; }
+    const CellType * getCell(int i, int j) const { return &cells_[i * TILE_SIZE + j]; }
+
+    typename CellType::Allocator& getVolumeAllocator() { return volumeAllocator_; }
+
+    virtual void addPVolume(int i, int j, float bot, float top)
+    {
+      getCell(i, j)->addPVolume(bot, top, volumeAllocator_);
+      setDirty(i, j);
+    }
+
+    virtual void addNVolume(int i, int j, float bot, float top)
+    {
+      getCell(i, j)->addNVolume(bot, top, volumeAllocator_);
+      setDirty(i, j);
+    }
+
+    virtual void addPVolumes(int i, int j, const Volume * volumes, int count)
+    {
+      getCell(i, j)->addPVolumes(volumes, count, volumeAllocator_);
+      setDirty(i, j);
+    }
+
+    virtual void addNVolumes(int i, int j, const Volume * volumes, int count)
+    {
+      getCell(i, j)->addNVolumes(volumes, count, volumeAllocator_);
+      setDirty(i, j);
+    }
+
+    virtual void clearCell(int i, int j)
+    {
+      getCell(i, j)->clear(volumeAllocator_);
+      setDirty(i, j);
+    }
+
+    virtual const Volume * getPVolumes(int i, int j, int& count)
+    {
+      count = getCell(i, j)->getPVolumesCount();
+      return getCell(i, j)->getPVolumes();
+    }
+
+    virtual const Volume * getNVolumes(int i, int j, int& count)
+    {
+      count = getCell(i, j)->getNVolumesCount();
+      return getCell(i, j)->getNVolumes();
+    }
+
+    virtual size_t getMemorySize() const
+    {
+      size_t heapSize = 0;
+      for (int c = 0; c < TILE_CELLS; c++)
+        heapSize += cells_[c].getHeapSize();
+
+      return sizeof(CellTile) + volumeAllocator_.getSlabBytes() + heapSize + getCacheMemorySize();
+    }
+};
+
+// **** tile of Cells: volumes kept in the tile's VolumeAllocator
+
+typedef CellTile<Cell> FloatTile;
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_TILE_H
@@ -0,0 +1,148 @@
+#ifndef MVOG_MODEL_TILE_SPILL_H
+#define MVOG_MODEL_TILE_SPILL_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/thread.hpp>
+
+#include <mvog_model/tile.h>
+#include <mvog_model/cell_format.h>
+
+namespace MVOG
+{
+
+struct SpillStats
+{
+  size_t   evictions;
+  size_t   reloads;
+  double   reloadTime;      // s, all reloads
+  double   maxReloadTime;   // s
+  uint64_t spilledBytes;    // records in the file
+  size_t   readErrors;      // reloads which failed, leaving the tile spilled
+};
+
+// **** temporary file holding evicted tiles, one record each, in the
+//      tile record format of map snapshots (see map_file.h). The space
+//      of a record is reused once its tile is reloaded. Safe to use from
+//      the insertion threads at the same time. The file is removed when
+//      the TileSpill is destroyed.
+
+class TileSpill
+{
+  private:
+
+    int fd_;
+    std::string filename_;
+
+    uint64_t fileSize_;
+    std::multimap<uint64_t, uint64_t> freeRecords_;  // size -> offset
+
+    SpillStats stats_;
+
+    std::vector<char> record_;
+
+    boost::mutex mutex_;
+
+    // non-copyable: owns the file
+    TileSpill(const TileSpill&);
+    TileSpill& operator=(const TileSpill&);
+
+  public:
+
+    TileSpill();
+    virtual ~TileSpill();
+
+    bool open(const std::string& filename);
+
+    // writes the volumes of the tile. Returns false if the file could not
+    // be written.
+    bool write(Tile& tile, uint64_t& offset, uint64_t& size);
+
+    // a new tile of the given format, with the volumes of the record at
+    // offset. The record's space is freed. Returns NULL, and keeps the
+    // record, if it could not be read.
+    Tile * read(uint64_t offset, uint64_t size, CellFormat cellFormat);
+
+    // the record at offset, which is kept. Returns false if it could not
+    // be read.
+    bool readRecord(uint64_t offset, uint64_t size, std::vector<char>& record);
+
+    // frees the record of a tile which is not needed any more
+    void release(uint64_t offset, uint64_t size);
+
+    void getStats(SpillStats& stats);
+};
+
+// **** stands in for an evicted tile in the map's directory. Any use of
+//      the tile reloads it from the spill file, and all calls are then
+//      passed on to the reloaded tile until it is evicted again. If the
+//      tile cannot be reloaded, it stays spilled and the next use tries
+//      again: until then its cells read as empty, and changes to them
+//      are dropped.
+
+class SpilledTile: public Tile
+{
+  private:
+
+    TileSpill * spill_;
+    CellFormat cellFormat_;
+
+    Tile * tile_;         // NULL while spilled
+    uint64_t offset_;
+    uint64_t size_;
+
+    // the reloaded tile, NULL if it could not be read
+    Tile * getTile();
+
+  protected:
+
+    virtual void createMLVolumes(int i, int j, MLVolumeVector& mlVolumes);
+    virtual bool prepareMLVolumes();
+
+  public:
+
+    // takes over the tile, which stays resident until evict()
+    SpilledTile(TileSpill * spill, Tile * tile, CellFormat cellFormat);
+    virtual ~SpilledTile();
+
+    // writes the tile to the spill file and frees it. Returns false, and
+    // keeps the tile, if it could not be written.
+    bool evict();
+
+    bool isResident() const { return tile_ != NULL; }
+
+    // the tile's record in the spill file, read without reloading the
+    // tile. Only for a tile which is not resident.
+    bool readRecord(std::vector<char>& record) const
+    {
+      return spill_->readRecord(offset_, size_, record);
+    }
+
+    virtual void addPVolume(int i, int j, float bot, float top);
+    virtual void addNVolume(int i, int j, float bot, float top);
+    virtual void addPVolumes(int i, int j, const Volume * volumes, int count);
+    virtual void addNVolumes(int i, int j, const Volume * volumes, int count);
+
+    virtual void clearCell(int i, int j);
+
+    virtual const Volume * getPVolumes(int i, int j, int& count);
+    virtual const Volume * getNVolumes(int i, int j, int& count);
+
+    virtual size_t getMemorySize() const;
+};
+
+// **** true for a tile evicted to the spill file: reading its volumes
+//      would load it back
+
+inline bool isSpilled(Tile * tile)
+{
+  SpilledTile * spilled = dynamic_cast<SpilledTile*>(tile);
+  return spilled && !spilled->isResident();
+}
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_TILE_SPILL_H
@@ -2,6 +2,7 @@
 #define MVOG_MODEL_VOLUME_H
 
 #include <algorithm>
+#include <vector>
 
 namespace MVOG 
 {
@@ -11,15 +12,15 @@ namespace MVOG
 
   void createVolume(float bot, float top, Volume& volume);
 
-  float getBot (const Volume& volume);
-  float getTop (const Volume& volume);
-  float getMass(const Volume& volume);
+  inline float getBot (const Volume& volume) { return volume[0]; }
+  inline float getTop (const Volume& volume) { return volume[1]; }
+  inline float getMass(const Volume& volume) { return volume[2]; }
 
   float getDensity (const Volume& volume);
 
-  void setBot (Volume& volume, float bot);
-  void setTop (Volume& volume, float top);
-  void setMass(Volume& volume, float mass);
+  inline void setBot (Volume& volume, float bot)  { volume[0] = bot;  }
+  inline void setTop (Volume& volume, float top)  { volume[1] = top;  }
+  inline void setMass(Volume& volume, float mass) { volume[2] = mass; }
 
   struct MLVolume
   {
@@ -27,8 +28,20 @@ namespace MVOG
     float top;
   };
 
+  typedef std::vector<MLVolume> MLVolumeVector;
+
   void createMLVolume(const Volume& volume, MLVolume& mlVolume);
 
+  // **** operations on sorted, non-overlapping volume lists
+
+  // merges two lists sorted by bottom into merged, which must hold
+  // aCount + bCount volumes. Returns the number of merged volumes.
+  int mergeVolumes(const Volume * a, int aCount, const Volume * b, int bCount, Volume * merged);
+
+  // maximum likelihood volumes from the positive and negative volumes
+  void createMLVolumes(const Volume * pVolumes, int pVolumesCount,
+                       const Volume * nVolumes, int nVolumesCount, MLVolumeVector& mlVolumes);
+
 }; // namespace MVOG
 
 #endif // MVOG_MODEL_VOLUME_H
@@ -0,0 +1,72 @@
+#ifndef MVOG_MODEL_VOLUME_ALLOCATOR_H
+#define MVOG_MODEL_VOLUME_ALLOCATOR_H
+
+#include <vector>
+
+#include <mvog_model/volume.h>
+
+namespace MVOG
+{
+
+// **** volume arrays are handed out in power-of-two size classes,
+//      carved from large slabs which are only returned when the
+//      allocator itself is destroyed
+
+const int    VOLUME_ALLOCATOR_CLASSES   = 24;
+const size_t VOLUME_ALLOCATOR_SLAB_SIZE = 16 * 1024; // bytes
+
+class VolumeAllocator
+{
+  private:
+
+    struct FreeBlock
+    {
+      FreeBlock * next;
+    };
+
+    std::vector<char*> slabs_;
+
+    char * slabPos_;
+    size_t slabLeft_;
+
+    size_t slabBytes_;   // total bytes requested from the heap
+    size_t usedBytes_;   // bytes currently handed out
+
+    FreeBlock * freeLists_[VOLUME_ALLOCATOR_CLASSES];
+
+    char * allocateFromSlab(size_t bytes);
+
+    // non-copyable: cells hold raw pointers into the slabs
+    VolumeAllocator(const VolumeAllocator&);
+    VolumeAllocator& operator=(const VolumeAllocator&);
+
+  public:
+
+    VolumeAllocator();
+    virtual ~VolumeAllocator();
+
+    // capacity must be a power of two
+    Volume * allocate(int capacity);
+    void deallocate(Volume * volumes, int capacity);
+
+    // release all slabs - invalidates every array handed out so far
+    void clear();
+
+    size_t getSlabBytes() const { return slabBytes_; }
+    size_t getUsedBytes() const { return usedBytes_; }
+
+    static int getSizeClass(int capacity);
+};
+
+// **** for cells which own their volume arrays
+
+class NullVolumeAllocator
+{
+  public:
+
+    size_t getSlabBytes() const { return 0; }
+};
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_VOLUME_ALLOCATOR_H
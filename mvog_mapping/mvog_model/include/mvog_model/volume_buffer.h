@@ -0,0 +1,85 @@
+#ifndef MVOG_MODEL_VOLUME_BUFFER_H
+#define MVOG_MODEL_VOLUME_BUFFER_H
+
+#include <vector>
+
+#include <mvog_model/tile.h>
+
+namespace MVOG
+{
+
+// **** collects the N volumes of one scan, bucketed by cell. Beams close
+//      to the sensor cross the same cells many times; a volume which
+//      overlaps the previous one of its cell is joined with it right
+//      away, and flush() merges each cell's volumes at once.
+
+class VolumeBuffer
+{
+  private:
+
+    struct Interval
+    {
+      Volume volume;
+      int    next;  // next interval of the same cell, -1 at the end
+    };
+
+    struct Bucket
+    {
+      Tile * tile;
+      int  * slots; // slot array of the tile
+      int    cell;  // i * TILE_SIZE + j
+      int    first; // intervals of the cell, in the order they were added
+      int    last;
+      int    count;
+    };
+
+    // bucket index of every cell of a tile, -1 if not touched
+    struct TileSlots
+    {
+      Tile * tile;
+      int  * slots;
+    };
+
+    std::vector<TileSlots> tiles_;      // tiles touched since the last flush
+    std::vector<int*>      freeSlots_;  // slot arrays, all -1, for reuse
+
+    Tile * lastTile_;
+    int  * lastSlots_;
+
+    std::vector<Bucket>   buckets_;
+    std::vector<Interval> intervals_;
+
+    std::vector<float>    scratch_;     // volumes of one cell, 3 floats each
+
+    size_t addedCount_;
+    size_t mergedCount_;
+
+    int * getSlots(Tile * tile);
+
+    // non-copyable: owns the slot arrays
+    VolumeBuffer(const VolumeBuffer&);
+    VolumeBuffer& operator=(const VolumeBuffer&);
+
+  public:
+
+    VolumeBuffer();
+    virtual ~VolumeBuffer();
+
+    // i, j: cell indices inside the tile
+    void addNVolume(Tile * tile, int i, int j, float bot, float top);
+
+    // merges the collected volumes into their cells and empties the buffer
+    void flush();
+
+    bool empty() const { return buckets_.empty(); }
+
+    // **** statistics since construction: volumes added, and the
+    //      number of cell merges they turned into
+
+    size_t getAddedCount()  const { return addedCount_;  }
+    size_t getMergedCount() const { return mergedCount_; }
+};
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_VOLUME_BUFFER_H
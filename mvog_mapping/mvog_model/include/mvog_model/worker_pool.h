@@ -0,0 +1,50 @@
+#ifndef MVOG_MODEL_WORKER_POOL_H
+#define MVOG_MODEL_WORKER_POOL_H
+
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+
+namespace MVOG
+{
+
+// **** a fixed set of threads which run the same job, each with its own
+//      index. The calling thread takes index 0, so a pool of N threads
+//      spawns N-1 workers.
+
+class WorkerPool
+{
+  private:
+
+    typedef boost::function<void (int)> Job;
+
+    int threads_;
+
+    std::vector<boost::thread*> workers_;
+
+    boost::mutex mutex_;
+    boost::condition_variable startCondition_;
+    boost::condition_variable doneCondition_;
+
+    Job job_;
+    unsigned int generation_;
+    int pending_;
+    bool shutdown_;
+
+    void workerLoop(int index);
+
+  public:
+
+    WorkerPool(int threads);
+    virtual ~WorkerPool();
+
+    int getThreads() const { return threads_; }
+
+    // runs job(0) ... job(threads - 1) concurrently, returns when all are done
+    void run(const Job& job);
+};
+
+}; // namespace MVOG
+
+#endif // MVOG_MODEL_WORKER_POOL_H
@@ -7,30 +7,100 @@ Cell::Cell()
 {
   pVolumesCount = 0;
   nVolumesCount = 0;
-  pVolumes = NULL;
-  nVolumes = NULL;
 }
 
 Cell::~Cell()
 {
-  delete[] pVolumes;
-  delete[] nVolumes;
-  
-  pVolumes = NULL;
-  nVolumes = NULL;
+  // volume arrays are owned by the map's allocator
+}
+
+void Cell::addPVolume(float bot, float top, VolumeAllocator& allocator)
+{
+	addVolume(bot, top, pStorage, pVolumesCount, allocator);
+}
+
+void Cell::addNVolume(float bot, float top, VolumeAllocator& allocator)
+{
+	addVolume(bot, top, nStorage, nVolumesCount, allocator);
+}
+
+void Cell::addPVolumes(const Volume * volumes, int count, VolumeAllocator& allocator)
+{
+  addVolumes(volumes, count, pStorage, pVolumesCount, allocator);
+}
+
+void Cell::addNVolumes(const Volume * volumes, int count, VolumeAllocator& allocator)
+{
+  addVolumes(volumes, count, nStorage, nVolumesCount, allocator);
 }
 
-void Cell::addPVolume(float bot, float top)
+int Cell::getCapacity(int volumesCount)
 {
-	addVolume(bot, top, pVolumes, pVolumesCount);
+  if (volumesCount <= CELL_INLINE_VOLUMES) return CELL_INLINE_VOLUMES;
+
+  int capacity = CELL_INLINE_VOLUMES;
+  while (capacity < volumesCount) capacity *= 2;
+  return capacity;
+}
+
+VolumeArray Cell::getArray(VolumeStorage& volumes, int volumesCount)
+{
+  if (volumesCount <= CELL_INLINE_VOLUMES) return volumes.local;
+  return volumes.heap;
+}
+
+const Volume * Cell::getArray(const VolumeStorage& volumes, int volumesCount)
+{
+  if (volumesCount <= CELL_INLINE_VOLUMES) return volumes.local;
+  return volumes.heap;
+}
+
+void Cell::resize(VolumeStorage& volumes, int& volumesCount, int newCount, 
+                  VolumeAllocator& allocator)
+{
+  // **** the capacity is implied by the count, so the storage only
+  //      moves when the count crosses a size class boundary
+
+  int capacity    = getCapacity(volumesCount);
+  int newCapacity = getCapacity(newCount);
+
+  if (capacity != newCapacity)
+  {
+    int keep = std::min(volumesCount, newCount);
+
+    if (newCapacity == CELL_INLINE_VOLUMES)
+    {
+      // heap -> inline
+      VolumeArray old = volumes.heap;
+      memcpy(volumes.local, old, keep*VOLUME_BYTE_SIZE);
+      allocator.deallocate(old, capacity);
+    }
+    else
+    {
+      // inline or heap -> heap
+      VolumeArray newVolumes = allocator.allocate(newCapacity);
+      memcpy(newVolumes, getArray(volumes, volumesCount), keep*VOLUME_BYTE_SIZE);
+
+      if (capacity != CELL_INLINE_VOLUMES)
+        allocator.deallocate(volumes.heap, capacity);
+
+      volumes.heap = newVolumes;
+    }
+  }
+
+  volumesCount = newCount;
 }
 
-void Cell::addNVolume(float bot, float top)
+void Cell::release(VolumeStorage& volumes, int& volumesCount, VolumeAllocator& allocator)
 {
-	addVolume(bot, top, nVolumes, nVolumesCount);
+  if (volumesCount > CELL_INLINE_VOLUMES)
+    allocator.deallocate(volumes.heap, getCapacity(volumesCount));
+
+  volumesCount = 0;
 }
 
-void Cell::addVolume(float bot, float top, VolumeArray& volumes, int& volumesCount)
+void Cell::addVolume(float bot, float top, VolumeStorage& storage, int& volumesCount,
+                     VolumeAllocator& allocator)
 {
   float minGap = 0.0; // FIXME: gap only works for 0.0, - gap of 1.0 needs code for adj. mass
 
@@ -38,6 +108,8 @@ void Cell::addVolume(float bot, float top, VolumeArray& volumes, int& volumesCou
   Volume v;
   createVolume(bot, top, v);
 
+  VolumeArray volumes = getArray(storage, volumesCount);
+
   // **** non-empty list: iterate over volumes
   for (int i = 0; i < volumesCount; i++)
   {
@@ -45,16 +117,12 @@ void Cell::addVolume(float bot, float top, VolumeArray& volumes, int& volumesCou
     if (getTop(v) < getBot(volumes[i]) - minGap)
     {
       // insert it at position i;
-      VolumeArray newVolumes = new Volume[volumesCount+1];
-
-      memcpy(newVolumes, volumes, i*VOLUME_BYTE_SIZE);
-      memcpy(newVolumes[i], v, VOLUME_BYTE_SIZE);
-      memcpy(newVolumes+i+1, volumes+i, (volumesCount-i)*VOLUME_BYTE_SIZE);
-
+      int count = volumesCount;
+      resize(storage, volumesCount, count + 1, allocator);
+      volumes = getArray(storage, volumesCount);
 
-      delete[] volumes;
-      volumes = newVolumes;  
-      volumesCount++;   
+      memmove(volumes+i+1, volumes+i, (count-i)*VOLUME_BYTE_SIZE);
+      memcpy(volumes[i], v, VOLUME_BYTE_SIZE);
 
       return;
     }
@@ -90,12 +158,11 @@ void Cell::addVolume(float bot, float top, VolumeArray& volumes, int& volumesCou
       // erase old volumes that were merged
       //printf ("erasing from %d to %d\n", i+1, stopIndex);
       
-      VolumeArray newVolumes = new Volume[volumesCount - (stopIndex - i) + 1];
-      memcpy(newVolumes+0, volumes, (i+1)*VOLUME_BYTE_SIZE);
-      memcpy(newVolumes+i+1, volumes + stopIndex, (volumesCount - stopIndex)*VOLUME_BYTE_SIZE);
-      delete[] volumes; 
-      volumes = newVolumes;
-      volumesCount = volumesCount - (stopIndex - i) + 1;
+      if (stopIndex > i+1)
+      {
+        memmove(volumes+i+1, volumes+stopIndex, (volumesCount - stopIndex)*VOLUME_BYTE_SIZE);
+        resize(storage, volumesCount, volumesCount - (stopIndex - i) + 1, allocator);
+      }
 
       return;
     }
@@ -103,17 +170,44 @@ void Cell::addVolume(float bot, float top, VolumeArray& volumes, int& volumesCou
 
   // insert it at position i;
 
-  VolumeArray newVolumes = new Volume[volumesCount+1];
-  memcpy(newVolumes, volumes, volumesCount*VOLUME_BYTE_SIZE);
-  memcpy(newVolumes[volumesCount], v, VOLUME_BYTE_SIZE);
-  delete[] volumes;
-  volumes = newVolumes;
+  int count = volumesCount;
+  resize(storage, volumesCount, count + 1, allocator);
+  memcpy(getArray(storage, volumesCount)[count], v, VOLUME_BYTE_SIZE);
+}
+
+void Cell::addVolumes(const Volume * batch, int batchCount, VolumeStorage& storage, int& volumesCount,
+                      VolumeAllocator& allocator)
+{
+  if (batchCount == 0) return;
+
+  // **** merge the two sorted lists. Short lists are merged on the stack.
+
+  int count = volumesCount;
+
+  const Volume * volumes = getArray(storage, count);
 
-  volumesCount++;
+  int      capacity = getCapacity(count + batchCount);
+  Volume   local[CELL_MERGE_VOLUMES];
+  Volume * merged = (count + batchCount <= CELL_MERGE_VOLUMES) ? local : allocator.allocate(capacity);
+
+
+  int mergedCount = mergeVolumes(volumes, count, batch, batchCount, merged);
+
+  // **** copy back - the storage only moves if the size class changes
+
+  if (getCapacity(mergedCount) != getCapacity(count))
+    resize(storage, volumesCount, mergedCount, allocator);
+
+  volumesCount = mergedCount;
+  memcpy(getArray(storage, volumesCount), merged, mergedCount*VOLUME_BYTE_SIZE);
+
+  if (merged != local) allocator.deallocate(merged, capacity);
 }
 
 void Cell::printPVolumes()
 {
+  VolumeArray pVolumes = getPVolumes();
+
   printf("*** CELL (+) %d ****\n", pVolumesCount);
 
   for (int i = 0; i < pVolumesCount; i++)
@@ -122,6 +216,8 @@ void Cell::printPVolumes()
 
 void Cell::printNVolumes()
 {
+  VolumeArray nVolumes = getNVolumes();
+
   printf("*** CELL (-) %d ****\n", nVolumesCount);
 
   for (int i = 0; i < nVolumesCount; i++)
@@ -143,6 +239,8 @@ bool Cell::getOccDensity(float z, float& density) const
 
 float Cell::getPDensity(float z) const
 {
+  const Volume * pVolumes = getArray(pStorage, pVolumesCount);
+
   for(int i = 0; i < pVolumesCount; ++i)
   {
     if (getBot(pVolumes[i]) <= z && z <= getTop(pVolumes[i]))
@@ -156,6 +254,8 @@ float Cell::getPDensity(float z) const
 
 float Cell::getNDensity(float z) const
 {
+  const Volume * nVolumes = getArray(nStorage, nVolumesCount);
+
   for(int i = 0; i < nVolumesCount; ++i)
   {
     if (getBot(nVolumes[i]) <= z && z <= getTop(nVolumes[i]))
@@ -169,6 +269,9 @@ float Cell::getNDensity(float z) const
 
 bool Cell::validate()
 {
+  VolumeArray pVolumes = getPVolumes();
+  VolumeArray nVolumes = getNVolumes();
+
   for (int i = 0; i<nVolumesCount-1; i++)
   {
     if (getTop(nVolumes[i]) >= getBot(nVolumes[i+1]))
@@ -184,176 +287,15 @@ bool Cell::validate()
   return true;
 }
 
-void Cell::clear()
+void Cell::clear(VolumeAllocator& allocator)
 {
-  pVolumesCount = 0;
-  nVolumesCount = 0;
-
-  delete[] pVolumes;
-  delete[] nVolumes;
-  
-  pVolumes = NULL;
-  nVolumes = NULL;
+  release(pStorage, pVolumesCount, allocator);
+  release(nStorage, nVolumesCount, allocator);
 }
 
 void Cell::createMLVolumes(MLVolumeVector& mlVolumes)
 {
-  if (pVolumesCount == 0 && nVolumesCount == 0) return;
-
-  int state = 0; // 0 - not in Positive, not in Negative
-                 // 1 - in P, not in N
-                 // 2 - not in P, in N
-                 // 3 - in P, in N
-
-  int cp = 0;   // index of current positive volume
-  int cn = 0;   // index of curentt negative volume
-
-  MLVolume ml;
-
-  //printf("Starting ML iteration\n");
-
-  while(true)
-  {
-    // **** STATE == 0: NOT IN P, NOT IN N ********************* 
-    if (state == 0)
-    {
-      //printf("\nstate == 0\n");
-
-      if (cp >= pVolumesCount)
-      { 
-        // no more positive volumes - exit loop
-        //printf("\tReached end of P volumes, EXIT\n");
-        break;
-      }
-      if (cn >= nVolumesCount)
-      {
-        // no more negative volumes - add all remaining positive and exit
-        while (cp < pVolumesCount)
-        {
-          createMLVolume(pVolumes[cp], ml);
-          mlVolumes.push_back(ml);
-          cp++;
-        }
-        //printf("\tReached end of N volumes, added all P, EXIT\n");
-        break;
-      }
-
-      if(getBot(pVolumes[cp]) <= getBot(nVolumes[cn]))
-      {
-        // entering a new P volume
-
-        ml.bot = getBot(pVolumes[cp]);
-
-        state = 1;
-        continue;
-      }
-      else
-      {
-        // enterint a new N volume - do nothing
-        state = 2;
-        continue;
-      }
-    } // state == 0
-    else if (state == 1)
-    {
-      //printf("\nstate == 1\n");
-
-      if (cn >= nVolumesCount || getTop(pVolumes[cp]) < getBot(nVolumes[cn]))
-      {
-        // no more N volumes, or next N does not intersect
-
-        ml.top = getTop(pVolumes[cp]);
-        mlVolumes.push_back(ml);
-        cp++; 
-  
-        state = 0;
-        continue;
-      }
-      else
-      {
-        // entering an N volume
-
-        if(getCombinedDensity(cp, cn) < 0.5)
-        { 
-          // N volume with high density
-          ml.top = getBot(nVolumes[cn]);
-          mlVolumes.push_back(ml);
-        }
-
-        state = 3;
-        continue;
-      }
-    } // state == 1
-    else if (state == 2)
-    {
-      //printf("\nstate == 2\n");
-
-      if (cp >= pVolumesCount || getBot(pVolumes[cp]) >= getTop(nVolumes[cn]))
-      {
-        // leaving N - next P does not intersect
-        cn++;
-
-        state = 0;
-        continue;
-      }
-      else
-      { 
-        // entering a P volume
-
-        if (getCombinedDensity(cp, cn) >= 0.5)
-        {
-          // entering P volume with high density
-          ml.bot = getBot(pVolumes[cp]);
-        }
-
-        state = 3;
-        continue;
-      }
-    } // state == 2
-    else // state == 3
-    {
-      //printf("\nstate == 3\n");
-
-      if (getTop(pVolumes[cp]) >= getTop(nVolumes[cn]))
-      {
-        // N volume ends
-
-        if (getCombinedDensity(cp, cn) < 0.5)
-        {
-          ml.bot = getTop(nVolumes[cn]);
-        }
-
-        cn++;
-        state = 1;
-        continue;
-      }
-      else
-      {
-        // P Volume ends
-
-        if (getCombinedDensity(cp, cn) >= 0.5)
-        {
-          ml.top = getTop(pVolumes[cp]);
-          mlVolumes.push_back(ml);  
-        }
-
-        cp++;
-        state = 2;
-        continue;
-      } // state == 3
-    }
-  }
-
-  //printf("\t Done ML iteration\n");
-
-}
-
-float Cell::getCombinedDensity(int cp, int cn)
-{
-  float pd = getDensity(pVolumes[cp]);
-  float nd = getDensity(nVolumes[cn]);
-  
-  return pd / (pd + nd);
+  MVOG::createMLVolumes(getPVolumes(), pVolumesCount, getNVolumes(), nVolumesCount, mlVolumes);
 }
 
 bool isObstacle(int pIndex, int nIndex)
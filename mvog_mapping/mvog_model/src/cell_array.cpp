@@ -1,15 +1,18 @@
-#include "mvog_model/cell.h"
+#include "mvog_model/cell_array.h"
 
 namespace MVOG
 {
 
-Cell::Cell()
+ArrayCell::ArrayCell()
 {
+  pVolumes = NULL;
+  nVolumes = NULL;
+
   pVolumesCount = 0;
   nVolumesCount = 0;
 }
 
-Cell::~Cell()
+ArrayCell::~ArrayCell()
 {
   delete[] pVolumes;
   delete[] nVolumes;
@@ -18,32 +21,55 @@ Cell::~Cell()
   nVolumes = NULL;
 }
 
-void Cell::addPVolume(double bot, double top)
+void ArrayCell::addPVolume(float bot, float top, Allocator&)
 {
 	addVolume(bot, top, pVolumes, pVolumesCount);
 }
 
-void Cell::addNVolume(double bot, double top)
+void ArrayCell::addNVolume(float bot, float top, Allocator&)
 {
 	addVolume(bot, top, nVolumes, nVolumesCount);
 }
 
-void Cell::addVolume(double bot, double top, Volume*& volumes, int& volumesCount)
+void ArrayCell::addPVolumes(const Volume * volumes, int count, Allocator&)
+{
+  addVolumes(volumes, count, pVolumes, pVolumesCount);
+}
+
+void ArrayCell::addNVolumes(const Volume * volumes, int count, Allocator&)
+{
+  addVolumes(volumes, count, nVolumes, nVolumesCount);
+}
+
+void ArrayCell::addVolumes(const Volume * batch, int count, Volume*& volumes, int& volumesCount)
+{
+  if (count == 0) return;
+
+  Volume * merged = new Volume[volumesCount + count];
+  int mergedCount = mergeVolumes(volumes, volumesCount, batch, count, merged);
+
+  delete[] volumes;
+  volumes = merged;
+  volumesCount = mergedCount;
+}
+
+void ArrayCell::addVolume(float bot, float top, Volume*& volumes, int& volumesCount)
 {
-  Volume v(bot, top);
+  Volume v;
+  createVolume(bot, top, v);
   float minGap = 0.0; // FIXME: gap only works for 0.0, - gap of 1.0 needs code for adj. mass
 
   // **** non-empty list: iterate over volumes
   for (int i = 0; i < volumesCount; i++)
   {
     // 1. below next volume, and does not intersect
-    if (v.getTop() < volumes[i].getBot() - minGap)
+    if (getTop(v) < getBot(volumes[i]) - minGap)
     {
       // insert it at position i;
       Volume * newVolumes = new Volume[volumesCount+1];
       memcpy(newVolumes, volumes, i*VOLUME_BYTE_SIZE);
-      newVolumes[i] = v;
-      memcpy(newVolumes+i+1, volumes, (volumesCount-i)*VOLUME_BYTE_SIZE);
+      memcpy(newVolumes[i], v, VOLUME_BYTE_SIZE);
+      memcpy(newVolumes+i+1, volumes+i, (volumesCount-i)*VOLUME_BYTE_SIZE);
       delete[] volumes;
       volumes = newVolumes;  
       volumesCount++;   
@@ -51,7 +77,7 @@ void Cell::addVolume(double bot, double top, Volume*& volumes, int& volumesCount
       return;
     }
     // 2. intersects with next volume
-    else if (v.getBot() <= volumes[i].getTop() + minGap)
+    else if (getBot(v) <= getTop(volumes[i]) + minGap)
     {
       // get all volumes that v intersects with
       int stopIndex  = i+1;
@@ -59,7 +85,7 @@ void Cell::addVolume(double bot, double top, Volume*& volumes, int& volumesCount
       int c = i+1;
       while(c < volumesCount )
       {
-        if (v.getTop() >= volumes[c].getBot() - minGap)
+        if (getTop(v) >= getBot(volumes[c]) - minGap)
         {
            c++;
            stopIndex = c;
@@ -68,26 +94,27 @@ void Cell::addVolume(double bot, double top, Volume*& volumes, int& volumesCount
       }
       // merge with new volume
 
-      volumes[i].setBot(std::min(volumes[i].getBot(), v.getBot()));
-      volumes[i].setTop(std::max(volumes[i].getTop(), v.getTop()));
-      volumes[i].setMass(volumes[i].getMass() + v.getMass()); // + FIXME: gap mass??
+      setBot (volumes[i], std::min(getBot(volumes[i]), getBot(v)));
+      setTop (volumes[i], std::max(getTop(volumes[i]), getTop(v)));
+      setMass(volumes[i], getMass(volumes[i]) + getMass(v)); // + FIXME: gap mass??
 
       // merge with rest
-      volumes[i].setTop(std::max(volumes[i].getTop(), volumes[stopIndex - 1].getTop()));
+      setTop(volumes[i], std::max(getTop(volumes[i]), getTop(volumes[stopIndex - 1])));
 
-      for (size_t t = i+1; t < stopIndex ; t++)
-         volumes[i].setMass(volumes[i].getMass() + volumes[t].getMass()); // + FIXME: gap mass??
+      for (int t = i+1; t < stopIndex ; t++)
+         setMass(volumes[i], getMass(volumes[i]) + getMass(volumes[t])); // + FIXME: gap mass??
 
       // erase old volumes that were merged
-      //printf ("erasing from %d to %d\n", i+1, stopIndex);
-      //volumes.erase(volumes.begin() + i+1, volumes.begin() + stopIndex);
-      
-      Volume * newVolumes = new Volume[volumesCount - (stopIndex - i) + 1];
-      memcpy(newVolumes+0, volumes, (i+1)*VOLUME_BYTE_SIZE);
-      memcpy(newVolumes+i+1, volumes + stopIndex, (volumesCount - stopIndex)*VOLUME_BYTE_SIZE);
-      delete[] volumes; 
-      volumes = newVolumes;
-      volumesCount = volumesCount - (stopIndex - i) + 1;
+
+      if (stopIndex > i+1)
+      {
+        Volume * newVolumes = new Volume[volumesCount - (stopIndex - i) + 1];
+        memcpy(newVolumes+0, volumes, (i+1)*VOLUME_BYTE_SIZE);
+        memcpy(newVolumes+i+1, volumes + stopIndex, (volumesCount - stopIndex)*VOLUME_BYTE_SIZE);
+        delete[] volumes; 
+        volumes = newVolumes;
+        volumesCount = volumesCount - (stopIndex - i) + 1;
+      }
 
       return;
     }
@@ -97,19 +124,36 @@ void Cell::addVolume(double bot, double top, Volume*& volumes, int& volumesCount
 
   Volume * newVolumes = new Volume[volumesCount+1];
   memcpy(newVolumes, volumes, volumesCount*VOLUME_BYTE_SIZE);
-  newVolumes[volumesCount] = v;
+  memcpy(newVolumes[volumesCount], v, VOLUME_BYTE_SIZE);
   delete[] volumes;
   volumes = newVolumes;
 
   volumesCount++;
 }
 
-void Cell::printPVolumes()
+void ArrayCell::clear(Allocator&)
+{
+  delete[] pVolumes;
+  delete[] nVolumes;
+
+  pVolumes = NULL;
+  nVolumes = NULL;
+
+  pVolumesCount = 0;
+  nVolumesCount = 0;
+}
+
+void ArrayCell::createMLVolumes(MLVolumeVector& mlVolumes)
+{
+  MVOG::createMLVolumes(pVolumes, pVolumesCount, nVolumes, nVolumesCount, mlVolumes);
+}
+
+void ArrayCell::printPVolumes()
 {
   printf("*** CELL (+) %d ****\n", pVolumesCount);
 
   for (int i = 0; i < pVolumesCount; i++)
-    printf("\t%d [%f, %f] [%f]\n", i, pVolumes[i].getBot(), pVolumes[i].getTop(), pVolumes[i].getMass());
+    printf("\t%d [%f, %f] [%f]\n", i, getBot(pVolumes[i]), getTop(pVolumes[i]), getMass(pVolumes[i]));
 }
 
 }
@@ -0,0 +1,34 @@
+#include "mvog_model/cell_format.h"
+
+#include "mvog_model/compact_tile.h"
+#include "mvog_model/cell_array.h"
+#include "mvog_model/cell_vector.h"
+
+namespace MVOG
+{
+
+const char * getCellFormatName(CellFormat cellFormat)
+{
+  switch (cellFormat)
+  {
+    case CELL_FORMAT_FLOAT:   return "float";
+    case CELL_FORMAT_COMPACT: return "compact";
+    case CELL_FORMAT_ARRAY:   return "array";
+    case CELL_FORMAT_VECTOR:  return "vector";
+  }
+
+  return "unknown";
+}
+
+Tile * createTile(CellFormat cellFormat)
+{
+  switch (cellFormat)
+  {
+    case CELL_FORMAT_COMPACT: return new CompactTile();
+    case CELL_FORMAT_ARRAY:   return new CellTile<ArrayCell>();
+    case CELL_FORMAT_VECTOR:  return new CellTile<VectorCell>();
+    default:                  return new FloatTile();
+  }
+}
+
+}; // namespace MVOG
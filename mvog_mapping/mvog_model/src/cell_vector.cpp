@@ -1,55 +1,88 @@
-#include "mvog_model/cell.h"
+#include "mvog_model/cell_vector.h"
 
 namespace MVOG
 {
 
-Cell::Cell()
+VectorCell::VectorCell()
 {
 
 
 }
 
-Cell::~Cell()
+VectorCell::~VectorCell()
 {
 
 
 }
 
-void Cell::addPVolume(double bot, double top)
+Volume * VectorCell::getArray(VolumeVector& volumes)
+{
+  if (volumes.empty()) return NULL;
+  return reinterpret_cast<Volume*>(&volumes[0]);
+}
+
+void VectorCell::addPVolume(float bot, float top, Allocator&)
 {
 	addVolume(bot, top, pVolumes);
 }
 
-void Cell::addNVolume(double bot, double top)
+void VectorCell::addNVolume(float bot, float top, Allocator&)
 {
 	addVolume(bot, top, nVolumes);
 }
 
-void Cell::addVolume(double bot, double top, VolumeVector& volumes)
+void VectorCell::addPVolumes(const Volume * volumes, int count, Allocator&)
+{
+  addVolumes(volumes, count, pVolumes);
+}
+
+void VectorCell::addNVolumes(const Volume * volumes, int count, Allocator&)
 {
-  Volume v(bot, top);
+  addVolumes(volumes, count, nVolumes);
+}
+
+void VectorCell::addVolumes(const Volume * batch, int count, VolumeVector& volumes)
+{
+  if (count == 0) return;
+
+  int volumesCount = volumes.size() / 3;
+
+  VolumeVector merged((volumesCount + count) * 3);
+  int mergedCount = mergeVolumes(getArray(volumes), volumesCount, batch, count, getArray(merged));
+
+  merged.resize(mergedCount * 3);
+  volumes.swap(merged);
+}
+
+void VectorCell::addVolume(float bot, float top, VolumeVector& volumes)
+{
+  Volume v;
+  createVolume(bot, top, v);
   float minGap = 0.0; // FIXME: gap only works for 0.0, - gap of 1.0 needs code for adj. mass
+
+  Volume * array = getArray(volumes);
+  int volumesCount = volumes.size() / 3;
     
   // **** non-empty list: iterate over volumes
-  for (size_t i = 0; i < volumes.size(); i++)
+  for (int i = 0; i < volumesCount; i++)
   {
     // 1. below next volume, and does not intersect
-    if (v.getTop() < volumes[i].getBot() - minGap)
+    if (getTop(v) < getBot(array[i]) - minGap)
     {
       // insert it at position i;
-      volumes.insert(volumes.begin() + i, v);
+      volumes.insert(volumes.begin() + i*3, v, v + 3);
       return;
     }
     // 2. intersects with next volume
-    else if (v.getBot() <= volumes[i].getTop() + minGap)
+    else if (getBot(v) <= getTop(array[i]) + minGap)
     {
       // get all volumes that v intersects with
       int stopIndex  = i+1;
 
       int c = i+1;
-      while(c < volumes.size() )
+      while(c < volumesCount )
       {
-        if (v.getTop() >= volumes[c].getBot() - minGap)
+        if (getTop(v) >= getBot(array[c]) - minGap)
         {
            c++;
            stopIndex = c;
@@ -59,33 +92,45 @@ void Cell::addVolume(double bot, double top, VolumeVector& volumes)
 
       // merge with new volume
 
-      volumes[i].setBot(std::min(volumes[i].getBot(), v.getBot()));
-      volumes[i].setTop(std::max(volumes[i].getTop(), v.getTop()));
-      volumes[i].setMass(volumes[i].getMass() + v.getMass()); // + FIXME: gap mass??
+      setBot (array[i], std::min(getBot(array[i]), getBot(v)));
+      setTop (array[i], std::max(getTop(array[i]), getTop(v)));
+      setMass(array[i], getMass(array[i]) + getMass(v)); // + FIXME: gap mass??
 
       // merge with rest
-      volumes[i].setTop(std::max(volumes[i].getTop(), volumes[stopIndex - 1].getTop()));
+      setTop(array[i], std::max(getTop(array[i]), getTop(array[stopIndex - 1])));
 
-      for (size_t t = i+1; t < stopIndex ; t++)
-         volumes[i].setMass(volumes[i].getMass() + volumes[t].getMass()); // + FIXME: gap mass??
+      for (int t = i+1; t < stopIndex ; t++)
+         setMass(array[i], getMass(array[i]) + getMass(array[t])); // + FIXME: gap mass??
 
       // erase old volumes that were merged
-      //printf ("erasing from %d to %d\n", i+1, stopIndex);
-      volumes.erase(volumes.begin() + i+1, volumes.begin() + stopIndex);
+      volumes.erase(volumes.begin() + (i+1)*3, volumes.begin() + stopIndex*3);
       
       return;
     }
   }
    
-  volumes.push_back(v);
+  volumes.insert(volumes.end(), v, v + 3);
 }
 
-void Cell::printPVolumes()
+void VectorCell::clear(Allocator&)
+{
+  VolumeVector().swap(pVolumes);
+  VolumeVector().swap(nVolumes);
+}
+
+void VectorCell::createMLVolumes(MLVolumeVector& mlVolumes)
+{
+  MVOG::createMLVolumes(getPVolumes(), getPVolumesCount(), getNVolumes(), getNVolumesCount(), mlVolumes);
+}
+
+void VectorCell::printPVolumes()
 {
   printf("-------------\n");
 
-  for (size_t i = 0; i < pVolumes.size(); i++)
-    printf("\t%d [%f, %f] [%f]\n", i, pVolumes[i].getBot(), pVolumes[i].getTop(), pVolumes[i].getMass());
+  Volume * array = getPVolumes();
+
+  for (int i = 0; i < getPVolumesCount(); i++)
+    printf("\t%d [%f, %f] [%f]\n", i, getBot(array[i]), getTop(array[i]), getMass(array[i]));
 }
 
 }
@@ -0,0 +1,263 @@
+#include "mvog_model/compact_tile.h"
+
+#include <cmath>
+#include <string.h>
+#include <algorithm>
+
+namespace MVOG
+{
+
+CompactTile::CompactTile()
+{
+  for (int c = 0; c < TILE_CELLS; c++)
+  {
+    cells_[c].offset        = 0;
+    cells_[c].pVolumesCount = 0;
+    cells_[c].nVolumesCount = 0;
+  }
+}
+
+CompactTile::~CompactTile()
+{
+
+}
+
+int CompactTile::getCapacity(int volumesCount)
+{
+  if (volumesCount == 0) return 0;
+
+  int capacity = 2;
+  while (capacity < volumesCount) capacity *= 2;
+  return capacity;
+}
+
+unsigned int CompactTile::allocate(int capacity)
+{
+  std::vector<unsigned int>& freeRanges = freeRanges_[VolumeAllocator::getSizeClass(capacity)];
+
+  if (!freeRanges.empty())
+  {
+    unsigned int offset = freeRanges.back();
+    freeRanges.pop_back();
+    return offset;
+  }
+
+  unsigned int offset = volumes_.size();
+  volumes_.resize(offset + capacity);
+  return offset;
+}
+
+void CompactTile::deallocate(unsigned int offset, int capacity)
+{
+  freeRanges_[VolumeAllocator::getSizeClass(capacity)].push_back(offset);
+}
+
+Volume * CompactTile::getScratch(std::vector<float>& scratch, int count)
+{
+  if (scratch.size() < (size_t)(count + 1) * 3) scratch.resize((count + 1) * 3);
+  return reinterpret_cast<Volume*>(&scratch[0]);
+}
+
+void CompactTile::quantize(Volume& volume)
+{
+  float bot = floor(getBot(volume) * COMPACT_HEIGHT_SCALE);
+  float top = ceil (getTop(volume) * COMPACT_HEIGHT_SCALE);
+
+  setBot(volume, std::max(bot, -32768.0f) / COMPACT_HEIGHT_SCALE);
+  setTop(volume, std::min(top,  32767.0f) / COMPACT_HEIGHT_SCALE);
+}
+
+void CompactTile::decode(const CompactCell& cell, Volume * pVolumes, Volume * nVolumes) const
+{
+  if (cell.pVolumesCount + cell.nVolumesCount == 0) return;
+
+  const CompactVolume * volumes = &volumes_[0] + cell.offset;
+
+  // **** either list may be skipped by passing NULL
+
+  if (pVolumes)
+    for (int v = 0; v < cell.pVolumesCount; v++)
+    {
+      setBot (pVolumes[v], volumes[v].bot  / COMPACT_HEIGHT_SCALE);
+      setTop (pVolumes[v], volumes[v].top  / COMPACT_HEIGHT_SCALE);
+      setMass(pVolumes[v], volumes[v].mass / COMPACT_MASS_SCALE);
+    }
+
+  volumes += cell.pVolumesCount;
+
+  if (nVolumes)
+    for (int v = 0; v < cell.nVolumesCount; v++)
+    {
+      setBot (nVolumes[v], volumes[v].bot  / COMPACT_HEIGHT_SCALE);
+      setTop (nVolumes[v], volumes[v].top  / COMPACT_HEIGHT_SCALE);
+      setMass(nVolumes[v], volumes[v].mass / COMPACT_MASS_SCALE);
+    }
+}
+
+void CompactTile::store(CompactCell& cell, const Volume * pVolumes, int pVolumesCount,
+                                           const Volume * nVolumes, int nVolumesCount)
+{
+  // **** the capacity is implied by the count: move the cell's range
+  //      only when it crosses a size class
+
+  int capacity    = getCapacity(cell.pVolumesCount + cell.nVolumesCount);
+  int newCapacity = getCapacity(pVolumesCount + nVolumesCount);
+
+  if (capacity != newCapacity)
+  {
+    if (capacity)    deallocate(cell.offset, capacity);
+    if (newCapacity) cell.offset = allocate(newCapacity);
+  }
+
+  cell.pVolumesCount = pVolumesCount;
+  cell.nVolumesCount = nVolumesCount;
+
+  if (!newCapacity) return;
+
+  // **** halve the masses until the largest fits
+
+  float maxMass = 0.0;
+  for (int v = 0; v < pVolumesCount; v++) maxMass = std::max(maxMass, getMass(pVolumes[v]));
+  for (int v = 0; v < nVolumesCount; v++) maxMass = std::max(maxMass, getMass(nVolumes[v]));
+
+  float massScale = COMPACT_MASS_SCALE;
+  while (maxMass * massScale > 65535.0f) massScale *= 0.5;
+
+  CompactVolume * volumes = &volumes_[0] + cell.offset;
+
+  for (int v = 0; v < pVolumesCount; v++, volumes++)
+  {
+    volumes->bot  = (short)(getBot(pVolumes[v]) * COMPACT_HEIGHT_SCALE);
+    volumes->top  = (short)(getTop(pVolumes[v]) * COMPACT_HEIGHT_SCALE);
+    volumes->mass = (unsigned short)std::max(1.0f, (float)floor(getMass(pVolumes[v]) * massScale + 0.5f));
+  }
+
+  for (int v = 0; v < nVolumesCount; v++, volumes++)
+  {
+    volumes->bot  = (short)(getBot(nVolumes[v]) * COMPACT_HEIGHT_SCALE);
+    volumes->top  = (short)(getTop(nVolumes[v]) * COMPACT_HEIGHT_SCALE);
+    volumes->mass = (unsigned short)std::max(1.0f, (float)floor(getMass(nVolumes[v]) * massScale + 0.5f));
+  }
+}
+
+void CompactTile::addVolumes(int i, int j, const Volume * batch, int count, bool positive)
+{
+  CompactCell& cell = cells_[i * TILE_SIZE + j];
+
+  int pCount = cell.pVolumesCount;
+  int nCount = cell.nVolumesCount;
+
+  Volume * pVolumes = getScratch(pScratch_, pCount + count);
+  Volume * nVolumes = getScratch(nScratch_, nCount + count);
+
+  decode(cell, pVolumes, nVolumes);
+
+  // **** snap the new volumes to the quantization grid before merging,
+  //      so that stored volumes never overlap after rounding
+
+  Volume * quantized = getScratch(mergeScratch_, 2 * count + (positive ? pCount : nCount));
+  Volume * merged    = quantized + count;
+
+  for (int v = 0; v < count; v++)
+  {
+    memcpy(quantized[v], batch[v], VOLUME_BYTE_SIZE);
+    quantize(quantized[v]);
+  }
+
+  if (positive)
+  {
+    int mergedCount = mergeVolumes(pVolumes, pCount, quantized, count, merged);
+    store(cell, merged, mergedCount, nVolumes, nCount);
+  }
+  else
+  {
+    int mergedCount = mergeVolumes(nVolumes, nCount, quantized, count, merged);
+    store(cell, pVolumes, pCount, merged, mergedCount);
+  }
+
+  setDirty(i, j);
+}
+
+void CompactTile::addPVolume(int i, int j, float bot, float top)
+{
+  Volume v;
+  createVolume(bot, top, v);
+  addVolumes(i, j, &v, 1, true);
+}
+
+void CompactTile::addNVolume(int i, int j, float bot, float top)
+{
+  Volume v;
+  createVolume(bot, top, v);
+  addVolumes(i, j, &v, 1, false);
+}
+
+void CompactTile::addPVolumes(int i, int j, const Volume * volumes, int count)
+{
+  if (count == 0) return;
+  addVolumes(i, j, volumes, count, true);
+}
+
+void CompactTile::addNVolumes(int i, int j, const Volume * volumes, int count)
+{
+  if (count == 0) return;
+  addVolumes(i, j, volumes, count, false);
+}
+
+void CompactTile::clearCell(int i, int j)
+{
+  store(cells_[i * TILE_SIZE + j], NULL, 0, NULL, 0);
+  setDirty(i, j);
+}
+
+const Volume * CompactTile::getPVolumes(int i, int j, int& count)
+{
+  const CompactCell& cell = cells_[i * TILE_SIZE + j];
+
+  Volume * pVolumes = getScratch(pScratch_, cell.pVolumesCount);
+  decode(cell, pVolumes, NULL);
+
+  count = cell.pVolumesCount;
+  return pVolumes;
+}
+
+const Volume * CompactTile::getNVolumes(int i, int j, int& count)
+{
+  const CompactCell& cell = cells_[i * TILE_SIZE + j];
+
+  Volume * nVolumes = getScratch(nScratch_, cell.nVolumesCount);
+  decode(cell, NULL, nVolumes);
+
+  count = cell.nVolumesCount;
+  return nVolumes;
+}
+
+void CompactTile::createMLVolumes(int i, int j, MLVolumeVector& mlVolumes)
+{
+  const CompactCell& cell = cells_[i * TILE_SIZE + j];
+
+  if (cell.pVolumesCount == 0 && cell.nVolumesCount == 0) return;
+
+  // **** decoded into the merge scratch, so that volumes returned by
+  //      getPVolumes() and getNVolumes() stay valid
+
+  Volume * pVolumes = getScratch(mergeScratch_, cell.pVolumesCount + cell.nVolumesCount);
+  Volume * nVolumes = pVolumes + cell.pVolumesCount;
+  decode(cell, pVolumes, nVolumes);
+
+  MVOG::createMLVolumes(pVolumes, cell.pVolumesCount, nVolumes, cell.nVolumesCount, mlVolumes);
+}
+
+size_t CompactTile::getMemorySize() const
+{
+  size_t size = sizeof(CompactTile) + volumes_.capacity() * sizeof(CompactVolume);
+
+  for (int c = 0; c < VOLUME_ALLOCATOR_CLASSES; c++)
+    size += freeRanges_[c].capacity() * sizeof(unsigned int);
+
+  size += (pScratch_.capacity() + nScratch_.capacity() + mergeScratch_.capacity()) * sizeof(float);
+
+  return size + getCacheMemorySize();
+}
+
+}; // namespace MVOG
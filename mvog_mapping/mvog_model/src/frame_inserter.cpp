@@ -0,0 +1,316 @@
+#include "mvog_model/frame_inserter.h"
+#include "mvog_model/ray_traversal.h"
+
+#include <cmath>
+#include <algorithm>
+#include <string.h>
+
+namespace MVOG
+{
+
+// **** voxel coordinates are packed into 21 bits each
+
+const int VOXEL_BITS   = 21;
+const int VOXEL_OFFSET = 1 << (VOXEL_BITS - 1);
+const unsigned long long VOXEL_MASK = (1ULL << VOXEL_BITS) - 1;
+
+const unsigned long long EMPTY_KEY  = ~0ULL;
+
+static inline size_t hashKey(unsigned long long key, size_t mask)
+{
+  return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+FrameInserter::FrameInserter(Map * map)
+{
+  map_ = map;
+
+  gridMinCX_ = 0;
+  gridMinCY_ = 0;
+  gridSizeX_ = 0;
+  gridSizeY_ = 0;
+
+  pointCount_  = 0;
+  bundleCount_ = 0;
+}
+
+FrameInserter::~FrameInserter()
+{
+
+}
+
+void FrameInserter::begin(const btVector3& origin, size_t maxPoints)
+{
+  origin_ = origin;
+
+  voxels_.clear();
+  pointCount_  = 0;
+  bundleCount_ = 0;
+
+  // **** at most half full, so that probes stay short
+
+  size_t size = 1024;
+  while (size < 2 * maxPoints) size *= 2;
+
+  if (table_.size() < size) table_.assign(size, EMPTY_KEY);
+}
+
+void FrameInserter::addPoint(const btVector3& point)
+{
+  double x = floor(point.getX());
+  double y = floor(point.getY());
+  double z = floor(point.getZ());
+
+  if (fabs(x) >= VOXEL_OFFSET || fabs(y) >= VOXEL_OFFSET || fabs(z) >= VOXEL_OFFSET) return;
+
+  pointCount_++;
+
+  Voxel voxel;
+  voxel.cx = (int)x;
+  voxel.cy = (int)y;
+  voxel.cz = (int)z;
+
+  unsigned long long key = ((voxel.cx + VOXEL_OFFSET) & VOXEL_MASK) << (2 * VOXEL_BITS) |
+                           ((voxel.cy + VOXEL_OFFSET) & VOXEL_MASK) << VOXEL_BITS |
+                           ((voxel.cz + VOXEL_OFFSET) & VOXEL_MASK);
+
+  // **** more points than announced: grow the table and place the
+  //      voxels again
+
+  if ((voxels_.size() + 1) * 2 > table_.size())
+  {
+    std::vector<unsigned long long> table(table_.size() * 2, EMPTY_KEY);
+    size_t mask = table.size() - 1;
+
+    for (size_t v = 0; v < voxels_.size(); v++)
+    {
+      unsigned long long k = table_[voxels_[v].slot];
+
+      size_t slot = hashKey(k, mask);
+      while (table[slot] != EMPTY_KEY) slot = (slot + 1) & mask;
+
+      table[slot] = k;
+      voxels_[v].slot = slot;
+    }
+
+    table_.swap(table);
+  }
+
+  size_t mask = table_.size() - 1;
+  size_t slot = hashKey(key, mask);
+
+  while (table_[slot] != EMPTY_KEY)
+  {
+    if (table_[slot] == key) return;
+    slot = (slot + 1) & mask;
+  }
+
+  table_[slot] = key;
+  voxel.slot   = slot;
+  voxels_.push_back(voxel);
+}
+
+void FrameInserter::end(bool modelNegativeSpace, double maxFreeRange)
+{
+  if (voxels_.empty()) return;
+
+  // **** leave the table empty for the next frame
+
+  for (size_t v = 0; v < voxels_.size(); v++)
+    table_[voxels_[v].slot] = EMPTY_KEY;
+
+  std::sort(voxels_.begin(), voxels_.end());
+
+  // **** make room for every cell the frame can touch
+
+  int ox = (int)floor(origin_.getX());
+  int oy = (int)floor(origin_.getY());
+
+  int minCX = ox, maxCX = ox;
+  int minCY = oy, maxCY = oy;
+
+  for (size_t v = 0; v < voxels_.size(); v++)
+  {
+    minCX = std::min(minCX, voxels_[v].cx);
+    minCY = std::min(minCY, voxels_[v].cy);
+    maxCX = std::max(maxCX, voxels_[v].cx);
+    maxCY = std::max(maxCY, voxels_[v].cy);
+  }
+
+  map_->reserve(minCX - 1, minCY - 1, maxCX + 1, maxCY + 1);
+
+  // **** one P volume per voxel, one merge per column
+
+  for (size_t v = 0; v < voxels_.size(); )
+  {
+    size_t w = v;
+    while (w < voxels_.size() && voxels_[w].cx == voxels_[v].cx && voxels_[w].cy == voxels_[v].cy) w++;
+
+    if (scratch_.size() < (w - v) * 3) scratch_.resize((w - v) * 3);
+    Volume * volumes = reinterpret_cast<Volume*>(&scratch_[0]);
+
+    for (size_t u = v; u < w; u++)
+      createVolume(voxels_[u].cz, voxels_[u].cz + 1, volumes[u - v]);
+
+    int i, j;
+    Tile * tile = map_->getReservedTileAt(voxels_[v].cx, voxels_[v].cy, i, j);
+    tile->addPVolumes(i, j, volumes, w - v);
+
+    v = w;
+  }
+
+  if (!modelNegativeSpace) return;
+
+  // **** free space: cells within the maximum range of the origin
+
+  if (maxFreeRange > 0.0)
+  {
+    int range = (int)ceil(maxFreeRange);
+    minCX = std::max(minCX, ox - range);
+    minCY = std::max(minCY, oy - range);
+    maxCX = std::min(maxCX, ox + range);
+    maxCY = std::min(maxCY, oy + range);
+  }
+
+  gridMinCX_ = minCX - 1;
+  gridMinCY_ = minCY - 1;
+  gridSizeX_ = maxCX - minCX + 3;
+  gridSizeY_ = maxCY - minCY + 3;
+
+  if (cells_.size() < (size_t)gridSizeX_ * gridSizeY_)
+    cells_.resize((size_t)gridSizeX_ * gridSizeY_, -1);
+
+  // **** one bundle per run of stacked voxels
+
+  for (size_t v = 0; v < voxels_.size(); )
+  {
+    size_t w = v + 1;
+    while (w < voxels_.size() && voxels_[w].cx == voxels_[v].cx && voxels_[w].cy == voxels_[v].cy &&
+           voxels_[w].cz == voxels_[w - 1].cz + 1) w++;
+
+    traceBundle(&voxels_[v], w - v, maxFreeRange);
+    bundleCount_++;
+
+    v = w;
+  }
+
+  flushFreeSpace();
+}
+
+void FrameInserter::traceBundle(const Voxel * voxels, int count, double maxFreeRange)
+{
+  // **** all beams of the bundle cross the same cells: trace the one
+  //      through the column axis, and follow the lowest and the highest
+  //      beam with the same t. In between, the beams are less than a
+  //      cell apart, so their N volumes leave no gap.
+
+  double oz = origin_.getZ();
+  double lowZ  = voxels[0].cz + 0.5;
+  double highZ = voxels[count - 1].cz + 0.5;
+
+  btVector3 target(voxels[0].cx + 0.5, voxels[0].cy + 0.5, oz);
+  btVector3 beam = target - origin_;
+
+  // **** the whole bundle stops where its longest beam reaches the
+  //      maximum range
+
+  double tLimit = 1.0;
+
+  if (maxFreeRange > 0.0)
+  {
+    double horizontal2 = beam.getX()*beam.getX() + beam.getY()*beam.getY();
+    double vertical    = std::max(fabs(lowZ - oz), fabs(highZ - oz));
+    double length      = sqrt(horizontal2 + vertical * vertical);
+
+    if (length > maxFreeRange) tLimit = maxFreeRange / length;
+  }
+
+  RayTraversal ray(origin_, origin_ + beam * tLimit);
+
+  while (ray.leavesCell())
+  {
+    double t0 = ray.getEntryT() * tLimit;
+    double t1 = ray.getExitT()  * tLimit;
+
+    addFreeSpace(ray.getCellX(), ray.getCellY(),
+                 oz + std::min(t0 * (lowZ  - oz), t1 * (lowZ  - oz)),
+                 oz + std::max(t0 * (highZ - oz), t1 * (highZ - oz)));
+    ray.step();
+  }
+
+  double t0 = ray.getEntryT() * tLimit;
+
+  if (tLimit < 1.0)
+  {
+    addFreeSpace(ray.getCellX(), ray.getCellY(),
+                 oz + std::min(t0 * (lowZ  - oz), tLimit * (lowZ  - oz)),
+                 oz + std::max(t0 * (highZ - oz), tLimit * (highZ - oz)));
+    return;
+  }
+
+  // **** last cell: as for laser beams, only steep beams leave a
+  //      negative volume below (above) their obstacle
+
+  double horizontal = sqrt(beam.getX()*beam.getX() + beam.getY()*beam.getY());
+
+  for (int v = 0; v < count; v++)
+  {
+    double z = voxels[v].cz + 0.5;
+    double slopeZYX = (z - oz) / horizontal;
+    double pz = oz + t0 * (z - oz);
+
+    if(slopeZYX > 1.0)
+    {
+      double ez = z - 0.5;
+      if (ez > pz) addFreeSpace(ray.getCellX(), ray.getCellY(), pz, ez);
+    }
+    else if(slopeZYX < -1.0)
+    {
+      double ez = z + 0.5;
+      if (ez < pz) addFreeSpace(ray.getCellX(), ray.getCellY(), ez, pz);
+    }
+  }
+}
+
+void FrameInserter::flushFreeSpace()
+{
+  for (size_t t = 0; t < touchedCells_.size(); t++)
+  {
+    int c = touchedCells_[t];
+
+    // **** the intervals of a cell do not overlap: sort them by their
+    //      bottom, at density 1
+
+    int count = 0;
+    for (int n = cells_[c]; n != -1; n = intervals_[n].next) count++;
+
+    if (scratch_.size() < (size_t)count * 3) scratch_.resize(count * 3);
+    Volume * volumes = reinterpret_cast<Volume*>(&scratch_[0]);
+
+    int sorted = 0;
+    for (int n = cells_[c]; n != -1; n = intervals_[n].next)
+    {
+      const Interval& interval = intervals_[n];
+
+      int i = sorted;
+      while (i > 0 && getBot(volumes[i-1]) > interval.bot)
+      {
+        memcpy(volumes[i], volumes[i-1], VOLUME_BYTE_SIZE);
+        i--;
+      }
+      createVolume(interval.bot, interval.top, volumes[i]);
+      sorted++;
+    }
+
+    int i, j;
+    Tile * tile = map_->getReservedTileAt(gridMinCX_ + c / gridSizeY_, gridMinCY_ + c % gridSizeY_, i, j);
+    tile->addNVolumes(i, j, volumes, count);
+
+    cells_[c] = -1;
+  }
+
+  touchedCells_.clear();
+  intervals_.clear();
+}
+
+}; // namespace MVOG
@@ -0,0 +1,143 @@
+#include "mvog_model/grid_exporter.h"
+
+#include <cmath>
+#include <limits>
+
+namespace MVOG
+{
+
+GridExporter::GridExporter(Map * map)
+{
+  map_ = map;
+
+  bandMin_ = 0.0;
+  bandMax_ = 2.0;
+  all_     = true;
+}
+
+GridExporter::~GridExporter()
+{
+
+}
+
+void GridExporter::setBand(double minZ, double maxZ)
+{
+  bandMin_ = minZ;
+  bandMax_ = maxZ;
+  all_     = true;
+}
+
+void GridExporter::getPatches(std::vector<GridPatch>& patches)
+{
+  patches.clear();
+
+  std::bitset<TILE_CELLS> changed;
+
+  for (int tx = 0; tx < map_->getTilesX(); tx++)
+  for (int ty = 0; ty < map_->getTilesY(); ty++)
+  {
+    Tile * tile = map_->getTile(tx, ty);
+    if (!tile || (!all_ && !tile->hasChangedCells(CHANGES_EXPORT))) continue;
+
+    // **** a tile evicted to the spill file is not reloaded to be
+    //      exported: its flags are kept for a call when it is resident
+
+    if (isSpilled(tile))
+    {
+      if (all_) tile->setAllChanged(CHANGES_EXPORT);
+      continue;
+    }
+
+    tile->takeChangedCells(CHANGES_EXPORT, changed);
+    if (all_) changed.set();
+
+    // **** bounding box of the changed cells
+
+    int minI = TILE_SIZE, maxI = -1;
+    int minJ = TILE_SIZE, maxJ = -1;
+
+    for (int c = 0; c < TILE_CELLS; c++)
+    {
+      if (!changed.test(c)) continue;
+
+      minI = std::min(minI, c / TILE_SIZE);
+      maxI = std::max(maxI, c / TILE_SIZE);
+      minJ = std::min(minJ, c % TILE_SIZE);
+      maxJ = std::max(maxJ, c % TILE_SIZE);
+    }
+
+    if (maxI < 0) continue;
+
+    patches.resize(patches.size() + 1);
+    GridPatch& patch = patches.back();
+
+    patch.minCX = tx * TILE_SIZE + minI - map_->getOffsetX();
+    patch.minCY = ty * TILE_SIZE + minJ - map_->getOffsetY();
+    patch.sizeX = maxI - minI + 1;
+    patch.sizeY = maxJ - minJ + 1;
+
+    int cells = patch.sizeX * patch.sizeY;
+    patch.occupancy.resize(cells);
+    patch.maxHeight.resize(cells);
+    patch.minClearance.resize(cells);
+
+    for (int j = minJ; j <= maxJ; j++)
+    for (int i = minI; i <= maxI; i++)
+      exportCell(tile, i, j, patch, (j - minJ) * patch.sizeX + (i - minI));
+  }
+
+  all_ = false;
+}
+
+void GridExporter::exportCell(Tile * tile, int i, int j, GridPatch& patch, int index)
+{
+  double resolution = map_->getResolution();
+
+  // **** the band, in grid units
+
+  float bandBot = bandMin_ / resolution;
+  float bandTop = bandMax_ / resolution;
+
+  int count;
+  const MLVolume * mlVolumes = tile->getMLVolumes(i, j, count);
+
+  if (count == 0)
+  {
+    patch.maxHeight[index]    = std::numeric_limits<float>::quiet_NaN();
+    patch.minClearance[index] = std::numeric_limits<float>::quiet_NaN();
+  }
+  else
+  {
+    patch.maxHeight[index] = mlVolumes[count - 1].top * resolution;
+
+    if (count > 1)
+      patch.minClearance[index] = (mlVolumes[1].bot - mlVolumes[0].top) * resolution;
+    else
+      patch.minClearance[index] = std::numeric_limits<float>::infinity();
+  }
+
+  for (int v = 0; v < count; v++)
+  {
+    if (mlVolumes[v].bot <= bandTop && mlVolumes[v].top >= bandBot)
+    {
+      patch.occupancy[index] = GRID_OCCUPIED;
+      return;
+    }
+  }
+
+  int nCount;
+  const Volume * nVolumes = tile->getNVolumes(i, j, nCount);
+
+  for (int v = 0; v < nCount; v++)
+  {
+    if (getBot(nVolumes[v]) <= bandTop && getTop(nVolumes[v]) >= bandBot)
+    {
+      patch.occupancy[index] = GRID_FREE;
+      return;
+    }
+  }
+
+  patch.occupancy[index] = GRID_UNKNOWN;
+}
+
+}; // namespace MVOG
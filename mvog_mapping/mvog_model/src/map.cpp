@@ -1,177 +1,960 @@
 #include "mvog_model/map.h"
+#include "mvog_model/map_file.h"
+#include "mvog_model/ray_traversal.h"
+#include "mvog_model/worker_pool.h"
+
+#include <cstring>
+
+#include <boost/bind.hpp>
 
 namespace MVOG
 {
 
-Map::Map (double resolution, double sizeXmeters, double sizeYmeters)
+Map::Map (double resolution, double sizeXmeters, double sizeYmeters,
+          CellFormat cellFormat)
 {
   resolution_ = resolution;
+  cellFormat_ = cellFormat;
+
+  int cellsX = sizeXmeters / resolution_ + 1;
+  int cellsY = sizeYmeters / resolution_ + 1;
 
-  sizeX_ = sizeXmeters / resolution_ + 1;
-  sizeY_ = sizeYmeters / resolution_ + 1;
+  tilesX_ = (cellsX + TILE_SIZE - 1) / TILE_SIZE;
+  tilesY_ = (cellsY + TILE_SIZE - 1) / TILE_SIZE;
+
+  sizeX_ = tilesX_ * TILE_SIZE;
+  sizeY_ = tilesY_ * TILE_SIZE;
   
   printf("Map size:  %f x %f meters\n", sizeXmeters, sizeYmeters);
-  printf("Grid size: %d x %d cells\n", sizeX_, sizeY_);
+  printf("Grid size: %d x %d cells (%d x %d tiles)\n", sizeX_, sizeY_, tilesX_, tilesY_);
+  printf("Cells:     %s\n", getCellFormatName(cellFormat_));
+
+  offsetX_ = (tilesX_ / 2) * TILE_SIZE;
+  offsetY_ = (tilesY_ / 2) * TILE_SIZE;
+
+  tiles_ = new Tile*[tilesX_ * tilesY_];
+  for (int t = 0; t < tilesX_ * tilesY_; t++)
+    tiles_[t] = NULL;
+
+  spill_         = NULL;
+  memoryBudget_  = 0;
+  residentBytes_ = 0;
+  tileBytes_     = 0;
+  recountAll_    = false;
+  clock_         = 0;
+  version_       = 0;
+}
 
-  offsetX_ = sizeX_ / 2;
-  offsetY_ = sizeY_ / 2;
+Map::Map (const Map * finer)
+{
+  resolution_ = finer->resolution_ * 2.0;
+  cellFormat_ = finer->cellFormat_;
 
-  grid_ = initializeGrid(sizeX_, sizeY_);
+  tilesX_ = std::max(1, finer->tilesX_ / 2);
+  tilesY_ = std::max(1, finer->tilesY_ / 2);
+
+  sizeX_ = tilesX_ * TILE_SIZE;
+  sizeY_ = tilesY_ * TILE_SIZE;
+
+  offsetX_ = (tilesX_ / 2) * TILE_SIZE;
+  offsetY_ = (tilesY_ / 2) * TILE_SIZE;
+
+  tiles_ = new Tile*[tilesX_ * tilesY_];
+  for (int t = 0; t < tilesX_ * tilesY_; t++)
+    tiles_[t] = NULL;
+
+  spill_         = NULL;
+  memoryBudget_  = 0;
+  residentBytes_ = 0;
+  tileBytes_     = 0;
+  recountAll_    = false;
+  clock_         = 0;
+  version_       = 0;
 }
 
 Map::~Map ()
 {
+  for (size_t l = 0; l < levels_.size(); l++)
+    delete levels_[l];
+
+  for (int t = 0; t < tilesX_ * tilesY_; t++)
+    delete tiles_[t];
 
+  delete[] tiles_;
 
+  // after the tiles, which give their records back
+  delete spill_;
 }
 
 void Map::validate()
 {
-  for (int i = 0; i < sizeX_; i++)
-  for (int j = 0; j < sizeY_; j++)
-    grid_[i][j].validate();
+  for (int tx = 0; tx < tilesX_; tx++)
+  for (int ty = 0; ty < tilesY_; ty++)
+  {
+    Tile * tile = getTile(tx, ty);
+    if (!tile) continue;
+
+    for (int i = 0; i < TILE_SIZE; i++)
+    for (int j = 0; j < TILE_SIZE; j++)
+      tile->validate(i, j);
+  }
 }
 
-void Map::deleteGrid()
+void Map::growDirectory(int cx, int cy)
 {
-   for (int i = 0; i < sizeX_; i++) delete[] grid_[i];
-   delete[] grid_;
+  // **** double the directory in the direction of (cx, cy). Only tile
+  //      pointers are moved - the tiles and their cells stay in place
+
+  int newTilesX = tilesX_;
+  int newTilesY = tilesY_;
+  int shiftX = 0; // in tiles
+  int shiftY = 0;
+
+  if (cx < 0)
+  {
+    shiftX = tilesX_;
+    newTilesX *= 2;
+  }
+  else if (cx >= sizeX_) newTilesX *= 2;
+
+  if (cy < 0)
+  {
+    shiftY = tilesY_;
+    newTilesY *= 2;
+  }
+  else if (cy >= sizeY_) newTilesY *= 2;
+
+  Tile ** newTiles = new Tile*[newTilesX * newTilesY];
+  for (int t = 0; t < newTilesX * newTilesY; t++)
+    newTiles[t] = NULL;
+
+  for (int tx = 0; tx < tilesX_; tx++)
+  for (int ty = 0; ty < tilesY_; ty++)
+    newTiles[(tx + shiftX) * newTilesY + (ty + shiftY)] = tiles_[tx * tilesY_ + ty];
+
+  delete[] tiles_;
+  tiles_ = newTiles;
+
+  tilesX_ = newTilesX;
+  tilesY_ = newTilesY;
+
+  sizeX_ = tilesX_ * TILE_SIZE;
+  sizeY_ = tilesY_ * TILE_SIZE;
+
+  offsetX_ += shiftX * TILE_SIZE;
+  offsetY_ += shiftY * TILE_SIZE;
+}
+
+Tile* Map::getTile(double x, double y, int& i, int& j)
+{
+  return getTileAt(floor(x), floor(y), i, j);
 }
 
-Cell** Map::initializeGrid(int sizeX, int sizeY)
+void Map::reserve(int minCX, int minCY, int maxCX, int maxCY)
 {
-  Cell** grid;
+  growToInclude(minCX, minCY);
+  growToInclude(maxCX, maxCY);
+}
+
+void Map::growToInclude(int cx, int cy)
+{
+  while (cx + offsetX_ < 0 || cx + offsetX_ >= sizeX_ || 
+         cy + offsetY_ < 0 || cy + offsetY_ >= sizeY_)
+  {
+    growDirectory(cx + offsetX_, cy + offsetY_);
+  }
+}
 
-  grid = new Cell*[sizeX];
-  for (int i = 0; i < sizeX; i++)
-    grid[i] = new Cell[sizeY];
+Tile* Map::getTileAt(int cx, int cy, int& i, int& j)
+{
+  growToInclude(cx, cy);
 
-  return grid;
+  return getReservedTileAt(cx, cy, i, j);
 }
 
 Cell* Map::getCell(double x, double y)
 {
-  int cx = floor(x) + offsetX_;
-  int cy = floor(y) + offsetY_;
+  int i, j;
+  FloatTile * tile = dynamic_cast<FloatTile*>(getTile(x, y, i, j));
+  return tile ? tile->getCell(i, j) : NULL;
+}
 
-  if (cx < 0)
-  { 
-    // initialize new grid
-    MVOG::Cell** newGrid = initializeGrid(sizeX_*2, sizeY_);
+void Map::addPVolume(double x, double y, float bot, float top)
+{
+  int i, j;
+  Tile * tile = getTile(x, y, i, j);
+  tile->addPVolume(i, j, bot, top);
+}
+
+void Map::addNVolume(double x, double y, float bot, float top)
+{
+  int i, j;
+  Tile * tile = getTile(x, y, i, j);
+  tile->addNVolume(i, j, bot, top);
+}
+
+const MLVolume * Map::getMLVolumes(double x, double y, int& count)
+{
+  return getMLVolumesAt((int)floor(x), (int)floor(y), count);
+}
+
+const MLVolume * Map::getMLVolumesAt(int cx, int cy, int& count)
+{
+  count = 0;
+
+  cx += offsetX_;
+  cy += offsetY_;
+
+  if (cx < 0 || cx >= sizeX_ || cy < 0 || cy >= sizeY_) return NULL;
+
+  Tile * tile = tiles_[(cx >> TILE_BITS) * tilesY_ + (cy >> TILE_BITS)];
+  if (!tile) return NULL;
+
+  tile->touch(clock_);
+  return tile->getMLVolumes(cx & TILE_MASK, cy & TILE_MASK, count);
+}
+
+// **** binary search in a sorted, non-overlapping list: the volume with
+//      bot <= z <= top, or NULL
+
+static const Volume * findVolume(const Volume * volumes, int count, float z)
+{
+  int lo = 0, hi = count; // first volume with bot > z
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (getBot(volumes[mid]) > z) hi = mid;
+    else lo = mid + 1;
+  }
+
+  if (lo == 0 || getTop(volumes[lo - 1]) < z) return NULL;
+  return &volumes[lo - 1];
+}
+
+static bool isInside(const MLVolume * mlVolumes, int count, float z)
+{
+  int lo = 0, hi = count;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (mlVolumes[mid].bot > z) hi = mid;
+    else lo = mid + 1;
+  }
+
+  return lo > 0 && mlVolumes[lo - 1].top >= z;
+}
+
+void Map::sortPoints(const std::vector<btVector3>& points, std::vector<PointKey>& keys) const
+{
+  const int    RADIX_BITS  = 11;
+  const size_t RADIX_MIN   = 4096; // smaller batches use std::sort
+
+  keys.clear();
+  keys.reserve(points.size());
+
+  for (size_t p = 0; p < points.size(); p++)
+  {
+    int cx = (int)floor(points[p].getX() / resolution_) + offsetX_;
+    int cy = (int)floor(points[p].getY() / resolution_) + offsetY_;
+
+    if (cx < 0 || cx >= sizeX_ || cy < 0 || cy >= sizeY_) continue;
+
+    unsigned long long tile = (cx >> TILE_BITS) * tilesY_ + (cy >> TILE_BITS);
+
+    PointKey key;
+    key.key   = tile * TILE_CELLS + (cx & TILE_MASK) * TILE_SIZE + (cy & TILE_MASK);
+    key.index = p;
+    keys.push_back(key);
+  }
+
+  if (keys.size() < RADIX_MIN)
+  {
+    std::sort(keys.begin(), keys.end());
+    return;
+  }
 
-    // copy information over
-    for (int i = 0; i < sizeX_; i++)
-    for (int j = 0; j < sizeY_; j++)
+  // **** LSD radix sort, stable in every pass
+
+  unsigned long long maxKey = (unsigned long long)tilesX_ * tilesY_ * TILE_CELLS - 1;
+
+  std::vector<PointKey> buffer(keys.size());
+  std::vector<size_t> starts(1 << RADIX_BITS);
+
+  for (int shift = 0; (maxKey >> shift) != 0; shift += RADIX_BITS)
+  {
+    std::fill(starts.begin(), starts.end(), 0);
+
+    for (size_t k = 0; k < keys.size(); k++)
+      starts[(keys[k].key >> shift) & ((1 << RADIX_BITS) - 1)]++;
+
+    size_t sum = 0;
+    for (size_t d = 0; d < starts.size(); d++)
     {
-      newGrid[i + sizeX_][j] = grid_[i][j];
-      newGrid[i + sizeX_][j].pVolumes = new Volume[grid_[i][j].pVolumesCount];
-      newGrid[i + sizeX_][j].nVolumes = new Volume[grid_[i][j].nVolumesCount];
+      size_t count = starts[d];
+      starts[d] = sum;
+      sum += count;
+    }
+
+    for (size_t k = 0; k < keys.size(); k++)
+      buffer[starts[(keys[k].key >> shift) & ((1 << RADIX_BITS) - 1)]++] = keys[k];
+
+    keys.swap(buffer);
+  }
+}
+
+void Map::getOccDensities(const std::vector<btVector3>& points, std::vector<float>& densities)
+{
+  densities.assign(points.size(), -1.0);
+
+  // **** in the order given: sorting the points by cell costs more than
+  //      the lookups it saves. A run of points in one cell reads its
+  //      volume lists once.
+
+  long long lastCell = -1;
+  int pCount = 0, nCount = 0;
+  const Volume * pVolumes = NULL;
+  const Volume * nVolumes = NULL;
 
-      memcpy(newGrid[i + sizeX_][j].pVolumes, grid_[i][j].pVolumes, grid_[i][j].pVolumesCount * VOLUME_BYTE_SIZE);
-      memcpy(newGrid[i + sizeX_][j].nVolumes, grid_[i][j].nVolumes, grid_[i][j].nVolumesCount * VOLUME_BYTE_SIZE);
+  for (size_t p = 0; p < points.size(); p++)
+  {
+    int cx = (int)floor(points[p].getX() / resolution_) + offsetX_;
+    int cy = (int)floor(points[p].getY() / resolution_) + offsetY_;
+
+    if (cx < 0 || cx >= sizeX_ || cy < 0 || cy >= sizeY_) continue;
+
+    long long cell = (long long)cx * sizeY_ + cy;
+    if (cell != lastCell)
+    {
+      lastCell = cell;
+      pCount = nCount = 0;
+
+      Tile * tile = tiles_[(cx >> TILE_BITS) * tilesY_ + (cy >> TILE_BITS)];
+      if (tile)
+      {
+        pVolumes = tile->getPVolumes(cx & TILE_MASK, cy & TILE_MASK, pCount);
+        nVolumes = tile->getNVolumes(cx & TILE_MASK, cy & TILE_MASK, nCount);
+      }
     }
-    // delete old grid
-    deleteGrid();
 
-    // change size variables
-    offsetX_ += sizeX_;
-    sizeX_ *= 2;
-    grid_ = newGrid;
+    if (!pCount && !nCount) continue;
+
+    float z = points[p].getZ() / resolution_;
 
-    return getCell(x, y);
+    const Volume * pv = findVolume(pVolumes, pCount, z);
+    const Volume * nv = findVolume(nVolumes, nCount, z);
+
+    float pd = pv ? getDensity(*pv) : 0.0;
+    float nd = nv ? getDensity(*nv) : 0.0;
+
+    if (pd != 0 || nd != 0) densities[p] = pd / (pd + nd);
   }
-  if (cx >= sizeX_)
-  { 
-    // initialize new grid
-    MVOG::Cell** newGrid = initializeGrid(sizeX_*2, sizeY_);
+}
+
+void Map::getOccupied(const std::vector<btVector3>& points, std::vector<char>& occupied)
+{
+  occupied.assign(points.size(), 0);
+
+  // **** in the order given, as getOccDensities
+
+  long long lastCell = -1;
+  int count = 0;
+  const MLVolume * mlVolumes = NULL;
+
+  for (size_t p = 0; p < points.size(); p++)
+  {
+    int cx = (int)floor(points[p].getX() / resolution_) + offsetX_;
+    int cy = (int)floor(points[p].getY() / resolution_) + offsetY_;
+
+    if (cx < 0 || cx >= sizeX_ || cy < 0 || cy >= sizeY_) continue;
 
-    // copy information over
-    for (int i = 0; i < sizeX_; i++)
-    for (int j = 0; j < sizeY_; j++)
+    long long cell = (long long)cx * sizeY_ + cy;
+    if (cell != lastCell)
     {
-      newGrid[i][j] = grid_[i][j];
-      newGrid[i][j].pVolumes = new Volume[grid_[i][j].pVolumesCount];
-      newGrid[i][j].nVolumes = new Volume[grid_[i][j].nVolumesCount];
+      lastCell = cell;
+      count = 0;
 
-      memcpy(newGrid[i][j].pVolumes, grid_[i][j].pVolumes, grid_[i][j].pVolumesCount * VOLUME_BYTE_SIZE);
-      memcpy(newGrid[i][j].nVolumes, grid_[i][j].nVolumes, grid_[i][j].nVolumesCount * VOLUME_BYTE_SIZE);
+      Tile * tile = tiles_[(cx >> TILE_BITS) * tilesY_ + (cy >> TILE_BITS)];
+      if (tile) mlVolumes = tile->getMLVolumes(cx & TILE_MASK, cy & TILE_MASK, count);
     }
 
-    // delete old grid
-    deleteGrid();
+    float z = points[p].getZ() / resolution_;
+    if (count && isInside(mlVolumes, count, z)) occupied[p] = 1;
+  }
+}
 
-    // change size variables
-    sizeX_ *= 2;
-    grid_ = newGrid;
+bool Map::findHit(const MLVolume * mlVolumes, int count, double z0, double z1, double& hitZ)
+{
+  if (z0 <= z1)
+  {
+    // **** going up: the first volume with top >= z0
+    int lo = 0, hi = count;
+    while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (mlVolumes[mid].top < z0) lo = mid + 1;
+      else hi = mid;
+    }
 
-    return getCell(x, y);
+    if (lo == count || mlVolumes[lo].bot > z1) return false;
+    hitZ = std::max(z0, (double)mlVolumes[lo].bot);
   }
-  if (cy < 0)
-  { 
-    // initialize new grid
-    MVOG::Cell** newGrid = initializeGrid(sizeX_, sizeY_*2);
+  else
+  {
+    // **** going down: the last volume with bot <= z0
+    int lo = 0, hi = count;
+    while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (mlVolumes[mid].bot > z0) hi = mid;
+      else lo = mid + 1;
+    }
+
+    if (lo == 0 || mlVolumes[lo - 1].top < z1) return false;
+    hitZ = std::min(z0, (double)mlVolumes[lo - 1].top);
+  }
+
+  return true;
+}
+
+void Map::getSegmentsOccupied(const std::vector<btVector3>& starts, const std::vector<btVector3>& ends,
+                              std::vector<char>& occupied)
+{
+  occupied.assign(starts.size(), 0);
+
+  // **** segments which start in the same cell are traversed one after
+  //      the other, while their tiles are still in the cache
+
+  std::vector<PointKey> keys;
+  sortPoints(starts, keys);
+
+  for (size_t k = 0; k < keys.size(); k++)
+  {
+    int s = keys[k].index;
+
+    btVector3 start = starts[s] / resolution_;
+    btVector3 end   = ends[s]   / resolution_;
+
+    RayTraversal ray(start, end);
+
+    while (true)
+    {
+      bool last = !ray.leavesCell();
+      double z1 = last ? end.getZ() : ray.getExitZ();
+
+      int count;
+      const MLVolume * mlVolumes = getMLVolumesAt(ray.getCellX(), ray.getCellY(), count);
+
+      double hitZ;
+      if (count && findHit(mlVolumes, count, ray.getEntryZ(), z1, hitZ))
+      {
+        occupied[s] = 1;
+        break;
+      }
+
+      if (last) break;
+      ray.step();
+    }
+  }
+}
+
+bool Map::castRay(const btVector3& origin, const btVector3& direction, double maxRange, btVector3& hit)
+{
+  // **** no ray without a direction or a range
+
+  double length = direction.length();
+  if (!(length > 0.0) || !(maxRange > 0.0)) return false;
+
+  btVector3 start = origin / resolution_;
+  btVector3 end   = (origin + direction * (maxRange / length)) / resolution_;
+  btVector3 beam  = end - start;
+
+  RayTraversal ray(start, end);
+
+  bool entered = false;
+
+  while (true)
+  {
+    bool last = !ray.leavesCell();
+    double z1 = last ? end.getZ() : ray.getExitZ();
+
+    // **** a straight ray which has left the map does not come back
+
+    int cx = ray.getCellX() + offsetX_;
+    int cy = ray.getCellY() + offsetY_;
+    bool inside = (cx >= 0 && cx < sizeX_ && cy >= 0 && cy < sizeY_);
+
+    if (!inside && entered) return false;
+    entered = entered || inside;
+
+    int count;
+    const MLVolume * mlVolumes = getMLVolumesAt(ray.getCellX(), ray.getCellY(), count);
+
+    double hitZ;
+    if (count && findHit(mlVolumes, count, ray.getEntryZ(), z1, hitZ))
+    {
+      // **** a horizontal ray hits where it enters the cell
+      double t = ray.getEntryT();
+      if (beam.getZ() != 0.0) t = std::max(t, (hitZ - start.getZ()) / beam.getZ());
+
+      hit = (start + beam * t) * resolution_;
+      return true;
+    }
+
+    if (last) return false;
+    ray.step();
+  }
+}
+
+void Map::clearCell(double x, double y)
+{
+  int i, j;
+  Tile * tile = getTile(x, y, i, j);
+  tile->clearCell(i, j);
+}
+
+void Map::setLevels(int levels)
+{
+  // **** bring the levels which are kept up to date first: new ones are
+  //      built from the one below
+
+  updateLevels();
+
+  levels = std::max(levels, 0);
+
+  while ((int)levels_.size() > levels)
+  {
+    delete levels_.back();
+    levels_.pop_back();
+  }
+
+  while ((int)levels_.size() < levels)
+  {
+    Map * source = levels_.empty() ? this : levels_.back();
+    Map * level  = new Map(source);
 
-    // copy information over
-    for (int i = 0; i < sizeX_; i++)
-    for (int j = 0; j < sizeY_; j++)
+    updateLevel(source, level, true);
+    levels_.push_back(level);
+  }
+}
+
+Map * Map::getLevel(int level)
+{
+  if (level == 0) return this;
+  if (level < 0 || level > (int)levels_.size()) return NULL;
+
+  updateLevels();
+  return levels_[level - 1];
+}
+
+void Map::updateLevels()
+{
+  Map * source = this;
+
+  for (size_t l = 0; l < levels_.size(); l++)
+  {
+    updateLevel(source, levels_[l], false);
+    source = levels_[l];
+  }
+}
+
+void Map::updateLevel(Map * source, Map * target, bool all)
+{
+  const int HALF_SIZE = TILE_SIZE / 2;
+
+  std::bitset<TILE_CELLS> changed;
+
+  for (int tx = 0; tx < source->tilesX_; tx++)
+  for (int ty = 0; ty < source->tilesY_; ty++)
+  {
+    Tile * tile = source->getTile(tx, ty);
+    if (!tile || (!all && !tile->hasChangedCells(CHANGES_LEVELS))) continue;
+
+    tile->takeChangedCells(CHANGES_LEVELS, changed);
+    if (all) changed.set();
+
+    // **** one parent per 2 x 2 block of changed children
+
+    std::bitset<TILE_CELLS / 4> parents;
+
+    for (int c = 0; c < TILE_CELLS; c++)
+      if (changed.test(c))
+        parents.set((c / TILE_SIZE >> 1) * HALF_SIZE + (c % TILE_SIZE >> 1));
+
+    // grid coordinates of cell (0, 0) of the tile: even, since the
+    // offsets are multiples of TILE_SIZE
+
+    int cx = tx * TILE_SIZE - source->offsetX_;
+    int cy = ty * TILE_SIZE - source->offsetY_;
+
+    for (int p = 0; p < TILE_CELLS / 4; p++)
     {
-      newGrid[i][j + sizeY_] = grid_[i][j];
-      newGrid[i][j + sizeY_].pVolumes = new Volume[grid_[i][j].pVolumesCount];
-      newGrid[i][j + sizeY_].nVolumes = new Volume[grid_[i][j].nVolumesCount];
+      if (!parents.test(p)) continue;
+
+      int i = (p / HALF_SIZE) * 2;
+      int j = (p % HALF_SIZE) * 2;
 
-      memcpy(newGrid[i][j + sizeY_].pVolumes, grid_[i][j].pVolumes, grid_[i][j].pVolumesCount * VOLUME_BYTE_SIZE);
-      memcpy(newGrid[i][j + sizeY_].nVolumes, grid_[i][j].nVolumes, grid_[i][j].nVolumesCount * VOLUME_BYTE_SIZE);
+      int pi, pj;
+      Tile * parent = target->getTileAt(cx / 2 + i / 2, cy / 2 + j / 2, pi, pj);
+
+      parent->clearCell(pi, pj);
+
+      int count = mergeChildren(tile, i, j, true);
+      if (count) parent->addPVolumes(pi, pj, reinterpret_cast<Volume*>(&levelVolumes_[0]), count);
+
+      count = mergeChildren(tile, i, j, false);
+      if (count) parent->addNVolumes(pi, pj, reinterpret_cast<Volume*>(&levelVolumes_[0]), count);
     }
-    // delete old grid
-    deleteGrid();
+  }
+}
 
-    // change size variables
-    offsetY_ += sizeY_;
-    sizeY_ *= 2;
-    grid_ = newGrid;
+int Map::mergeChildren(Tile * tile, int i, int j, bool positive)
+{
+  int mergedCount = 0;
+
+  for (int c = 0; c < 4; c++)
+  {
+    int count;
+    const Volume * volumes = positive ? tile->getPVolumes(i + (c >> 1), j + (c & 1), count) :
+                                        tile->getNVolumes(i + (c >> 1), j + (c & 1), count);
+    if (count == 0) continue;
+
+    // **** heights and masses halve: the densities stay the same
+
+    if (childVolumes_.size() < (size_t)count * 3) childVolumes_.resize(count * 3);
+    Volume * child = reinterpret_cast<Volume*>(&childVolumes_[0]);
+
+    for (int v = 0; v < count; v++)
+    {
+      setBot (child[v], getBot (volumes[v]) * 0.5f);
+      setTop (child[v], getTop (volumes[v]) * 0.5f);
+      setMass(child[v], getMass(volumes[v]) * 0.5f);
+    }
+
+    if (mergedVolumes_.size() < (size_t)(mergedCount + count) * 3) 
+      mergedVolumes_.resize((mergedCount + count) * 3);
+
+    mergedCount = mergeVolumes(mergedCount ? reinterpret_cast<Volume*>(&levelVolumes_[0]) : NULL, mergedCount,
+                               child, count, reinterpret_cast<Volume*>(&mergedVolumes_[0]));
 
-    return getCell(x, y);
+    levelVolumes_.swap(mergedVolumes_);
+  }
+
+  return mergedCount;
+}
+
+bool Map::merge(Map& other, const btTransform& transform, int threads)
+{
+  if (&other == this) return false;
+
+  if (fabs(other.resolution_ - resolution_) > resolution_ * 1e-9)
+  {
+    printf("Map::merge: resolutions differ (%f, %f)\n", resolution_, other.resolution_);
+    return false;
+  }
+
+  if (transform.getBasis()[2].getZ() < 1.0 - 1e-6)
+  {
+    printf("Map::merge: only rotations about z are supported\n");
+    return false;
   }
-  if (cy >= sizeY_)
-  { 
-    // initialize new grid
-    MVOG::Cell** newGrid = initializeGrid(sizeX_, sizeY_*2);
 
-    // copy information over
-    for (int i = 0; i < sizeX_; i++)
-    for (int j = 0; j < sizeY_; j++)
+  // **** footprint of other's tiles, in this map's grid units
+
+  bool empty = true;
+  double minX = 0.0, minY = 0.0, maxX = 0.0, maxY = 0.0;
+
+  for (int tx = 0; tx < other.tilesX_; tx++)
+  for (int ty = 0; ty < other.tilesY_; ty++)
+  {
+    if (!other.getTile(tx, ty)) continue;
+
+    for (int corner = 0; corner < 4; corner++)
     {
-      newGrid[i][j] = grid_[i][j];
-      newGrid[i][j].pVolumes = new Volume[grid_[i][j].pVolumesCount];
-      newGrid[i][j].nVolumes = new Volume[grid_[i][j].nVolumesCount];
+      double x = (tx + (corner >> 1)) * TILE_SIZE - other.offsetX_;
+      double y = (ty + (corner &  1)) * TILE_SIZE - other.offsetY_;
+
+      btVector3 p = transform * btVector3(x * resolution_, y * resolution_, 0.0);
+
+      x = p.getX() / resolution_;
+      y = p.getY() / resolution_;
+
+      if (empty)
+      {
+        minX = maxX = x;
+        minY = maxY = y;
+        empty = false;
+      }
+      else
+      {
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+      }
+    }
+  }
+
+  if (empty) return true;
+
+  // **** grow the directory once, so that the threads never move it
+
+  int minCX = floor(minX) - 1;
+  int minCY = floor(minY) - 1;
+  int maxCX = floor(maxX) + 1;
+  int maxCY = floor(maxY) + 1;
+
+  reserve(minCX, minCY, maxCX, maxCY);
+
+  MergeJob job;
+  job.source  = &other;
+  job.threads = std::max(threads, 1);
+  job.records.resize(other.tilesX_ * other.tilesY_);
+
+  for (int tx = (minCX + offsetX_) >> TILE_BITS; tx <= (maxCX + offsetX_) >> TILE_BITS; tx++)
+  for (int ty = (minCY + offsetY_) >> TILE_BITS; ty <= (maxCY + offsetY_) >> TILE_BITS; ty++)
+    job.tiles.push_back(tx * tilesY_ + ty);
+
+  // **** the inverse transform, for cell centers, in grid units
+
+  btTransform inverse = transform.inverse();
+
+  btVector3 origin = inverse * btVector3(0.0, 0.0, 0.0);
+  btVector3 ex = inverse * btVector3(1.0, 0.0, 0.0) - origin;
+  btVector3 ey = inverse * btVector3(0.0, 1.0, 0.0) - origin;
+
+  job.exX = ex.getX();
+  job.exY = ex.getY();
+  job.eyX = ey.getX();
+  job.eyY = ey.getY();
+
+  job.originX = origin.getX() / resolution_ + 0.5 * (job.exX + job.eyX);
+  job.originY = origin.getY() / resolution_ + 0.5 * (job.exY + job.eyY);
+
+  job.dz = transform.getOrigin().getZ() / resolution_;
+
+  WorkerPool pool(job.threads);
+
+  pool.run(boost::bind(&Map::packMergeTiles, this, &job, _1));
+  pool.run(boost::bind(&Map::fillMergeTiles, this, &job, _1));
 
-      memcpy(newGrid[i][j].pVolumes, grid_[i][j].pVolumes, grid_[i][j].pVolumesCount * VOLUME_BYTE_SIZE);
-      memcpy(newGrid[i][j].nVolumes, grid_[i][j].nVolumes, grid_[i][j].nVolumesCount * VOLUME_BYTE_SIZE);
+  markChanged();
+
+  return true;
+}
+
+void Map::packMergeTiles(MergeJob * job, int thread)
+{
+  for (size_t t = thread; t < job->records.size(); t += job->threads)
+  {
+    Tile * tile = job->source->tiles_[t];
+    if (!tile) continue;
+
+    // **** spilled tiles are read as they are in the spill file, which
+    //      is the record format: reloading them would grow the source
+
+    if (isSpilled(tile))
+      static_cast<SpilledTile*>(tile)->readRecord(job->records[t]);
+    else
+      MapFile::packTile(*tile, job->records[t]);
+  }
+}
+
+void Map::fillMergeTiles(MergeJob * job, int thread)
+{
+  const Map * source = job->source;
+
+  std::vector<float> shifted;   // 3 floats per volume
+
+  for (size_t t = thread; t < job->tiles.size(); t += job->threads)
+  {
+    Tile *& tile = tiles_[job->tiles[t]];
+
+    int cx0 = (job->tiles[t] / tilesY_) * TILE_SIZE - offsetX_;
+    int cy0 = (job->tiles[t] % tilesY_) * TILE_SIZE - offsetY_;
+
+    for (int i = 0; i < TILE_SIZE; i++)
+    for (int j = 0; j < TILE_SIZE; j++)
+    {
+      int cx = cx0 + i;
+      int cy = cy0 + j;
+
+      int sx = (int)floor(job->originX + job->exX * cx + job->eyX * cy) + source->offsetX_;
+      int sy = (int)floor(job->originY + job->exY * cx + job->eyY * cy) + source->offsetY_;
+
+      if (sx < 0 || sx >= source->sizeX_ || sy < 0 || sy >= source->sizeY_) continue;
+
+      const std::vector<char>& record = 
+        job->records[(sx >> TILE_BITS) * source->tilesY_ + (sy >> TILE_BITS)];
+
+      if (record.empty()) continue;
+
+      int c = (sx & TILE_MASK) * TILE_SIZE + (sy & TILE_MASK);
+
+      for (int positive = 1; positive >= 0; positive--)
+      {
+        int count;
+        const Volume * volumes = MapFile::getRecordVolumes(&record[0], c, positive, count);
+        if (count == 0) continue;
+
+        if (job->dz != 0.0f)
+        {
+          if (shifted.size() < (size_t)count * 3) shifted.resize(count * 3);
+          Volume * s = reinterpret_cast<Volume*>(&shifted[0]);
+
+          for (int v = 0; v < count; v++)
+          {
+            setBot (s[v], getBot(volumes[v]) + job->dz);
+            setTop (s[v], getTop(volumes[v]) + job->dz);
+            setMass(s[v], getMass(volumes[v]));
+          }
+
+          volumes = s;
+        }
+
+        if (!tile) tile = createTile(cellFormat_);
+
+        if (positive)
+          tile->addPVolumes(i, j, volumes, count);
+        else
+          tile->addNVolumes(i, j, volumes, count);
+      }
+    }
+
+    if (tile) tile->touch(clock_);
+  }
+}
+
+bool Map::setMemoryBudget(size_t bytes, const std::string& spillFilename)
+{
+  memoryBudget_ = bytes;
+  recountAll_   = true;
+
+  if (!bytes || spill_) return true;
+
+  spill_ = new TileSpill();
+  if (spill_->open(spillFilename)) return true;
+
+  delete spill_;
+  spill_ = NULL;
+  memoryBudget_ = 0;
+
+  return false;
+}
+
+void Map::enforceMemoryBudget(double x, double y, double keepRadius)
+{
+  if (!memoryBudget_)
+  {
+    clock_++;
+    return;
+  }
+
+  countResidentBytes(recountAll_);
+  recountAll_ = false;
+
+  if (residentBytes_ <= memoryBudget_) return;
+
+  // **** changes must reach the levels before their tiles leave
+
+  updateLevels();
+
+  // **** resident tiles far enough from (x, y), least recently used first
+
+  std::vector<std::pair<unsigned long, int> > candidates;
+
+  for (int tx = 0; tx < tilesX_; tx++)
+  for (int ty = 0; ty < tilesY_; ty++)
+  {
+    Tile * tile = getTile(tx, ty);
+    if (!tile) continue;
+
+    SpilledTile * spilled = dynamic_cast<SpilledTile*>(tile);
+    if (spilled && !spilled->isResident()) continue;
+
+    double dx = tx * TILE_SIZE + TILE_SIZE / 2 - offsetX_ - x;
+    double dy = ty * TILE_SIZE + TILE_SIZE / 2 - offsetY_ - y;
+
+    if (dx * dx + dy * dy <= keepRadius * keepRadius) continue;
+
+    candidates.push_back(std::make_pair(tile->getLastTouch(), tx * tilesY_ + ty));
+  }
+
+  std::sort(candidates.begin(), candidates.end());
+
+  size_t target = memoryBudget_ / 10 * 9;
+
+  for (size_t c = 0; c < candidates.size() && residentBytes_ > target; c++)
+  {
+    Tile *& tile = tiles_[candidates[c].second];
+    size_t before = tile->getCountedBytes();
+
+    SpilledTile * spilled = dynamic_cast<SpilledTile*>(tile);
+    if (!spilled)
+    {
+      spilled = new SpilledTile(spill_, tile, cellFormat_);
+      tile = spilled;
     }
 
-    // delete old grid
-    deleteGrid();
+    if (!spilled->evict()) break;
+
+    size_t after = spilled->getMemorySize();
+    spilled->setCountedBytes(after);
+
+    tileBytes_     += after - before;
+    residentBytes_ += after - before;
+  }
+}
+
+void Map::countResidentBytes(bool all)
+{
+  if (all) tileBytes_ = 0;
+
+  for (int t = 0; t < tilesX_ * tilesY_; t++)
+  {
+    Tile * tile = tiles_[t];
+    if (!tile) continue;
+
+    bool resized = tile->takeResized();
+    if (!all && !resized && tile->getLastTouch() != clock_) continue;
+
+    size_t bytes = tile->getMemorySize();
+
+    if (!all) tileBytes_ -= tile->getCountedBytes();
+    tileBytes_ += bytes;
+
+    tile->setCountedBytes(bytes);
+  }
+
+  clock_++;
 
-    // change size variables
-    sizeY_ *= 2;
-    grid_ = newGrid;
+  residentBytes_ = tileBytes_ + tilesX_ * tilesY_ * sizeof(Tile*);
 
-    return getCell(x, y);
+  for (size_t l = 0; l < levels_.size(); l++)
+  {
+    levels_[l]->countResidentBytes(all);
+    residentBytes_ += levels_[l]->residentBytes_;
   }
+}
 
-  return &grid_[cx][cy];
+void Map::getSpillStats(SpillStats& stats)
+{
+  if (spill_)
+    spill_->getStats(stats);
+  else
+    memset(&stats, 0, sizeof(stats));
 }
 
-double Map::getMemorySize()
+size_t Map::getMemoryBytes()
 {
-  double gridSize = sizeX_ * sizeY_ * sizeof(Cell);
+  size_t bytes = tilesX_ * tilesY_ * sizeof(Tile*);
+
+  for (int t = 0; t < tilesX_ * tilesY_; t++)
+    if (tiles_[t]) bytes += tiles_[t]->getMemorySize();
 
-  double dataSize = 0;
-  for (int i = 0; i< sizeX_; ++i)
-  for (int j = 0; j< sizeY_; ++j)
-    dataSize += (grid_[i][j].getPVolumesCount() + grid_[i][j].getPVolumesCount()) * VOLUME_BYTE_SIZE;
+  for (size_t l = 0; l < levels_.size(); l++)
+    bytes += levels_[l]->getMemoryBytes();
 
-  return (gridSize + dataSize)/1024.0;
+  return bytes;
 }
 
 void Map::test()
@@ -180,7 +963,7 @@ void Map::test()
 
   while(true)
   {
-    getCell(0,0)->clear();
+    clearCell(0,0);
 
     // add random volumes
 
@@ -190,10 +973,11 @@ void Map::test()
     {
       rnd_1 = (rand() % 100) / 10.0;
       rnd_2 = (rand() % 100) / 10.0;
-      getCell(0,0)->addNVolume(rnd_1, rnd_2);      
+      addNVolume(0, 0, rnd_1, rnd_2);      
     }
 
-    if (!getCell(0,0)->validate()) break;
+    int i, j;
+    if (!getTile(0, 0, i, j)->validate(i, j)) break;
     printf(".\n");
   }
 
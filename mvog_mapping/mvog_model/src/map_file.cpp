@@ -0,0 +1,489 @@
+#include "mvog_model/map_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace MVOG
+{
+
+const uint64_t MAP_FILE_STARTS_SIZE = 2 * (TILE_CELLS + 1) * sizeof(uint32_t);
+
+// **** copies all volumes of one tile into another, empty one
+
+static void copyTile(Tile& from, Tile& to)
+{
+  for (int i = 0; i < TILE_SIZE; i++)
+  for (int j = 0; j < TILE_SIZE; j++)
+  {
+    int count;
+    const Volume * volumes;
+
+    volumes = from.getPVolumes(i, j, count);
+    if (count) to.addPVolumes(i, j, volumes, count);
+
+    volumes = from.getNVolumes(i, j, count);
+    if (count) to.addNVolumes(i, j, volumes, count);
+  }
+}
+
+// ****************************************************************
+
+MappedFile::MappedFile()
+{
+  data_ = NULL;
+  size_ = 0;
+}
+
+MappedFile::~MappedFile()
+{
+  if (data_) munmap((void*)data_, size_);
+}
+
+bool MappedFile::open(const std::string& filename)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  void * data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED) return false;
+
+  data_ = (const char*)data;
+  size_ = info.st_size;
+
+  return true;
+}
+
+// ****************************************************************
+
+MappedTile::MappedTile(const boost::shared_ptr<MappedFile>& file, uint64_t offset,
+                       CellFormat cellFormat):
+  file_(file)
+{
+  const char * record = file_->getData() + offset;
+
+  pStart_ = (const uint32_t*)record;
+  nStart_ = pStart_ + TILE_CELLS + 1;
+
+  pVolumes_ = (const Volume*)(record + MAP_FILE_STARTS_SIZE);
+  nVolumes_ = pVolumes_ + pStart_[TILE_CELLS];
+
+  cellFormat_ = cellFormat;
+  copy_ = NULL;
+}
+
+MappedTile::~MappedTile()
+{
+  delete copy_;
+}
+
+uint64_t MappedTile::getRecordSize(const char * data, uint64_t offset, uint64_t size)
+{
+  if (offset % 8 || offset > size || size - offset < MAP_FILE_STARTS_SIZE) return 0;
+
+  const uint32_t * pStart = (const uint32_t*)(data + offset);
+  const uint32_t * nStart = pStart + TILE_CELLS + 1;
+
+  uint64_t recordSize = MAP_FILE_STARTS_SIZE +
+    ((uint64_t)pStart[TILE_CELLS] + nStart[TILE_CELLS]) * VOLUME_BYTE_SIZE;
+
+  if (size - offset < recordSize) return 0;
+
+  return recordSize;
+}
+
+Tile * MappedTile::getCopy()
+{
+  if (!copy_)
+  {
+    // copy_ must stay NULL while copying, so that the volumes are read
+    // from the file
+    Tile * copy = createTile(cellFormat_);
+    copyTile(*this, *copy);
+    copy_ = copy;
+  }
+
+  return copy_;
+}
+
+const Volume * MappedTile::getVolumes(const uint32_t * start, const Volume * volumes,
+                                      int c, int& count) const
+{
+  // **** only the totals were checked when loading - reject cells which
+  //      would reach outside the record
+
+  uint32_t bot = start[c];
+  uint32_t top = start[c + 1];
+
+  if (top <= bot || top > start[TILE_CELLS])
+  {
+    count = 0;
+    return NULL;
+  }
+
+  count = top - bot;
+  return volumes + bot;
+}
+
+void MappedTile::addPVolume(int i, int j, float bot, float top)
+{
+  getCopy()->addPVolume(i, j, bot, top);
+  setDirty(i, j);
+}
+
+void MappedTile::addNVolume(int i, int j, float bot, float top)
+{
+  getCopy()->addNVolume(i, j, bot, top);
+  setDirty(i, j);
+}
+
+void MappedTile::addPVolumes(int i, int j, const Volume * volumes, int count)
+{
+  getCopy()->addPVolumes(i, j, volumes, count);
+  setDirty(i, j);
+}
+
+void MappedTile::addNVolumes(int i, int j, const Volume * volumes, int count)
+{
+  getCopy()->addNVolumes(i, j, volumes, count);
+  setDirty(i, j);
+}
+
+void MappedTile::clearCell(int i, int j)
+{
+  getCopy()->clearCell(i, j);
+  setDirty(i, j);
+}
+
+const Volume * MappedTile::getPVolumes(int i, int j, int& count)
+{
+  if (copy_) return copy_->getPVolumes(i, j, count);
+  return getVolumes(pStart_, pVolumes_, i * TILE_SIZE + j, count);
+}
+
+const Volume * MappedTile::getNVolumes(int i, int j, int& count)
+{
+  if (copy_) return copy_->getNVolumes(i, j, count);
+  return getVolumes(nStart_, nVolumes_, i * TILE_SIZE + j, count);
+}
+
+void MappedTile::createMLVolumes(int i, int j, MLVolumeVector& mlVolumes)
+{
+  int pCount, nCount;
+  const Volume * pVolumes = getPVolumes(i, j, pCount);
+  const Volume * nVolumes = getNVolumes(i, j, nCount);
+
+  if (pCount || nCount)
+    MVOG::createMLVolumes(pVolumes, pCount, nVolumes, nCount, mlVolumes);
+}
+
+size_t MappedTile::getMemorySize() const
+{
+  size_t size = sizeof(MappedTile) + getCacheMemorySize();
+  if (copy_) size += copy_->getMemorySize();
+  return size;
+}
+
+// ****************************************************************
+
+void MapFile::packTile(Tile& tile, std::vector<char>& record)
+{
+  // **** count the volumes first, so that the record is sized once
+
+  uint32_t pTotal = 0, nTotal = 0;
+
+  for (int c = 0; c < TILE_CELLS; c++)
+  {
+    int count;
+    tile.getPVolumes(c / TILE_SIZE, c % TILE_SIZE, count);
+    pTotal += count;
+    tile.getNVolumes(c / TILE_SIZE, c % TILE_SIZE, count);
+    nTotal += count;
+  }
+
+  record.resize(MAP_FILE_STARTS_SIZE + ((uint64_t)pTotal + nTotal) * VOLUME_BYTE_SIZE);
+
+  uint32_t * pStart = (uint32_t*)&record[0];
+  uint32_t * nStart = pStart + TILE_CELLS + 1;
+
+  Volume * pVolumes = (Volume*)(&record[0] + MAP_FILE_STARTS_SIZE);
+  Volume * nVolumes = pVolumes + pTotal;
+
+  pStart[0] = 0;
+  nStart[0] = 0;
+
+  for (int c = 0; c < TILE_CELLS; c++)
+  {
+    int count;
+    const Volume * volumes;
+
+    volumes = tile.getPVolumes(c / TILE_SIZE, c % TILE_SIZE, count);
+    if (count) memcpy(pVolumes + pStart[c], volumes, count * VOLUME_BYTE_SIZE);
+    pStart[c + 1] = pStart[c] + count;
+
+    volumes = tile.getNVolumes(c / TILE_SIZE, c % TILE_SIZE, count);
+    if (count) memcpy(nVolumes + nStart[c], volumes, count * VOLUME_BYTE_SIZE);
+    nStart[c + 1] = nStart[c] + count;
+  }
+}
+
+void MapFile::unpackTile(const char * record, Tile& tile)
+{
+  const uint32_t * pStart = (const uint32_t*)record;
+  const uint32_t * nStart = pStart + TILE_CELLS + 1;
+
+  const Volume * pVolumes = (const Volume*)(record + MAP_FILE_STARTS_SIZE);
+  const Volume * nVolumes = pVolumes + pStart[TILE_CELLS];
+
+  for (int c = 0; c < TILE_CELLS; c++)
+  {
+    if (pStart[c + 1] > pStart[c])
+      tile.addPVolumes(c / TILE_SIZE, c % TILE_SIZE, pVolumes + pStart[c], pStart[c + 1] - pStart[c]);
+    if (nStart[c + 1] > nStart[c])
+      tile.addNVolumes(c / TILE_SIZE, c % TILE_SIZE, nVolumes + nStart[c], nStart[c + 1] - nStart[c]);
+  }
+}
+
+const Volume * MapFile::getRecordVolumes(const char * record, int c, bool positive, int& count)
+{
+  const uint32_t * pStart = (const uint32_t*)record;
+  const uint32_t * nStart = pStart + TILE_CELLS + 1;
+
+  const Volume * volumes = (const Volume*)(record + MAP_FILE_STARTS_SIZE);
+
+  if (positive)
+  {
+    count = pStart[c + 1] - pStart[c];
+    return volumes + pStart[c];
+  }
+
+  count = nStart[c + 1] - nStart[c];
+  return volumes + pStart[TILE_CELLS] + nStart[c];
+}
+
+bool MapFile::save(Map& map, const std::string& filename)
+{
+  boost::mutex::scoped_lock lock(map.mutex_);
+
+  std::string tmpFilename = filename + ".tmp";
+
+  FILE * file = fopen(tmpFilename.c_str(), "wb");
+  if (!file)
+  {
+    printf("MapFile: cannot write %s\n", tmpFilename.c_str());
+    return false;
+  }
+
+  // **** header, and a tile index which is filled in at the end
+
+  MapFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "MVOG", 4);
+
+  header.version    = MAP_FILE_VERSION;
+  header.byteOrder  = MAP_FILE_BYTE_ORDER;
+  header.tileSize   = TILE_SIZE;
+  header.resolution = map.resolution_;
+  header.sizeX      = map.sizeX_;
+  header.sizeY      = map.sizeY_;
+  header.offsetX    = map.offsetX_;
+  header.offsetY    = map.offsetY_;
+  header.tilesX     = map.tilesX_;
+  header.tilesY     = map.tilesY_;
+  header.cellFormat = map.cellFormat_;
+
+  int tilesCount = map.tilesX_ * map.tilesY_;
+  std::vector<uint64_t> tileOffsets(tilesCount, 0);
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(&tileOffsets[0], sizeof(uint64_t), tilesCount, file) == (size_t)tilesCount;
+
+  uint64_t offset = sizeof(header) + tilesCount * sizeof(uint64_t);
+
+  // **** tile records
+
+  std::vector<char> record;
+
+  for (int t = 0; t < tilesCount && ok; t++)
+  {
+    Tile * tile = map.tiles_[t];
+    if (!tile) continue;
+
+    packTile(*tile, record);
+
+    // records are 8 byte aligned
+    static const char padding[8] = {0};
+    int pad = (8 - offset % 8) % 8;
+
+    ok = ok && fwrite(padding, 1, pad, file) == (size_t)pad;
+    offset += pad;
+
+    tileOffsets[t] = offset;
+
+    ok = ok && fwrite(&record[0], 1, record.size(), file) == record.size();
+    offset += record.size();
+  }
+
+  ok = ok && fseeko(file, sizeof(header), SEEK_SET) == 0;
+  ok = ok && fwrite(&tileOffsets[0], sizeof(uint64_t), tilesCount, file) == (size_t)tilesCount;
+
+  ok = (fclose(file) == 0) && ok;
+
+  if (!ok || rename(tmpFilename.c_str(), filename.c_str()) != 0)
+  {
+    printf("MapFile: error writing %s\n", filename.c_str());
+    remove(tmpFilename.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool MapFile::load(Map& map, const std::string& filename, bool mapped)
+{
+  boost::shared_ptr<MappedFile> file(new MappedFile());
+
+  if (!file->open(filename))
+  {
+    printf("MapFile: cannot read %s\n", filename.c_str());
+    return false;
+  }
+
+  const char * data = file->getData();
+  uint64_t size = file->getSize();
+
+  // **** check the header and the tile index
+
+  MapFileHeader header;
+
+  if (size < sizeof(header))
+  {
+    printf("MapFile: %s is too short\n", filename.c_str());
+    return false;
+  }
+
+  memcpy(&header, data, sizeof(header));
+
+  if (memcmp(header.magic, "MVOG", 4) != 0)
+  {
+    printf("MapFile: %s is not a map file\n", filename.c_str());
+    return false;
+  }
+  if (header.byteOrder != MAP_FILE_BYTE_ORDER)
+  {
+    printf("MapFile: %s was written with a different byte order\n", filename.c_str());
+    return false;
+  }
+  if (header.version != MAP_FILE_VERSION)
+  {
+    printf("MapFile: %s has version %u, expected %u\n", filename.c_str(), header.version, MAP_FILE_VERSION);
+    return false;
+  }
+  if (header.tileSize != (uint32_t)TILE_SIZE || header.tilesX <= 0 || header.tilesY <= 0 ||
+      header.sizeX != header.tilesX * TILE_SIZE || header.sizeY != header.tilesY * TILE_SIZE)
+  {
+    printf("MapFile: %s has an invalid grid\n", filename.c_str());
+    return false;
+  }
+  if (header.offsetX < 0 || header.offsetX > header.sizeX || header.offsetX % TILE_SIZE != 0 ||
+      header.offsetY < 0 || header.offsetY > header.sizeY || header.offsetY % TILE_SIZE != 0)
+  {
+    printf("MapFile: %s has an invalid grid offset\n", filename.c_str());
+    return false;
+  }
+  if (!(header.resolution > 0.0))
+  {
+    printf("MapFile: %s has an invalid resolution\n", filename.c_str());
+    return false;
+  }
+
+  uint64_t tilesCount = (uint64_t)header.tilesX * header.tilesY;
+
+  if ((size - sizeof(header)) / sizeof(uint64_t) < tilesCount)
+  {
+    printf("MapFile: %s is truncated\n", filename.c_str());
+    return false;
+  }
+
+  const uint64_t * tileOffsets = (const uint64_t*)(data + sizeof(header));
+
+  for (uint64_t t = 0; t < tilesCount; t++)
+  {
+    if (tileOffsets[t] && !MappedTile::getRecordSize(data, tileOffsets[t], size))
+    {
+      printf("MapFile: %s is truncated\n", filename.c_str());
+      return false;
+    }
+  }
+
+  // **** replace the map's tiles
+
+  boost::mutex::scoped_lock lock(map.mutex_);
+
+  Tile ** tiles = new Tile*[tilesCount];
+
+  for (uint64_t t = 0; t < tilesCount; t++)
+  {
+    tiles[t] = NULL;
+    if (!tileOffsets[t]) continue;
+
+    MappedTile * tile = new MappedTile(file, tileOffsets[t], map.cellFormat_);
+
+    if (mapped)
+      tiles[t] = tile;
+    else
+    {
+      tiles[t] = createTile(map.cellFormat_);
+      copyTile(*tile, *tiles[t]);
+      delete tile;
+    }
+
+    // the users of the change flags see the whole tile as new
+    tiles[t]->setAllChanged();
+  }
+
+  for (int t = 0; t < map.tilesX_ * map.tilesY_; t++)
+    delete map.tiles_[t];
+  delete[] map.tiles_;
+
+  map.tiles_      = tiles;
+  map.resolution_ = header.resolution;
+  map.sizeX_      = header.sizeX;
+  map.sizeY_      = header.sizeY;
+  map.offsetX_    = header.offsetX;
+  map.offsetY_    = header.offsetY;
+  map.tilesX_     = header.tilesX;
+  map.tilesY_     = header.tilesY;
+
+  // **** the levels were built over the old grid: rebuild as many
+
+  int levels = map.levels_.size();
+
+  for (size_t l = 0; l < map.levels_.size(); l++)
+    delete map.levels_[l];
+  map.levels_.clear();
+
+  map.setLevels(levels);
+
+  // **** none of the new tiles was counted towards the memory budget
+
+  map.recountAll_ = true;
+
+  map.markChanged();
+
+  return true;
+}
+
+}; // namespace MVOG
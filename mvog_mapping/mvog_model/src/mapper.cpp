@@ -1,19 +1,38 @@
 #include "mvog_model/mapper.h"
 
+#include <climits>
+#include <cstring>
+#include <stdint.h>
+
+#include <sensor_msgs/image_encodings.h>
+
+#include <boost/bind.hpp>
+
 namespace MVOG 
 {
 
-Mapper::Mapper(double resolution, double sizeXmeters, double sizeYmeters):
-        map_(resolution, sizeXmeters, sizeYmeters)
+Mapper::Mapper(double resolution, double sizeXmeters, double sizeYmeters,
+               CellFormat cellFormat):
+        map_(resolution, sizeXmeters, sizeYmeters, cellFormat),
+        frameInserter_(&map_)
 {
   modelNegativeSpace_  = true;
+  maxFreeSpaceRange_   = 0.0;
+  memoryKeepRadius_    = 0.0;
 
+  pixelRaysWidth_  = 0;
+  pixelRaysHeight_ = 0;
+
+  pool_ = NULL;
+  setInsertionThreads(1);
 }
 
 Mapper::~Mapper ()
 {
+  delete pool_;
 
-
+  for (size_t b = 0; b < buffers_.size(); b++)
+    delete buffers_[b];
 }
 
 void Mapper::setModelNegativeSpace(bool modelNegativeSpace)
@@ -26,6 +45,78 @@ bool Mapper::getModelNegativeSpace() const
   return modelNegativeSpace_;
 }
 
+void Mapper::setMaxFreeSpaceRange(double range)
+{
+  maxFreeSpaceRange_ = std::max(range, 0.0);
+}
+
+double Mapper::getMaxFreeSpaceRange() const
+{
+  return maxFreeSpaceRange_;
+}
+
+bool Mapper::setMemoryBudget(size_t bytes, const std::string& spillFilename, double keepRadius)
+{
+  boost::mutex::scoped_lock lock(map_.mutex_);
+
+  memoryKeepRadius_ = std::max(keepRadius, 0.0);
+  return map_.setMemoryBudget(bytes, spillFilename);
+}
+
+void Mapper::endInsertion(const btVector3& origin)
+{
+  map_.markChanged();
+
+  double scale = 1.0 / map_.getResolution();
+
+  map_.enforceMemoryBudget(origin.getX() * scale, origin.getY() * scale, memoryKeepRadius_ * scale);
+}
+
+void Mapper::getFrameStats(size_t& points, size_t& voxels) const
+{
+  points = frameInserter_.getPointCount();
+  voxels = frameInserter_.getVoxelCount();
+}
+
+void Mapper::setInsertionThreads(int threads)
+{
+  threads = std::max(threads, 1);
+
+  delete pool_;
+  pool_ = NULL;
+
+  if (threads > 1) pool_ = new WorkerPool(threads);
+
+  workers_.clear();
+  workers_.resize(threads);
+  for (int i = 0; i < threads; i++)
+    workers_[i].partitions.resize(threads);
+
+  for (size_t b = 0; b < buffers_.size(); b++)
+    delete buffers_[b];
+
+  buffers_.resize(threads);
+  for (int i = 0; i < threads; i++)
+    buffers_[i] = new VolumeBuffer();
+}
+
+int Mapper::getInsertionThreads() const
+{
+  return workers_.size();
+}
+
+void Mapper::getCoalescingStats(size_t& volumes, size_t& merges) const
+{
+  volumes = 0;
+  merges  = 0;
+
+  for (size_t b = 0; b < buffers_.size(); b++)
+  {
+    volumes += buffers_[b]->getAddedCount();
+    merges  += buffers_[b]->getMergedCount();
+  }
+}
+
 Map * Mapper::getMap()
 {
   return &map_;
@@ -33,19 +124,132 @@ Map * Mapper::getMap()
 
 void Mapper::addLaserData (const sensor_msgs::LaserScanConstPtr& scan, const btTransform& w2l)
 {
-  boost::mutex::scoped_lock(map_.mutex_);
+  boost::mutex::scoped_lock lock(map_.mutex_);
 
+  if (!pool_)
+  {
+    addBeams(scan, w2l, 0, scan->ranges.size(), NULL);
+    buffers_[0]->flush();
+
+    endInsertion(w2l * btVector3(0.0, 0.0, 0.0));
+    return;
+  }
+
+  // **** 1. every thread rasterizes a contiguous block of beams into
+  //         its own update lists
+
+  pool_->run(boost::bind(&Mapper::rasterizeBeams, this, boost::cref(scan), boost::cref(w2l), _1));
+
+  // **** 2. make room for all touched cells, so that no tile pointers
+  //         move during the merge
+
+  int minCX = INT_MAX, minCY = INT_MAX;
+  int maxCX = INT_MIN, maxCY = INT_MIN;
+
+  for (size_t w = 0; w < workers_.size(); w++)
+  {
+    minCX = std::min(minCX, workers_[w].minCX);
+    minCY = std::min(minCY, workers_[w].minCY);
+    maxCX = std::max(maxCX, workers_[w].maxCX);
+    maxCY = std::max(maxCY, workers_[w].maxCY);
+  }
+
+  if (minCX <= maxCX) map_.reserve(minCX, minCY, maxCX, maxCY);
+
+  // **** 3. every thread merges the updates for its own tile columns
+
+  pool_->run(boost::bind(&Mapper::mergeUpdates, this, _1));
+
+  endInsertion(w2l * btVector3(0.0, 0.0, 0.0));
+}
+
+void Mapper::rasterizeBeams(const sensor_msgs::LaserScanConstPtr& scan, const btTransform& w2l, int index)
+{
+  InsertionWorker& worker = workers_[index];
+
+  for (size_t p = 0; p < worker.partitions.size(); p++)
+    worker.partitions[p].clear();
+
+  worker.minCX = INT_MAX;
+  worker.minCY = INT_MAX;
+  worker.maxCX = INT_MIN;
+  worker.maxCY = INT_MIN;
+
+  size_t beams   = scan->ranges.size();
+  size_t threads = workers_.size();
+
+  addBeams(scan, w2l, beams * index / threads, beams * (index + 1) / threads, &worker);
+}
+
+void Mapper::mergeUpdates(int index)
+{
+  // **** beam blocks are merged in order, so every cell receives its
+  //      volumes in the same order as in a single-threaded insertion.
+  //      P volumes go straight into their cells, N volumes are gathered
+  //      per cell and merged once.
+
+  VolumeBuffer& buffer = *buffers_[index];
+
+  for (size_t w = 0; w < workers_.size(); w++)
+  {
+    const VolumeUpdateVector& updates = workers_[w].partitions[index];
+
+    for (size_t u = 0; u < updates.size(); u++)
+    {
+      const VolumeUpdate& update = updates[u];
+
+      int i, j;
+      Tile * tile = map_.getReservedTileAt(update.cx, update.cy, i, j);
+
+      if (update.positive)
+        tile->addPVolume(i, j, update.bot, update.top);
+      else
+        buffer.addNVolume(tile, i, j, update.bot, update.top);
+    }
+  }
+
+  buffer.flush();
+}
+
+void Mapper::InsertionWorker::add(int cx, int cy, float bot, float top, bool positive)
+{
+  VolumeUpdate update;
+  update.cx       = cx;
+  update.cy       = cy;
+  update.bot      = bot;
+  update.top      = top;
+  update.positive = positive;
+
+  // **** partition by tile column: a tile, and the allocator of its
+  //      volumes, is only ever touched by one merging thread
+
+  int partitions = this->partitions.size();
+  int partition  = (update.cx >> TILE_BITS) % partitions;
+  if (partition < 0) partition += partitions;
+
+  this->partitions[partition].push_back(update);
+
+  minCX = std::min(minCX, update.cx);
+  minCY = std::min(minCY, update.cy);
+  maxCX = std::max(maxCX, update.cx);
+  maxCY = std::max(maxCY, update.cy);
+}
+
+void Mapper::addBeams(const sensor_msgs::LaserScanConstPtr& scan, const btTransform& w2l,
+                      size_t begin, size_t end, InsertionWorker * worker)
+{
   // position of the laser in the world coordinates
 	btVector3 origin = w2l * btVector3(0.0, 0.0, 0.0);
 
-  double scanAngle = scan->angle_min;
-  for (size_t i = 0; i < scan->ranges.size(); i++)
+  for (size_t i = begin; i < end; i++)
   {
+    double scanAngle = scan->angle_min + i * scan->angle_increment;
+
     if (scan->ranges[i] > scan->range_min && scan->ranges[i] < scan->range_max)
     {
       // valid, in range reading
 		  btVector3 obstacle = w2l * btVector3(cos(scanAngle)*scan->ranges[i], sin(scanAngle)*scan->ranges[i], 0.0);
-      addBeamReading(origin, obstacle);
+      addBeamReading(origin, obstacle, worker);
     }
 		else if (scan->ranges[i] > scan->range_max || scan->ranges[i] == 0)
 		{
@@ -56,178 +260,222 @@ void Mapper::addLaserData (const sensor_msgs::LaserScanConstPtr& scan, const btT
       // invalid reading - too close, or error
 
     }
-    
-    // increment scan angle
-    scanAngle += scan->angle_increment;
   }
 }
 
 void Mapper::addBeamReading(btVector3 origin, btVector3 obstacle)
+{
+  boost::mutex::scoped_lock lock(map_.mutex_);
+
+  addBeamReading(origin, obstacle, NULL);
+  buffers_[0]->flush();
+
+  map_.markChanged();
+}
+
+void Mapper::addBeamReading(btVector3 origin, btVector3 obstacle, InsertionWorker * worker)
 {
   // **** convert to grid scale
   origin   /= map_.getResolution();
   obstacle /= map_.getResolution();
 
-  addPositiveBeamSpace(obstacle);
-  if (modelNegativeSpace_) addNegativeBeamSpace(origin, obstacle);
+  addPositiveBeamSpace(obstacle, worker);
+  if (modelNegativeSpace_) addNegativeBeamSpace(origin, obstacle, worker);
 }
 
-void Mapper::addPositiveBeamSpace(btVector3 obstacle)
+void Mapper::addPositiveBeamSpace(btVector3 obstacle, InsertionWorker * worker)
 {
   // **** add a positive volume
 
-  map_.getCell(obstacle.getX(), obstacle.getY())->
-    addPVolume(obstacle.getZ() - 0.5, obstacle.getZ() + 0.5);
+  if (worker)
+    worker->add(floor(obstacle.getX()), floor(obstacle.getY()), 
+                obstacle.getZ() - 0.5, obstacle.getZ() + 0.5, true);
+  else
+    map_.addPVolume(obstacle.getX(), obstacle.getY(), 
+                    obstacle.getZ() - 0.5, obstacle.getZ() + 0.5);
 }
 
-void Mapper::addNegativeBeamSpace(btVector3 origin, btVector3 obstacle)
+void Mapper::addNegativeBeamSpace(btVector3 origin, btVector3 obstacle, InsertionWorker * worker)
 {
-  // **** precalculate some variables
-
   btVector3 beam = obstacle - origin;
 
-  double cx    = origin.getX();
-  double cy    = origin.getY();
-  double cz    = origin.getZ();
-  double cd    = 0.0;
+  double slopeZYX = beam.getZ() / sqrt(beam.getX()*beam.getX() + beam.getY()*beam.getY());
 
-  double beamLength = beam.length();
+  // **** serial insertion: make room for every cell the beam can cross
+  //      once, instead of checking the bounds at each step
 
-  double slopeYX  = beam.getY() / beam.getX(); 
-  double slopeZX  = beam.getZ() / beam.getX(); 
-  double slopeZY  = beam.getZ() / beam.getY(); 
-  double slopeXY  = beam.getX() / beam.getY(); 
-  double slopeZYX = beam.getZ() / sqrt(beam.getX()*beam.getX() + beam.getY()*beam.getY());
-  double slopeDX  = beamLength / beam.getX();
-  double slopeDY  = beamLength / beam.getY();
+  if (!worker)
+  {
+    map_.reserve((int)floor(std::min(origin.getX(), obstacle.getX())) - 1,
+                 (int)floor(std::min(origin.getY(), obstacle.getY())) - 1,
+                 (int)floor(std::max(origin.getX(), obstacle.getX())) + 1,
+                 (int)floor(std::max(origin.getY(), obstacle.getY())) + 1);
+  }
 
   // **** rasterize
 
-  Cell * currentCell;
-  double pz;
+  RayTraversal ray(origin, obstacle);
+
+  while (ray.leavesCell())
+  {
+    addNVolume(ray.getCellX(), ray.getCellY(), ray.getEntryZ(), ray.getExitZ(), worker);
+    ray.step();
+  }
+
+  // **** last cell: only steep beams leave a negative volume below
+  //      (above) the obstacle
 
-  while(1)
+  double pz = ray.getEntryZ();
+
+  if(slopeZYX > 1.0)
+  {
+    double ez = obstacle.getZ() - 0.5;
+    if (ez > pz) addNVolume(ray.getCellX(), ray.getCellY(), pz, ez, worker);
+  }
+  else if(slopeZYX < -1.0)
   {
-    pz = cz;
+    double ez = obstacle.getZ() + 0.5;
+    if (ez < pz) addNVolume(ray.getCellX(), ray.getCellY(), ez, pz, worker);
+  }
+}
 
-    // **** rasterize in the appropriate quadrant
+void Mapper::updatePixelRays(const sensor_msgs::CameraInfo& info, int width, int height)
+{
+  double fx = info.K[0];
+  double cx = info.K[2];
+  double fy = info.K[4];
+  double cy = info.K[5];
+
+  if (width  == pixelRaysWidth_  && height == pixelRaysHeight_ &&
+      fx == pixelRaysK_[0] && cx == pixelRaysK_[1] &&
+      fy == pixelRaysK_[2] && cy == pixelRaysK_[3]) return;
+
+  pixelRays_.resize(width * height);
+
+  for (int v = 0; v < height; v++)
+  for (int u = 0; u < width;  u++)
+    pixelRays_[v * width + u] = btVector3((u - cx) / fx, (v - cy) / fy, 1.0);
+
+  pixelRaysK_[0] = fx;
+  pixelRaysK_[1] = cx;
+  pixelRaysK_[2] = fy;
+  pixelRaysK_[3] = cy;
+  pixelRaysWidth_  = width;
+  pixelRaysHeight_ = height;
+}
+
+static inline bool isHostBigEndian()
+{
+  uint16_t one = 1;
+  return *reinterpret_cast<const uint8_t*>(&one) == 0;
+}
+
+bool Mapper::addDepthImage(const sensor_msgs::ImageConstPtr& image, 
+                           const sensor_msgs::CameraInfoConstPtr& info, const btTransform& w2c)
+{
+  bool mm = (image->encoding == sensor_msgs::image_encodings::TYPE_16UC1);
+
+  if (!mm && image->encoding != sensor_msgs::image_encodings::TYPE_32FC1) return false;
+
+  // **** the pixels are read in place: the rows must hold them all, in
+  //      this host's byte order, and the camera must be calibrated
+
+  uint64_t pixelSize = mm ? sizeof(uint16_t) : sizeof(float);
 
-	  if      (beam.getX() >= 0 && beam.getY() >= 0)	  // **** Q1
+  if (image->width > INT_MAX || image->height > INT_MAX) return false;
+  if ((uint64_t)image->step < image->width * pixelSize) return false;
+  if ((uint64_t)image->data.size() < (uint64_t)image->step * image->height) return false;
+  if ((bool)image->is_bigendian != isHostBigEndian()) return false;
+  if (info->K[0] == 0.0 || info->K[4] == 0.0) return false;
+
+  int width  = image->width;
+  int height = image->height;
+
+  updatePixelRays(*info, width, height);
+
+  // **** the points are gathered without the map lock
+
+  double scale = 1.0 / map_.getResolution();
+
+  frameInserter_.begin(w2c * btVector3(0.0, 0.0, 0.0) * scale, width * height);
+
+  for (int v = 0; v < height; v++)
+  {
+    const unsigned char * row = &image->data[v * image->step];
+    const btVector3 * rays = &pixelRays_[v * width];
+
+    for (int u = 0; u < width; u++)
     {
-      double dx = floor(cx) + 1.0 - cx; // distance to right cell wall
-      double dy = floor(cy) + 1.0 - cy; // distance to top cell wall
+      double depth;
+      if (mm) depth = reinterpret_cast<const uint16_t*>(row)[u] * 0.001;
+      else    depth = reinterpret_cast<const float*>(row)[u];
 
-      currentCell = map_.getCell(cx, cy);
+      if (!(depth > 0.0)) continue; // no reading, or NaN
 
-      if (dy > dx * slopeYX)
-      {
-        cx += dx;
-        cy += dx * slopeYX;
-        cz += dx * slopeZX;
-        cd += dx * slopeDX;
-      }
-      else
-      {
-        cx += dy * slopeXY;
-        cy += dy;
-        cz += dy * slopeZY;
-        cd += dy * slopeDY;
-      }
+      frameInserter_.addPoint(w2c * (rays[u] * depth) * scale);
     }
-	  else if (beam.getX() <  0 && beam.getY() >= 0)		// **** Q2
-    {
-      double dx = floor(cx) - cx;       // distance to left cell wall
-      double dy = floor(cy) + 1.0 - cy; // distance to top cell wall
+  }
 
-      if (dx == 0.0) dx = -1.0;
+  boost::mutex::scoped_lock lock(map_.mutex_);
+  frameInserter_.end(modelNegativeSpace_, maxFreeSpaceRange_ * scale);
 
-      currentCell = map_.getCell(cx + dx, cy);
+  endInsertion(w2c * btVector3(0.0, 0.0, 0.0));
 
-      if (dy > dx * slopeYX)
-      {
-        cx += dx;
-        cy += dx * slopeYX;
-        cz += dx * slopeZX;
-        cd += dx * slopeDX;
-      }
-      else
+  return true;
+}
+
+bool Mapper::addPointCloud(const sensor_msgs::PointCloud2ConstPtr& cloud, const btTransform& w2s)
+{
+  int64_t offsets[3] = {-1, -1, -1};
+  const char * names[3] = {"x", "y", "z"};
+
+  for (size_t f = 0; f < cloud->fields.size(); f++)
+    for (int a = 0; a < 3; a++)
+      if (cloud->fields[f].name == names[a])
       {
-        cx += dy * slopeXY;
-        cy += dy;
-        cz += dy * slopeZY;
-        cd += dy * slopeDY;
+        if (cloud->fields[f].datatype != sensor_msgs::PointField::FLOAT32) return false;
+        offsets[a] = cloud->fields[f].offset;
       }
-    }
-    else if (beam.getX() <= 0 && beam.getY() <  0)		// **** Q3
-    {
-      double dx = floor(cx) - cx; // distance to right cell wall
-      double dy = floor(cy) - cy; // distance to top cell wall
 
-      if (dx == 0) dx = -1.0; 
-      if (dy == 0) dy = -1.0;
+  if (offsets[0] < 0 || offsets[1] < 0 || offsets[2] < 0) return false;
 
-      currentCell = map_.getCell(cx + dx, cy+dy);
+  // **** the points are read in place: each must hold its fields, the
+  //      rows their points and the data its rows, in this host's byte order
 
-      if (dy < dx * slopeYX)
-      {
-        cx += dx;
-        cy += dx * slopeYX;
-        cz += dx * slopeZX;
-        cd += dx * slopeDX;
-      }
-      else
-      {
-        cx += dy * slopeXY;
-        cy += dy;
-        cz += dy * slopeZY;
-        cd += dy * slopeDY;
-      }
-    }
-    else                                           	// **** Q4
-    {
-      double dx = floor(cx) + 1.0 - cx; // distance to right cell wall
-      double dy = floor(cy) - cy; // distance to top cell wall
+  for (int a = 0; a < 3; a++)
+    if (offsets[a] + (int64_t)sizeof(float) > (int64_t)cloud->point_step) return false;
 
-      if (dy == 0.0) dy = -1.0;
+  if ((uint64_t)cloud->row_step < (uint64_t)cloud->width * cloud->point_step) return false;
+  if ((uint64_t)cloud->data.size() < (uint64_t)cloud->row_step * cloud->height) return false;
+  if ((bool)cloud->is_bigendian != isHostBigEndian()) return false;
 
-      currentCell = map_.getCell(cx, cy + dy);
+  double scale = 1.0 / map_.getResolution();
 
-      if (dy < dx * slopeYX)
-      {
-        cx += dx;
-        cy += dx * slopeYX;
-        cz += dx * slopeZX;
-        cd += dx * slopeDX;
-      }
-      else
-      {
-        cx += dy * slopeXY;
-        cy += dy;
-        cz += dy * slopeZY;
-        cd += dy * slopeDY;
-      }  
-    }
+  frameInserter_.begin(w2s * btVector3(0.0, 0.0, 0.0) * scale, cloud->width * cloud->height);
+
+  for (size_t v = 0; v < cloud->height; v++)
+  {
+    const unsigned char * point = &cloud->data[v * cloud->row_step];
 
-    // check if we reached the end
-    if (cd < beamLength)
+    for (size_t u = 0; u < cloud->width; u++, point += cloud->point_step)
     {
-      currentCell->addNVolume(pz, cz);
-    }
-    else
-    {  
-      if(slopeZYX > 1.0)
-      {
-        double ez = obstacle.getZ() - 0.5;
-        if (ez > pz) currentCell->addNVolume(pz, ez);
-      }
-      else if(slopeZYX < -1.0)
-      {
-        double ez = obstacle.getZ() + 0.5;
-        if (ez < pz) currentCell->addNVolume(ez, pz);
-      }
-      break;
+      float x, y, z;
+      memcpy(&x, point + offsets[0], sizeof(float));
+      memcpy(&y, point + offsets[1], sizeof(float));
+      memcpy(&z, point + offsets[2], sizeof(float));
+
+      if (x != x || y != y || z != z) continue; // NaN
+
+      frameInserter_.addPoint(w2s * btVector3(x, y, z) * scale);
     }
-  }    
+  }
+
+  boost::mutex::scoped_lock lock(map_.mutex_);
+  frameInserter_.end(modelNegativeSpace_, maxFreeSpaceRange_ * scale);
+
+  endInsertion(w2s * btVector3(0.0, 0.0, 0.0));
+
+  return true;
 }
 
 } // namespace MVOG
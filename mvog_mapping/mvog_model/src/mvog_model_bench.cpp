@@ -0,0 +1,1593 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <mvog_model/mapper.h>
+#include <mvog_model/compact_tile.h>
+#include <mvog_model/cell_array.h>
+#include <mvog_model/cell_vector.h>
+#include <mvog_model/map_file.h>
+#include <mvog_model/ray_traversal.h>
+#include <mvog_model/grid_exporter.h>
+
+// **** synthetic scene: a closed room, scanned by a 1081-beam, 270 deg
+//      laser which moves, turns and wobbles through it
+
+const int    BEAMS      = 1081;
+const double FOV        = 270.0 * M_PI / 180.0;
+const double RANGE_MAX  = 30.0;
+
+const double ROOM_MIN[3] = {-12.0, -8.0, 0.0};
+const double ROOM_MAX[3] = { 12.0,  8.0, 3.5};
+
+double getTime()
+{
+  timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+double castRay(const btVector3& origin, const btVector3& dir)
+{
+  double range = RANGE_MAX + 1.0;
+
+  double o[3] = {origin.getX(), origin.getY(), origin.getZ()};
+  double d[3] = {dir.getX(),    dir.getY(),    dir.getZ()};
+
+  for (int a = 0; a < 3; a++)
+  {
+    if      (d[a] > 0) range = std::min(range, (ROOM_MAX[a] - o[a]) / d[a]);
+    else if (d[a] < 0) range = std::min(range, (ROOM_MIN[a] - o[a]) / d[a]);
+  }
+
+  return range;
+}
+
+void createScan(int index, sensor_msgs::LaserScan& scan, btTransform& w2l)
+{
+  double t = index * 0.05;
+
+  w2l.setIdentity();
+  w2l.setOrigin(btVector3(6.0 * cos(0.3*t), 4.0 * sin(0.3*t), 1.0 + 0.5 * sin(t)));
+  w2l.setRotation(btQuaternion(0.3*t + M_PI/2.0, 0.10 * sin(1.3*t), 0.10 * cos(0.7*t)));
+
+  scan.angle_min       = -FOV / 2.0;
+  scan.angle_max       =  FOV / 2.0;
+  scan.angle_increment =  FOV / (BEAMS - 1);
+  scan.range_min       =  0.1;
+  scan.range_max       =  RANGE_MAX;
+  scan.ranges.resize(BEAMS);
+
+  btVector3 origin = w2l * btVector3(0.0, 0.0, 0.0);
+
+  for (int i = 0; i < BEAMS; i++)
+  {
+    double a = scan.angle_min + i * scan.angle_increment;
+    btVector3 dir = w2l * btVector3(cos(a), sin(a), 0.0) - origin;
+
+    // small deterministic noise
+    double noise = ((i * 7919 + index * 104729) % 1000) / 1000.0 * 0.02 - 0.01;
+
+    scan.ranges[i] = castRay(origin, dir) + noise;
+  }
+}
+
+// **** true if every cell of a has the same volumes as the cell at the
+//      same world position in b. The directories of the two maps may be
+//      laid out differently, so tiles are matched by world coordinates.
+//      With massError, masses may differ: the largest relative difference
+//      is kept there.
+
+bool compareVolumes(const MVOG::Volume * a, int countA, const MVOG::Volume * b, int countB,
+                    double * massError)
+{
+  if (countA != countB) return false;
+  if (!massError) return countA == 0 || !memcmp(a, b, countA * sizeof(MVOG::Volume));
+
+  for (int v = 0; v < countA; v++)
+  {
+    if (MVOG::getBot(a[v]) != MVOG::getBot(b[v]) || MVOG::getTop(a[v]) != MVOG::getTop(b[v]))
+      return false;
+
+    double error = fabs(MVOG::getMass(a[v]) - MVOG::getMass(b[v])) / MVOG::getMass(b[v]);
+    *massError = std::max(*massError, error);
+  }
+
+  return true;
+}
+
+bool containsMap(MVOG::Map * a, MVOG::Map * b, double * massError = NULL)
+{
+  for (int tx = 0; tx < a->getTilesX(); tx++)
+  for (int ty = 0; ty < a->getTilesY(); ty++)
+  {
+    MVOG::Tile * ta = a->getTile(tx, ty);
+    if (!ta) continue;
+
+    // position of the tile in b
+    int bx = tx * MVOG::TILE_SIZE - a->getOffsetX() + b->getOffsetX();
+    int by = ty * MVOG::TILE_SIZE - a->getOffsetY() + b->getOffsetY();
+
+    if (bx < 0 || bx >= b->getSizeX() || by < 0 || by >= b->getSizeY()) return false;
+
+    MVOG::Tile * tb = b->getTile(bx / MVOG::TILE_SIZE, by / MVOG::TILE_SIZE);
+    if (!tb) return false;
+
+    for (int i = 0; i < MVOG::TILE_SIZE; i++)
+    for (int j = 0; j < MVOG::TILE_SIZE; j++)
+    {
+      int countA, countB;
+
+      const MVOG::Volume * pa = ta->getPVolumes(i, j, countA);
+      const MVOG::Volume * pb = tb->getPVolumes(i, j, countB);
+
+      if (!compareVolumes(pa, countA, pb, countB, massError)) return false;
+
+      const MVOG::Volume * na = ta->getNVolumes(i, j, countA);
+      const MVOG::Volume * nb = tb->getNVolumes(i, j, countB);
+
+      if (!compareVolumes(na, countA, nb, countB, massError)) return false;
+    }
+  }
+
+  return true;
+}
+
+bool compareMaps(MVOG::Map * a, MVOG::Map * b, double * massError = NULL)
+{
+  return containsMap(a, b, massError) && containsMap(b, a, massError);
+}
+
+// **** ML volumes of every cell, the way the 3D drawer reads them: 
+//      recomputed from scratch, or through the tile caches. Returns the 
+//      number of volumes, and a checksum.
+
+long extractMLVolumes(MVOG::Map * map, bool cached, double& checksum)
+{
+  long total = 0;
+  checksum = 0.0;
+
+  for (int tx = 0; tx < map->getTilesX(); tx++)
+  for (int ty = 0; ty < map->getTilesY(); ty++)
+  {
+    MVOG::Tile * tile = map->getTile(tx, ty);
+    if (!tile) continue;
+
+    for (int i = 0; i < MVOG::TILE_SIZE; i++)
+    for (int j = 0; j < MVOG::TILE_SIZE; j++)
+    {
+      if (cached)
+      {
+        int count;
+        const MVOG::MLVolume * mlVolumes = tile->getMLVolumes(i, j, count);
+        for (int c = 0; c < count; c++)
+          checksum += mlVolumes[c].bot + 2.0 * mlVolumes[c].top;
+        total += count;
+      }
+      else
+      {
+        int pCount, nCount;
+        const MVOG::Volume * pVolumes = tile->getPVolumes(i, j, pCount);
+        const MVOG::Volume * nVolumes = tile->getNVolumes(i, j, nCount);
+
+        MVOG::MLVolumeVector mlVolumes;
+        MVOG::createMLVolumes(pVolumes, pCount, nVolumes, nCount, mlVolumes);
+        for (size_t c = 0; c < mlVolumes.size(); c++)
+          checksum += mlVolumes[c].bot + 2.0 * mlVolumes[c].top;
+        total += mlVolumes.size();
+      }
+    }
+  }
+
+  return total;
+}
+
+void benchMLVolumes(MVOG::Mapper& mapper, const sensor_msgs::LaserScanPtr& scan, const btTransform& pose)
+{
+  MVOG::Map * map = mapper.getMap();
+  double fullSum, cachedSum;
+
+  double start = getTime();
+  long full = extractMLVolumes(map, false, fullSum);
+  double fullTime = getTime() - start;
+
+  start = getTime();
+  extractMLVolumes(map, true, cachedSum);
+  double firstTime = getTime() - start;
+
+  // **** one more scan changes a fraction of the cells
+
+  mapper.addLaserData(scan, pose);
+
+  start = getTime();
+  extractMLVolumes(map, true, cachedSum);
+  double cachedTime = getTime() - start;
+
+  start = getTime();
+  long cachedAgain = extractMLVolumes(map, true, cachedSum);
+  double cleanTime = getTime() - start;
+
+  extractMLVolumes(map, false, fullSum);
+
+  printf("ML volumes: %ld, full %.2f ms, cache build %.2f ms, "
+         "after a scan %.2f ms, unchanged %.2f ms, cache %s\n",
+    full, 1000.0 * fullTime, 1000.0 * firstTime, 1000.0 * cachedTime, 1000.0 * cleanTime,
+    (fullSum == cachedSum && cachedAgain > 0) ? "IDENTICAL" : "DIFFERENT");
+}
+
+double insertScans(MVOG::Mapper& mapper,
+                   const std::vector<sensor_msgs::LaserScanPtr>& scanSet,
+                   const std::vector<btTransform>& poses)
+{
+  double start = getTime();
+
+  for (size_t i = 0; i < scanSet.size(); i++)
+    mapper.addLaserData(scanSet[i], poses[i]);
+
+  return getTime() - start;
+}
+
+long getPeakRSS()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss; // KB
+}
+
+// **** long beams: cell sequences of the former quadrant rasterizer
+//      against the traversal kernel
+
+struct RayCell
+{
+  int cx;
+  int cy;
+  double bot;
+  double top;
+};
+
+// the rasterizer Mapper::addNegativeBeamSpace used before the kernel,
+// kept as a reference
+void traverseQuadrants(btVector3 origin, btVector3 obstacle, std::vector<RayCell>& cells)
+{
+  btVector3 beam = obstacle - origin;
+
+  double cx = origin.getX();
+  double cy = origin.getY();
+  double cz = origin.getZ();
+  double cd = 0.0;
+
+  double beamLength = beam.length();
+
+  double slopeYX = beam.getY() / beam.getX();
+  double slopeZX = beam.getZ() / beam.getX();
+  double slopeZY = beam.getZ() / beam.getY();
+  double slopeXY = beam.getX() / beam.getY();
+  double slopeDX = beamLength / beam.getX();
+  double slopeDY = beamLength / beam.getY();
+
+  double currentX, currentY;
+  double pz;
+
+  while(1)
+  {
+    pz = cz;
+
+    double dx, dy;
+    bool stepX;
+
+    if (beam.getX() >= 0 && beam.getY() >= 0)
+    {
+      dx = floor(cx) + 1.0 - cx;
+      dy = floor(cy) + 1.0 - cy;
+      currentX = cx;
+      currentY = cy;
+      stepX = dy > dx * slopeYX;
+    }
+    else if (beam.getX() < 0 && beam.getY() >= 0)
+    {
+      dx = floor(cx) - cx;
+      dy = floor(cy) + 1.0 - cy;
+      if (dx == 0.0) dx = -1.0;
+      currentX = cx + dx;
+      currentY = cy;
+      stepX = dy > dx * slopeYX;
+    }
+    else if (beam.getX() <= 0 && beam.getY() < 0)
+    {
+      dx = floor(cx) - cx;
+      dy = floor(cy) - cy;
+      if (dx == 0) dx = -1.0;
+      if (dy == 0) dy = -1.0;
+      currentX = cx + dx;
+      currentY = cy + dy;
+      stepX = dy < dx * slopeYX;
+    }
+    else
+    {
+      dx = floor(cx) + 1.0 - cx;
+      dy = floor(cy) - cy;
+      if (dy == 0.0) dy = -1.0;
+      currentX = cx;
+      currentY = cy + dy;
+      stepX = dy < dx * slopeYX;
+    }
+
+    if (stepX)
+    {
+      cx += dx;
+      cy += dx * slopeYX;
+      cz += dx * slopeZX;
+      cd += dx * slopeDX;
+    }
+    else
+    {
+      cx += dy * slopeXY;
+      cy += dy;
+      cz += dy * slopeZY;
+      cd += dy * slopeDY;
+    }
+
+    RayCell cell = {(int)floor(currentX), (int)floor(currentY), pz, cz};
+    if (cd >= beamLength) cell.top = pz;
+    cells.push_back(cell);
+
+    if (cd >= beamLength) break;
+  }
+}
+
+void traverseKernel(btVector3 origin, btVector3 obstacle, std::vector<RayCell>& cells)
+{
+  MVOG::RayTraversal ray(origin, obstacle);
+
+  while (ray.leavesCell())
+  {
+    RayCell cell = {ray.getCellX(), ray.getCellY(), ray.getEntryZ(), ray.getExitZ()};
+    cells.push_back(cell);
+    ray.step();
+  }
+
+  RayCell cell = {ray.getCellX(), ray.getCellY(), ray.getEntryZ(), ray.getEntryZ()};
+  cells.push_back(cell);
+}
+
+// beams of RANGE_MAX meters in random directions, in grid units
+void createBeams(int count, double resolution, std::vector<btVector3>& origins, std::vector<btVector3>& ends)
+{
+  srand(42);
+
+  for (int i = 0; i < count; i++)
+  {
+    double yaw   = 2.0 * M_PI * rand() / RAND_MAX;
+    double pitch = 0.4 * rand() / RAND_MAX - 0.2;
+
+    btVector3 o((40.0 * rand() / RAND_MAX - 20.0) / resolution,
+                (40.0 * rand() / RAND_MAX - 20.0) / resolution,
+                (2.0 * rand() / RAND_MAX) / resolution);
+
+    btVector3 d(cos(pitch) * cos(yaw), cos(pitch) * sin(yaw), sin(pitch));
+
+    origins.push_back(o);
+    ends.push_back(o + d * (RANGE_MAX / resolution));
+  }
+}
+
+void benchRays(int count, double resolution)
+{
+  printf("Traversing %d beams of %.1f m at %.3f m resolution\n", count, RANGE_MAX, resolution);
+
+  std::vector<btVector3> origins, ends;
+  createBeams(count, resolution, origins, ends);
+
+  // **** identical cell sequences
+
+  std::vector<RayCell> a, b;
+  int    mismatches = 0;
+  double maxDZ      = 0.0;
+  long   cells      = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    a.clear();
+    b.clear();
+    traverseQuadrants(origins[i], ends[i], a);
+    traverseKernel   (origins[i], ends[i], b);
+
+    cells += a.size();
+
+    bool same = a.size() == b.size();
+    for (size_t c = 0; same && c < a.size(); c++)
+    {
+      same = a[c].cx == b[c].cx && a[c].cy == b[c].cy;
+      maxDZ = std::max(maxDZ, std::max(fabs(a[c].bot - b[c].bot), fabs(a[c].top - b[c].top)));
+    }
+
+    if (!same) mismatches++;
+  }
+
+  printf("cells:     %.1f per beam\n", (double)cells / count);
+  printf("sequences: %s (%d of %d beams differ), max z difference %g cells\n",
+    mismatches ? "DIFFERENT" : "IDENTICAL", mismatches, count, maxDZ);
+
+  // **** traversal only
+
+  double start = getTime();
+  for (int i = 0; i < count; i++)
+  {
+    a.clear();
+    traverseQuadrants(origins[i], ends[i], a);
+  }
+  double quadrants = getTime() - start;
+
+  start = getTime();
+  for (int i = 0; i < count; i++)
+  {
+    b.clear();
+    traverseKernel(origins[i], ends[i], b);
+  }
+  double kernel = getTime() - start;
+
+  printf("quadrants: %.1f ns/cell\n", 1e9 * quadrants / cells);
+  printf("kernel:    %.1f ns/cell (%.2fx)\n", 1e9 * kernel / cells, quadrants / kernel);
+
+  // **** full insertion into a map
+
+  MVOG::Mapper mapper(resolution, 10.0, 10.0);
+
+  start = getTime();
+  for (int i = 0; i < count; i++)
+    mapper.addBeamReading(origins[i] * resolution, ends[i] * resolution);
+  double insert = getTime() - start;
+
+  printf("insert:    %.1f ns/cell\n", 1e9 * insert / cells);
+}
+
+void createScans(int scans, std::vector<sensor_msgs::LaserScanPtr>& scanSet,
+                 std::vector<btTransform>& poses)
+{
+  scanSet.resize(scans);
+  poses.resize(scans);
+
+  for (int i = 0; i < scans; i++)
+  {
+    scanSet[i].reset(new sensor_msgs::LaserScan);
+    createScan(i, *scanSet[i], poses[i]);
+  }
+}
+
+// **** cells with any volumes, in the tiles allocated so far
+
+long countCells(MVOG::Map * map, long& allocated)
+{
+  long used = 0;
+  allocated = 0;
+
+  for (int tx = 0; tx < map->getTilesX(); tx++)
+  for (int ty = 0; ty < map->getTilesY(); ty++)
+  {
+    MVOG::Tile * tile = map->getTile(tx, ty);
+    if (!tile) continue;
+
+    allocated += MVOG::TILE_CELLS;
+
+    for (int i = 0; i < MVOG::TILE_SIZE; i++)
+    for (int j = 0; j < MVOG::TILE_SIZE; j++)
+    {
+      int pCount, nCount;
+      tile->getPVolumes(i, j, pCount);
+      tile->getNVolumes(i, j, nCount);
+      if (pCount || nCount) used++;
+    }
+  }
+
+  return used;
+}
+
+// **** the same scans, inserted into a map of each cell format. Query
+//      time is reading the volumes of every cell and building their ML
+//      volumes, without the tile caches.
+
+void benchFormats(int scans, double resolution)
+{
+  printf("Inserting %d scans at %.3f m resolution\n", scans, resolution);
+
+  std::vector<sensor_msgs::LaserScanPtr> scanSet;
+  std::vector<btTransform> poses;
+  createScans(scans, scanSet, poses);
+
+  const int formatsCount = 4;
+  MVOG::CellFormat formats[formatsCount] = 
+    {MVOG::CELL_FORMAT_FLOAT, MVOG::CELL_FORMAT_COMPACT, MVOG::CELL_FORMAT_ARRAY, MVOG::CELL_FORMAT_VECTOR};
+
+  MVOG::Mapper * mappers[formatsCount];
+  double insertTime[formatsCount];
+  double queryTime[formatsCount];
+  long   mlCount[formatsCount];
+
+  for (int f = 0; f < formatsCount; f++)
+  {
+    mappers[f] = new MVOG::Mapper(resolution, 10.0, 10.0, formats[f]);
+    insertTime[f] = insertScans(*mappers[f], scanSet, poses);
+
+    double checksum;
+    double start = getTime();
+    mlCount[f] = extractMLVolumes(mappers[f]->getMap(), false, checksum);
+    queryTime[f] = getTime() - start;
+  }
+
+  printf("\n%-12s %10s %10s %10s %10s %10s %10s  %s\n", "format", "scans/s", "query ms",
+    "map KB", "B/cell", "B/used", "ML vols", "same as float");
+
+  for (int f = 0; f < formatsCount; f++)
+  {
+    MVOG::Map * map = mappers[f]->getMap();
+
+    long allocated;
+    long used = countCells(map, allocated);
+    double bytes = map->getMemoryBytes();
+
+    printf("%-12s %10.2f %10.2f %10.1f %10.1f %10.1f %10ld  %s\n", 
+      MVOG::getCellFormatName(formats[f]), scans / insertTime[f], 1000.0 * queryTime[f], 
+      bytes / 1024.0, bytes / allocated, bytes / used, mlCount[f],
+      f == 0 ? "-" : (compareMaps(mappers[0]->getMap(), map) ? "yes" : "no"));
+  }
+
+  printf("\nsizeof: Cell %d, CompactCell %d, ArrayCell %d, VectorCell %d bytes\n",
+    (int)sizeof(MVOG::Cell), (int)sizeof(MVOG::CompactCell), 
+    (int)sizeof(MVOG::ArrayCell), (int)sizeof(MVOG::VectorCell));
+
+  // **** a fully touched 500 m x 500 m map at 10 cm, before any volumes
+
+  double tiles = (500.0 / 0.10) * (500.0 / 0.10) / MVOG::TILE_CELLS;
+
+  printf("500 x 500 m at 10 cm, empty cells: %.0f MB float, %.0f MB compact\n",
+    tiles * sizeof(MVOG::FloatTile)   / (1024.0 * 1024.0),
+    tiles * sizeof(MVOG::CompactTile) / (1024.0 * 1024.0));
+
+  for (int f = 0; f < formatsCount; f++)
+    delete mappers[f];
+}
+
+// **** save the map, load it back mapped and copied. A scan inserted
+//      after loading must give the same map as without the round trip.
+
+void benchSnapshot(int scans, double resolution, const char * filename)
+{
+  printf("Inserting %d scans at %.3f m resolution\n", scans, resolution);
+
+  std::vector<sensor_msgs::LaserScanPtr> scanSet;
+  std::vector<btTransform> poses;
+  createScans(scans + 1, scanSet, poses);
+
+  MVOG::Mapper mapper(resolution, 10.0, 10.0);
+
+  for (int i = 0; i < scans; i++)
+    mapper.addLaserData(scanSet[i], poses[i]);
+
+  double start = getTime();
+  bool saved = MVOG::MapFile::save(*mapper.getMap(), filename);
+  double saveTime = getTime() - start;
+
+  if (!saved) return;
+
+  struct stat info;
+  stat(filename, &info);
+
+  MVOG::Mapper mappedMapper(0.5, 1.0, 1.0);
+  MVOG::Mapper copiedMapper(0.5, 1.0, 1.0, MVOG::CELL_FORMAT_COMPACT);
+
+  start = getTime();
+  bool mapped = MVOG::MapFile::load(*mappedMapper.getMap(), filename, true);
+  double mapTime = getTime() - start;
+
+  start = getTime();
+  bool copied = MVOG::MapFile::load(*copiedMapper.getMap(), filename, false);
+  double copyTime = getTime() - start;
+
+  if (!mapped || !copied) return;
+
+  double checksum;
+  start = getTime();
+  extractMLVolumes(mappedMapper.getMap(), true, checksum);
+  double queryTime = getTime() - start;
+
+  printf("file:   %.1f KB, saved in %.2f ms\n", info.st_size / 1024.0, 1000.0 * saveTime);
+  printf("mapped: loaded in %.3f ms, first full ML query %.2f ms, map %s\n",
+    1000.0 * mapTime, 1000.0 * queryTime,
+    compareMaps(mapper.getMap(), mappedMapper.getMap()) ? "IDENTICAL" : "DIFFERENT");
+  printf("copied: loaded in %.2f ms into compact cells, %.1f KB\n",
+    1000.0 * copyTime, copiedMapper.getMap()->getMemorySize());
+
+  mapper.addLaserData(scanSet[scans], poses[scans]);
+  mappedMapper.addLaserData(scanSet[scans], poses[scans]);
+
+  printf("mapped, after one more scan: %s, %.1f KB in memory\n",
+    compareMaps(mapper.getMap(), mappedMapper.getMap()) ? "IDENTICAL" : "DIFFERENT",
+    mappedMapper.getMap()->getMemorySize());
+}
+
+// **** batched queries against one point at a time
+
+double getRandom(double min, double max)
+{
+  return min + (max - min) * (rand() / (double)RAND_MAX);
+}
+
+void benchQueries(int count, double resolution)
+{
+  int scans = 200;
+  printf("Inserting %d scans at %.3f m resolution\n", scans, resolution);
+
+  std::vector<sensor_msgs::LaserScanPtr> scanSet;
+  std::vector<btTransform> poses;
+  createScans(scans, scanSet, poses);
+
+  MVOG::Mapper mapper(resolution, 10.0, 10.0);
+  insertScans(mapper, scanSet, poses);
+
+  MVOG::Map * map = mapper.getMap();
+
+  srand(1);
+
+  std::vector<btVector3> points(count);
+  for (int p = 0; p < count; p++)
+    points[p] = btVector3(getRandom(ROOM_MIN[0], ROOM_MAX[0]),
+                          getRandom(ROOM_MIN[1], ROOM_MAX[1]),
+                          getRandom(ROOM_MIN[2], ROOM_MAX[2]));
+
+  // **** both paths run once before they are timed, so that neither pays
+  //      for the tiles' ML volume caches or a cold cache; the best of
+  //      REPEATS runs is reported
+
+  const int REPEATS = 3;
+
+  // **** point densities
+
+  std::vector<float> densities;
+  std::vector<float> singleDensities(count);
+
+  double batchTime = 1e9, singleTime = 1e9;
+
+  for (int r = 0; r <= REPEATS; r++)
+  {
+    double start = getTime();
+    map->getOccDensities(points, densities);
+    if (r) batchTime = std::min(batchTime, getTime() - start);
+
+    start = getTime();
+    for (int p = 0; p < count; p++)
+    {
+      double x = points[p].getX() / resolution;
+      double y = points[p].getY() / resolution;
+      float  z = points[p].getZ() / resolution;
+
+      float density = -1.0;
+      map->getCell(x, y)->getOccDensity(z, density);
+      singleDensities[p] = density;
+    }
+    if (r) singleTime = std::min(singleTime, getTime() - start);
+  }
+
+  int mismatches = 0, known = 0;
+  for (int p = 0; p < count; p++)
+  {
+    if (singleDensities[p] != densities[p]) mismatches++;
+    if (singleDensities[p] >= 0.0) known++;
+  }
+
+  printf("\npoint densities: %.2f M/s batched, %.2f M/s one by one (Cell::getOccDensity), "
+         "%d known, %s\n",
+    count / batchTime / 1e6, count / singleTime / 1e6, known,
+    mismatches ? "DIFFERENT" : "IDENTICAL");
+
+  // **** points inside ML volumes
+
+  std::vector<char> occupied;
+  std::vector<char> singleOccupied(count);
+
+  batchTime = singleTime = 1e9;
+
+  for (int r = 0; r <= REPEATS; r++)
+  {
+    double start = getTime();
+    map->getOccupied(points, occupied);
+    if (r) batchTime = std::min(batchTime, getTime() - start);
+
+    start = getTime();
+    for (int p = 0; p < count; p++)
+    {
+      int mlCount;
+      const MVOG::MLVolume * mlVolumes = 
+        map->getMLVolumes(points[p].getX() / resolution, points[p].getY() / resolution, mlCount);
+
+      float z = points[p].getZ() / resolution;
+      bool in = false;
+      for (int v = 0; v < mlCount && !in; v++)
+        in = (mlVolumes[v].bot <= z && z <= mlVolumes[v].top);
+
+      singleOccupied[p] = in;
+    }
+    if (r) singleTime = std::min(singleTime, getTime() - start);
+  }
+
+  mismatches = 0;
+  int inside = 0;
+  for (int p = 0; p < count; p++)
+  {
+    if (singleOccupied[p] != occupied[p]) mismatches++;
+    if (singleOccupied[p]) inside++;
+  }
+
+  printf("occupied points: %.2f M/s batched, %.2f M/s one by one (linear search), "
+         "%d occupied, %s\n",
+    count / batchTime / 1e6, count / singleTime / 1e6, inside,
+    mismatches ? "DIFFERENT" : "IDENTICAL");
+
+  // **** 1 m segments. A sampled point inside an ML volume means the
+  //      segment must be reported.
+
+  int segments = count / 10;
+  std::vector<btVector3> starts(segments), ends(segments);
+
+  for (int s = 0; s < segments; s++)
+  {
+    starts[s] = points[s];
+    btVector3 dir(getRandom(-1, 1), getRandom(-1, 1), getRandom(-0.3, 0.3));
+    ends[s] = starts[s] + dir / dir.length();
+  }
+
+  double start = getTime();
+  map->getSegmentsOccupied(starts, ends, occupied);
+  batchTime = getTime() - start;
+
+  std::vector<btVector3> samples;
+  for (int s = 0; s < segments; s++)
+    for (int t = 0; t <= 100; t++)
+      samples.push_back(starts[s] + (ends[s] - starts[s]) * (t / 100.0));
+
+  std::vector<char> sampled;
+  map->getOccupied(samples, sampled);
+
+  mismatches = 0;
+  int hits = 0;
+  for (int s = 0; s < segments; s++)
+  {
+    bool any = false;
+    for (int t = 0; t <= 100; t++) any = any || sampled[s * 101 + t];
+
+    if (any && !occupied[s]) mismatches++;
+    if (occupied[s]) hits++;
+  }
+
+  printf("segments:        %.2f M/s, %d of %d occupied, %d missed\n",
+    segments / batchTime / 1e6, hits, segments, mismatches);
+
+  // **** ray casts from the middle of the room
+
+  int rays = count / 10;
+  int rayHits = 0;
+  double rangeSum = 0.0;
+
+  btVector3 origin(0.0, 0.0, 1.5);
+
+  start = getTime();
+  for (int r = 0; r < rays; r++)
+  {
+    btVector3 dir(getRandom(-1, 1), getRandom(-1, 1), getRandom(-1, 1));
+    if (dir.length2() < 1e-6) continue;
+
+    btVector3 hit;
+    if (map->castRay(origin, dir, RANGE_MAX, hit))
+    {
+      rayHits++;
+      rangeSum += (hit - origin).length();
+    }
+  }
+  double rayTime = getTime() - start;
+
+  printf("ray casts:       %.2f M/s, %d of %d hit, mean range %.2f m\n",
+    rays / rayTime / 1e6, rayHits, rays, rayHits ? rangeSum / rayHits : 0.0);
+}
+
+// **** dense frames: a 640 x 480 depth camera at the laser's height,
+//      looking along the laser's heading, and the 320 x 240 cloud which
+//      kinect_node publishes from it
+
+const int    DEPTH_WIDTH  = 640;
+const int    DEPTH_HEIGHT = 480;
+const double DEPTH_F      = 525.0;
+const double DEPTH_MAX    = 8.0;
+
+void createDepthFrame(int index, sensor_msgs::Image& image, sensor_msgs::CameraInfo& info, btTransform& w2c)
+{
+  double t = index * 0.05;
+
+  // camera z along the heading, x down
+  w2c.setIdentity();
+  w2c.setOrigin(btVector3(6.0 * cos(0.3*t), 4.0 * sin(0.3*t), 1.0 + 0.5 * sin(t)));
+  w2c.setRotation(btQuaternion(0.3*t + M_PI, M_PI/2.0 + 0.10 * sin(1.3*t), M_PI/2.0));
+
+  info.width  = DEPTH_WIDTH;
+  info.height = DEPTH_HEIGHT;
+  info.K.assign(0.0);
+  info.K[0] = DEPTH_F;
+  info.K[2] = (DEPTH_WIDTH  - 1) / 2.0;
+  info.K[4] = DEPTH_F;
+  info.K[5] = (DEPTH_HEIGHT - 1) / 2.0;
+  info.K[8] = 1.0;
+
+  image.width    = DEPTH_WIDTH;
+  image.height   = DEPTH_HEIGHT;
+  image.encoding = "16UC1";
+  image.step     = DEPTH_WIDTH * sizeof(uint16_t);
+
+  uint16_t one = 1;
+  image.is_bigendian = (*reinterpret_cast<uint8_t*>(&one) == 0);
+  image.data.resize(image.step * DEPTH_HEIGHT);
+
+  btVector3 origin = w2c * btVector3(0.0, 0.0, 0.0);
+
+  for (int v = 0; v < DEPTH_HEIGHT; v++)
+  for (int u = 0; u < DEPTH_WIDTH;  u++)
+  {
+    btVector3 ray((u - info.K[2]) / DEPTH_F, (v - info.K[5]) / DEPTH_F, 1.0);
+
+    // the range along a ray with z = 1 is the depth
+    double depth = castRay(origin, w2c * ray - origin);
+
+    double noise = (((u * 7919 + v * 104729 + index * 15485863) % 1000) / 1000.0 - 0.5) * 0.01;
+
+    uint16_t mm = 0;
+    if (depth < DEPTH_MAX) mm = (uint16_t)((depth + noise) * 1000.0);
+
+    reinterpret_cast<uint16_t*>(&image.data[0])[v * DEPTH_WIDTH + u] = mm;
+  }
+}
+
+void createCloud(const sensor_msgs::Image& image, const sensor_msgs::CameraInfo& info,
+                 sensor_msgs::PointCloud2& cloud)
+{
+  // **** every other pixel, as PointXYZRGB: x, y, z at 0, 4, 8
+
+  const char * names[3] = {"x", "y", "z"};
+
+  cloud.fields.resize(3);
+  for (int a = 0; a < 3; a++)
+  {
+    cloud.fields[a].name     = names[a];
+    cloud.fields[a].offset   = a * sizeof(float);
+    cloud.fields[a].datatype = sensor_msgs::PointField::FLOAT32;
+    cloud.fields[a].count    = 1;
+  }
+
+  cloud.width      = image.width  / 2;
+  cloud.height     = image.height / 2;
+  cloud.point_step = 32;
+  cloud.row_step   = cloud.point_step * cloud.width;
+  cloud.is_bigendian = image.is_bigendian;
+  cloud.data.assign(cloud.row_step * cloud.height, 0);
+
+  for (size_t v = 0; v < cloud.height; v++)
+  for (size_t u = 0; u < cloud.width;  u++)
+  {
+    int pu = u * 2, pv = v * 2;
+    uint16_t mm = reinterpret_cast<const uint16_t*>(&image.data[0])[pv * image.width + pu];
+
+    float p[3];
+    if (mm == 0)
+      p[0] = p[1] = p[2] = std::numeric_limits<float>::quiet_NaN();
+    else
+    {
+      p[2] = mm * 0.001;
+      p[0] = (pu - info.K[2]) / info.K[0] * p[2];
+      p[1] = (pv - info.K[5]) / info.K[4] * p[2];
+    }
+
+    memcpy(&cloud.data[v * cloud.row_step + u * cloud.point_step], p, sizeof(p));
+  }
+}
+
+void benchDepth(int frames, double resolution)
+{
+  printf("Creating %d depth frames\n", frames);
+
+  std::vector<sensor_msgs::ImagePtr>       images;
+  std::vector<sensor_msgs::CameraInfoPtr>  infos;
+  std::vector<sensor_msgs::PointCloud2Ptr> clouds;
+  std::vector<btTransform> poses(frames);
+
+  for (int f = 0; f < frames; f++)
+  {
+    images.push_back(sensor_msgs::ImagePtr(new sensor_msgs::Image));
+    infos .push_back(sensor_msgs::CameraInfoPtr(new sensor_msgs::CameraInfo));
+    clouds.push_back(sensor_msgs::PointCloud2Ptr(new sensor_msgs::PointCloud2));
+
+    createDepthFrame(f * 4, *images[f], *infos[f], poses[f]);
+    createCloud(*images[f], *infos[f], *clouds[f]);
+  }
+
+  printf("\n%-26s %9s %9s %8s %8s %9s %10s\n", 
+    "input", "ms/frame", "max ms", "fps", "points", "voxels", "range err");
+
+  for (int run = 0; run < 4; run++)
+  {
+    bool   cloud        = (run != 0);
+    double maxFreeRange = (run == 2) ? 3.0 : 0.0;
+    bool   perPoint     = (run == 3);
+
+    MVOG::Mapper mapper(resolution, 10.0, 10.0);
+    mapper.setMaxFreeSpaceRange(maxFreeRange);
+
+    // **** one beam per point is slow: a few frames are enough
+    int runFrames = perPoint ? std::min(frames, 5) : frames;
+
+    double total = 0.0, worst = 0.0;
+    size_t points = 0, voxels = 0;
+
+    for (int f = 0; f < runFrames; f++)
+    {
+      double start = getTime();
+
+      if (perPoint)
+      {
+        // the cloud, through addBeamReading()
+        btVector3 origin = poses[f] * btVector3(0.0, 0.0, 0.0);
+        const sensor_msgs::PointCloud2& c = *clouds[f];
+
+        for (size_t p = 0; p < c.width * c.height; p++)
+        {
+          float xyz[3];
+          memcpy(xyz, &c.data[p * c.point_step], sizeof(xyz));
+          if (xyz[0] != xyz[0]) continue;
+          mapper.addBeamReading(origin, poses[f] * btVector3(xyz[0], xyz[1], xyz[2]));
+        }
+      }
+      else if (cloud)
+        mapper.addPointCloud(clouds[f], poses[f]);
+      else
+        mapper.addDepthImage(images[f], infos[f], poses[f]);
+
+      double duration = getTime() - start;
+      total += duration;
+      worst  = std::max(worst, duration);
+
+      size_t framePoints, frameVoxels;
+      mapper.getFrameStats(framePoints, frameVoxels);
+      points += framePoints;
+      voxels += frameVoxels;
+    }
+
+    // **** range to the first occupied volume against the room, for a
+    //      grid of pixels of the first frame
+
+    MVOG::Map * map = mapper.getMap();
+    btVector3 origin = poses[0] * btVector3(0.0, 0.0, 0.0);
+
+    double error = 0.0;
+    int    rays  = 0;
+
+    for (int v = 0; v < DEPTH_HEIGHT; v += 16)
+    for (int u = 0; u < DEPTH_WIDTH;  u += 16)
+    {
+      btVector3 ray((u - infos[0]->K[2]) / DEPTH_F, (v - infos[0]->K[5]) / DEPTH_F, 1.0);
+      btVector3 dir = poses[0] * ray - origin;
+      dir /= dir.length();
+
+      double range = castRay(origin, dir);
+      if (range > DEPTH_MAX * 0.9) continue;
+
+      btVector3 hit;
+      if (map->castRay(origin, dir, DEPTH_MAX, hit))
+        error += fabs((hit - origin).length() - range);
+      else
+        error += range;
+      rays++;
+    }
+
+    const char * names[4] = {"depth image 640x480", "cloud 320x240", 
+                             "cloud 320x240, 3 m free", "cloud 320x240, per point"};
+
+    printf("%-26s %9.2f %9.2f %8.1f %8zu %9zu %8.3f m\n", names[run],
+      total / runFrames * 1000.0, worst * 1000.0, runFrames / total,
+      perPoint ? 0 : points / runFrames, perPoint ? 0 : voxels / runFrames, 
+      rays ? error / rays : 0.0);
+  }
+}
+
+// **** 2D grids kept up to date from patches, against exporting the
+//      whole map again
+
+struct Grid
+{
+  int minCX, minCY, sizeX, sizeY;
+  std::vector<signed char> occupancy;
+  std::vector<float> maxHeight, minClearance;
+
+  Grid(int minCX_, int minCY_, int sizeX_, int sizeY_):
+    minCX(minCX_), minCY(minCY_), sizeX(sizeX_), sizeY(sizeY_),
+    occupancy(sizeX_ * sizeY_, MVOG::GRID_UNKNOWN),
+    maxHeight(sizeX_ * sizeY_, std::numeric_limits<float>::quiet_NaN()),
+    minClearance(sizeX_ * sizeY_, std::numeric_limits<float>::quiet_NaN()) { }
+
+  // patches may reach past the grid: whole tiles are exported at first
+  void apply(const std::vector<MVOG::GridPatch>& patches)
+  {
+    for (size_t p = 0; p < patches.size(); p++)
+    {
+      const MVOG::GridPatch& patch = patches[p];
+
+      for (int y = 0; y < patch.sizeY; y++)
+      for (int x = 0; x < patch.sizeX; x++)
+      {
+        int gx = patch.minCX + x - minCX;
+        int gy = patch.minCY + y - minCY;
+        if (gx < 0 || gx >= sizeX || gy < 0 || gy >= sizeY) continue;
+
+        int g = gy * sizeX + gx;
+        int c = y * patch.sizeX + x;
+
+        occupancy[g]    = patch.occupancy[c];
+        maxHeight[g]    = patch.maxHeight[c];
+        minClearance[g] = patch.minClearance[c];
+      }
+    }
+  }
+
+  // NaNs compare equal
+  bool operator==(const Grid& other) const
+  {
+    return occupancy == other.occupancy &&
+           !memcmp(&maxHeight[0], &other.maxHeight[0], maxHeight.size() * sizeof(float)) &&
+           !memcmp(&minClearance[0], &other.minClearance[0], minClearance.size() * sizeof(float));
+  }
+};
+
+void benchExport(int scans, double resolution)
+{
+  printf("Inserting %d scans at %.3f m resolution\n", scans, resolution);
+
+  std::vector<sensor_msgs::LaserScanPtr> scanSet;
+  std::vector<btTransform> poses;
+  createScans(scans, scanSet, poses);
+
+  MVOG::Mapper mapper(resolution, 10.0, 10.0);
+  MVOG::Map * map = mapper.getMap();
+
+  MVOG::GridExporter exporter(map);
+  exporter.setBand(0.5, 1.5);
+
+  // **** the room, and a margin
+
+  int minCX = (int)floor((ROOM_MIN[0] - 1.0) / resolution);
+  int minCY = (int)floor((ROOM_MIN[1] - 1.0) / resolution);
+  int maxCX = (int)ceil ((ROOM_MAX[0] + 1.0) / resolution);
+  int maxCY = (int)ceil ((ROOM_MAX[1] + 1.0) / resolution);
+
+  Grid grid(minCX, minCY, maxCX - minCX, maxCY - minCY);
+
+  std::vector<MVOG::GridPatch> patches;
+  double exportTime = 0.0, insertTime = 0.0;
+  size_t patchCount = 0, patchCells = 0;
+
+  for (int s = 0; s < scans; s++)
+  {
+    double start = getTime();
+    mapper.addLaserData(scanSet[s], poses[s]);
+    double inserted = getTime();
+    exporter.getPatches(patches);
+    double exported = getTime();
+
+    insertTime += inserted - start;
+    exportTime += exported - inserted;
+
+    patchCount += patches.size();
+    for (size_t p = 0; p < patches.size(); p++)
+      patchCells += patches[p].sizeX * patches[p].sizeY;
+
+    grid.apply(patches);
+  }
+
+  // **** a local change: one beam
+
+  btVector3 origin = poses[0] * btVector3(0.0, 0.0, 0.0);
+  mapper.addBeamReading(origin, origin + btVector3(1.0, 0.5, 0.0));
+
+  double start = getTime();
+  exporter.getPatches(patches);
+  double beamTime = getTime() - start;
+
+  size_t beamCells = 0;
+  for (size_t p = 0; p < patches.size(); p++)
+    beamCells += patches[p].sizeX * patches[p].sizeY;
+
+  grid.apply(patches);
+
+  // **** everything again, from scratch
+
+  MVOG::GridExporter fullExporter(map);
+  fullExporter.setBand(0.5, 1.5);
+
+  start = getTime();
+  fullExporter.getPatches(patches);
+  double fullTime = getTime() - start;
+
+  size_t fullCells = 0;
+  for (size_t p = 0; p < patches.size(); p++)
+    fullCells += patches[p].sizeX * patches[p].sizeY;
+
+  Grid full(minCX, minCY, maxCX - minCX, maxCY - minCY);
+  full.apply(patches);
+
+  long occupied = 0, free = 0;
+  for (size_t c = 0; c < full.occupancy.size(); c++)
+  {
+    if (full.occupancy[c] == MVOG::GRID_OCCUPIED) occupied++;
+    if (full.occupancy[c] == MVOG::GRID_FREE)     free++;
+  }
+
+  printf("insert %.2f ms/scan, patches %.2f ms/scan: %.1f patches, %.0f cells per scan\n",
+    1000.0 * insertTime / scans, 1000.0 * exportTime / scans, 
+    (double)patchCount / scans, (double)patchCells / scans);
+  printf("one beam: patches %.3f ms, %zu cells\n", 1000.0 * beamTime, beamCells);
+  printf("full export %.2f ms, %zu cells\n", 1000.0 * fullTime, fullCells);
+  printf("band 0.5 - 1.5 m: %ld occupied, %ld free cells\n", occupied, free);
+  printf("grid from patches: %s\n", grid == full ? "IDENTICAL" : "DIFFERENT");
+}
+
+// **** a memory budget: the map must come out the same as without one,
+//      with the spilled tiles reloaded as the laser comes back to them
+
+void benchSpill(int scans, double resolution, double budgetKB, double keepRadius)
+{
+  printf("Inserting %d scans at %.3f m resolution, budget %.0f KB, keeping %.1f m\n", 
+    scans, resolution, budgetKB, keepRadius);
+
+  std::vector<sensor_msgs::LaserScanPtr> scanSet;
+  std::vector<btTransform> poses;
+  createScans(scans, scanSet, poses);
+
+  MVOG::Mapper bounded(resolution, 10.0, 10.0);
+  bounded.setMemoryBudget(budgetKB * 1024.0, "/tmp/mvog_model_bench.spill", keepRadius);
+
+  double boundedTime = 0.0, worst = 0.0;
+  size_t peakResident = 0;
+
+  for (int s = 0; s < scans; s++)
+  {
+    double start = getTime();
+    bounded.addLaserData(scanSet[s], poses[s]);
+    double duration = getTime() - start;
+
+    boundedTime += duration;
+    worst        = std::max(worst, duration);
+    peakResident = std::max(peakResident, bounded.getMap()->getResidentBytes());
+  }
+
+  long boundedRSS = getPeakRSS();
+
+  MVOG::Mapper unbounded(resolution, 10.0, 10.0);
+  double unboundedTime = insertScans(unbounded, scanSet, poses);
+
+  MVOG::SpillStats stats;
+  bounded.getMap()->getSpillStats(stats);
+
+  printf("\n%-10s %9s %9s %12s %12s\n", "budget", "ms/scan", "max ms", "map KB", "peak RSS KB");
+  printf("%-10s %9.2f %9.2f %12.1f %12ld\n", "bounded", 1000.0 * boundedTime / scans, 1000.0 * worst,
+    bounded.getMap()->getMemorySize(), boundedRSS);
+  printf("%-10s %9.2f %9s %12.1f %12ld\n", "none", 1000.0 * unboundedTime / scans, "-",
+    unbounded.getMap()->getMemorySize(), getPeakRSS());
+
+  printf("\nresident after each scan: max %.1f KB\n", peakResident / 1024.0);
+  printf("evictions %zu, reloads %zu, reload %.3f ms mean, %.3f ms max, %.1f KB spilled, %zu read errors\n",
+    stats.evictions, stats.reloads, stats.reloads ? 1000.0 * stats.reloadTime / stats.reloads : 0.0,
+    1000.0 * stats.maxReloadTime, stats.spilledBytes / 1024.0, stats.readErrors);
+
+  // **** reading every tile back reloads all of them
+
+  printf("map: %s\n", compareMaps(bounded.getMap(), unbounded.getMap()) ? "IDENTICAL" : "DIFFERENT");
+}
+
+// **** coarser levels kept up to date scan by scan, against building
+//      them from the finished map, and against merging all the fine
+//      cells under each coarse cell directly
+
+// max relative difference between the volumes of the level cell and the
+// union of its fine cells, scaled; -1 if their extents differ
+double checkLevelCell(MVOG::Map * map, int level, MVOG::Tile * tile, int i, int j, int cx, int cy, bool positive)
+{
+  int factor = 1 << level;
+  std::vector<float> merged, buffer, scaled;
+  int mergedCount = 0;
+
+  for (int x = cx * factor; x < (cx + 1) * factor; x++)
+  for (int y = cy * factor; y < (cy + 1) * factor; y++)
+  {
+    int fi, fj;
+    MVOG::Tile * fine = map->getTileAt(x, y, fi, fj);
+
+    int count;
+    const MVOG::Volume * volumes = positive ? fine->getPVolumes(fi, fj, count) : fine->getNVolumes(fi, fj, count);
+    if (!count) continue;
+
+    scaled.resize(count * 3);
+    for (int v = 0; v < count; v++)
+    {
+      scaled[v*3 + 0] = volumes[v][0] / factor;
+      scaled[v*3 + 1] = volumes[v][1] / factor;
+      scaled[v*3 + 2] = volumes[v][2] / factor;
+    }
+
+    buffer.resize((mergedCount + count) * 3);
+    mergedCount = MVOG::mergeVolumes(mergedCount ? reinterpret_cast<MVOG::Volume*>(&merged[0]) : NULL, mergedCount,
+      reinterpret_cast<MVOG::Volume*>(&scaled[0]), count, reinterpret_cast<MVOG::Volume*>(&buffer[0]));
+    merged.swap(buffer);
+  }
+
+  int count;
+  const MVOG::Volume * volumes = positive ? tile->getPVolumes(i, j, count) : tile->getNVolumes(i, j, count);
+  if (count != mergedCount) return -1.0;
+
+  double error = 0.0;
+  for (int v = 0; v < count; v++)
+  {
+    if (volumes[v][0] != merged[v*3 + 0] || volumes[v][1] != merged[v*3 + 1]) return -1.0;
+    error = std::max(error, fabs(volumes[v][2] - merged[v*3 + 2]) / merged[v*3 + 2]);
+  }
+
+  return error;
+}
+
+void benchLevels(int scans, double resolution, int levels)
+{
+  printf("Inserting %d scans at %.3f m resolution, %d levels\n", scans, resolution, levels);
+
+  std::vector<sensor_msgs::LaserScanPtr> scanSet;
+  std::vector<btTransform> poses;
+  createScans(scans, scanSet, poses);
+
+  MVOG::Mapper mapper(resolution, 10.0, 10.0);
+  mapper.getMap()->setLevels(levels);
+
+  double insertTime = 0.0, updateTime = 0.0, worstUpdate = 0.0;
+
+  for (int s = 0; s < scans; s++)
+  {
+    double start = getTime();
+    mapper.addLaserData(scanSet[s], poses[s]);
+    double inserted = getTime();
+    mapper.getMap()->getLevel(levels);
+    double updated = getTime();
+
+    insertTime  += inserted - start;
+    updateTime  += updated - inserted;
+    worstUpdate  = std::max(worstUpdate, updated - inserted);
+  }
+
+  MVOG::Mapper rebuilt(resolution, 10.0, 10.0);
+  insertScans(rebuilt, scanSet, poses);
+
+  double start = getTime();
+  rebuilt.getMap()->setLevels(levels);
+  double rebuildTime = getTime() - start;
+
+  // **** a local change: one beam
+
+  start = getTime();
+  btVector3 origin = poses[0] * btVector3(0.0, 0.0, 0.0);
+  mapper.addBeamReading(origin, origin + btVector3(1.0, 0.5, 0.0));
+  double beamInsert = getTime() - start;
+
+  start = getTime();
+  mapper.getMap()->getLevel(levels);
+  double beamUpdate = getTime() - start;
+
+  rebuilt.addBeamReading(origin, origin + btVector3(1.0, 0.5, 0.0));
+  rebuilt.getMap()->getLevel(levels);
+
+  printf("insert %.2f ms/scan, incremental levels %.2f ms/scan (max %.2f), full build %.2f ms\n",
+    1000.0 * insertTime / scans, 1000.0 * updateTime / scans, 1000.0 * worstUpdate, 1000.0 * rebuildTime);
+  printf("one beam: insert %.3f ms, incremental levels %.3f ms\n", 1000.0 * beamInsert, 1000.0 * beamUpdate);
+
+  printf("\n%-6s %8s %10s %10s %10s %12s  %s\n", 
+    "level", "cell m", "cells", "ML vols", "KB", "mass error", "same as full build");
+
+  double levelsKB = 0.0;
+  for (int l = 1; l <= levels; l++)
+    levelsKB += mapper.getMap()->getLevel(l)->getMemorySize();
+
+  for (int l = 0; l <= levels; l++)
+  {
+    MVOG::Map * level = mapper.getMap()->getLevel(l);
+
+    long allocated;
+    long used = countCells(level, allocated);
+
+    double checksum;
+    long mlCount = extractMLVolumes(level, true, checksum);
+
+    // **** every used cell against its fine cells
+
+    double error = 0.0;
+
+    for (int tx = 0; tx < level->getTilesX() && l > 0; tx++)
+    for (int ty = 0; ty < level->getTilesY(); ty++)
+    {
+      MVOG::Tile * tile = level->getTile(tx, ty);
+      if (!tile) continue;
+
+      for (int i = 0; i < MVOG::TILE_SIZE; i++)
+      for (int j = 0; j < MVOG::TILE_SIZE; j++)
+      {
+        int cx = tx * MVOG::TILE_SIZE + i - level->getOffsetX();
+        int cy = ty * MVOG::TILE_SIZE + j - level->getOffsetY();
+
+        double pError = checkLevelCell(mapper.getMap(), l, tile, i, j, cx, cy, true);
+        double nError = checkLevelCell(mapper.getMap(), l, tile, i, j, cx, cy, false);
+
+        if (pError < 0.0 || nError < 0.0 || error < 0.0) error = -1.0;
+        else error = std::max(error, std::max(pError, nError));
+      }
+    }
+
+    char errorText[32];
+    if (error < 0.0) sprintf(errorText, "WRONG");
+    else sprintf(errorText, "%.1e", error);
+
+    printf("%-6d %8.2f %10ld %10ld %10.1f %12s  %s\n", l, level->getResolution(), used, mlCount,
+      level->getMemorySize() - (l ? 0.0 : levelsKB), l ? errorText : "-",
+      l ? (compareMaps(level, rebuilt.getMap()->getLevel(l)) ? "IDENTICAL" : "DIFFERENT") : "-");
+  }
+}
+
+// **** merging a map built from the second half of the scans into one
+//      built from the first half, against replaying those scans. The
+//      two maps have different sizes, so their grid origins differ.
+
+void benchMerge(int scans, double resolution, int threads)
+{
+  printf("Merging %d scans into %d at %.3f m resolution, %d threads\n", 
+    scans - scans / 2, scans / 2, resolution, threads);
+
+  std::vector<sensor_msgs::LaserScanPtr> scanSet;
+  std::vector<btTransform> poses;
+  createScans(scans, scanSet, poses);
+
+  std::vector<sensor_msgs::LaserScanPtr> firstScans (scanSet.begin(), scanSet.begin() + scans / 2);
+  std::vector<sensor_msgs::LaserScanPtr> secondScans(scanSet.begin() + scans / 2, scanSet.end());
+  std::vector<btTransform> firstPoses (poses.begin(), poses.begin() + scans / 2);
+  std::vector<btTransform> secondPoses(poses.begin() + scans / 2, poses.end());
+
+  MVOG::Mapper first (resolution, 10.0, 10.0);
+  MVOG::Mapper second(resolution, 30.0,  5.0);
+  insertScans(first,  firstScans,  firstPoses);
+  insertScans(second, secondScans, secondPoses);
+
+  MVOG::Mapper replayed(resolution, 10.0, 10.0);
+  insertScans(replayed, firstScans, firstPoses);
+  double replayTime = insertScans(replayed, secondScans, secondPoses);
+
+  btTransform identity;
+  identity.setIdentity();
+
+  // **** a merge into an empty map is a copy
+
+  MVOG::Map copy(resolution, 4.0, 4.0);
+  copy.merge(*first.getMap(), identity);
+
+  printf("copy: %s\n", compareMaps(&copy, first.getMap()) ? "IDENTICAL" : "DIFFERENT");
+
+  // **** merging against replaying: the same volumes, masses summed in
+  //      a different order
+
+  MVOG::Map merged1(resolution, 4.0, 4.0);
+  MVOG::Map mergedN(resolution, 4.0, 4.0);
+  merged1.merge(*first.getMap(), identity);
+  mergedN.merge(*first.getMap(), identity);
+
+  double start = getTime();
+  merged1.merge(*second.getMap(), identity, 1);
+  double mergeTime1 = getTime() - start;
+
+  start = getTime();
+  mergedN.merge(*second.getMap(), identity, threads);
+  double mergeTimeN = getTime() - start;
+
+  double massError = 0.0;
+  bool same = compareMaps(&merged1, replayed.getMap(), &massError);
+
+  printf("\n%-18s %10s\n", "", "ms");
+  printf("%-18s %10.2f\n", "replay", 1000.0 * replayTime);
+  printf("%-18s %10.2f\n", "merge, 1 thread", 1000.0 * mergeTime1);
+  printf("%-18s %10.2f\n", "merge, N threads", 1000.0 * mergeTimeN);
+
+  printf("\nmerged vs replayed: %s, max mass error %g\n", same ? "SAME VOLUMES" : "DIFFERENT", massError);
+  printf("1 vs N threads: %s\n", compareMaps(&merged1, &mergedN) ? "IDENTICAL" : "DIFFERENT");
+
+  // **** a transform by whole cells there and back again
+
+  btTransform transform;
+  transform.setIdentity();
+  transform.setOrigin(btVector3(37 * resolution, -21 * resolution, 0.0));
+  transform.setRotation(btQuaternion(M_PI / 2.0, 0.0, 0.0));
+
+  MVOG::Map moved(resolution, 4.0, 4.0);
+  MVOG::Map back (resolution, 4.0, 4.0);
+
+  start = getTime();
+  moved.merge(*second.getMap(), transform, threads);
+  double moveTime = getTime() - start;
+
+  back.merge(moved, transform.inverse(), threads);
+
+  printf("moved and back (%.2f ms): %s\n", 1000.0 * moveTime,
+    compareMaps(&back, second.getMap()) ? "IDENTICAL" : "DIFFERENT");
+}
+
+int main (int argc, char **argv)
+{
+  if (argc > 1 && std::string(argv[1]) == "rays")
+  {
+    int    count      = 20000;
+    double resolution = 0.05;
+
+    if (argc > 2) count      = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+
+    benchRays(count, resolution);
+    return 0;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "queries")
+  {
+    int    count      = 1000000;
+    double resolution = 0.10;
+
+    if (argc > 2) count      = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+
+    benchQueries(count, resolution);
+    return 0;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "depth")
+  {
+    int    frames     = 100;
+    double resolution = 0.05;
+
+    if (argc > 2) frames     = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+
+    benchDepth(frames, resolution);
+    return 0;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "export")
+  {
+    int    scans      = 200;
+    double resolution = 0.05;
+
+    if (argc > 2) scans      = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+
+    benchExport(scans, resolution);
+    return 0;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "spill")
+  {
+    int    scans      = 400;
+    double resolution = 0.05;
+    double budgetKB   = 16384.0;
+    double keepRadius = 3.0;
+
+    if (argc > 2) scans      = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+    if (argc > 4) budgetKB   = atof(argv[4]);
+    if (argc > 5) keepRadius = atof(argv[5]);
+
+    benchSpill(scans, resolution, budgetKB, keepRadius);
+    return 0;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "levels")
+  {
+    int    scans      = 200;
+    double resolution = 0.05;
+    int    levels     = 3;
+
+    if (argc > 2) scans      = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+    if (argc > 4) levels     = atoi(argv[4]);
+
+    benchLevels(scans, resolution, levels);
+    return 0;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "merge")
+  {
+    int    scans      = 200;
+    double resolution = 0.05;
+    int    threads    = 4;
+
+    if (argc > 2) scans      = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+    if (argc > 4) threads    = atoi(argv[4]);
+
+    benchMerge(scans, resolution, threads);
+    return 0;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "snapshot")
+  {
+    int    scans      = 200;
+    double resolution = 0.10;
+    const char * filename = "/tmp/mvog_model_bench.map";
+
+    if (argc > 2) scans      = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+    if (argc > 4) filename   = argv[4];
+
+    benchSnapshot(scans, resolution, filename);
+    return 0;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "formats")
+  {
+    int    scans      = 200;
+    double resolution = 0.10;
+
+    if (argc > 2) scans      = atoi(argv[2]);
+    if (argc > 3) resolution = atof(argv[3]);
+
+    benchFormats(scans, resolution);
+    return 0;
+  }
+
+  int    scans      = 200;
+  double resolution = 0.10;
+  int    threads    = 1;
+
+  if (argc > 1) scans      = atoi(argv[1]);
+  if (argc > 2) resolution = atof(argv[2]);
+  if (argc > 3) threads    = atoi(argv[3]);
+
+  printf("Inserting %d scans at %.3f m resolution\n", scans, resolution);
+
+  std::vector<sensor_msgs::LaserScanPtr> scanSet;
+  std::vector<btTransform> poses;
+  createScans(scans, scanSet, poses);
+
+  MVOG::Mapper mapper(resolution, 10.0, 10.0);
+
+  double duration = insertScans(mapper, scanSet, poses);
+
+  size_t nVolumes, nMerges;
+  mapper.getCoalescingStats(nVolumes, nMerges);
+
+  printf("insert:    %.2f scans/s (%.3f ms/scan)\n", scans / duration, 1000.0 * duration / scans);
+  printf("N volumes: %.0f per scan, %.0f cell merges per scan\n", (double)nVolumes / scans, (double)nMerges / scans);
+  printf("map size:  %.1f KB\n", mapper.getMap()->getMemorySize());
+  printf("peak RSS:  %ld KB\n", getPeakRSS());
+
+  if (threads > 1)
+  {
+    MVOG::Mapper parallelMapper(resolution, 10.0, 10.0);
+    parallelMapper.setInsertionThreads(threads);
+
+    double parallelDuration = insertScans(parallelMapper, scanSet, poses);
+
+    printf("insert (%d threads): %.2f scans/s (%.3f ms/scan), speedup %.2fx\n",
+      threads, scans / parallelDuration, 1000.0 * parallelDuration / scans, duration / parallelDuration);
+    printf("parallel map: %s\n", 
+      compareMaps(mapper.getMap(), parallelMapper.getMap()) ? "IDENTICAL" : "DIFFERENT");
+  }
+
+  benchMLVolumes(mapper, scanSet[0], poses[0]);
+
+  return 0;
+}
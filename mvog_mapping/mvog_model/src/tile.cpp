@@ -0,0 +1,118 @@
+#include "mvog_model/tile.h"
+
+namespace MVOG
+{
+
+Tile::Tile()
+{
+  mlStart_ = NULL;
+  mlDirty_ = true;
+
+  mlDirtyCells_.set();
+
+  for (int c = 0; c < CHANGE_CHANNELS; c++)
+    changed_[c] = false;
+
+  lastTouch_    = 0;
+  countedBytes_ = 0;
+  resized_      = false;
+}
+
+Tile::~Tile()
+{
+  delete[] mlStart_;
+}
+
+void Tile::updateMLVolumes()
+{
+  if (!mlStart_)
+  {
+    mlStart_ = new int[TILE_CELLS + 1];
+    std::fill(mlStart_, mlStart_ + TILE_CELLS + 1, 0);
+  }
+
+  if (!prepareMLVolumes()) return;
+
+  // **** rebuild the list: copy the volumes of unchanged cells,
+  //      recompute the ones of changed cells
+
+  MLVolumeVector mlVolumes;
+  mlVolumes.reserve(mlVolumes_.size());
+
+  for (int c = 0; c < TILE_CELLS; c++)
+  {
+    int start = mlVolumes.size();
+
+    if (mlDirtyCells_.test(c))
+      createMLVolumes(c / TILE_SIZE, c % TILE_SIZE, mlVolumes);
+    else
+      mlVolumes.insert(mlVolumes.end(), mlVolumes_.begin() + mlStart_[c], mlVolumes_.begin() + mlStart_[c + 1]);
+
+    mlStart_[c] = start;
+  }
+
+  mlStart_[TILE_CELLS] = mlVolumes.size();
+
+  mlVolumes_.swap(mlVolumes);
+
+  mlDirtyCells_.reset();
+  mlDirty_ = false;
+
+  resized_ = true;
+}
+
+void Tile::moveChanges(Tile& tile)
+{
+  for (int c = 0; c < CHANGE_CHANNELS; c++)
+  {
+    changedCells_[c] |= tile.changedCells_[c];
+    changed_[c]       = changed_[c] || tile.changed_[c];
+
+    tile.changedCells_[c].reset();
+    tile.changed_[c] = false;
+  }
+}
+
+void Tile::setAllChanged()
+{
+  for (int c = 0; c < CHANGE_CHANNELS; c++)
+  {
+    changedCells_[c].set();
+    changed_[c] = true;
+  }
+}
+
+void Tile::freeCache()
+{
+  delete[] mlStart_;
+  mlStart_ = NULL;
+
+  MLVolumeVector().swap(mlVolumes_);
+
+  mlDirtyCells_.set();
+  mlDirty_ = true;
+}
+
+bool Tile::validate(int i, int j)
+{
+  int pCount, nCount;
+  const Volume * pVolumes = getPVolumes(i, j, pCount);
+  const Volume * nVolumes = getNVolumes(i, j, nCount);
+
+  for (int v = 0; v < pCount - 1; v++)
+    if (getTop(pVolumes[v]) >= getBot(pVolumes[v+1])) return false;
+
+  for (int v = 0; v < nCount - 1; v++)
+    if (getTop(nVolumes[v]) >= getBot(nVolumes[v+1])) return false;
+
+  return true;
+}
+
+size_t Tile::getCacheMemorySize() const
+{
+  if (!mlStart_) return 0;
+
+  return (TILE_CELLS + 1) * sizeof(int) + mlVolumes_.capacity() * sizeof(MLVolume);
+}
+
+}; // namespace MVOG
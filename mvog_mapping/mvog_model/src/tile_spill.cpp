@@ -0,0 +1,333 @@
+#include "mvog_model/tile_spill.h"
+#include "mvog_model/map_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+namespace MVOG
+{
+
+static double getTime()
+{
+  timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+// **** whole records, retrying short reads and writes
+
+static bool writeAll(int fd, const char * data, uint64_t size, uint64_t offset)
+{
+  while (size > 0)
+  {
+    ssize_t written = pwrite(fd, data, size, offset);
+    if (written <= 0) return false;
+
+    data   += written;
+    size   -= written;
+    offset += written;
+  }
+
+  return true;
+}
+
+static bool readAll(int fd, char * data, uint64_t size, uint64_t offset)
+{
+  while (size > 0)
+  {
+    ssize_t read = pread(fd, data, size, offset);
+    if (read <= 0) return false;
+
+    data   += read;
+    size   -= read;
+    offset += read;
+  }
+
+  return true;
+}
+
+// ****************************************************************
+
+TileSpill::TileSpill()
+{
+  fd_ = -1;
+  fileSize_ = 0;
+
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+TileSpill::~TileSpill()
+{
+  if (fd_ < 0) return;
+
+  close(fd_);
+  unlink(filename_.c_str());
+}
+
+bool TileSpill::open(const std::string& filename)
+{
+  fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+  if (fd_ < 0)
+  {
+    printf("TileSpill: cannot create %s\n", filename.c_str());
+    return false;
+  }
+
+  filename_ = filename;
+  return true;
+}
+
+bool TileSpill::write(Tile& tile, uint64_t& offset, uint64_t& size)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (fd_ < 0) return false;
+
+  MapFile::packTile(tile, record_);
+
+  size = record_.size();
+
+  // **** the smallest free record it fits in, or the end of the file.
+  //      Space is handed out in multiples of 8 bytes.
+
+  uint64_t space = (size + 7) & ~7ULL;
+
+  std::multimap<uint64_t, uint64_t>::iterator free = freeRecords_.lower_bound(space);
+
+  if (free != freeRecords_.end())
+  {
+    offset = free->second;
+
+    uint64_t left = free->first - space;
+    freeRecords_.erase(free);
+
+    if (left > 0) freeRecords_.insert(std::make_pair(left, offset + space));
+  }
+  else
+  {
+    offset = fileSize_;
+    fileSize_ += space;
+  }
+
+  if (!writeAll(fd_, &record_[0], size, offset))
+  {
+    printf("TileSpill: error writing %s\n", filename_.c_str());
+    freeRecords_.insert(std::make_pair(space, offset));
+    return false;
+  }
+
+  stats_.evictions++;
+  stats_.spilledBytes += space;
+
+  return true;
+}
+
+Tile * TileSpill::read(uint64_t offset, uint64_t size, CellFormat cellFormat)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  double start = getTime();
+
+  record_.resize(size);
+
+  if (!readAll(fd_, &record_[0], size, offset))
+  {
+    // **** the tile is tried again on its next use: report the first
+    //      failure, and count them all
+
+    if (stats_.readErrors++ == 0)
+      printf("TileSpill: error reading %s, the tile stays spilled\n", filename_.c_str());
+
+    return NULL;
+  }
+
+  Tile * tile = createTile(cellFormat);
+  MapFile::unpackTile(&record_[0], *tile);
+
+  uint64_t space = (size + 7) & ~7ULL;
+  freeRecords_.insert(std::make_pair(space, offset));
+
+  double duration = getTime() - start;
+
+  stats_.reloads++;
+  stats_.reloadTime   += duration;
+  stats_.maxReloadTime = std::max(stats_.maxReloadTime, duration);
+  stats_.spilledBytes -= space;
+
+  return tile;
+}
+
+bool TileSpill::readRecord(uint64_t offset, uint64_t size, std::vector<char>& record)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  record.resize(size);
+  if (readAll(fd_, &record[0], size, offset)) return true;
+
+  if (stats_.readErrors++ == 0)
+    printf("TileSpill: error reading %s\n", filename_.c_str());
+
+  record.clear();
+  return false;
+}
+
+void TileSpill::release(uint64_t offset, uint64_t size)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  uint64_t space = (size + 7) & ~7ULL;
+  freeRecords_.insert(std::make_pair(space, offset));
+
+  stats_.spilledBytes -= space;
+}
+
+void TileSpill::getStats(SpillStats& stats)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  stats = stats_;
+}
+
+// ****************************************************************
+
+SpilledTile::SpilledTile(TileSpill * spill, Tile * tile, CellFormat cellFormat)
+{
+  spill_      = spill;
+  tile_       = tile;
+  cellFormat_ = cellFormat;
+
+  offset_ = 0;
+  size_   = 0;
+
+  moveChanges(*tile);
+}
+
+SpilledTile::~SpilledTile()
+{
+  if (tile_)
+    delete tile_;
+  else
+    spill_->release(offset_, size_);
+}
+
+bool SpilledTile::evict()
+{
+  if (!tile_) return true;
+
+  if (!spill_->write(*tile_, offset_, size_)) return false;
+
+  delete tile_;
+  tile_ = NULL;
+
+  freeCache();
+
+  return true;
+}
+
+Tile * SpilledTile::getTile()
+{
+  if (!tile_)
+  {
+    tile_ = spill_->read(offset_, size_, cellFormat_);
+    if (tile_) resized_ = true;
+  }
+
+  return tile_;
+}
+
+void SpilledTile::addPVolume(int i, int j, float bot, float top)
+{
+  Tile * tile = getTile();
+  if (!tile) return;
+
+  tile->addPVolume(i, j, bot, top);
+  setDirty(i, j);
+}
+
+void SpilledTile::addNVolume(int i, int j, float bot, float top)
+{
+  Tile * tile = getTile();
+  if (!tile) return;
+
+  tile->addNVolume(i, j, bot, top);
+  setDirty(i, j);
+}
+
+void SpilledTile::addPVolumes(int i, int j, const Volume * volumes, int count)
+{
+  Tile * tile = getTile();
+  if (!tile) return;
+
+  tile->addPVolumes(i, j, volumes, count);
+  setDirty(i, j);
+}
+
+void SpilledTile::addNVolumes(int i, int j, const Volume * volumes, int count)
+{
+  Tile * tile = getTile();
+  if (!tile) return;
+
+  tile->addNVolumes(i, j, volumes, count);
+  setDirty(i, j);
+}
+
+void SpilledTile::clearCell(int i, int j)
+{
+  Tile * tile = getTile();
+  if (!tile) return;
+
+  tile->clearCell(i, j);
+  setDirty(i, j);
+}
+
+const Volume * SpilledTile::getPVolumes(int i, int j, int& count)
+{
+  Tile * tile = getTile();
+  if (!tile)
+  {
+    count = 0;
+    return NULL;
+  }
+
+  return tile->getPVolumes(i, j, count);
+}
+
+const Volume * SpilledTile::getNVolumes(int i, int j, int& count)
+{
+  Tile * tile = getTile();
+  if (!tile)
+  {
+    count = 0;
+    return NULL;
+  }
+
+  return tile->getNVolumes(i, j, count);
+}
+
+bool SpilledTile::prepareMLVolumes()
+{
+  return getTile() != NULL;
+}
+
+void SpilledTile::createMLVolumes(int i, int j, MLVolumeVector& mlVolumes)
+{
+  int pCount, nCount;
+  const Volume * pVolumes = getPVolumes(i, j, pCount);
+  const Volume * nVolumes = getNVolumes(i, j, nCount);
+
+  if (pCount || nCount)
+    MVOG::createMLVolumes(pVolumes, pCount, nVolumes, nCount, mlVolumes);
+}
+
+size_t SpilledTile::getMemorySize() const
+{
+  size_t size = sizeof(SpilledTile) + getCacheMemorySize();
+  if (tile_) size += tile_->getMemorySize();
+  return size;
+}
+
+}; // namespace MVOG
@@ -1,5 +1,7 @@
 #include "mvog_model/volume.h"
 
+#include <string.h>
+
 namespace MVOG
 {
 
@@ -26,23 +28,205 @@ void createVolume(float bot, float top, Volume& volume)
   setMass(volume, mass); 
 }
 
-float getBot (const Volume& volume) { return volume[0]; }
-float getTop (const Volume& volume) { return volume[1]; }
-float getMass(const Volume& volume) { return volume[2]; }
-
 float getDensity(const Volume& volume) 
 { 
   return getMass(volume)/(getTop(volume) - getBot(volume)); 
 }
 
-void setBot (Volume& volume, float bot)  { volume[0] = bot;  }
-void setTop (Volume& volume, float top)  { volume[1] = top;  }
-void setMass(Volume& volume, float mass) { volume[2] = mass; }
-
 void createMLVolume(const Volume& volume, MLVolume& mlVolume)
 {
   mlVolume.bot = getBot(volume);
   mlVolume.top = getTop(volume);
 }
 
+int mergeVolumes(const Volume * a, int aCount, const Volume * b, int bCount, Volume * merged)
+{
+  // **** walk both lists by bottom, joining every volume which touches
+  //      the previous one - the same result as adding them one by one
+
+  int mergedCount = 0;
+
+  int i = 0, j = 0;
+  while (i < aCount || j < bCount)
+  {
+    const Volume * v;
+    if (j >= bCount || (i < aCount && getBot(a[i]) <= getBot(b[j])))
+      v = &a[i++];
+    else
+      v = &b[j++];
+
+    if (mergedCount > 0 && getBot(*v) <= getTop(merged[mergedCount - 1]))
+    {
+      Volume& last = merged[mergedCount - 1];
+      setTop (last, std::max(getTop(last), getTop(*v)));
+      setMass(last, getMass(last) + getMass(*v));
+    }
+    else
+      memcpy(merged[mergedCount++], *v, VOLUME_BYTE_SIZE);
+  }
+
+  return mergedCount;
+}
+
+static float getCombinedDensity(const Volume& pVolume, const Volume& nVolume)
+{
+  float pd = getDensity(pVolume);
+  float nd = getDensity(nVolume);
+  
+  return pd / (pd + nd);
+}
+
+void createMLVolumes(const Volume * pVolumes, int pVolumesCount,
+                     const Volume * nVolumes, int nVolumesCount, MLVolumeVector& mlVolumes)
+{
+  if (pVolumesCount == 0 && nVolumesCount == 0) return;
+
+  int state = 0; // 0 - not in Positive, not in Negative
+                 // 1 - in P, not in N
+                 // 2 - not in P, in N
+                 // 3 - in P, in N
+
+  int cp = 0;   // index of current positive volume
+  int cn = 0;   // index of curentt negative volume
+
+  MLVolume ml;
+
+  //printf("Starting ML iteration\n");
+
+  while(true)
+  {
+    // **** STATE == 0: NOT IN P, NOT IN N ********************* 
+    if (state == 0)
+    {
+      //printf("\nstate == 0\n");
+
+      if (cp >= pVolumesCount)
+      { 
+        // no more positive volumes - exit loop
+        //printf("\tReached end of P volumes, EXIT\n");
+        break;
+      }
+      if (cn >= nVolumesCount)
+      {
+        // no more negative volumes - add all remaining positive and exit
+        while (cp < pVolumesCount)
+        {
+          createMLVolume(pVolumes[cp], ml);
+          mlVolumes.push_back(ml);
+          cp++;
+        }
+        //printf("\tReached end of N volumes, added all P, EXIT\n");
+        break;
+      }
+
+      if(getBot(pVolumes[cp]) <= getBot(nVolumes[cn]))
+      {
+        // entering a new P volume
+
+        ml.bot = getBot(pVolumes[cp]);
+
+        state = 1;
+        continue;
+      }
+      else
+      {
+        // enterint a new N volume - do nothing
+        state = 2;
+        continue;
+      }
+    } // state == 0
+    else if (state == 1)
+    {
+      //printf("\nstate == 1\n");
+
+      if (cn >= nVolumesCount || getTop(pVolumes[cp]) < getBot(nVolumes[cn]))
+      {
+        // no more N volumes, or next N does not intersect
+
+        ml.top = getTop(pVolumes[cp]);
+        mlVolumes.push_back(ml);
+        cp++; 
+  
+        state = 0;
+        continue;
+      }
+      else
+      {
+        // entering an N volume
+
+        if(getCombinedDensity(pVolumes[cp], nVolumes[cn]) < 0.5)
+        { 
+          // N volume with high density
+          ml.top = getBot(nVolumes[cn]);
+          mlVolumes.push_back(ml);
+        }
+
+        state = 3;
+        continue;
+      }
+    } // state == 1
+    else if (state == 2)
+    {
+      //printf("\nstate == 2\n");
+
+      if (cp >= pVolumesCount || getBot(pVolumes[cp]) >= getTop(nVolumes[cn]))
+      {
+        // leaving N - next P does not intersect
+        cn++;
+
+        state = 0;
+        continue;
+      }
+      else
+      { 
+        // entering a P volume
+
+        if (getCombinedDensity(pVolumes[cp], nVolumes[cn]) >= 0.5)
+        {
+          // entering P volume with high density
+          ml.bot = getBot(pVolumes[cp]);
+        }
+
+        state = 3;
+        continue;
+      }
+    } // state == 2
+    else // state == 3
+    {
+      //printf("\nstate == 3\n");
+
+      if (getTop(pVolumes[cp]) >= getTop(nVolumes[cn]))
+      {
+        // N volume ends
+
+        if (getCombinedDensity(pVolumes[cp], nVolumes[cn]) < 0.5)
+        {
+          ml.bot = getTop(nVolumes[cn]);
+        }
+
+        cn++;
+        state = 1;
+        continue;
+      }
+      else
+      {
+        // P Volume ends
+
+        if (getCombinedDensity(pVolumes[cp], nVolumes[cn]) >= 0.5)
+        {
+          ml.top = getTop(pVolumes[cp]);
+          mlVolumes.push_back(ml);  
+        }
+
+        cp++;
+        state = 2;
+        continue;
+      } // state == 3
+    }
+  }
+
+  //printf("\t Done ML iteration\n");
+
+}
+
 }
@@ -0,0 +1,115 @@
+#include "mvog_model/volume_allocator.h"
+
+#include <cassert>
+#include <cstdlib>
+
+namespace MVOG
+{
+
+VolumeAllocator::VolumeAllocator()
+{
+  slabPos_  = NULL;
+  slabLeft_ = 0;
+
+  slabBytes_ = 0;
+  usedBytes_ = 0;
+
+  for (int i = 0; i < VOLUME_ALLOCATOR_CLASSES; i++)
+    freeLists_[i] = NULL;
+}
+
+VolumeAllocator::~VolumeAllocator()
+{
+  clear();
+}
+
+void VolumeAllocator::clear()
+{
+  for (size_t i = 0; i < slabs_.size(); i++)
+    free(slabs_[i]);
+
+  slabs_.clear();
+
+  slabPos_  = NULL;
+  slabLeft_ = 0;
+
+  slabBytes_ = 0;
+  usedBytes_ = 0;
+
+  for (int i = 0; i < VOLUME_ALLOCATOR_CLASSES; i++)
+    freeLists_[i] = NULL;
+}
+
+int VolumeAllocator::getSizeClass(int capacity)
+{
+  int sizeClass = 0;
+  while ((1 << sizeClass) < capacity) sizeClass++;
+  return sizeClass;
+}
+
+Volume * VolumeAllocator::allocate(int capacity)
+{
+  int sizeClass = getSizeClass(capacity);
+  assert(sizeClass < VOLUME_ALLOCATOR_CLASSES);
+  assert((1 << sizeClass) == capacity);
+
+  size_t bytes = capacity * VOLUME_BYTE_SIZE;
+  usedBytes_ += bytes;
+
+  // **** reuse a freed block of the same class if possible
+
+  FreeBlock * block = freeLists_[sizeClass];
+  if (block)
+  {
+    freeLists_[sizeClass] = block->next;
+    return reinterpret_cast<Volume*>(block);
+  }
+
+  return reinterpret_cast<Volume*>(allocateFromSlab(bytes));
+}
+
+void VolumeAllocator::deallocate(Volume * volumes, int capacity)
+{
+  if (volumes == NULL) return;
+
+  int sizeClass = getSizeClass(capacity);
+
+  usedBytes_ -= capacity * VOLUME_BYTE_SIZE;
+
+  FreeBlock * block = reinterpret_cast<FreeBlock*>(volumes);
+  block->next = freeLists_[sizeClass];
+  freeLists_[sizeClass] = block;
+}
+
+char * VolumeAllocator::allocateFromSlab(size_t bytes)
+{
+  // keep blocks aligned for the free list pointers
+  bytes = (bytes + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+  if (bytes > slabLeft_)
+  {
+    // oversized blocks get a dedicated slab, the current one stays open
+    if (bytes > VOLUME_ALLOCATOR_SLAB_SIZE)
+    {
+      char * slab = static_cast<char*>(malloc(bytes));
+      slabs_.push_back(slab);
+      slabBytes_ += bytes;
+      return slab;
+    }
+
+    // the tail of the old slab is abandoned
+    slabPos_  = static_cast<char*>(malloc(VOLUME_ALLOCATOR_SLAB_SIZE));
+    slabLeft_ = VOLUME_ALLOCATOR_SLAB_SIZE;
+
+    slabs_.push_back(slabPos_);
+    slabBytes_ += VOLUME_ALLOCATOR_SLAB_SIZE;
+  }
+
+  char * block = slabPos_;
+  slabPos_  += bytes;
+  slabLeft_ -= bytes;
+
+  return block;
+}
+
+} // namespace MVOG
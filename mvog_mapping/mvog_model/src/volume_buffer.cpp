@@ -0,0 +1,176 @@
+#include "mvog_model/volume_buffer.h"
+
+namespace MVOG
+{
+
+VolumeBuffer::VolumeBuffer()
+{
+  lastTile_  = NULL;
+  lastSlots_ = NULL;
+
+  addedCount_  = 0;
+  mergedCount_ = 0;
+}
+
+VolumeBuffer::~VolumeBuffer()
+{
+  for (size_t t = 0; t < tiles_.size(); t++)
+    delete[] tiles_[t].slots;
+
+  for (size_t t = 0; t < freeSlots_.size(); t++)
+    delete[] freeSlots_[t];
+}
+
+int * VolumeBuffer::getSlots(Tile * tile)
+{
+  // **** beams cross few tiles - a linear search is enough
+
+  for (size_t t = 0; t < tiles_.size(); t++)
+    if (tiles_[t].tile == tile) return tiles_[t].slots;
+
+  TileSlots tileSlots;
+  tileSlots.tile = tile;
+
+  if (freeSlots_.empty())
+  {
+    tileSlots.slots = new int[TILE_CELLS];
+    std::fill(tileSlots.slots, tileSlots.slots + TILE_CELLS, -1);
+  }
+  else
+  {
+    tileSlots.slots = freeSlots_.back();
+    freeSlots_.pop_back();
+  }
+
+  tiles_.push_back(tileSlots);
+
+  return tileSlots.slots;
+}
+
+void VolumeBuffer::addNVolume(Tile * tile, int i, int j, float bot, float top)
+{
+  if (tile != lastTile_)
+  {
+    lastTile_  = tile;
+    lastSlots_ = getSlots(tile);
+  }
+
+  int cell = i * TILE_SIZE + j;
+
+  if (lastSlots_[cell] == -1)
+  {
+    Bucket bucket;
+    bucket.tile  = tile;
+    bucket.slots = lastSlots_;
+    bucket.cell  = cell;
+    bucket.first = -1;
+    bucket.last  = -1;
+    bucket.count = 0;
+
+    lastSlots_[cell] = buckets_.size();
+    buckets_.push_back(bucket);
+  }
+
+  Bucket& bucket = buckets_[lastSlots_[cell]];
+
+  addedCount_++;
+
+  Volume v;
+  createVolume(bot, top, v);
+
+  // **** consecutive beams mostly overlap: join with the last volume
+
+  if (bucket.last != -1)
+  {
+    Volume& last = intervals_[bucket.last].volume;
+
+    if (getBot(v) <= getTop(last) && getTop(v) >= getBot(last))
+    {
+      setBot (last, std::min(getBot(last), getBot(v)));
+      setTop (last, std::max(getTop(last), getTop(v)));
+      setMass(last, getMass(last) + getMass(v));
+      return;
+    }
+  }
+
+  Interval interval;
+  memcpy(interval.volume, v, VOLUME_BYTE_SIZE);
+  interval.next = -1;
+
+  int index = intervals_.size();
+  intervals_.push_back(interval);
+
+  if (bucket.last == -1) bucket.first = index;
+  else intervals_[bucket.last].next = index;
+
+  bucket.last = index;
+  bucket.count++;
+}
+
+void VolumeBuffer::flush()
+{
+  for (size_t b = 0; b < buckets_.size(); b++)
+  {
+    const Bucket& bucket = buckets_[b];
+
+    // **** sort the volumes by their bottom. Lists are short, and
+    //      insertion sort keeps equal volumes in the order they came.
+
+    if (scratch_.size() < (size_t)bucket.count * 3) scratch_.resize(bucket.count * 3);
+    Volume * volumes = reinterpret_cast<Volume*>(&scratch_[0]);
+
+    int count = 0;
+    for (int n = bucket.first; n != -1; n = intervals_[n].next)
+    {
+      const Volume& v = intervals_[n].volume;
+
+      int i = count;
+      while (i > 0 && getBot(volumes[i-1]) > getBot(v))
+      {
+        memcpy(volumes[i], volumes[i-1], VOLUME_BYTE_SIZE);
+        i--;
+      }
+      memcpy(volumes[i], v, VOLUME_BYTE_SIZE);
+      count++;
+    }
+
+    // **** union the overlapping ones
+
+    int unionCount = 1;
+    for (int i = 1; i < count; i++)
+    {
+      Volume& last = volumes[unionCount - 1];
+
+      if (getBot(volumes[i]) <= getTop(last))
+      {
+        setTop (last, std::max(getTop(last), getTop(volumes[i])));
+        setMass(last, getMass(last) + getMass(volumes[i]));
+      }
+      else
+        memcpy(volumes[unionCount++], volumes[i], VOLUME_BYTE_SIZE);
+    }
+
+    // **** one merge into the cell
+
+    bucket.tile->addNVolumes(bucket.cell / TILE_SIZE, bucket.cell % TILE_SIZE, volumes, unionCount);
+
+    mergedCount_++;
+  }
+
+  // **** reset the touched slots, keep the arrays
+
+  for (size_t b = 0; b < buckets_.size(); b++)
+    buckets_[b].slots[buckets_[b].cell] = -1;
+
+  for (size_t t = 0; t < tiles_.size(); t++)
+    freeSlots_.push_back(tiles_[t].slots);
+
+  tiles_.clear();
+  buckets_.clear();
+  intervals_.clear();
+
+  lastTile_  = NULL;
+  lastSlots_ = NULL;
+}
+
+}; // namespace MVOG
@@ -0,0 +1,82 @@
+#include "mvog_model/worker_pool.h"
+
+namespace MVOG
+{
+
+WorkerPool::WorkerPool(int threads)
+{
+  threads_    = std::max(threads, 1);
+  generation_ = 0;
+  pending_    = 0;
+  shutdown_   = false;
+
+  for (int i = 1; i < threads_; i++)
+    workers_.push_back(new boost::thread(boost::bind(&WorkerPool::workerLoop, this, i)));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutdown_ = true;
+  }
+  startCondition_.notify_all();
+
+  for (size_t i = 0; i < workers_.size(); i++)
+  {
+    workers_[i]->join();
+    delete workers_[i];
+  }
+}
+
+void WorkerPool::run(const Job& job)
+{
+  if (threads_ == 1)
+  {
+    job(0);
+    return;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    job_ = job;
+    pending_ = threads_ - 1;
+    generation_++;
+  }
+  startCondition_.notify_all();
+
+  job(0);
+
+  boost::mutex::scoped_lock lock(mutex_);
+  while (pending_ > 0) doneCondition_.wait(lock);
+}
+
+void WorkerPool::workerLoop(int index)
+{
+  unsigned int generation = 0;
+
+  while(true)
+  {
+    Job job;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!shutdown_ && generation_ == generation) startCondition_.wait(lock);
+
+      if (shutdown_) return;
+
+      generation = generation_;
+      job = job_;
+    }
+
+    job(index);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      pending_--;
+    }
+    doneCondition_.notify_one();
+  }
+}
+
+} // namespace MVOG
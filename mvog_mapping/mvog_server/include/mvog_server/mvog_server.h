@@ -4,39 +4,110 @@
 #include <ros/ros.h>
 #include <sensor_msgs/LaserScan.h>
 #include <sensor_msgs/PointCloud.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
 #include <tf/transform_listener.h>
 #include <tf/message_filter.h>
 #include <message_filters/subscriber.h>
+#include <message_filters/time_synchronizer.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <nav_msgs/OccupancyGrid.h>
 
 #include <mvog_model/mapper.h>
+#include <mvog_model/map_file.h>
+#include <mvog_model/grid_exporter.h>
 #include <mvog_gtk_gui/gtk_gui.h>
 
+#include <mvog_server/scan_queue.h>
+#include <mvog_server/ElevationGrid.h>
+
 const std::string scanTopic_  = "scan";
 const std::string cloudTopic_ = "cloud";
+const std::string depthTopic_ = "depth";
+const std::string cameraInfoTopic_ = "camera_info";
 
 class MVOGServer
 {
   private:
 
     MVOG::Mapper * mapper_;
+
+    // **** the gui runs its own main loop on guiThread_, so that
+    //      drawing never delays the ROS callbacks
+
     MVOG::GTKGui * gui_;
+    boost::thread * guiThread_;
 
     // **** scan subscribers
     message_filters::Subscriber < sensor_msgs::LaserScan > *scanFilterSub_;
     tf::MessageFilter < sensor_msgs::LaserScan > *scanFilter_;
 
+    // **** point cloud subscribers
+    message_filters::Subscriber < sensor_msgs::PointCloud2 > *cloudFilterSub_;
+    tf::MessageFilter < sensor_msgs::PointCloud2 > *cloudFilter_;
+
+    // **** depth image subscribers: each image is paired with the camera
+    //      info of the same stamp
+    message_filters::Subscriber < sensor_msgs::Image > *depthFilterSub_;
+    tf::MessageFilter < sensor_msgs::Image > *depthFilter_;
+    message_filters::Subscriber < sensor_msgs::CameraInfo > *cameraInfoSub_;
+    message_filters::TimeSynchronizer < sensor_msgs::Image, sensor_msgs::CameraInfo > *depthSync_;
+
     // **** transforms
     tf::TransformListener tfListener_;
     std::string worldFrame_;
 
+    // **** map snapshots
+    std::string saveMapFile_;
+
+    // **** scans are inserted by the mapper thread, so that a slow
+    //      insertion stalls neither the gui nor the ROS callbacks
+
+    ScanQueue * scanQueue_;
+    boost::thread * mapperThread_;
+
+    // **** insertion metrics: latency from arrival to the end of the
+    //      insertion, for the last INSERTION_LATENCIES scans
+
+    static const size_t INSERTION_LATENCIES = 1000;
+
+    boost::mutex metricsMutex_;
+    std::vector<double> latencies_;    // ms
+    size_t latencyIndex_;
+    size_t insertedCount_;
+    size_t lastDroppedCount_;
+
+    ros::Publisher metricsPublisher_;
+    ros::Timer metricsTimer_;
+
+    // **** 2D exports: a height band occupancy grid and a 2.5D elevation
+    //      grid, published as patches of the cells changed since the
+    //      last export. A new subscriber gets the whole map first.
+
+    MVOG::GridExporter * gridExporter_;
+    double sliceMinZ_;
+
+    ros::Publisher slicePublisher_;
+    ros::Publisher elevationPublisher_;
+    ros::Timer exportTimer_;
+
+    void publishGrids(const ros::TimerEvent& event);
+    void gridSubscriberConnected(const ros::SingleSubscriberPublisher& publisher);
+
+    bool getWorldTransform(const std::string& frame, const ros::Time& stamp, btTransform& transform);
+
     void scanCallback(const sensor_msgs::LaserScanConstPtr& scan);
+    void cloudCallback(const sensor_msgs::PointCloud2ConstPtr& cloud);
+    void depthCallback(const sensor_msgs::ImageConstPtr& image, const sensor_msgs::CameraInfoConstPtr& info);
+
+    void mapperLoop();
+    void publishMetrics(const ros::TimerEvent& event);
 
   public:
 
     MVOGServer ();
     virtual ~MVOGServer();
-
-    void spinOnce();
 };
 
 #endif
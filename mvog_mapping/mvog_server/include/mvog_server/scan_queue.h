@@ -0,0 +1,87 @@
+#ifndef MVOG_SERVER_SCAN_QUEUE_H
+#define MVOG_SERVER_SCAN_QUEUE_H
+
+#include <deque>
+#include <string>
+
+#include <boost/thread.hpp>
+
+#include <ros/ros.h>
+#include <sensor_msgs/LaserScan.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <btBulletDynamicsCommon.h>
+
+// **** what to drop when a scan arrives and the queue is full:
+//      DROP_OLDEST:    the oldest queued scan, the map stays up to date
+//      DROP_NEWEST:    the arriving scan, the queued ones are kept
+//      DROP_EVERY_NTH: the arriving scan, except for every Nth one while
+//                      the queue stays full, which replaces the oldest
+
+enum DropPolicy
+{
+  DROP_OLDEST,
+  DROP_NEWEST,
+  DROP_EVERY_NTH
+};
+
+// **** a laser scan, a point cloud or a depth image with its camera info,
+//      whichever is set, and the transform from its frame into the world
+
+struct QueuedScan
+{
+  sensor_msgs::LaserScanConstPtr scan;
+  sensor_msgs::PointCloud2ConstPtr cloud;
+  sensor_msgs::ImageConstPtr image;
+  sensor_msgs::CameraInfoConstPtr info;
+  btTransform w2l;
+  ros::WallTime received;
+};
+
+// **** bounded queue of scans between the ROS callbacks and the
+//      mapper thread
+
+class ScanQueue
+{
+  private:
+
+    std::deque<QueuedScan> scans_;
+
+    size_t capacity_;
+    DropPolicy dropPolicy_;
+    int dropEveryN_;
+
+    int fullCount_;   // scans arrived since the queue became full
+    bool closed_;
+
+    size_t receivedCount_;
+    size_t droppedCount_;
+
+    boost::mutex mutex_;
+    boost::condition_variable notEmpty_;
+
+  public:
+
+    ScanQueue(size_t capacity, DropPolicy dropPolicy, int dropEveryN);
+    virtual ~ScanQueue();
+
+    // returns false if a scan had to be dropped
+    bool push(const QueuedScan& scan);
+
+    // waits for the next scan. Returns false once the queue is closed.
+    bool pop(QueuedScan& scan);
+
+    // wakes up pop(); queued scans are discarded
+    void close();
+
+    size_t getSize();
+    size_t getCapacity() const { return capacity_; }
+    size_t getReceivedCount();
+    size_t getDroppedCount();
+
+    // "oldest", "newest" or "every_nth"
+    static bool parseDropPolicy(const std::string& name, DropPolicy& dropPolicy);
+};
+
+#endif // MVOG_SERVER_SCAN_QUEUE_H
@@ -4,12 +4,7 @@ int main (int argc, char **argv)
 {
   ros::init (argc, argv, "mvog_server");
   MVOGServer mvogServer;
-
-  while(ros::ok())
-  {
-    mvogServer.spinOnce();
-  }
-
+  ros::spin();
   return 0;
 }
 
@@ -26,7 +21,22 @@ MVOGServer::MVOGServer ()
   double initMapSizeX;
   double initMapSizeY;
   bool   modelNegativeSpace;
+  int    insertionThreads;
+  bool   compactCells;
   double tfTolerance;
+  std::string loadMapFile;
+  int    insertionQueueSize;
+  std::string dropPolicyName;
+  int    dropEveryN;
+  double metricsPeriod;
+  double maxFreeSpaceRange;
+  int    mapLevels;
+  double memoryBudget;
+  std::string spillFile;
+  double spillKeepRadius;
+  double exportPeriod;
+  double sliceMaxZ;
+  double guiMaxFps;
 
   if (!nh_private.getParam ("map_resolution", mapResolution))
     mapResolution = 0.10;
@@ -36,21 +46,117 @@ MVOGServer::MVOGServer ()
     initMapSizeY = 10;
   if (!nh_private.getParam ("model_negative_space", modelNegativeSpace))
     modelNegativeSpace = true;
+  if (!nh_private.getParam ("insertion_threads", insertionThreads))
+    insertionThreads = 1;
+  if (!nh_private.getParam ("compact_cells", compactCells))
+    compactCells = false;
   if (!nh_private.getParam ("tf_tolerance", tfTolerance))
     tfTolerance = 0.01;
   if (!nh_private.getParam ("world_frame", worldFrame_))
     worldFrame_ = "map";
+  if (!nh_private.getParam ("load_map_file", loadMapFile))
+    loadMapFile = "";
+  if (!nh_private.getParam ("save_map_file", saveMapFile_))
+    saveMapFile_ = "";
+  if (!nh_private.getParam ("insertion_queue_size", insertionQueueSize))
+    insertionQueueSize = 10;
+  if (!nh_private.getParam ("drop_policy", dropPolicyName))
+    dropPolicyName = "oldest";
+  if (!nh_private.getParam ("drop_every_n", dropEveryN))
+    dropEveryN = 2;
+  if (!nh_private.getParam ("metrics_period", metricsPeriod))
+    metricsPeriod = 1.0;
+  if (!nh_private.getParam ("max_free_space_range", maxFreeSpaceRange))
+    maxFreeSpaceRange = 0.0;
+  if (!nh_private.getParam ("map_levels", mapLevels))
+    mapLevels = 0;
+  if (!nh_private.getParam ("memory_budget", memoryBudget))
+    memoryBudget = 0.0;
+  if (!nh_private.getParam ("spill_file", spillFile))
+    spillFile = "/tmp/mvog_server.spill";
+  if (!nh_private.getParam ("spill_keep_radius", spillKeepRadius))
+    spillKeepRadius = 10.0;
+  if (!nh_private.getParam ("export_period", exportPeriod))
+    exportPeriod = 1.0;
+  if (!nh_private.getParam ("slice_min_z", sliceMinZ_))
+    sliceMinZ_ = 0.1;
+  if (!nh_private.getParam ("slice_max_z", sliceMaxZ))
+    sliceMaxZ = 1.5;
+  if (!nh_private.getParam ("gui_max_fps", guiMaxFps))
+    guiMaxFps = MVOG::MAX_FPS;
+
+  DropPolicy dropPolicy;
+  if (!ScanQueue::parseDropPolicy(dropPolicyName, dropPolicy))
+  {
+    ROS_WARN ("Unknown drop_policy %s, using oldest", dropPolicyName.c_str());
+    dropPolicy = DROP_OLDEST;
+  }
 
   // **** create mapper
 
-  mapper_ = new MVOG::Mapper(mapResolution, initMapSizeX, initMapSizeY);
+  MVOG::CellFormat cellFormat = compactCells ? MVOG::CELL_FORMAT_COMPACT : MVOG::CELL_FORMAT_FLOAT;
+
+  mapper_ = new MVOG::Mapper(mapResolution, initMapSizeX, initMapSizeY, cellFormat);
   mapper_->setModelNegativeSpace(modelNegativeSpace);
+  mapper_->setInsertionThreads(insertionThreads);
+  mapper_->setMaxFreeSpaceRange(maxFreeSpaceRange);
+
+  // **** bounded memory: memory_budget in MB, 0 for no limit
+
+  if (!mapper_->setMemoryBudget(memoryBudget * 1024.0 * 1024.0, spillFile, spillKeepRadius))
+    ROS_WARN ("Cannot create spill file %s, memory is not bounded", spillFile.c_str());
+
+  // **** continue a previous map: tiles are read from the file as they
+  //      are used, and copied once they change
+
+  if (!loadMapFile.empty())
+  {
+    if (MVOG::MapFile::load(*mapper_->getMap(), loadMapFile, true))
+      ROS_INFO ("Loaded map from %s", loadMapFile.c_str());
+    else
+      ROS_WARN ("Could not load map from %s, starting empty", loadMapFile.c_str());
+  }
+
+  // **** coarser levels, built from the loaded map if there is one
+
+  mapper_->getMap()->setLevels(mapLevels);
+
+  // **** start the mapper thread
+
+  latencies_.reserve(INSERTION_LATENCIES);
+  latencyIndex_     = 0;
+  insertedCount_    = 0;
+  lastDroppedCount_ = 0;
 
-  // **** create gui
+  scanQueue_    = new ScanQueue(insertionQueueSize, dropPolicy, dropEveryN);
+  mapperThread_ = new boost::thread(boost::bind(&MVOGServer::mapperLoop, this));
 
-  gui_ = new MVOG::GTKGui();
+  metricsPublisher_ = nh.advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 1);
+  metricsTimer_     = nh.createTimer(ros::Duration(metricsPeriod), &MVOGServer::publishMetrics, this);
+
+  // **** 2D exports, 0 export_period to disable
+
+  gridExporter_ = new MVOG::GridExporter(mapper_->getMap());
+  gridExporter_->setBand(sliceMinZ_, sliceMaxZ);
+
+  if (exportPeriod > 0.0)
+  {
+    ros::SubscriberStatusCallback connected = boost::bind(&MVOGServer::gridSubscriberConnected, this, _1);
+
+    slicePublisher_     = nh.advertise<nav_msgs::OccupancyGrid>("slice_updates", 100, connected);
+    elevationPublisher_ = nh.advertise<mvog_server::ElevationGrid>("elevation_updates", 100, connected);
+    exportTimer_        = nh.createTimer(ros::Duration(exportPeriod), &MVOGServer::publishGrids, this);
+  }
+
+  // **** create gui, and run it on a thread of its own: it redraws at
+  //      most gui_max_fps times a second, only when the map or the view
+  //      changed. gtk is set up by start(), on that thread.
+
+  gui_ = new MVOG::GTKGui(guiMaxFps);
   gui_->setMap(mapper_->getMap());
 
+  guiThread_ = new boost::thread(boost::bind(&MVOG::GTKGui::start, gui_));
+
   // **** testing
 
   //mapper_->getMap()->test();
@@ -60,45 +166,347 @@ MVOGServer::MVOGServer ()
   scanFilter_ = new tf::MessageFilter < sensor_msgs::LaserScan > (*scanFilterSub_, tfListener_, worldFrame_, 10);
   scanFilter_->registerCallback (boost::bind (&MVOGServer::scanCallback, this, _1));
   scanFilter_->setTolerance (ros::Duration (tfTolerance));
+
+  // **** subscribe to point cloud messages
+  cloudFilterSub_ = new message_filters::Subscriber < sensor_msgs::PointCloud2 > (nh, cloudTopic_, 2);
+  cloudFilter_ = new tf::MessageFilter < sensor_msgs::PointCloud2 > (*cloudFilterSub_, tfListener_, worldFrame_, 2);
+  cloudFilter_->registerCallback (boost::bind (&MVOGServer::cloudCallback, this, _1));
+  cloudFilter_->setTolerance (ros::Duration (tfTolerance));
+
+  // **** subscribe to depth images (16UC1 or 32FC1) and their camera info
+  depthFilterSub_ = new message_filters::Subscriber < sensor_msgs::Image > (nh, depthTopic_, 2);
+  depthFilter_ = new tf::MessageFilter < sensor_msgs::Image > (*depthFilterSub_, tfListener_, worldFrame_, 2);
+  depthFilter_->setTolerance (ros::Duration (tfTolerance));
+  cameraInfoSub_ = new message_filters::Subscriber < sensor_msgs::CameraInfo > (nh, cameraInfoTopic_, 2);
+  depthSync_ = new message_filters::TimeSynchronizer < sensor_msgs::Image, sensor_msgs::CameraInfo > (*depthFilter_, *cameraInfoSub_, 2);
+  depthSync_->registerCallback (boost::bind (&MVOGServer::depthCallback, this, _1, _2));
 }
 
 MVOGServer::~MVOGServer ()
 {
+  // **** stop the gui thread
+
+  gui_->stop();
+  guiThread_->join();
+
+  delete guiThread_;
+
+  // **** stop the mapper thread; scans still queued are discarded
+
+  scanQueue_->close();
+  mapperThread_->join();
+
+  delete mapperThread_;
+  delete scanQueue_;
+  delete gridExporter_;
+
   printf("Final Size: %f\n", mapper_->getMap()->getMemorySize());
+
+  if (!saveMapFile_.empty())
+  {
+    if (MVOG::MapFile::save(*mapper_->getMap(), saveMapFile_))
+      ROS_INFO ("Saved map to %s", saveMapFile_.c_str());
+    else
+      ROS_WARN ("Could not save map to %s", saveMapFile_.c_str());
+  }
+
   ROS_INFO ("Destroying MVOGServer");
 }
 
-void MVOGServer::spinOnce()
+bool MVOGServer::getWorldTransform(const std::string& frame, const ros::Time& stamp, btTransform& transform)
 {
-  gui_->spinOnce();
-  ros::spinOnce();
+  tf::StampedTransform worldToFrame;
+  try
+  {
+    tfListener_.lookupTransform (worldFrame_, frame, stamp, worldToFrame);
+  }
+  catch (tf::TransformException ex)
+  {
+    // transform unavailable - skip scan
+    ROS_WARN ("Skipping scan (%s)", ex.what ());
+    return false;
+  }
+
+  transform = worldToFrame;
+  return true;
 }
 
 void MVOGServer::scanCallback(const sensor_msgs::LaserScanConstPtr& scan)
 {
   // **** obtain transform between world and laser frame
-  tf::StampedTransform worldToLaser;
-  try
+  QueuedScan queuedScan;
+  if (!getWorldTransform(scan->header.frame_id, scan->header.stamp, queuedScan.w2l)) return;
+
+  queuedScan.scan     = scan;
+  queuedScan.received = ros::WallTime::now();
+
+  scanQueue_->push(queuedScan);
+}
+
+void MVOGServer::cloudCallback(const sensor_msgs::PointCloud2ConstPtr& cloud)
+{
+  // **** obtain transform between world and sensor frame
+  QueuedScan queuedScan;
+  if (!getWorldTransform(cloud->header.frame_id, cloud->header.stamp, queuedScan.w2l)) return;
+
+  queuedScan.cloud    = cloud;
+  queuedScan.received = ros::WallTime::now();
+
+  scanQueue_->push(queuedScan);
+}
+
+void MVOGServer::depthCallback(const sensor_msgs::ImageConstPtr& image, const sensor_msgs::CameraInfoConstPtr& info)
+{
+  // **** obtain transform between world and camera frame
+  QueuedScan queuedScan;
+  if (!getWorldTransform(image->header.frame_id, image->header.stamp, queuedScan.w2l)) return;
+
+  queuedScan.image    = image;
+  queuedScan.info     = info;
+  queuedScan.received = ros::WallTime::now();
+
+  scanQueue_->push(queuedScan);
+}
+
+void MVOGServer::mapperLoop()
+{
+  QueuedScan queuedScan;
+
+  while (scanQueue_->pop(queuedScan))
   {
-    tfListener_.lookupTransform (worldFrame_, scan->header.frame_id, scan->header.stamp, worldToLaser);
+    if (queuedScan.cloud)
+    {
+      if (!mapper_->addPointCloud(queuedScan.cloud, queuedScan.w2l))
+        ROS_WARN ("Skipping cloud without float x, y and z fields, or with short data");
+    }
+    else if (queuedScan.image)
+    {
+      if (!mapper_->addDepthImage(queuedScan.image, queuedScan.info, queuedScan.w2l))
+        ROS_WARN ("Skipping depth image with an unsupported encoding, short data or no calibration");
+    }
+    else
+      mapper_->addLaserData(queuedScan.scan, queuedScan.w2l);
+
+    double latency = (ros::WallTime::now() - queuedScan.received).toSec() * 1000.0;
+
+    boost::mutex::scoped_lock lock(metricsMutex_);
+
+    if (latencies_.size() < INSERTION_LATENCIES)
+      latencies_.push_back(latency);
+    else
+      latencies_[latencyIndex_] = latency;
+
+    latencyIndex_ = (latencyIndex_ + 1) % INSERTION_LATENCIES;
+    insertedCount_++;
   }
-  catch (tf::TransformException ex)
+}
+
+void MVOGServer::gridSubscriberConnected(const ros::SingleSubscriberPublisher& publisher)
+{
+  gridExporter_->exportAll();
+}
+
+void MVOGServer::publishGrids(const ros::TimerEvent& event)
+{
+  MVOG::Map * map = mapper_->getMap();
+
+  std::vector<MVOG::GridPatch> patches;
+  double resolution;
+
   {
-    // transform unavailable - skip scan
-    ROS_WARN ("Skipping scan (%s)", ex.what ());
-    return;
+    boost::mutex::scoped_lock lock(map->mutex_);
+    gridExporter_->getPatches(patches);
+    resolution = map->getResolution();
+  }
+
+  ros::Time now = ros::Time::now();
+
+  for (size_t p = 0; p < patches.size(); p++)
+  {
+    const MVOG::GridPatch& patch = patches[p];
+
+    nav_msgs::MapMetaData info;
+    info.map_load_time = now;
+    info.resolution    = resolution;
+    info.width         = patch.sizeX;
+    info.height        = patch.sizeY;
+    info.origin.position.x    = patch.minCX * resolution;
+    info.origin.position.y    = patch.minCY * resolution;
+    info.origin.orientation.w = 1.0;
+
+    nav_msgs::OccupancyGrid slice;
+    slice.header.stamp    = now;
+    slice.header.frame_id = worldFrame_;
+    slice.info = info;
+    slice.info.origin.position.z = sliceMinZ_;
+    slice.data.assign(patch.occupancy.begin(), patch.occupancy.end());
+
+    slicePublisher_.publish(slice);
+
+    mvog_server::ElevationGrid elevation;
+    elevation.header.stamp    = now;
+    elevation.header.frame_id = worldFrame_;
+    elevation.info = info;
+    elevation.max_height    = patch.maxHeight;
+    elevation.min_clearance = patch.minClearance;
+
+    elevationPublisher_.publish(elevation);
+  }
+}
+
+void MVOGServer::publishMetrics(const ros::TimerEvent& event)
+{
+  std::vector<double> latencies;
+  size_t insertedCount;
+
+  {
+    boost::mutex::scoped_lock lock(metricsMutex_);
+    latencies     = latencies_;
+    insertedCount = insertedCount_;
+  }
+
+  size_t droppedCount = scanQueue_->getDroppedCount();
+
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name        = "mvog_server: scan insertion";
+  status.hardware_id = "none";
+
+  if (droppedCount > lastDroppedCount_)
+  {
+    status.level   = diagnostic_msgs::DiagnosticStatus::WARN;
+    status.message = "Dropping scans";
+  }
+  else
+  {
+    status.level   = diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = "OK";
+  }
+
+  lastDroppedCount_ = droppedCount;
+
+  // **** queue
+
+  char value[64];
+
+  diagnostic_msgs::KeyValue keyValue;
+
+  keyValue.key = "queue depth";
+  sprintf(value, "%d / %d", (int)scanQueue_->getSize(), (int)scanQueue_->getCapacity());
+  keyValue.value = value;
+  status.values.push_back(keyValue);
+
+  keyValue.key = "received scans";
+  sprintf(value, "%d", (int)scanQueue_->getReceivedCount());
+  keyValue.value = value;
+  status.values.push_back(keyValue);
+
+  keyValue.key = "inserted scans";
+  sprintf(value, "%d", (int)insertedCount);
+  keyValue.value = value;
+  status.values.push_back(keyValue);
+
+  keyValue.key = "dropped scans";
+  sprintf(value, "%d", (int)droppedCount);
+  keyValue.value = value;
+  status.values.push_back(keyValue);
+
+  // **** latency percentiles
+
+  const int percentiles[4] = {50, 90, 99, 100};
+
+  std::sort(latencies.begin(), latencies.end());
+
+  for (int p = 0; p < 4 && !latencies.empty(); p++)
+  {
+    size_t index = std::min(latencies.size() - 1, latencies.size() * percentiles[p] / 100);
+
+    sprintf(value, "latency p%d (ms)", percentiles[p]);
+    keyValue.key = value;
+    sprintf(value, "%.2f", latencies[index]);
+    keyValue.value = value;
+    status.values.push_back(keyValue);
+  }
+
+  // **** map memory
+
+  MVOG::Map * map = mapper_->getMap();
+
+  size_t residentBytes;
+  MVOG::SpillStats spillStats;
+
+  {
+    boost::mutex::scoped_lock lock(map->mutex_);
+    residentBytes = map->getMemoryBytes();
+    map->getSpillStats(spillStats);
   }
 
-  timeval start_insert, stop_insert; 
-  gettimeofday(&start_insert, NULL);
+  diagnostic_msgs::DiagnosticStatus memoryStatus;
+  memoryStatus.name        = "mvog_server: map memory";
+  memoryStatus.hardware_id = "none";
+
+  size_t budget = map->getMemoryBudget();
+
+  if (spillStats.readErrors)
+  {
+    memoryStatus.level   = diagnostic_msgs::DiagnosticStatus::ERROR;
+    memoryStatus.message = "Spilled tiles could not be read";
+  }
+  else if (budget && residentBytes > budget)
+  {
+    memoryStatus.level   = diagnostic_msgs::DiagnosticStatus::WARN;
+    memoryStatus.message = "Over budget";
+  }
+  else
+  {
+    memoryStatus.level   = diagnostic_msgs::DiagnosticStatus::OK;
+    memoryStatus.message = "OK";
+  }
+
+  keyValue.key = "resident (KB)";
+  sprintf(value, "%.1f", residentBytes / 1024.0);
+  keyValue.value = value;
+  memoryStatus.values.push_back(keyValue);
+
+  keyValue.key = "budget (KB)";
+  sprintf(value, "%.1f", budget / 1024.0);
+  keyValue.value = value;
+  memoryStatus.values.push_back(keyValue);
+
+  keyValue.key = "spilled (KB)";
+  sprintf(value, "%.1f", spillStats.spilledBytes / 1024.0);
+  keyValue.value = value;
+  memoryStatus.values.push_back(keyValue);
+
+  keyValue.key = "evictions";
+  sprintf(value, "%d", (int)spillStats.evictions);
+  keyValue.value = value;
+  memoryStatus.values.push_back(keyValue);
+
+  keyValue.key = "reloads";
+  sprintf(value, "%d", (int)spillStats.reloads);
+  keyValue.value = value;
+  memoryStatus.values.push_back(keyValue);
+
+  keyValue.key = "reload latency mean (ms)";
+  sprintf(value, "%.3f", spillStats.reloads ? spillStats.reloadTime / spillStats.reloads * 1000.0 : 0.0);
+  keyValue.value = value;
+  memoryStatus.values.push_back(keyValue);
 
-  mapper_->addLaserData(scan, worldToLaser);
+  keyValue.key = "reload latency max (ms)";
+  sprintf(value, "%.3f", spillStats.maxReloadTime * 1000.0);
+  keyValue.value = value;
+  memoryStatus.values.push_back(keyValue);
 
-  gettimeofday(&stop_insert, NULL);
+  keyValue.key = "reload errors";
+  sprintf(value, "%d", (int)spillStats.readErrors);
+  keyValue.value = value;
+  memoryStatus.values.push_back(keyValue);
 
-  double dur_insert = ( (stop_insert.tv_sec  - start_insert.tv_sec ) * 1000000 + 
-                        (stop_insert.tv_usec - start_insert.tv_usec) ) /1000.0;
+  diagnostic_msgs::DiagnosticArray diagnostics;
+  diagnostics.header.stamp = ros::Time::now();
+  diagnostics.status.push_back(status);
+  diagnostics.status.push_back(memoryStatus);
 
-  printf("dur_insert: %f ms\n", dur_insert);
+  metricsPublisher_.publish(diagnostics);
 }
 
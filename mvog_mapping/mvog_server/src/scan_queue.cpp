@@ -0,0 +1,107 @@
+#include "mvog_server/scan_queue.h"
+
+ScanQueue::ScanQueue(size_t capacity, DropPolicy dropPolicy, int dropEveryN)
+{
+  capacity_   = std::max(capacity, (size_t)1);
+  dropPolicy_ = dropPolicy;
+  dropEveryN_ = std::max(dropEveryN, 1);
+
+  fullCount_ = 0;
+  closed_    = false;
+
+  receivedCount_ = 0;
+  droppedCount_  = 0;
+}
+
+ScanQueue::~ScanQueue()
+{
+
+}
+
+bool ScanQueue::push(const QueuedScan& scan)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  receivedCount_++;
+
+  if (scans_.size() < capacity_)
+  {
+    fullCount_ = 0;
+    scans_.push_back(scan);
+    notEmpty_.notify_one();
+    return true;
+  }
+
+  droppedCount_++;
+
+  // **** full: drop the arriving scan, or make room for it
+
+  bool keep = false;
+
+  switch (dropPolicy_)
+  {
+    case DROP_OLDEST:    keep = true; break;
+    case DROP_NEWEST:    keep = false; break;
+    case DROP_EVERY_NTH: keep = (++fullCount_ % dropEveryN_ == 0); break;
+  }
+
+  if (keep)
+  {
+    scans_.pop_front();
+    scans_.push_back(scan);
+  }
+
+  return false;
+}
+
+bool ScanQueue::pop(QueuedScan& scan)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (scans_.empty() && !closed_)
+    notEmpty_.wait(lock);
+
+  if (closed_) return false;
+
+  scan = scans_.front();
+  scans_.pop_front();
+
+  return true;
+}
+
+void ScanQueue::close()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  closed_ = true;
+  scans_.clear();
+  notEmpty_.notify_all();
+}
+
+size_t ScanQueue::getSize()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return scans_.size();
+}
+
+size_t ScanQueue::getReceivedCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return receivedCount_;
+}
+
+size_t ScanQueue::getDroppedCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return droppedCount_;
+}
+
+bool ScanQueue::parseDropPolicy(const std::string& name, DropPolicy& dropPolicy)
+{
+  if      (name == "oldest")    dropPolicy = DROP_OLDEST;
+  else if (name == "newest")    dropPolicy = DROP_NEWEST;
+  else if (name == "every_nth") dropPolicy = DROP_EVERY_NTH;
+  else return false;
+
+  return true;
+}